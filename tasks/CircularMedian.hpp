@@ -0,0 +1,170 @@
+/* ----------------------------------------------------------------------------
+ * CircularMedian.hpp
+ * Streaming median of angles over a sliding window
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_CIRCULAR_MEDIAN_HPP
+#define UW_PARTICLE_LOCALIZATION_CIRCULAR_MEDIAN_HPP
+
+#include <set>
+#include <cmath>
+#include <boost/circular_buffer.hpp>
+
+namespace uw_localization {
+
+/**
+ * Normalizes an angle to (-pi, pi]
+ */
+inline double wrapAngle(double angle) {
+    while(angle > M_PI)
+        angle -= 2.0 * M_PI;
+
+    while(angle <= -M_PI)
+        angle += 2.0 * M_PI;
+
+    return angle;
+}
+
+/**
+ * Median of the last angles. Adding an angle costs O(log n), the median is O(1).
+ * The angles are stored relative to a reference angle near the median, so
+ * the median is correct across the wraparound at +-pi, as long as the
+ * angles of the window spread less than pi.
+ * For an even number of angles, the upper median is returned.
+ * A window size of 0 is treated as 1.
+ */
+class CircularMedian {
+public:
+    CircularMedian(size_t window_size) : window(window_size > 0 ? window_size : 1), reference(0.0) {
+        middle = sorted.end();
+    }
+
+    size_t size() const { return window.size(); }
+    bool empty() const { return window.empty(); }
+
+    void clear() {
+        window.clear();
+        sorted.clear();
+        middle = sorted.end();
+    }
+
+    /**
+     * Adds an angle. If the window is full, the oldest angle is removed
+     */
+    void push(double angle) {
+        if(window.empty())
+            reference = angle;
+
+        if(window.full()) {
+            erase(window.front());
+            window.pop_front();
+        }
+
+        double value = wrapAngle(angle - reference);
+        window.push_back(value);
+        insert(value);
+
+        //Keep the reference near the median, so the window does not cross the wraparound
+        if(std::fabs(*middle) > 0.5 * M_PI)
+            recenter();
+    }
+
+    /**
+     * @return: the median in (-pi, pi], or 0.0 if the window is empty
+     */
+    double median() const {
+        if(window.empty())
+            return 0.0;
+
+        return wrapAngle(reference + *middle);
+    }
+
+    /**
+     * Adds an offset to all angles of the window
+     */
+    void shift(double offset) {
+        reference += offset;
+    }
+
+private:
+    boost::circular_buffer<double> window;
+    std::multiset<double> sorted;
+
+    /** element number size/2 of the sorted values */
+    std::multiset<double>::iterator middle;
+    double reference;
+
+    /**
+     * Moves the middle iterator from the element number index to size/2
+     */
+    void moveMiddle(size_t index) {
+        size_t target = sorted.size() / 2;
+
+        for(; index > target; index--)
+            --middle;
+
+        for(; index < target; index++)
+            ++middle;
+    }
+
+    void insert(double value) {
+        size_t n = sorted.size();
+
+        if(n == 0) {
+            middle = sorted.insert(value);
+            return;
+        }
+
+        //Equal values are inserted after the middle
+        size_t index = n / 2 + (value < *middle ? 1 : 0);
+        sorted.insert(value);
+        moveMiddle(index);
+    }
+
+    void erase(double value) {
+        size_t n = sorted.size();
+        size_t index = n / 2;
+
+        if(n == 1) {
+            sorted.clear();
+            middle = sorted.end();
+            return;
+        }
+
+        if(value == *middle) {
+            std::multiset<double>::iterator it = middle;
+            ++middle;
+            sorted.erase(it);
+        }
+        else {
+            if(value < *middle)
+                index--;
+
+            sorted.erase(sorted.find(value));
+        }
+
+        moveMiddle(index);
+    }
+
+    /**
+     * Uses the median as new reference and rebuilds the sorted values
+     */
+    void recenter() {
+        double offset = *middle;
+        reference = wrapAngle(reference + offset);
+        sorted.clear();
+
+        for(boost::circular_buffer<double>::iterator it = window.begin(); it != window.end(); it++) {
+            *it = wrapAngle(*it - offset);
+            sorted.insert(*it);
+        }
+
+        middle = sorted.begin();
+        moveMiddle(0);
+    }
+};
+
+}
+
+#endif
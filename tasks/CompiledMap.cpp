@@ -0,0 +1,539 @@
+#include "CompiledMap.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/crc.hpp>
+
+using namespace uw_localization;
+
+namespace {
+
+boost::uint32_t checksum(const char* data, size_t size)
+{
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+template<typename T>
+void put(std::string& buffer, const T& value)
+{
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void putString(std::string& buffer, const std::string& value)
+{
+  put(buffer, static_cast<boost::uint32_t>(value.size()));
+  buffer.append(value);
+}
+
+void putVector(std::string& buffer, const base::Vector3d& value)
+{
+  put(buffer, value.x());
+  put(buffer, value.y());
+  put(buffer, value.z());
+}
+
+/**
+ * Writes the count and the plain data of the elements
+ */
+template<typename T>
+void putArray(std::string& buffer, const std::vector<T>& values)
+{
+  put(buffer, static_cast<boost::uint32_t>(values.size()));
+
+  if(!values.empty())
+    buffer.append(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(T));
+}
+
+/**
+ * Reads from the mapped file, without reading beyond its end
+ */
+class Reader {
+public:
+  Reader(const char* data, size_t size) : data(data), size(size), position(0) {}
+
+  template<typename T>
+  bool get(T& value)
+  {
+    if(position + sizeof(T) > size)
+      return false;
+
+    memcpy(&value, data + position, sizeof(T));
+    position += sizeof(T);
+    return true;
+  }
+
+  bool getString(std::string& value)
+  {
+    boost::uint32_t length;
+
+    if(!get(length) || length > 4096 || position + length > size)
+      return false;
+
+    value.assign(data + position, length);
+    position += length;
+    return true;
+  }
+
+  bool getVector(base::Vector3d& value)
+  {
+    double x, y, z;
+
+    if(!get(x) || !get(y) || !get(z))
+      return false;
+
+    value = base::Vector3d(x, y, z);
+    return true;
+  }
+
+  template<typename T>
+  bool getArray(std::vector<T>& values)
+  {
+    boost::uint32_t count;
+
+    if(!get(count) || count > (size - position) / sizeof(T))
+      return false;
+
+    values.resize(count);
+
+    if(count > 0)
+      memcpy(&values[0], data + position, count * sizeof(T));
+
+    position += count * sizeof(T);
+    return true;
+  }
+
+  size_t offset() const { return position; }
+
+private:
+  const char* data;
+  size_t size;
+  size_t position;
+};
+
+size_t align(size_t offset)
+{
+  return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * The layers in the order of the geometry section
+ */
+void layerList(MapLayers& layers, MapLayer* list[5])
+{
+  list[0] = &layers.wall;
+  list[1] = &layers.box;
+  list[2] = &layers.pipeline;
+  list[3] = &layers.end_of_pipe;
+  list[4] = &layers.buoy;
+}
+
+DepthObstacleGrid* createGrid(NodeMap& map, double resolution)
+{
+  DepthObstacleGrid* grid = new DepthObstacleGrid( base::Vector2d(-map.getTranslation().x(), -map.getTranslation().y() ),
+                          base::Vector2d(map.getLimitations().x(), map.getLimitations().y() ), resolution);
+  grid->initGrid();
+  grid->initDepthObstacleConfig(-8.0, 0.0, 2.0);
+  return grid;
+}
+
+}
+
+const boost::uint32_t CompiledMap::MAGIC;
+const boost::uint32_t CompiledMap::VERSION;
+const boost::uint32_t CompiledMap::TILE_SIZE;
+
+boost::int64_t uw_localization::fileStamp(const std::string& file)
+{
+  struct stat info;
+
+  if(file.empty() || stat(file.c_str(), &info) != 0)
+    return -1;
+
+  return (static_cast<boost::int64_t>(info.st_mtime) << 24) ^ static_cast<boost::int64_t>(info.st_size);
+}
+
+CompiledMap::CompiledMap()
+  : data(0), size(0), tile_directory(0), geometry(0), depths(0), tiles_x(0)
+{
+  header.width = 0;
+  header.height = 0;
+  header.tile_size = TILE_SIZE;
+}
+
+CompiledMap::~CompiledMap()
+{
+  close();
+}
+
+bool CompiledMap::compile(const std::string& yaml_map, const std::string& yaml_depth_map,
+                          double resolution, const std::string& file)
+{
+  NodeMap map;
+  if(!map.fromYaml(yaml_map)){
+    std::cerr << "ERROR: No map could be load " << yaml_map << std::endl;
+    return false;
+  }
+
+  MapLayers layers;
+  if(!layers.resolve(yaml_map)){
+    std::cerr << "ERROR: The layers of " << yaml_map << " could not be read" << std::endl;
+    return false;
+  }
+
+  Environment env = map.getEnvironment();
+  GeometryIndex index;
+  index.build(env, map, layers.box.boxes());
+
+  DepthObstacleGrid* grid = createGrid(map, resolution);
+
+  if(!grid->initializeDepth(yaml_depth_map, 0.0001)){
+    std::cerr << "ERROR: No depth map could be load " << yaml_depth_map << std::endl;
+    delete grid;
+    return false;
+  }
+
+  CompiledMapHeader header;
+  header.yaml_map = yaml_map;
+  header.yaml_depth_map = yaml_depth_map;
+  header.yaml_map_stamp = fileStamp(yaml_map);
+  header.yaml_depth_map_stamp = fileStamp(yaml_depth_map);
+  header.origin = base::Vector2d(-map.getTranslation().x(), -map.getTranslation().y());
+  header.span = base::Vector2d(map.getLimitations().x(), map.getLimitations().y());
+  header.resolution = resolution;
+  header.width = static_cast<boost::uint32_t>(std::ceil(header.span.x() / resolution));
+  header.height = static_cast<boost::uint32_t>(std::ceil(header.span.y() / resolution));
+  header.depth_cells = 0;
+  header.tile_size = TILE_SIZE;
+
+  //Sample the depth at the cell centers, only tiles with a known depth are allocated
+  TiledGrid<float> cells(NAN, TILE_SIZE);
+
+  for(unsigned int y = 0; y < header.height; y++){
+    for(unsigned int x = 0; x < header.width; x++){
+      double depth = grid->getDepth(header.origin.x() + (x + 0.5) * resolution,
+                                    header.origin.y() + (y + 0.5) * resolution);
+
+      if(!std::isnan(depth)){
+        cells.set(x, y, depth);
+        header.depth_cells++;
+      }
+    }
+  }
+
+  delete grid;
+
+  std::vector<TileKey> keys = cells.tileKeys();
+  header.tile_count = keys.size();
+
+  //The directory holds the index of every stored tile
+  boost::uint32_t tiles_x = (header.width + TILE_SIZE - 1) / TILE_SIZE;
+  boost::uint32_t tiles_y = (header.height + TILE_SIZE - 1) / TILE_SIZE;
+  std::vector<boost::int32_t> directory(static_cast<size_t>(tiles_x) * tiles_y, -1);
+
+  for(unsigned int i = 0; i < keys.size(); i++)
+    directory[keys[i].y * tiles_x + keys[i].x] = i;
+
+  std::string geometry;
+  writeGeometry(geometry, env, layers, index);
+  header.geometry_size = geometry.size();
+
+  std::string buffer;
+  put(buffer, MAGIC);
+  put(buffer, VERSION);
+  putString(buffer, header.yaml_map);
+  putString(buffer, header.yaml_depth_map);
+  put(buffer, header.yaml_map_stamp);
+  put(buffer, header.yaml_depth_map_stamp);
+  put(buffer, header.origin.x());
+  put(buffer, header.origin.y());
+  put(buffer, header.span.x());
+  put(buffer, header.span.y());
+  put(buffer, header.resolution);
+  put(buffer, header.width);
+  put(buffer, header.height);
+  put(buffer, header.depth_cells);
+  put(buffer, header.tile_size);
+  put(buffer, header.tile_count);
+  put(buffer, header.geometry_size);
+  put(buffer, checksum(buffer.data(), buffer.size()));
+  buffer.resize(align(buffer.size()), '\0');
+
+  if(!directory.empty())
+    buffer.append(reinterpret_cast<const char*>(&directory[0]), directory.size() * sizeof(boost::int32_t));
+  buffer.resize(align(buffer.size()), '\0');
+
+  buffer.append(geometry);
+  put(buffer, checksum(geometry.data(), geometry.size()));
+  buffer.resize(align(buffer.size()), '\0');
+
+  std::string temp_file = file + ".tmp";
+  FILE* output = fopen(temp_file.c_str(), "wb");
+
+  if(!output){
+    std::cout << "ERROR: Could not create compiled map " << temp_file << std::endl;
+    return false;
+  }
+
+  bool written = fwrite(buffer.data(), 1, buffer.size(), output) == buffer.size();
+  size_t tile_cells = TILE_SIZE * TILE_SIZE;
+
+  for(std::vector<TileKey>::iterator it = keys.begin(); written && it != keys.end(); it++)
+    written = fwrite(cells.tileCells(*it), sizeof(float), tile_cells, output) == tile_cells;
+
+  written = written && fflush(output) == 0;
+
+  fsync(fileno(output));
+  fclose(output);
+
+  if(!written || rename(temp_file.c_str(), file.c_str()) != 0){
+    std::cout << "ERROR: Could not write compiled map " << file << std::endl;
+    return false;
+  }
+
+  std::cout << "Compiled " << header.width << "x" << header.height << " cells, "
+    << header.depth_cells << " with depth in " << header.tile_count << " tiles, and "
+    << env.planes.size() << " planes" << std::endl;
+  return true;
+}
+
+void CompiledMap::writeGeometry(std::string& buffer, const Environment& env, MapLayers& layers, const GeometryIndex& index)
+{
+  putString(buffer, env.name);
+  putVector(buffer, env.left_top_corner);
+  putVector(buffer, env.right_bottom_corner);
+  put(buffer, static_cast<boost::uint32_t>(env.planes.size()));
+
+  for(std::vector<Plane>::const_iterator it = env.planes.begin(); it != env.planes.end(); it++){
+    putVector(buffer, it->position);
+    putVector(buffer, it->span_horizontal);
+    putVector(buffer, it->span_vertical);
+  }
+
+  put(buffer, static_cast<boost::uint32_t>(env.landmarks.size()));
+
+  for(std::vector<Landmark>::const_iterator it = env.landmarks.begin(); it != env.landmarks.end(); it++){
+    putString(buffer, it->caption);
+    putVector(buffer, it->point);
+  }
+
+  MapLayer* list[5];
+  layerList(layers, list);
+
+  for(int i = 0; i < 5; i++){
+    put(buffer, static_cast<boost::uint8_t>(list[i]->isResolved()));
+    putArray(buffer, list[i]->strips());
+    putArray(buffer, list[i]->boxes());
+  }
+
+  put(buffer, static_cast<boost::uint8_t>(index.boxes_indexed));
+  put(buffer, static_cast<boost::uint8_t>(index.world_indexed));
+  putVector(buffer, index.world_min);
+  putVector(buffer, index.world_max);
+  putArray(buffer, index.segments);
+  putArray(buffer, index.nodes);
+  putArray(buffer, index.boxes);
+  putArray(buffer, index.box_nodes);
+}
+
+bool CompiledMap::open(const std::string& file)
+{
+  close();
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if(fd < 0){
+    std::cout << "ERROR: Could not open compiled map " << file << std::endl;
+    return false;
+  }
+
+  struct stat info;
+  if(fstat(fd, &info) != 0 || info.st_size == 0){
+    std::cout << "ERROR: Compiled map is empty " << file << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  size = info.st_size;
+  data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+
+  if(data == MAP_FAILED){
+    std::cout << "ERROR: Could not map compiled map " << file << std::endl;
+    data = 0;
+    return false;
+  }
+
+  const char* bytes = static_cast<const char*>(data);
+  Reader reader(bytes, size);
+  boost::uint32_t magic, version, crc;
+  double origin_x, origin_y, span_x, span_y;
+
+  if(!reader.get(magic) || magic != MAGIC || !reader.get(version) || version != VERSION){
+    std::cout << "ERROR: " << file << " is no compiled map of version " << VERSION << std::endl;
+    close();
+    return false;
+  }
+
+  bool valid = reader.getString(header.yaml_map) && reader.getString(header.yaml_depth_map)
+    && reader.get(header.yaml_map_stamp) && reader.get(header.yaml_depth_map_stamp)
+    && reader.get(origin_x) && reader.get(origin_y) && reader.get(span_x) && reader.get(span_y)
+    && reader.get(header.resolution) && reader.get(header.width) && reader.get(header.height)
+    && reader.get(header.depth_cells) && reader.get(header.tile_size) && reader.get(header.tile_count)
+    && reader.get(header.geometry_size);
+
+  size_t header_size = reader.offset();
+
+  if(!valid || !reader.get(crc) || crc != checksum(bytes, header_size) || header.tile_size == 0){
+    std::cout << "ERROR: Corrupted header of compiled map " << file << std::endl;
+    close();
+    return false;
+  }
+
+  header.origin = base::Vector2d(origin_x, origin_y);
+  header.span = base::Vector2d(span_x, span_y);
+  tiles_x = (header.width + header.tile_size - 1) / header.tile_size;
+  size_t tiles_y = (header.height + header.tile_size - 1) / header.tile_size;
+
+  size_t directory_offset = align(reader.offset());
+  size_t geometry_offset = align(directory_offset + tiles_x * tiles_y * sizeof(boost::int32_t));
+  size_t offset = align(geometry_offset + header.geometry_size + sizeof(boost::uint32_t));
+  size_t cells = static_cast<size_t>(header.tile_count) * header.tile_size * header.tile_size;
+
+  if(offset + cells * sizeof(float) != size){
+    std::cout << "ERROR: Compiled map " << file << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+
+  //A changed source is only detected, if the source still exists
+  boost::int64_t map_stamp = fileStamp(header.yaml_map);
+  boost::int64_t depth_stamp = fileStamp(header.yaml_depth_map);
+
+  if((map_stamp >= 0 && map_stamp != header.yaml_map_stamp) ||
+      (depth_stamp >= 0 && depth_stamp != header.yaml_depth_map_stamp)){
+    std::cout << "ERROR: Compiled map " << file << " is older than its sources" << std::endl;
+    close();
+    return false;
+  }
+
+  tile_directory = reinterpret_cast<const boost::int32_t*>(bytes + directory_offset);
+  geometry = bytes + geometry_offset;
+  depths = reinterpret_cast<const float*>(bytes + offset);
+
+  for(size_t i = 0; i < tiles_x * tiles_y; i++){
+    if(tile_directory[i] >= static_cast<boost::int32_t>(header.tile_count)){
+      std::cout << "ERROR: Corrupted tile directory of compiled map " << file << std::endl;
+      close();
+      return false;
+    }
+  }
+
+  boost::uint32_t geometry_crc;
+  memcpy(&geometry_crc, geometry + header.geometry_size, sizeof(geometry_crc));
+
+  if(geometry_crc != checksum(geometry, header.geometry_size)){
+    std::cout << "ERROR: Corrupted geometry of compiled map " << file << std::endl;
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void CompiledMap::close()
+{
+  if(data)
+    munmap(data, size);
+
+  data = 0;
+  size = 0;
+  tile_directory = 0;
+  geometry = 0;
+  depths = 0;
+  tiles_x = 0;
+  header.width = 0;
+  header.height = 0;
+}
+
+bool CompiledMap::matches(NodeMap& map, double resolution) const
+{
+  if(!data)
+    return false;
+
+  base::Vector2d origin(-map.getTranslation().x(), -map.getTranslation().y());
+  base::Vector2d span(map.getLimitations().x(), map.getLimitations().y());
+
+  return (origin - header.origin).norm() < 1e-6 && (span - header.span).norm() < 1e-6
+    && std::fabs(resolution - header.resolution) < 1e-9;
+}
+
+bool CompiledMap::readGeometry(Environment& env, MapLayers& layers, GeometryIndex& index) const
+{
+  if(!data)
+    return false;
+
+  Reader reader(geometry, header.geometry_size);
+  boost::uint32_t count;
+
+  env = Environment();
+  bool valid = reader.getString(env.name) && reader.getVector(env.left_top_corner)
+    && reader.getVector(env.right_bottom_corner) && reader.get(count);
+
+  for(boost::uint32_t i = 0; valid && i < count; i++){
+    Plane plane;
+    valid = reader.getVector(plane.position) && reader.getVector(plane.span_horizontal)
+      && reader.getVector(plane.span_vertical);
+    env.planes.push_back(plane);
+  }
+
+  valid = valid && reader.get(count);
+
+  for(boost::uint32_t i = 0; valid && i < count; i++){
+    Landmark landmark;
+    valid = reader.getString(landmark.caption) && reader.getVector(landmark.point);
+    env.landmarks.push_back(landmark);
+  }
+
+  MapLayer* list[5];
+  layerList(layers, list);
+
+  for(int i = 0; valid && i < 5; i++){
+    boost::uint8_t resolved;
+    std::vector<LayerStrip> strips;
+    std::vector<GeometryBox> boxes;
+    valid = reader.get(resolved) && reader.getArray(strips) && reader.getArray(boxes);
+
+    if(valid && resolved)
+      list[i]->resolve(strips, boxes);
+    else
+      list[i]->unresolve();
+  }
+
+  boost::uint8_t boxes_indexed, world_indexed;
+  index.clear();
+
+  valid = valid && reader.get(boxes_indexed) && reader.get(world_indexed)
+    && reader.getVector(index.world_min) && reader.getVector(index.world_max)
+    && reader.getArray(index.segments) && reader.getArray(index.nodes)
+    && reader.getArray(index.boxes) && reader.getArray(index.box_nodes);
+
+  if(!valid){
+    std::cout << "ERROR: The geometry of the compiled map " << header.yaml_map << " is incomplete" << std::endl;
+    env = Environment();
+    layers.unresolve();
+    index.clear();
+    return false;
+  }
+
+  index.boxes_indexed = boxes_indexed;
+  index.world_indexed = world_indexed;
+  return true;
+}
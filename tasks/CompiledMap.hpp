@@ -0,0 +1,170 @@
+/* ----------------------------------------------------------------------------
+ * CompiledMap.hpp
+ * Versioned binary map with depths and geometry, loaded with mmap
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_COMPILED_MAP_HPP
+#define UW_PARTICLE_LOCALIZATION_COMPILED_MAP_HPP
+
+#include <cmath>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <base/eigen.h>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+#include <uw_localization/types/environment.hpp>
+#include "TiledGrid.hpp"
+#include "GeometryIndex.hpp"
+#include "MapLayers.hpp"
+
+namespace uw_localization {
+
+/**
+ * Sources and grid geometry of a compiled map
+ */
+struct CompiledMapHeader {
+  std::string yaml_map;
+  std::string yaml_depth_map;
+
+  /** size and modification time of the sources, to detect outdated maps */
+  boost::int64_t yaml_map_stamp;
+  boost::int64_t yaml_depth_map_stamp;
+
+  /** lower corner and size of the grid in meter */
+  base::Vector2d origin;
+  base::Vector2d span;
+  double resolution;
+
+  boost::uint32_t width;
+  boost::uint32_t height;
+
+  /** number of cells with a known depth */
+  boost::uint32_t depth_cells;
+
+  /** cells of a tile side, and number of stored tiles */
+  boost::uint32_t tile_size;
+  boost::uint32_t tile_count;
+
+  /** size of the geometry section in bytes */
+  boost::uint64_t geometry_size;
+};
+
+/**
+ * A map, which is prepared for the filter and mapped into memory, so
+ * starting the filter neither parses the yaml maps nor copies the depths.
+ *
+ * The depth map is sampled at the cells of the depth obstacle grid and
+ * stored in square tiles of floats. Only tiles with a known depth are
+ * stored, so the size grows with the surveyed area. Unknown depths are NaN.
+ * A directory of all tiles of the grid holds the index of each stored tile,
+ * so a depth is read from the mapping with two lookups. The filter reads the
+ * initial depths from here, the grid of the task only holds the mapped depths.
+ *
+ * The geometry section holds the environment, the nodes of the map layers
+ * and the geometry index, so they are not derived again from the yaml map.
+ * The node map itself is still loaded from its yaml file, uw_localization
+ * can only create it and the static cells of the grid from yaml.
+ *
+ * File layout: magic, version, header, crc32 of the header, padding to 8
+ * bytes, the tile directory (int32, -1 for tiles without depth, x varies
+ * fastest), padding, the geometry section and its crc32, padding, and the
+ * cells of every stored tile in row major order (x varies fastest).
+ */
+class CompiledMap {
+public:
+  static const boost::uint32_t MAGIC = 0x4d435755; // "UWCM"
+  static const boost::uint32_t VERSION = 3;
+  static const boost::uint32_t TILE_SIZE = 64;
+
+  CompiledMap();
+  ~CompiledMap();
+
+  /**
+   * Loads the yaml maps like the task and writes the compiled map
+   * @param yaml_map: node map, its environment, layers and geometry index are compiled
+   * @param yaml_depth_map: depth map, which is compiled
+   * @param resolution: resolution of the depth obstacle grid
+   * @param file: output file. It is written to a temporary file first and renamed
+   * @return: true, if the map was written
+   */
+  static bool compile(const std::string& yaml_map, const std::string& yaml_depth_map,
+                      double resolution, const std::string& file);
+
+  /**
+   * Maps the file into memory and validates the header
+   * @return: false, if the file could not be read, has another version or
+   *   its sources were changed after compiling
+   */
+  bool open(const std::string& file);
+  void close();
+  bool isOpen() const { return data != 0; }
+
+  const CompiledMapHeader& getHeader() const { return header; }
+
+  /**
+   * @return: true, if the map was compiled for the grid of the node map with this resolution
+   */
+  bool matches(NodeMap& map, double resolution) const;
+
+  /**
+   * @return: depth of the cell, or NaN if it is unknown
+   */
+  float depth(unsigned int x, unsigned int y) const {
+    if(!data || x >= header.width || y >= header.height)
+      return NAN;
+
+    boost::int32_t tile = tile_directory[(y / header.tile_size) * tiles_x + x / header.tile_size];
+
+    if(tile < 0)
+      return NAN;
+
+    return depths[static_cast<size_t>(tile) * header.tile_size * header.tile_size
+                  + (y % header.tile_size) * header.tile_size + x % header.tile_size];
+  }
+
+  /**
+   * @return: depth of the grid cell at a position, or NaN if it is unknown or outside of the grid
+   */
+  float depthAt(double x, double y) const {
+    double cell_x = (x - header.origin.x()) / header.resolution;
+    double cell_y = (y - header.origin.y()) / header.resolution;
+
+    if(!(cell_x >= 0.0 && cell_y >= 0.0 && cell_x < header.width && cell_y < header.height))
+      return NAN;
+
+    return depth(static_cast<unsigned int>(cell_x), static_cast<unsigned int>(cell_y));
+  }
+
+  /**
+   * Reads the geometry section
+   * @param env: environment of the node map
+   * @param layers: resolved layers of the node map
+   * @param index: geometry index of env with the boxes and the world bounds
+   * @return: false, if the section is corrupted
+   */
+  bool readGeometry(Environment& env, MapLayers& layers, GeometryIndex& index) const;
+
+private:
+  void* data;
+  size_t size;
+  const boost::int32_t* tile_directory;
+  const char* geometry;
+  const float* depths;
+  CompiledMapHeader header;
+  boost::uint32_t tiles_x;
+
+  static void writeGeometry(std::string& buffer, const Environment& env, MapLayers& layers, const GeometryIndex& index);
+
+  CompiledMap(const CompiledMap&);
+  CompiledMap& operator=(const CompiledMap&);
+};
+
+/**
+ * @return: size and modification time of a file, or -1 if it does not exist
+ */
+boost::int64_t fileStamp(const std::string& file);
+
+}
+
+#endif
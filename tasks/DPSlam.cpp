@@ -76,13 +76,11 @@ double DPSlam::observe(PoseSlamParticle &X, const double &depth){
 }
 
 
-double DPSlam::observe(PoseSlamParticle &X, const sonar_detectors::ObstacleFeatures& Z, double vehicle_yaw, double vehicle_depth){
+double DPSlam::observe(PoseSlamParticle &X, const SonarFeatures& Z, double vehicle_yaw, double vehicle_depth){
   std::vector<Eigen::Vector2d> cells = map->getGridCells( Eigen::Vector2d(X.p_position.x(), X.p_position.y()), Z.angle + vehicle_yaw,
                                                          config.feature_observation_minimum_range, config.feature_observation_range, true);
   
-  Eigen::AngleAxis<double> sonar_yaw(Z.angle, Eigen::Vector3d::UnitZ()); 
   Eigen::AngleAxis<double> abs_yaw(vehicle_yaw, Eigen::Vector3d::UnitZ());    
-  Eigen::Affine3d SonarToAvalon(config.sonarToAvalon);
   
   Eigen::Vector2d pos2d(X.p_position.x(), X.p_position.y() );
   
@@ -105,25 +103,19 @@ double DPSlam::observe(PoseSlamParticle &X, const sonar_detectors::ObstacleFeatu
   
   //std::cout << "Observe " << Z.features.size() << std::endl;
  int feature_count = 0;
- for(std::vector<sonar_detectors::ObstacleFeature>::const_iterator it_f = Z.features.begin(); it_f != Z.features.end(); it_f++){
+ for(std::vector<SonarFeature>::const_iterator it_f = Z.features.begin(); it_f != Z.features.end(); it_f++){
       
-      double dist = it_f->range / 1000.0;
-      
-      //std::cout << "Dist: " << dist << "Thresholds: " << config.sonar_minimum_distance << " " << config.sonar_maximum_distance << " " << config.feature_observation_range << std::endl;
+      double dist = it_f->distance;
       
       //Is feature in valid range??
-      if(dist < config.sonar_minimum_distance ||
-        dist > config.sonar_maximum_distance ||
-        dist < config.feature_observation_minimum_range ||
-        dist > config.feature_observation_range){
+      if(!it_f->has(FEATURE_IN_SONAR_RANGE | FEATURE_IN_OBSERVATION_RANGE)){
         //std::cout << "Obstacle out of range" << std::endl;
        continue; 
       }
       
       
       //Calculate feature in world frame
-      Eigen::Vector3d RelativeZ = sonar_yaw * SonarToAvalon * base::Vector3d(dist, 0.0, 0.0);
-      Eigen::Vector3d real_pos = (abs_yaw * RelativeZ) + X.p_position;
+      Eigen::Vector3d real_pos = (abs_yaw * it_f->relative) + X.p_position;
       
       double vertical_span = dist * std::sin(config.sonar_vertical_angle / 2.0);
       
@@ -2,6 +2,7 @@
 #define UW_LOCALIZATION_DPSLAM_DPSLAM_HPP
 
 #include "LocalizationConfig.hpp"
+#include "SonarPreprocessor.hpp"
 #include <machine_learning/GaussianParameters.hpp>
 #include <uw_localization/dp_slam/dp_map.hpp>
 #include <uw_localization/dp_slam/dp_types.hpp>
@@ -55,8 +56,9 @@ namespace uw_localization{
     
     /**
      * Observe the sonar measurement for one particle
+     * @param Z: the prepared features of one beam
      */
-    double observe(PoseSlamParticle &X, const sonar_detectors::ObstacleFeatures& Z, double vehicle_yaw, double vehicle_depth);
+    double observe(PoseSlamParticle &X, const SonarFeatures& Z, double vehicle_yaw, double vehicle_depth);
     
     
     /**
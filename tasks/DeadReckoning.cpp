@@ -0,0 +1,239 @@
+#include "DeadReckoning.hpp"
+#include <iostream>
+
+using namespace uw_localization;
+
+namespace {
+
+/**
+ * Compares the parameters, which are used to create the motion model
+ */
+bool sameMotionModel(const FilterConfig& a, const FilterConfig& b)
+{
+  return a.advanced_motion_model == b.advanced_motion_model
+    && a.param_length == b.param_length && a.param_radius == b.param_radius && a.param_mass == b.param_mass
+    && a.param_thrusterCoefficient == b.param_thrusterCoefficient
+    && a.param_linearThrusterCoefficient == b.param_linearThrusterCoefficient
+    && a.param_squareThrusterCoefficient == b.param_squareThrusterCoefficient
+    && a.param_TCM == b.param_TCM
+    && a.param_linDamp == b.param_linDamp && a.param_sqDamp == b.param_sqDamp
+    && a.param_linDampNeg == b.param_linDampNeg && a.param_sqDampNeg == b.param_sqDampNeg
+    && a.param_centerOfGravity == b.param_centerOfGravity && a.param_centerOfBuoyancy == b.param_centerOfBuoyancy
+    && a.param_floating == b.param_floating;
+}
+
+}
+
+DeadReckoning::DeadReckoning()
+  : configured(false), error(DEAD_RECKONING_OK)
+{
+  resetPose(base::Vector3d::Zero());
+}
+
+DeadReckoning::~DeadReckoning()
+{
+}
+
+DeadReckoning& DeadReckoning::shared()
+{
+  static DeadReckoning instance;
+  return instance;
+}
+
+void DeadReckoning::configure(const FilterConfig& config)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  setup(config);
+}
+
+bool DeadReckoning::configureOnce(const FilterConfig& config)
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(configured)
+    return sameMotionModel(this->config, config);
+
+  setup(config);
+  resetPose(config.init_position);
+  return true;
+}
+
+void DeadReckoning::setup(const FilterConfig& config)
+{
+  this->config = config;
+  predictor.configure(config);
+  configured = true;
+}
+
+bool DeadReckoning::isConfigured() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return configured;
+}
+
+void DeadReckoning::enableDynamicsCache(const DynamicsCacheConfig& config)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  predictor.enableDynamicsCache(config);
+}
+
+DynamicsCache DeadReckoning::getDynamicsCache() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return predictor.getDynamicsCache();
+}
+
+void DeadReckoning::setThrusterVoltage(double voltage)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  predictor.setThrusterVoltage(voltage);
+}
+
+void DeadReckoning::reset(const base::Vector3d& position)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  resetPose(position);
+}
+
+void DeadReckoning::resetPose(const base::Vector3d& position)
+{
+  motion_pose.position = position;
+  motion_pose.velocity = base::Vector3d::Zero();
+  motion_pose.angular_velocity = base::Vector3d::Zero();
+  motion_pose.time = base::Time::now();
+
+  full_motion_pose.position = position;
+  full_motion_pose.velocity = base::Vector3d::Zero();
+  full_motion_pose.angular_velocity = base::Vector3d::Zero();
+  full_motion_pose.time = base::Time::now();
+
+  last_sample_time = base::Time();
+  error = DEAD_RECKONING_OK;
+}
+
+DeadReckoningError DeadReckoning::getError() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return error;
+}
+
+bool DeadReckoning::update(const base::samples::Joints& joints, const base::Quaterniond& orientation)
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(!configured)
+    return false;
+
+  base::Time sample_time = joints.time;
+  if(sample_time.isNull())
+    sample_time = base::Time::now();
+
+  //Already integrated by another consumer, or older than the integrated samples
+  if(!last_sample_time.isNull() && sample_time <= last_sample_time)
+    return true;
+
+  error = DEAD_RECKONING_OK;
+
+  if(!last_sample_time.isNull()){
+    double dt = (sample_time - last_sample_time).toSeconds();
+
+    if(dt < 5.0){
+
+      base::Vector3d u_t1 = predictor.predict(motion_pose.velocity, orientation, joints, dt);
+
+      if(predictor.dynamicModel())
+        integrateFull(joints, dt);
+
+      base::Vector3d v_avg = (motion_pose.velocity + u_t1) / 2.0;
+
+      if(base::samples::RigidBodyState::isValidValue(u_t1) && base::samples::RigidBodyState::isValidValue(orientation)){
+
+        motion_pose.position = motion_pose.position + orientation * (v_avg * dt);
+        motion_pose.velocity = u_t1;
+
+      }else{
+        error = DEAD_RECKONING_INVALID_VALUES;
+      }
+    }else{
+      error = DEAD_RECKONING_TIME_GAP;
+    }
+  }
+
+  last_sample_time = sample_time;
+  motion_pose.time = sample_time;
+  return error == DEAD_RECKONING_OK;
+}
+
+void DeadReckoning::integrateFull(const base::samples::Joints& joints, double dt)
+{
+  //Full dead reckoning, the angular motion is not linearized
+  underwaterVehicle::DynamicModel* dynamic_model = predictor.dynamicModel();
+  dynamic_model->setSamplingtime(dt);
+  dynamic_model->setPosition(full_motion_pose.position);
+  dynamic_model->setLinearVelocity(full_motion_pose.velocity);
+  dynamic_model->setAngularVelocity(full_motion_pose.angular_velocity);
+  dynamic_model->setOrientation(full_motion_pose.orientation);
+
+  dynamic_model->setPWMLevels(joints);
+
+  full_motion_pose.position = dynamic_model->getPosition();
+  full_motion_pose.velocity = dynamic_model->getLinearVelocity();
+  full_motion_pose.angular_velocity = dynamic_model->getAngularVelocity();
+  full_motion_pose.orientation = dynamic_model->getOrientation_in_Quat();
+  full_motion_pose.time = joints.time;
+}
+
+base::samples::RigidBodyState DeadReckoning::getPose() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return motion_pose;
+}
+
+base::samples::RigidBodyState DeadReckoning::getFullPose() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return full_motion_pose;
+}
+
+base::Vector3d DeadReckoning::getVelocity() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return motion_pose.velocity;
+}
+
+void DeadReckoning::setOrientation(const base::Quaterniond& orientation, const base::Matrix3d& cov_orientation)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  motion_pose.orientation = orientation;
+  motion_pose.cov_orientation = cov_orientation;
+}
+
+void DeadReckoning::setVelocity(const base::Vector3d& velocity)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  motion_pose.velocity = velocity;
+}
+
+void DeadReckoning::setZVelocity(double velocity)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  motion_pose.velocity.z() = velocity;
+}
+
+void DeadReckoning::setAngularVelocity(const base::Vector3d& angular_velocity)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  motion_pose.angular_velocity = angular_velocity;
+}
+
+void DeadReckoning::setDepth(double depth)
+{
+  boost::mutex::scoped_lock lock(mutex);
+  motion_pose.position.z() = depth;
+}
+
+unsigned int DeadReckoning::integrations() const
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return predictor.integrations();
+}
@@ -0,0 +1,137 @@
+/* ----------------------------------------------------------------------------
+ * DeadReckoning.hpp
+ * Dead reckoning with the motion model, shareable between tasks
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_DEAD_RECKONING_HPP
+#define UW_PARTICLE_LOCALIZATION_DEAD_RECKONING_HPP
+
+#include <boost/thread/mutex.hpp>
+#include <base/eigen.h>
+#include <base/time.h>
+#include <base/samples/rigid_body_state.h>
+#include <base/samples/Joints.hpp>
+#include "LocalizationConfig.hpp"
+#include "VelocityPredictor.hpp"
+
+namespace uw_localization {
+
+/**
+ * Result of the last integrated thruster sample
+ */
+enum DeadReckoningError {
+  DEAD_RECKONING_OK = 0,
+  /** the predicted velocity or the orientation was not valid */
+  DEAD_RECKONING_INVALID_VALUES,
+  /** the sample is too long after the last sample, the pose was not changed */
+  DEAD_RECKONING_TIME_GAP
+};
+
+/**
+ * Integrates the thruster samples with the simple or the advanced motion model.
+ * Every thruster sample is integrated only once, samples with an already
+ * integrated or an older timestamp are ignored. So several consumers in one process can
+ * feed the same samples into the shared instance.
+ *
+ * All methods are thread safe. The particles are not predicted here, every
+ * filter predicts them with its own VelocityPredictor.
+ */
+class DeadReckoning {
+public:
+  DeadReckoning();
+  ~DeadReckoning();
+
+  /**
+   * The process wide instance, e.g. for the Task and the MotionModel task.
+   * Its pose starts at the init_position of the first consumer
+   */
+  static DeadReckoning& shared();
+
+  /**
+   * Creates the motion model. The dynamics cache and the pose are reset
+   */
+  void configure(const FilterConfig& config);
+  bool isConfigured() const;
+
+  /**
+   * Configures the instance, unless a consumer configured it before.
+   * The first configuration resets the pose to the init_position.
+   * The thruster voltage may differ, it is set at runtime
+   * @return: false, if it was configured with different motion model parameters
+   */
+  bool configureOnce(const FilterConfig& config);
+
+  /**
+   * Uses linearized transitions of the dynamic model. Only used with the advanced motion model
+   */
+  void enableDynamicsCache(const DynamicsCacheConfig& config);
+  DynamicsCache getDynamicsCache() const;
+
+  void setThrusterVoltage(double voltage);
+
+  /**
+   * Resets the pose to the position with zero velocity
+   */
+  void reset(const base::Vector3d& position);
+
+  /**
+   * Integrates a thruster sample
+   * @param joints: thruster commands, the time is the key of the sample
+   * @param orientation: orientation of the vehicle
+   * @return: false, if the sample could not be integrated, see getError().
+   *          An already integrated or an older sample returns true
+   */
+  bool update(const base::samples::Joints& joints, const base::Quaterniond& orientation);
+
+  /**
+   * @return: the result of the last integrated sample
+   */
+  DeadReckoningError getError() const;
+
+  /**
+   * Dead reckoning, the angular velocity is not integrated
+   */
+  base::samples::RigidBodyState getPose() const;
+
+  /**
+   * Dead reckoning with the full dynamic model. Only available with the advanced motion model
+   */
+  base::samples::RigidBodyState getFullPose() const;
+
+  base::Vector3d getVelocity() const;
+
+  /**
+   * Corrections of the dead reckoning by sensor measurements
+   */
+  void setOrientation(const base::Quaterniond& orientation, const base::Matrix3d& cov_orientation);
+  void setVelocity(const base::Vector3d& velocity);
+  void setZVelocity(double velocity);
+  void setAngularVelocity(const base::Vector3d& angular_velocity);
+  void setDepth(double depth);
+
+  unsigned int integrations() const;
+
+private:
+  mutable boost::mutex mutex;
+  FilterConfig config;
+  bool configured;
+
+  VelocityPredictor predictor;
+
+  base::samples::RigidBodyState motion_pose;
+  base::samples::RigidBodyState full_motion_pose;
+  base::Time last_sample_time;
+  DeadReckoningError error;
+
+  void resetPose(const base::Vector3d& position);
+  void integrateFull(const base::samples::Joints& joints, double dt);
+  void setup(const FilterConfig& config);
+
+  DeadReckoning(const DeadReckoning&);
+  DeadReckoning& operator=(const DeadReckoning&);
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "DebugExporter.hpp"
+#include <algorithm>
+#include <boost/bind.hpp>
+
+using namespace uw_localization;
+
+DebugExporter::DebugExporter()
+  : back_buffer(&buffers[0]), pending_buffer(&buffers[1]), front_buffer(&buffers[2]),
+    has_pending(false), running(false)
+{
+}
+
+DebugExporter::~DebugExporter()
+{
+  stop();
+}
+
+void DebugExporter::start(const Handler& handler)
+{
+  stop();
+
+  this->handler = handler;
+  has_pending = false;
+  running = true;
+  thread = boost::thread(boost::bind(&DebugExporter::run, this));
+}
+
+void DebugExporter::stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    running = false;
+  }
+  condition.notify_one();
+
+  if(thread.joinable())
+    thread.join();
+}
+
+bool DebugExporter::commit()
+{
+  bool replaced;
+
+  {
+    boost::mutex::scoped_lock lock(mutex);
+
+    replaced = has_pending;
+    if(replaced)
+      merge(*back_buffer, *pending_buffer);
+
+    std::swap(back_buffer, pending_buffer);
+    has_pending = true;
+  }
+  condition.notify_one();
+
+  return !replaced;
+}
+
+void DebugExporter::merge(DebugSnapshot& newer, DebugSnapshot& older)
+{
+  if(older.has_debug && !newer.has_debug){
+    newer.has_debug = true;
+    newer.has_grid = older.has_grid;
+    std::swap(newer.particles, older.particles);
+    std::swap(newer.grid, older.grid);
+  }
+
+  if(older.has_debug && older.has_environment && !(newer.has_debug && newer.has_environment)){
+    newer.has_environment = true;
+    std::swap(newer.environment, older.environment);
+  }
+
+  newer.compact_map = newer.compact_map || older.compact_map;
+}
+
+void DebugExporter::run()
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  while(true){
+
+    while(running && !has_pending)
+      condition.wait(lock);
+
+    if(!running)
+      return;
+
+    //The front buffer is not touched by the filter thread, while we are exporting
+    std::swap(pending_buffer, front_buffer);
+    has_pending = false;
+    lock.unlock();
+
+    handler(*front_buffer);
+
+    lock.lock();
+  }
+}
@@ -0,0 +1,104 @@
+/* ----------------------------------------------------------------------------
+ * DebugExporter.hpp
+ * Background worker for writing debug output
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_DEBUG_EXPORTER_HPP
+#define UW_PARTICLE_LOCALIZATION_DEBUG_EXPORTER_HPP
+
+#include <string>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <uw_localization/types/particle.hpp>
+#include <uw_localization/types/environment.hpp>
+#include <uw_localization/types/map.hpp>
+
+namespace uw_localization {
+
+/**
+ * Debug data, which is collected on the filter thread
+ */
+struct DebugSnapshot {
+  base::Time time;
+
+  /** true, if the debug ports should be written */
+  bool has_debug;
+
+  /** true, if a snapshot of the depth map should be saved */
+  bool compact_map;
+
+  ParticleSet particles;
+
+  /** true, if the grid was already extracted on the filter thread (slam-mode) */
+  bool has_grid;
+  SimpleGrid grid;
+
+  /** true, if the environment changed since the last snapshot */
+  bool has_environment;
+  Environment environment;
+
+  double output_confidence_threshold;
+  int observation_count_threshold;
+
+  /** file for the depth map, empty if it should not be saved */
+  std::string depth_output_map;
+};
+
+/**
+ * Exports debug snapshots on a background thread.
+ * The filter thread fills the back buffer and commits it, which swaps the back
+ * and the pending buffer. The worker swaps the pending and the front buffer
+ * and passes the front buffer to the export handler. So the filter thread
+ * fills the next snapshot, while the worker exports the last one.
+ * A pending snapshot, which was not exported yet, is replaced by a newer one.
+ */
+class DebugExporter {
+public:
+  typedef boost::function<void (DebugSnapshot&)> Handler;
+
+  DebugExporter();
+  ~DebugExporter();
+
+  void start(const Handler& handler);
+  void stop();
+
+  /**
+   * @return: buffer for the next snapshot. Only used by the filter thread
+   */
+  DebugSnapshot& back() { return *back_buffer; }
+
+  /**
+   * Hands the back buffer over to the worker. The parts of a replaced
+   * pending snapshot, which the new snapshot does not carry, are kept
+   * @return: false, if a pending snapshot was replaced
+   */
+  bool commit();
+
+private:
+  DebugSnapshot buffers[3];
+  DebugSnapshot* back_buffer;
+  DebugSnapshot* pending_buffer;
+  DebugSnapshot* front_buffer;
+  bool has_pending;
+  bool running;
+
+  Handler handler;
+  boost::thread thread;
+  boost::mutex mutex;
+  boost::condition_variable condition;
+
+  void run();
+
+  /**
+   * Moves the debug data, the environment and the compaction request of an
+   * unexported snapshot into a newer snapshot, which does not have them
+   */
+  static void merge(DebugSnapshot& newer, DebugSnapshot& older);
+};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "DepthProfile.hpp"
+
+using namespace uw_localization;
+
+DepthProfile::DepthProfile(double window, double distance, unsigned int max_samples)
+  : traveled(0.0)
+{
+  configure(window, distance, max_samples);
+}
+
+void DepthProfile::configure(double window, double distance, unsigned int max_samples)
+{
+  this->window = window;
+  this->distance = distance;
+  this->max_samples = max_samples > 0 ? max_samples : 1;
+  profile_samples.reserve(this->max_samples);
+}
+
+void DepthProfile::push(const base::Time& time, const base::Vector3d& position, const base::Matrix3d& cov_position, double depth)
+{
+  if(!profile_samples.empty())
+    traveled += (position - profile_samples.back().position).head<2>().norm();
+
+  DepthSample sample;
+  sample.time = time;
+  sample.position = position;
+  sample.cov_position = cov_position;
+  sample.depth = depth;
+  profile_samples.push_back(sample);
+}
+
+bool DepthProfile::complete() const
+{
+  if(profile_samples.empty())
+    return false;
+
+  if(profile_samples.size() >= max_samples || (window <= 0.0 && distance <= 0.0))
+    return true;
+
+  if(window > 0.0 && (profile_samples.back().time - profile_samples.front().time).toSeconds() >= window)
+    return true;
+
+  return distance > 0.0 && traveled >= distance;
+}
@@ -0,0 +1,68 @@
+/* ----------------------------------------------------------------------------
+ * DepthProfile.hpp
+ * Echosounder samples, which are observed together
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_DEPTH_PROFILE_HPP
+#define UW_PARTICLE_LOCALIZATION_DEPTH_PROFILE_HPP
+
+#include <vector>
+#include <base/eigen.h>
+#include <base/time.h>
+
+namespace uw_localization {
+
+/**
+ * Ground depth, measured at the estimated vehicle pose
+ */
+struct DepthSample {
+  base::Time time;
+  base::Vector3d position;
+  base::Matrix3d cov_position;
+  double depth;
+};
+
+/**
+ * Collects echosounder samples over a time window or a traveled distance.
+ * The particles are weighted once with the whole profile: every sample is
+ * compared at the particle position, shifted by the motion of the vehicle
+ * between the sample and the last sample of the profile.
+ */
+class DepthProfile {
+public:
+  /**
+   * @param window: duration of a profile in seconds
+   * @param distance: traveled distance of a profile in meter
+   * @param max_samples: a profile is complete with this number of samples
+   * If window and distance are 0, every sample is a complete profile
+   */
+  DepthProfile(double window = 0.0, double distance = 0.0, unsigned int max_samples = 50);
+
+  void configure(double window, double distance, unsigned int max_samples = 50);
+
+  void push(const base::Time& time, const base::Vector3d& position, const base::Matrix3d& cov_position, double depth);
+
+  /**
+   * @return: true, if the window or the distance is covered
+   */
+  bool complete() const;
+
+  void clear() { profile_samples.clear(); traveled = 0.0; }
+  bool empty() const { return profile_samples.empty(); }
+  size_t size() const { return profile_samples.size(); }
+
+  const std::vector<DepthSample>& samples() const { return profile_samples; }
+  const DepthSample& back() const { return profile_samples.back(); }
+
+private:
+  double window;
+  double distance;
+  unsigned int max_samples;
+  double traveled;
+  std::vector<DepthSample> profile_samples;
+};
+
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include "DynamicsCache.hpp"
+#include <cmath>
+
+using namespace uw_localization;
+
+namespace {
+
+const double VELOCITY_STEP = 1e-3;
+const double INPUT_STEP = 1e-3;
+const double GRAVITY_STEP = 1e-3;
+const double DT_STEP = 1e-4;
+
+base::VectorXd inputVector(const base::samples::Joints& joints)
+{
+  base::VectorXd input(joints.elements.size());
+
+  for(unsigned int i = 0; i < joints.elements.size(); i++)
+    input(i) = joints.elements[i].raw;
+
+  return input;
+}
+
+/**
+ * Gravity direction in body frame
+ */
+base::Vector3d gravityDirection(const base::Quaterniond& orientation)
+{
+  return orientation.inverse() * base::Vector3d(0.0, 0.0, -1.0);
+}
+
+/**
+ * An orientation with the given body frame gravity direction. The yaw is arbitrary
+ */
+base::Quaterniond orientationFromGravity(const base::Vector3d& gravity)
+{
+  return base::Quaterniond::FromTwoVectors(gravity.normalized(), base::Vector3d(0.0, 0.0, -1.0));
+}
+
+}
+
+DynamicsCacheConfig::DynamicsCacheConfig()
+  : dt_resolution(0.01), velocity_tolerance(0.05), input_tolerance(0.2), gravity_tolerance(0.1), max_linearizations(256)
+{
+}
+
+bool DynamicsCache::Key::operator<(const Key& other) const
+{
+  for(int i = 0; i < 4; i++){
+    if(values[i] != other.values[i])
+      return values[i] < other.values[i];
+  }
+
+  return false;
+}
+
+DynamicsCache::DynamicsCache()
+  : hit_count(0), linearization_count(0), integration_count(0), overflow_count(0)
+{
+}
+
+void DynamicsCache::configure(const DynamicsCacheConfig& config)
+{
+  this->config = config;
+  clear();
+}
+
+void DynamicsCache::clear()
+{
+  cells.clear();
+  hit_count = 0;
+  linearization_count = 0;
+  integration_count = 0;
+  overflow_count = 0;
+}
+
+DynamicsCache::Key DynamicsCache::key(const base::Vector3d& velocity, double dt) const
+{
+  double cell_width = 2.0 * config.velocity_tolerance;
+
+  Key k;
+  k.values[0] = static_cast<int>(std::floor(dt / config.dt_resolution + 0.5));
+
+  for(int i = 0; i < 3; i++)
+    k.values[i + 1] = static_cast<int>(std::floor(velocity(i) / cell_width));
+
+  return k;
+}
+
+base::Vector3d DynamicsCache::cellCenter(const Key& key) const
+{
+  double cell_width = 2.0 * config.velocity_tolerance;
+
+  return base::Vector3d(key.values[1] + 0.5, key.values[2] + 0.5, key.values[3] + 0.5) * cell_width;
+}
+
+base::Vector3d DynamicsCache::predict(underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                                      const base::Quaterniond& orientation, const base::samples::Joints& joints, double dt)
+{
+  Key k = key(velocity, dt);
+  base::VectorXd input = inputVector(joints);
+  base::Vector3d gravity = gravityDirection(orientation);
+
+  std::map<Key, Linearization>::iterator it = cells.find(k);
+
+  if(it != cells.end() && isValid(it->second, input, gravity)){
+    const Linearization& l = it->second;
+    hit_count++;
+
+    return l.f0 + l.A * (velocity - l.velocity) + l.B * (input - l.input)
+      + l.G * (gravity - l.gravity) + l.D * (dt - l.dt);
+  }
+
+  if(it == cells.end()){
+
+    //A linearization costs several integrations, it only pays off for cells in the cache.
+    //If the velocities keep leaving the cached cells, the cells are built again
+    if(cells.size() >= config.max_linearizations && overflow_count < config.max_linearizations){
+      overflow_count++;
+      integration_count++;
+      return integrate(model, velocity, orientation, joints, dt);
+    }
+
+    if(cells.size() >= config.max_linearizations){
+      cells.clear();
+      overflow_count = 0;
+    }
+
+    it = cells.insert(std::make_pair(k, Linearization())).first;
+  }
+  else if(++it->second.misses < linearizationCost(joints)){
+
+    //The operating point moved away, a single integration is cheaper than a linearization
+    integration_count++;
+    return integrate(model, velocity, orientation, joints, dt);
+  }
+
+  linearize(it->second, model, cellCenter(k), gravity, joints, dt);
+
+  const Linearization& l = it->second;
+  return l.f0 + l.A * (velocity - l.velocity) + l.D * (dt - l.dt);
+}
+
+bool DynamicsCache::isValid(const Linearization& l, const base::VectorXd& input, const base::Vector3d& gravity) const
+{
+  if(input.size() != l.input.size())
+    return false;
+
+  if(input.size() > 0 && (input - l.input).cwiseAbs().maxCoeff() > config.input_tolerance)
+    return false;
+
+  return (gravity - l.gravity).norm() <= config.gravity_tolerance;
+}
+
+void DynamicsCache::linearize(Linearization& l, underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                              const base::Vector3d& gravity, const base::samples::Joints& joints, double dt)
+{
+  linearization_count++;
+
+  base::Quaterniond orientation = orientationFromGravity(gravity);
+
+  l.dt = dt;
+  l.velocity = velocity;
+  l.input = inputVector(joints);
+  l.gravity = gravity;
+  l.misses = 0;
+  l.f0 = integrate(model, velocity, orientation, joints, dt);
+
+  //Forward differences of the model
+  for(int i = 0; i < 3; i++){
+    base::Vector3d v = velocity;
+    v(i) += VELOCITY_STEP;
+    l.A.col(i) = (integrate(model, v, orientation, joints, dt) - l.f0) / VELOCITY_STEP;
+  }
+
+  l.B.resize(3, l.input.size());
+  for(int i = 0; i < l.input.size(); i++){
+    base::samples::Joints j = joints;
+    j.elements[i].raw += INPUT_STEP;
+    l.B.col(i) = (integrate(model, velocity, orientation, j, dt) - l.f0) / INPUT_STEP;
+  }
+
+  for(int i = 0; i < 3; i++){
+    base::Vector3d g = gravity;
+    g(i) += GRAVITY_STEP;
+    l.G.col(i) = (integrate(model, velocity, orientationFromGravity(g), joints, dt) - l.f0) / GRAVITY_STEP;
+  }
+
+  l.D = (integrate(model, velocity, orientation, joints, dt + DT_STEP) - l.f0) / DT_STEP;
+}
+
+unsigned int DynamicsCache::linearizationCost(const base::samples::Joints& joints)
+{
+  //f0, the velocity, input and gravity differences and the time difference
+  return 1 + 3 + joints.elements.size() + 3 + 1;
+}
+
+base::Vector3d DynamicsCache::integrate(underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                                        const base::Quaterniond& orientation, const base::samples::Joints& joints, double dt)
+{
+  model.setPosition(base::Vector3d::Zero());
+  model.setLinearVelocity(velocity);
+  model.setAngularVelocity(base::Vector3d::Zero());
+  model.setOrientation(orientation);
+  model.setSamplingtime(dt);
+  model.setPWMLevels(joints);
+
+  return model.getLinearVelocity();
+}
@@ -0,0 +1,137 @@
+/* ----------------------------------------------------------------------------
+ * DynamicsCache.hpp
+ * Linearized velocity transitions of the dynamic model
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_DYNAMICS_CACHE_HPP
+#define UW_PARTICLE_LOCALIZATION_DYNAMICS_CACHE_HPP
+
+#include <map>
+#include <base/eigen.h>
+#include <base/samples/Joints.hpp>
+#include <uwv_dynamic_model/uwv_dynamic_model.h>
+
+namespace uw_localization {
+
+struct DynamicsCacheConfig {
+  DynamicsCacheConfig();
+
+  /** width of a sampling time bucket in seconds */
+  double dt_resolution;
+
+  /** maximum velocity difference to the linearization point in m/s.
+      The velocity cells of the cache have twice this width */
+  double velocity_tolerance;
+
+  /** maximum difference of a thruster command to the linearization point.
+      Inside it, the input Jacobian corrects the prediction */
+  double input_tolerance;
+
+  /** maximum difference of the body frame gravity direction, which changes with roll and pitch.
+      Inside it, the gravity Jacobian corrects the prediction */
+  double gravity_tolerance;
+
+  /** maximum number of cached linearizations */
+  unsigned int max_linearizations;
+};
+
+/**
+ * Replaces the integration of the dynamic model by a linearized transition
+ *   v_t+1 = f0 + A (v_t - v0) + B (u - u0) + G (g - g0) + D (dt - dt0)
+ * around an operating point. One linearization is cached for every sampling
+ * time bucket and velocity cell, it is linearized at the center of the cell.
+ * So particles with spread velocities use the linearizations of their cells,
+ * instead of linearizing the model again and again.
+ * The Jacobians B and G cover changes of the thruster commands and of the
+ * gravity direction, so a cell stays valid inside a wide input region.
+ * Outside of it, the prediction is integrated directly. A linearization
+ * costs several integrations, so the cell is only linearized again, after
+ * it missed as often as a linearization costs. If all linearizations are
+ * in use, a new cell is integrated directly as well. After
+ * max_linearizations of these misses, the cache is rebuilt.
+ * The angular velocity is assumed to be zero, like in the filter.
+ */
+class DynamicsCache {
+public:
+  DynamicsCache();
+
+  void configure(const DynamicsCacheConfig& config);
+
+  /**
+   * Drops all linearizations, e.g. after a change of the thruster voltage
+   */
+  void clear();
+
+  /**
+   * Predicts the linear velocity after dt
+   * @param model: the dynamic model, which is used for linearization
+   * @param velocity: linear velocity in body frame
+   * @param orientation: orientation of the vehicle
+   * @param joints: thruster commands, using the raw values
+   * @param dt: sampling time in seconds
+   * @return: linear velocity in body frame
+   */
+  base::Vector3d predict(underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                         const base::Quaterniond& orientation, const base::samples::Joints& joints, double dt);
+
+  unsigned int hits() const { return hit_count; }
+  unsigned int linearizations() const { return linearization_count; }
+  unsigned int integrations() const { return integration_count; }
+
+private:
+  /**
+   * Sampling time bucket and velocity cell of a linearization
+   */
+  struct Key {
+    int values[4];
+
+    bool operator<(const Key& other) const;
+  };
+
+  struct Linearization {
+    double dt;
+    base::Vector3d velocity;
+    base::VectorXd input;
+    base::Vector3d gravity;
+
+    base::Vector3d f0;
+    base::Matrix3d A;
+    base::MatrixXd B;
+    base::Matrix3d G;
+    base::Vector3d D;
+
+    /** predictions outside of the valid region since the linearization */
+    unsigned int misses;
+  };
+
+  DynamicsCacheConfig config;
+  std::map<Key, Linearization> cells;
+  unsigned int hit_count;
+  unsigned int linearization_count;
+  unsigned int integration_count;
+  unsigned int overflow_count;
+
+  Key key(const base::Vector3d& velocity, double dt) const;
+  base::Vector3d cellCenter(const Key& key) const;
+
+  /**
+   * The velocity is valid by the cell, only the input and the gravity direction are checked
+   */
+  bool isValid(const Linearization& l, const base::VectorXd& input, const base::Vector3d& gravity) const;
+
+  void linearize(Linearization& l, underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                 const base::Vector3d& gravity, const base::samples::Joints& joints, double dt);
+
+  /**
+   * Number of integrations of a linearization
+   */
+  static unsigned int linearizationCost(const base::samples::Joints& joints);
+
+  static base::Vector3d integrate(underwaterVehicle::DynamicModel& model, const base::Vector3d& velocity,
+                                  const base::Quaterniond& orientation, const base::samples::Joints& joints, double dt);
+};
+
+}
+
+#endif
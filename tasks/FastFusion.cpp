@@ -1,6 +1,9 @@
 /* Generated from orogen/lib/orogen/templates/tasks/Task.cpp */
 
 #include "FastFusion.hpp"
+#include <algorithm>
+#include <iostream>
+#include <rtt/base/ActivityInterface.hpp>
 
 using namespace uw_particle_localization;
 
@@ -19,11 +22,43 @@ FastFusion::~FastFusion()
 }
 
 
+bool FastFusion::configureHook()
+{
+    if (! FastFusionBase::configureHook())
+        return false;
+    
+    //The prediction is only written in updateHook, so it needs a periodic trigger
+    if(_prediction_rate.get() > 0.0){
+      
+      RTT::base::ActivityInterface* activity = getActivity();
+      
+      if(!activity || !activity->isPeriodic()){
+        std::cout << "FastFusion: prediction_rate is set, but the task is not deployed with a periodic activity" << std::endl;
+        return false;
+      }
+      
+      if(activity->getPeriod() > 1.0 / _prediction_rate.get()){
+        std::cout << "FastFusion: activity period of " << activity->getPeriod() << "s is too long for a prediction_rate of "
+          << _prediction_rate.get() << "Hz" << std::endl;
+        return false;
+      }
+      
+    }
+    
+    return true;
+}
 
 bool FastFusion::startHook()
 {
     if (! FastFusionBase::startHook())
         return false;
+    
+    boost::mutex::scoped_lock lock(history_mutex);
+    history.setCapacity(std::max(2, _history_size.get()));
+    history.clear();
+    lastOutput = base::Time();
+    lastPrediction = base::Time();
+    
     return true;
 }
 void FastFusion::updateHook()
@@ -31,92 +66,72 @@ void FastFusion::updateHook()
     FastFusionBase::updateHook();
     
     base::samples::RigidBodyState rbs;
+    boost::mutex::scoped_lock lock(history_mutex);
     
     //Update vehicle position
     while(_position_samples.read(rbs) == RTT::NewData){
-      
-      if(base::samples::RigidBodyState::isValidValue(rbs.position)){
-        
-        actualPose.position.x() = rbs.position.x();
-        actualPose.position.y() = rbs.position.y();
-        
-        //We never recieved velocity samples or we have a timeout -> use this samples insted!
-        if(lastVelocity.isNull() || (rbs.time.toSeconds() - lastVelocity.toSeconds()) > _velocity_timeout.get() ){
-          actualPose.velocity.x() = rbs.velocity.x();
-          actualPose.velocity.y() = rbs.velocity.y();
-        }
-        
-        
-        //Do we have a newer timestamp?
-        if(actualPose.time.toSeconds() < rbs.time.toSeconds()){
-          actualPose.time = rbs.time;
-        }
-        
-      }
-      
+      history.addPosition(rbs);
     }
     
     //Update vehicle depth
     while(_depth_samples.read(rbs) == RTT::NewData){
-      
-      if( (!std::isnan(rbs.position.z()) ) && (!std::isnan(rbs.velocity.z() ) ) ) {
-        
-        actualPose.position.z() = rbs.position.z();
-        actualPose.velocity.z() = rbs.velocity.z();
-        
-        //Do we have a newer timestamp?
-        if(actualPose.time.toSeconds() < rbs.time.toSeconds()){
-          actualPose.time = rbs.time;
-        }
-        
-      }
-    
+      history.addDepth(rbs);
     }
     
     //Update vehicle orientation
     while(_orientation_samples.read(rbs) == RTT::NewData){
-      
-      if(base::samples::RigidBodyState::isValidValue(rbs.orientation) &&
-        base::samples::RigidBodyState::isValidValue(rbs.angular_velocity) ){
-        
-        actualPose.orientation = rbs.orientation;
-        actualPose.angular_velocity = rbs.angular_velocity;
-      
-        //Do we have a newer timestamp?
-        if(actualPose.time.toSeconds() < rbs.time.toSeconds()){
-          actualPose.time = rbs.time;
-          
-        }
-      
-      }           
-      
+      history.addOrientation(rbs);
     }
     
-    //Update vehicle velocity
+    //Update vehicle velocity, the velocity is converted to world frame at the time of the pose
     while(_velocity_samples.read(rbs) == RTT::NewData){
+      history.addVelocity(rbs);
+    }
+    
+    //Publish at the newest time, for which all streams have data
+    base::Time time = history.latestCompleteTime(_stream_timeout.get());
+    
+    if(!time.isNull() && time > lastOutput){
       
-      //We need an valid orientation for body-to-world-transformation
-      if(base::samples::RigidBodyState::isValidValue(rbs.velocity) && base::samples::RigidBodyState::isValidValue(actualPose.orientation) ){
-        
-        //Convert velocity to world frame
-        Eigen::Vector3d vel = actualPose.orientation * rbs.velocity;
-        
-        actualPose.velocity.x() = vel.x();
-        actualPose.velocity.y() = vel.y();
-        lastVelocity = rbs.time;
-        
-        //Do we have a newer timestamp?
-        if(actualPose.time.toSeconds() < rbs.time.toSeconds()){
-          actualPose.time = rbs.time;
-        }
-        
-        
+      if(history.getPose(time, lastPose, _velocity_timeout.get())){
+        _pose_samples.write(lastPose);
+        lastOutput = time;
       }
-      
-      
     }
     
-    _pose_samples.write(actualPose);
+    if(_prediction_rate.get() > 0.0 && !lastOutput.isNull())
+      predict();
+    
+}
+
+void FastFusion::predict()
+{
+    base::Time now = base::Time::now();
+    
+    //Allow some jitter of the periodic activity
+    if(!lastPrediction.isNull() && (now - lastPrediction).toSeconds() < 0.9 / _prediction_rate.get())
+      return;
+    
+    uw_localization::PredictedPose prediction;
+    double horizon = std::max(0.0, (now - lastPose.time).toSeconds());
+    
+    prediction.source_time = lastPose.time;
+    prediction.clamped = horizon > _max_prediction_horizon.get();
+    prediction.horizon = std::min(horizon, _max_prediction_horizon.get());
+    prediction.pose = uw_localization::extrapolatePose(lastPose, prediction.horizon);
+    prediction.pose.time = now;
+    
+    _predicted_pose_samples.write(prediction);
+    lastPrediction = now;
+}
+
+base::samples::RigidBodyState FastFusion::poseAt(base::Time const& time)
+{
+    base::samples::RigidBodyState pose;
+    
+    boost::mutex::scoped_lock lock(history_mutex);
+    history.getPose(time, pose, _velocity_timeout.get());
     
+    return pose;
 }
 
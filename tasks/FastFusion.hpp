@@ -5,6 +5,8 @@
 
 #include "uw_particle_localization/FastFusionBase.hpp"
 #include <base/samples/RigidBodyState.hpp>
+#include <boost/thread/mutex.hpp>
+#include "PoseHistory.hpp"
 
 namespace uw_particle_localization {
 
@@ -47,17 +49,28 @@ namespace uw_particle_localization {
          */
 	~FastFusion();
 
+        /** Fails, if a prediction_rate is set without a periodic activity, that is fast enough for it
+         */
+        bool configureHook();
 
         bool startHook();
 
 
         void updateHook();
         
+        /** Returns the pose interpolated at the given time
+         */
+        base::samples::RigidBodyState poseAt(base::Time const& time);
         
     private:
       
-      base::samples::RigidBodyState actualPose;
-      base::Time lastVelocity;
+      uw_localization::PoseHistory history;
+      boost::mutex history_mutex;
+      base::Time lastOutput;
+      base::samples::RigidBodyState lastPose;
+      base::Time lastPrediction;
+      
+      void predict();
 
 
     };
@@ -0,0 +1,57 @@
+#include "FeatureFilter.hpp"
+#include <cmath>
+
+using namespace uw_localization;
+
+void uw_localization::filterObstacleFeatures(sonar_detectors::ObstacleFeatures& sample, const FeatureFilterConfig& config,
+                                             double current_depth, double current_ground){
+  
+  //calculate reflection of the ground
+  double diff_ground = std::fabs( current_ground - current_depth);
+  double dist_groundreflection = diff_ground/sin(config.sonar_vertical_angle/2.0);
+  double dist_surfacereflection = std::fabs(current_depth)/sin(config.sonar_vertical_angle/2.0);
+  
+  uint32_t last_range = -1;
+  double  last_confidence = NAN;
+  
+  //Search for duplicate features
+  //we asume, that duplicate features succed to each other
+  //The kept features are moved to the front, instead of erasing every removed one
+  std::vector<sonar_detectors::ObstacleFeature>& features = sample.features;
+  size_t kept = 0;
+  
+  for(size_t i = 0; i < features.size(); i++){
+   
+    const sonar_detectors::ObstacleFeature& feature = features[i];
+    double dist = feature.range / 1000.0;
+    
+    //We have a duplicate -> keep the feature with the higher confidence
+    if(feature.range == last_range){
+      if(feature.confidence > last_confidence){
+        features[kept - 1] = feature;
+        last_confidence = feature.confidence;
+      }
+     
+     //Feature is out of range -> remove it!
+    }else if(dist <= 0 || dist < config.sonar_minimum_distance || dist > config.sonar_maximum_distance){
+      
+      //Feature could be a false reflection from the ground or surface
+    }else if( std::fabs( dist - dist_groundreflection) < 0.5 || std::fabs( dist - dist_surfacereflection) < 0.5 ){ 
+      //TODO do we need this?
+      
+      //Feature confidence is to low -> do not use it!
+    }else if( config.feature_filter_threshold > 0.0 && feature.confidence <= config.feature_filter_threshold){
+    
+    }else{
+      last_range = feature.range;
+      last_confidence = feature.confidence;
+      
+      if(kept != i)
+        features[kept] = feature;
+      
+      kept++;
+    }
+  }
+  
+  features.resize(kept);
+}
@@ -0,0 +1,36 @@
+/* ----------------------------------------------------------------------------
+ * FeatureFilter.hpp
+ * Filtering of sonar obstacle features
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_FEATURE_FILTER_HPP
+#define UW_PARTICLE_LOCALIZATION_FEATURE_FILTER_HPP
+
+#include <sonar_detectors/SonarDetectorTypes.hpp>
+
+namespace uw_localization {
+
+struct FeatureFilterConfig {
+  double sonar_vertical_angle;
+  double sonar_minimum_distance;
+  double sonar_maximum_distance;
+  double feature_filter_threshold;
+};
+
+/**
+ * Filter out duplicate features. If a feature is found multiple times, the feature with the highest confidence is choosen
+ * We assume, that duplicate features are succeed to each other, to reduce computation time
+ * Features out of range, with a low confidence or at the distance of a ground or surface reflection are removed
+ * The remaining features keep their order, the list is compacted in a single pass
+ * @param sample: Features to be filtered
+ * @param config: sonar and filter parameters
+ * @param current_depth: depth of the vehicle
+ * @param current_ground: depth of the ground
+ */
+void filterObstacleFeatures(sonar_detectors::ObstacleFeatures& sample, const FeatureFilterConfig& config,
+                            double current_depth, double current_ground);
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include "FilterEnsemble.hpp"
+#include "ParticleLocalization.hpp"
+#include <boost/bind.hpp>
+
+using namespace uw_localization;
+
+FilterEnsemble::FilterEnsemble(NodeMap* map, DepthObstacleGrid* grid, boost::shared_mutex* grid_mutex)
+  : map(map), grid(grid), grid_mutex(grid_mutex)
+{
+}
+
+FilterEnsemble::~FilterEnsemble()
+{
+  stop();
+
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    delete (*it)->localizer;
+    delete *it;
+  }
+  members.clear();
+}
+
+void FilterEnsemble::addMember(const FilterConfig& config, double ess_threshold, int minimum_perceptions)
+{
+  Member* member = new Member();
+  member->config = config;
+  member->ess_threshold = ess_threshold;
+  member->minimum_perceptions = minimum_perceptions;
+  member->number_perceptions = 0;
+  member->running = false;
+  member->localizer = new ParticleLocalization(member->config);
+  members.push_back(member);
+}
+
+void FilterEnsemble::start()
+{
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    Member* member = *it;
+
+    member->localizer->initialize(member->config.particle_number, member->config.init_position, member->config.init_variance, 0.0, 0.0);
+
+    if(member->config.use_slam)
+      member->localizer->init_slam(map);
+  }
+
+  resume();
+}
+
+void FilterEnsemble::resume()
+{
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    Member* member = *it;
+
+    member->running = true;
+    member->thread = boost::thread(boost::bind(&FilterEnsemble::run, this, member));
+  }
+}
+
+void FilterEnsemble::setMap(NodeMap* map, DepthObstacleGrid* grid, Environment* env, const GeometryIndex& index, const MapLayers& layers,
+                            const CompiledMap* compiled_map)
+{
+  this->map = map;
+  this->grid = grid;
+  setEnvironment(env, index, layers, compiled_map);
+
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    //The slam keeps a pointer to the node map, which is deleted after the swap
+    if((*it)->config.use_slam)
+      (*it)->localizer->rebind_slam(map);
+  }
+}
+
+void FilterEnsemble::setEnvironment(Environment* env, const GeometryIndex& index, const MapLayers& layers, const CompiledMap* compiled_map)
+{
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    (*it)->config.env = env;
+    (*it)->localizer->setEnvironment(env, index, layers, compiled_map);
+  }
+}
+
+void FilterEnsemble::stop()
+{
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    {
+      boost::mutex::scoped_lock lock((*it)->mutex);
+      (*it)->running = false;
+    }
+    (*it)->condition.notify_one();
+  }
+
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    if((*it)->thread.joinable())
+      (*it)->thread.join();
+  }
+}
+
+void FilterEnsemble::push(const Job& job)
+{
+  for(std::vector<Member*>::iterator it = members.begin(); it != members.end(); it++){
+    {
+      boost::mutex::scoped_lock lock((*it)->mutex);
+      (*it)->jobs.push_back(job);
+    }
+    (*it)->condition.notify_one();
+  }
+}
+
+void FilterEnsemble::run(Member* member)
+{
+  boost::mutex::scoped_lock lock(member->mutex);
+
+  while(true){
+
+    while(member->running && member->jobs.empty())
+      member->condition.wait(lock);
+
+    if(!member->running)
+      return;
+
+    //Process all queued samples without holding the lock
+    std::deque<Job> jobs;
+    jobs.swap(member->jobs);
+    lock.unlock();
+
+    for(std::deque<Job>::iterator it = jobs.begin(); it != jobs.end(); it++){
+      (*it)(*member);
+    }
+
+    base::samples::RigidBodyState pose = member->localizer->estimate();
+    base::samples::RigidBodyState middle_pose = member->localizer->estimate_middle();
+    bool has_stats = member->localizer->hasStats();
+    Stats stats;
+    if(has_stats)
+      stats = member->localizer->getStats();
+
+    lock.lock();
+    member->pose = pose;
+    member->middle_pose = middle_pose;
+    if(has_stats)
+      member->stats = stats;
+  }
+}
+
+void FilterEnsemble::getEstimates(std::vector<base::samples::RigidBodyState>& poses, std::vector<Stats>& stats, bool avg_position)
+{
+  poses.resize(members.size());
+  stats.resize(members.size());
+
+  for(unsigned i = 0; i < members.size(); i++){
+    boost::mutex::scoped_lock lock(members[i]->mutex);
+    poses[i] = avg_position ? members[i]->middle_pose : members[i]->pose;
+    stats[i] = members[i]->stats;
+  }
+}
+
+void FilterEnsemble::observed(Member& member, double effective_sample_size, bool may_validate)
+{
+  member.number_perceptions++;
+
+  if(member.number_perceptions >= static_cast<unsigned>(member.minimum_perceptions)
+      && effective_sample_size < member.ess_threshold){
+    member.localizer->resample();
+
+    if(may_validate)
+      member.localizer->setParticlesValid();
+
+    member.number_perceptions = 0;
+  }
+}
+
+void FilterEnsemble::pushOrientation(const base::samples::RigidBodyState& rbs)
+{
+  push(boost::bind(&FilterEnsemble::doOrientation, this, _1, rbs));
+}
+
+void FilterEnsemble::pushSpeed(const base::samples::RigidBodyState& rbs)
+{
+  push(boost::bind(&FilterEnsemble::doSpeed, this, _1, rbs));
+}
+
+void FilterEnsemble::pushThrusters(const base::samples::Joints& joints)
+{
+  push(boost::bind(&FilterEnsemble::doThrusters, this, _1, joints));
+}
+
+void FilterEnsemble::pushLaser(const base::samples::LaserScan& scan, double importance, bool may_validate)
+{
+  push(boost::bind(&FilterEnsemble::doLaser, this, _1, scan, importance, may_validate));
+}
+
+void FilterEnsemble::pushObstacles(const sonar_detectors::ObstacleFeatures& features, double importance, bool may_validate)
+{
+  push(boost::bind(&FilterEnsemble::doObstacles, this, _1, features, importance, may_validate));
+}
+
+void FilterEnsemble::pushPoseUpdate(const base::samples::RigidBodyState& rbs, double ratio, bool random_uniform, bool invalidate)
+{
+  push(boost::bind(&FilterEnsemble::doPoseUpdate, this, _1, rbs, ratio, random_uniform, invalidate));
+}
+
+void FilterEnsemble::pushDepth(double depth, bool markov)
+{
+  push(boost::bind(&FilterEnsemble::doDepth, this, _1, depth, markov));
+}
+
+void FilterEnsemble::pushDepth(const DepthProfile& profile, bool markov)
+{
+  push(boost::bind(&FilterEnsemble::doDepthProfile, this, _1, profile, markov));
+}
+
+void FilterEnsemble::pushReset(double yaw)
+{
+  push(boost::bind(&FilterEnsemble::doReset, this, _1, yaw));
+}
+
+void FilterEnsemble::doOrientation(Member& member, const base::samples::RigidBodyState& rbs)
+{
+  member.localizer->setCurrentOrientation(rbs);
+  member.localizer->setCurrentAngularVelocity(rbs);
+  member.localizer->setCurrentZVelocity(rbs);
+  member.localizer->setCurrentDepth(rbs);
+}
+
+void FilterEnsemble::doSpeed(Member& member, const base::samples::RigidBodyState& rbs)
+{
+  member.localizer->setCurrentVelocity(rbs);
+  member.localizer->update(rbs, *map);
+}
+
+void FilterEnsemble::doThrusters(Member& member, const base::samples::Joints& joints)
+{
+  member.localizer->update_dead_reckoning(joints);
+  member.localizer->update(joints, *map);
+}
+
+void FilterEnsemble::doLaser(Member& member, const base::samples::LaserScan& scan, double importance, bool may_validate)
+{
+  double Neff = member.localizer->observeAndDebug(scan, *map, importance);
+  observed(member, Neff, may_validate);
+}
+
+void FilterEnsemble::doObstacles(Member& member, const sonar_detectors::ObstacleFeatures& features, double importance, bool may_validate)
+{
+  double Neff = member.localizer->observeAndDebug(features, *map, importance);
+  observed(member, Neff, may_validate);
+}
+
+void FilterEnsemble::doPoseUpdate(Member& member, const base::samples::RigidBodyState& rbs, double ratio, bool random_uniform, bool invalidate)
+{
+  member.localizer->interspersal(rbs, *map, ratio, random_uniform, invalidate);
+  member.number_perceptions = 0;
+}
+
+void FilterEnsemble::doDepth(Member& member, double depth, bool markov)
+{
+  //The grid is shared with the task, which may update it concurrently
+  boost::shared_lock<boost::shared_mutex> lock(*grid_mutex);
+
+  if(markov)
+    member.localizer->observe_markov(depth, *grid, 1.0);
+  else
+    member.localizer->observe(depth, *grid, 1.0);
+}
+
+void FilterEnsemble::doDepthProfile(Member& member, const DepthProfile& profile, bool markov)
+{
+  boost::shared_lock<boost::shared_mutex> lock(*grid_mutex);
+
+  if(markov)
+    member.localizer->observe_markov(profile, *grid, 1.0);
+  else
+    member.localizer->observe(profile, *grid, 1.0);
+}
+
+void FilterEnsemble::doReset(Member& member, double yaw)
+{
+  member.localizer->initialize(member.config.particle_number, member.config.init_position, map->getLimitations(), yaw, 0.0);
+  member.number_perceptions = 0;
+}
@@ -0,0 +1,150 @@
+/* ----------------------------------------------------------------------------
+ * FilterEnsemble.hpp
+ * Parallel ensemble of particle filters with different configurations
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_FILTER_ENSEMBLE_HPP
+#define UW_PARTICLE_LOCALIZATION_FILTER_ENSEMBLE_HPP
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <base/samples/rigid_body_state.h>
+#include <base/samples/Joints.hpp>
+#include <base/samples/laser_scan.h>
+#include <sonar_detectors/SonarDetectorTypes.hpp>
+#include "LocalizationConfig.hpp"
+#include "Types.hpp"
+#include "DepthProfile.hpp"
+
+namespace uw_localization {
+
+class ParticleLocalization;
+class NodeMap;
+class DepthObstacleGrid;
+class GeometryIndex;
+struct MapLayers;
+class CompiledMap;
+
+/**
+ * Runs several independent ParticleLocalization instances, each with its own
+ * FilterConfig, on dedicated worker threads.
+ * All members share the same read-only NodeMap and DepthObstacleGrid and are fed
+ * with the same input samples. Writes to the grid have to be guarded by the
+ * grid mutex given at construction.
+ */
+class FilterEnsemble {
+public:
+  FilterEnsemble(NodeMap* map, DepthObstacleGrid* grid, boost::shared_mutex* grid_mutex);
+  ~FilterEnsemble();
+
+  /**
+   * Adds a new member. Has to be called before start()
+   * @param config: filter configuration of the member
+   * @param ess_threshold: effective sample size threshold for resampling
+   * @param minimum_perceptions: minimum number of perceptions before resampling
+   */
+  void addMember(const FilterConfig& config, double ess_threshold, int minimum_perceptions);
+
+  /**
+   * Initializes all particle sets and starts the worker threads
+   */
+  void start();
+
+  /**
+   * Stops and joins all worker threads. Queued samples are kept
+   */
+  void stop();
+
+  /**
+   * Restarts the worker threads after stop(), the particle sets are kept
+   */
+  void resume();
+
+  /**
+   * Replaces the map of all members. The members have to be stopped.
+   * Members with slam drop their features and map into a new grid
+   * @param env: environment of the map, which has to outlive the ensemble
+   * @param index: geometry index of env
+   * @param layers: the resolved layers of the map
+   * @param compiled_map: the compiled map of the initial depths or 0, which has to outlive the ensemble
+   */
+  void setMap(NodeMap* map, DepthObstacleGrid* grid, Environment* env, const GeometryIndex& index, const MapLayers& layers,
+              const CompiledMap* compiled_map);
+
+  /**
+   * Hands the environment of the current map, its geometry index, its layers and its compiled map to all members
+   */
+  void setEnvironment(Environment* env, const GeometryIndex& index, const MapLayers& layers, const CompiledMap* compiled_map);
+
+  size_t size() const { return members.size(); }
+
+  void pushOrientation(const base::samples::RigidBodyState& rbs);
+  void pushSpeed(const base::samples::RigidBodyState& rbs);
+  void pushThrusters(const base::samples::Joints& joints);
+  void pushLaser(const base::samples::LaserScan& scan, double importance, bool may_validate);
+  void pushObstacles(const sonar_detectors::ObstacleFeatures& features, double importance, bool may_validate);
+  void pushPoseUpdate(const base::samples::RigidBodyState& rbs, double ratio, bool random_uniform, bool invalidate);
+  void pushDepth(double depth, bool markov);
+  void pushDepth(const DepthProfile& profile, bool markov);
+  void pushReset(double yaw);
+
+  /**
+   * Copies the latest estimate and statistic of every member
+   * @param poses: pose estimates, in the order the members were added
+   * @param stats: statistics, in the order the members were added
+   * @param avg_position: use the average particle position instead of the best particle
+   */
+  void getEstimates(std::vector<base::samples::RigidBodyState>& poses, std::vector<Stats>& stats, bool avg_position);
+
+private:
+  struct Member;
+  typedef boost::function<void (Member&)> Job;
+
+  struct Member {
+    ParticleLocalization* localizer;
+    FilterConfig config;
+    double ess_threshold;
+    int minimum_perceptions;
+    unsigned number_perceptions;
+
+    boost::thread thread;
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    std::deque<Job> jobs;
+    bool running;
+
+    base::samples::RigidBodyState pose;
+    base::samples::RigidBodyState middle_pose;
+    Stats stats;
+  };
+
+  NodeMap* map;
+  DepthObstacleGrid* grid;
+  boost::shared_mutex* grid_mutex;
+  std::vector<Member*> members;
+
+  void push(const Job& job);
+  void run(Member* member);
+  void observed(Member& member, double effective_sample_size, bool may_validate);
+
+  void doOrientation(Member& member, const base::samples::RigidBodyState& rbs);
+  void doSpeed(Member& member, const base::samples::RigidBodyState& rbs);
+  void doThrusters(Member& member, const base::samples::Joints& joints);
+  void doLaser(Member& member, const base::samples::LaserScan& scan, double importance, bool may_validate);
+  void doObstacles(Member& member, const sonar_detectors::ObstacleFeatures& features, double importance, bool may_validate);
+  void doPoseUpdate(Member& member, const base::samples::RigidBodyState& rbs, double ratio, bool random_uniform, bool invalidate);
+  void doDepth(Member& member, double depth, bool markov);
+  void doDepthProfile(Member& member, const DepthProfile& profile, bool markov);
+  void doReset(Member& member, double yaw);
+};
+
+}
+
+#endif
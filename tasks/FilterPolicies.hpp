@@ -0,0 +1,71 @@
+/* ----------------------------------------------------------------------------
+ * FilterPolicies.hpp
+ * Compile time flags of the specialized filter kernels
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_FILTER_POLICIES_HPP
+#define UW_PARTICLE_LOCALIZATION_FILTER_POLICIES_HPP
+
+namespace uw_localization {
+
+/**
+ * Motion of the particles
+ * @param PureRandom: the particles are only moved by the motion noise (pure_random_motion)
+ * @param Advanced: the velocity is predicted by the dynamic model (advanced_motion_model)
+ * @param Cached: the dynamic model is replaced by its cached linearizations (dynamics_cache)
+ */
+template<bool PureRandom, bool Advanced, bool Cached>
+struct MotionPolicy {
+  static const bool pure_random = PureRandom;
+  static const bool advanced = Advanced;
+  static const bool cached = Cached;
+};
+
+/**
+ * Weighting of the particles by an observation
+ * @param Markov: the weight only depends on the last observation (use_markov)
+ */
+template<bool Markov>
+struct ObservationPolicy {
+  static const bool markov = Markov;
+};
+
+/**
+ * Rating of sonar features
+ * @param Slam: the features are observed by the particle maps (use_slam)
+ * @param MappingOnly: the particle maps are built, but the particles are rated
+ *                     with the static map (use_mapping_only)
+ * @param BestFeatureOnly: only the best modeled feature of a beam is rated (use_best_feature_only)
+ */
+template<bool Slam, bool MappingOnly, bool BestFeatureOnly>
+struct SonarPolicy {
+  static const bool slam = Slam;
+  static const bool mapping_only = MappingOnly;
+  static const bool best_feature_only = BestFeatureOnly;
+};
+
+/**
+ * Rating of echosounder depths
+ * @param SlamDepthMap: every particle has its own depth map (use_slam without single_depth_map)
+ * @param InitialDepthMap: the particles are rated with the initial depth map
+ *                         (use_initial_depthmap without use_slam)
+ */
+template<bool SlamDepthMap, bool InitialDepthMap>
+struct DepthPolicy {
+  static const bool slam_depth_map = SlamDepthMap;
+  static const bool initial_depth_map = InitialDepthMap;
+};
+
+/**
+ * Rating of gps positions
+ * @param UseMap: particles outside of the map are rated with zero (useMap)
+ */
+template<bool UseMap>
+struct GpsPolicy {
+  static const bool use_map = UseMap;
+};
+
+}
+
+#endif
@@ -8,9 +8,15 @@
 #ifndef UW_LOCALIZATION__FIR_HPP
 #define UW_LOCALIZATION__FIR_HPP
 
+#include <vector>
+#include <list>
+#include <cmath>
+#include <boost/circular_buffer.hpp>
+#include <Eigen/Core>
+
 namespace uw_localization {
 
-std::vector<double> MovingAverage(unsigned window_size) {
+inline std::vector<double> MovingAverage(unsigned window_size) {
     std::vector<double> weights;
 
     for(unsigned i = 0; i < window_size; i++)
@@ -34,6 +40,268 @@ T Fir(const std::vector<double>& w, const std::list<T>& samples) {
     return result;
 }
 
+/**
+ * Zero value and element-wise square of the sample types of the streaming filters
+ */
+template<typename T>
+struct FilterTraits {
+    static T zero() { return T(0); }
+    static T square(const T& x) { return x * x; }
+    static T clampPositive(const T& x) { return x < T(0) ? T(0) : x; }
+};
+
+template<typename S, int R, int C, int O, int MR, int MC>
+struct FilterTraits< Eigen::Matrix<S, R, C, O, MR, MC> > {
+    typedef Eigen::Matrix<S, R, C, O, MR, MC> Type;
+    static Type zero() { return Type::Zero(); }
+    static Type square(const Type& x) { return x.cwiseProduct(x); }
+    static Type clampPositive(const Type& x) { return x.cwiseMax(S(0)); }
+};
+
+/**
+ * Dot product of weights and contiguous samples
+ */
+template<typename T>
+T dot(const double* weights, const T* samples, size_t size) {
+    T result = FilterTraits<T>::zero();
+
+    for(size_t i = 0; i < size; i++)
+        result += weights[i] * samples[i];
+
+    return result;
+}
+
+inline double dot(const double* weights, const double* samples, size_t size) {
+    return Eigen::Map<const Eigen::VectorXd>(weights, size).dot(Eigen::Map<const Eigen::VectorXd>(samples, size));
+}
+
+/**
+ * Streaming FIR filter. The samples are stored twice in a ring buffer, so the
+ * window is always contiguous in memory and the output is a vectorized dot
+ * product without copying the window.
+ * Like Fir(), the first weight belongs to the oldest sample.
+ */
+template<typename T>
+class FirFilter {
+public:
+    FirFilter(const std::vector<double>& weights)
+        : weights(weights), buffer(2 * weights.size(), FilterTraits<T>::zero()), position(0), count(0) {}
+
+    size_t size() const { return count; }
+    size_t window() const { return weights.size(); }
+    bool full() const { return count == weights.size(); }
+
+    void clear() {
+        position = 0;
+        count = 0;
+    }
+
+    /**
+     * Adds a sample. If the window is full, the oldest sample is removed
+     */
+    void push(const T& sample) {
+        size_t n = weights.size();
+
+        if(n == 0)
+            return;
+
+        buffer[position] = sample;
+        buffer[position + n] = sample;
+        position = (position + 1) % n;
+
+        if(count < n)
+            count++;
+    }
+
+    /**
+     * @return: the filtered value. Before the window is full, only the
+     *   last weights are applied to the available samples
+     */
+    T value() const {
+        size_t n = weights.size();
+
+        if(count == 0)
+            return FilterTraits<T>::zero();
+
+        //The oldest sample of a full window is at the write position
+        const T* window = &buffer[position + n - count];
+        return dot(&weights[n - count], window, count);
+    }
+
+private:
+    std::vector<double> weights;
+    std::vector<T> buffer;
+    size_t position;
+    size_t count;
+};
+
+/**
+ * Mean and variance of the last samples in O(1) per sample.
+ * The running sums are recomputed from the window once per window length,
+ * so rounding errors do not accumulate.
+ */
+template<typename T>
+class MovingVariance {
+public:
+    MovingVariance(size_t window_size)
+        : samples(window_size > 0 ? window_size : 1), pushes(0) {
+        clear();
+    }
+
+    size_t size() const { return samples.size(); }
+    size_t window() const { return samples.capacity(); }
+    bool full() const { return samples.full(); }
+    bool empty() const { return samples.empty(); }
+
+    void clear() {
+        samples.clear();
+        sum_value = FilterTraits<T>::zero();
+        sum_square = FilterTraits<T>::zero();
+        pushes = 0;
+    }
+
+    /**
+     * Adds a sample. If the window is full, the oldest sample is removed
+     */
+    void push(const T& sample) {
+        if(samples.full()) {
+            sum_value -= samples.front();
+            sum_square -= FilterTraits<T>::square(samples.front());
+        }
+
+        samples.push_back(sample);
+        sum_value += sample;
+        sum_square += FilterTraits<T>::square(sample);
+
+        if(++pushes >= samples.capacity())
+            recompute();
+    }
+
+    /**
+     * @return: sum of the samples in the window
+     */
+    const T& sum() const { return sum_value; }
+
+    /**
+     * @return: mean of the samples in the window, or zero if it is empty
+     */
+    T mean() const {
+        if(samples.empty())
+            return FilterTraits<T>::zero();
+
+        return sum_value / static_cast<double>(samples.size());
+    }
+
+    /**
+     * @return: population variance of the samples in the window
+     */
+    T variance() const {
+        if(samples.empty())
+            return FilterTraits<T>::zero();
+
+        double n = samples.size();
+        T m = sum_value / n;
+        return FilterTraits<T>::clampPositive(sum_square / n - FilterTraits<T>::square(m));
+    }
+
+private:
+    boost::circular_buffer<T> samples;
+    T sum_value;
+    T sum_square;
+    size_t pushes;
+
+    void recompute() {
+        sum_value = FilterTraits<T>::zero();
+        sum_square = FilterTraits<T>::zero();
+
+        for(typename boost::circular_buffer<T>::const_iterator it = samples.begin(); it != samples.end(); it++) {
+            sum_value += *it;
+            sum_square += FilterTraits<T>::square(*it);
+        }
+
+        pushes = 0;
+    }
+};
+
+/**
+ * Exponentially weighted mean and variance, for smoothing sensor inputs
+ * without a window
+ */
+template<typename T>
+class ExponentialFilter {
+public:
+    /**
+     * @param alpha: weight of a new sample in (0, 1]
+     */
+    ExponentialFilter(double alpha = 1.0) : alpha(alpha) {
+        clear();
+    }
+
+    /**
+     * @param alpha: weight of a new sample in (0, 1]
+     */
+    void setAlpha(double alpha) { this->alpha = alpha; }
+    double getAlpha() const { return alpha; }
+
+    bool empty() const { return !initialized; }
+
+    void clear() {
+        initialized = false;
+        mean_value = FilterTraits<T>::zero();
+        variance_value = FilterTraits<T>::zero();
+    }
+
+    void push(const T& sample) {
+        if(!initialized) {
+            mean_value = sample;
+            variance_value = FilterTraits<T>::zero();
+            initialized = true;
+            return;
+        }
+
+        T diff = sample - mean_value;
+        mean_value += alpha * diff;
+        variance_value = (1.0 - alpha) * (variance_value + alpha * FilterTraits<T>::square(diff));
+    }
+
+    const T& mean() const { return mean_value; }
+    const T& variance() const { return variance_value; }
+
+private:
+    double alpha;
+    bool initialized;
+    T mean_value;
+    T variance_value;
+};
+
+/**
+ * Median of the buffered values. For an even number of values, the upper median is returned
+ * @return: the median, or 0.0 if the buffer is empty
+ */
+inline double Median(const boost::circular_buffer<double>& buffer) {
+    if(buffer.empty())
+        return 0.0;
+
+    std::list<double> sorted_list;
+
+    //Sort the buffered values
+    for(boost::circular_buffer<double>::const_iterator it = buffer.begin(); it != buffer.end(); it++) {
+        std::list<double>::iterator jt = sorted_list.begin();
+
+        while(jt != sorted_list.end() && *jt < *it)
+            jt++;
+
+        sorted_list.insert(jt, *it);
+    }
+
+    //since there is no random access to lists, iterate to the middle element
+    std::list<double>::iterator jt = sorted_list.begin();
+
+    for(unsigned int i = 0; i < sorted_list.size()/2; i++)
+        jt++;
+
+    return *jt;
+}
 
 }
 
@@ -0,0 +1,395 @@
+#include "GeometryIndex.hpp"
+#include "CircularMedian.hpp"
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+using namespace uw_localization;
+
+namespace {
+
+const int LEAF_SIZE = 4;
+
+/**
+ * Orders primitives by the center of their bounds along one axis
+ */
+template<typename Primitive>
+struct CenterLess {
+  int axis;
+
+  CenterLess(int axis) : axis(axis) {}
+
+  bool operator()(const Primitive& a, const Primitive& b) const {
+    return a.lower()[axis] + a.upper()[axis] < b.lower()[axis] + b.upper()[axis];
+  }
+};
+
+base::Vector2d closestPoint(const base::Vector2d& start, const base::Vector2d& end, const base::Vector2d& point)
+{
+  base::Vector2d segment = end - start;
+  double length = segment.squaredNorm();
+
+  if(length <= 0.0)
+    return start;
+
+  double t = std::max(0.0, std::min(1.0, (point - start).dot(segment) / length));
+  return start + t * segment;
+}
+
+
+}
+
+GeometryIndex::GeometryIndex()
+  : boxes_indexed(false), world_indexed(false),
+    world_min(base::Vector3d::Constant(-INFINITY)), world_max(base::Vector3d::Constant(INFINITY))
+{
+}
+
+void GeometryIndex::clear()
+{
+  segments.clear();
+  nodes.clear();
+  boxes.clear();
+  box_nodes.clear();
+  boxes_indexed = false;
+  world_indexed = false;
+  world_min = base::Vector3d::Constant(-INFINITY);
+  world_max = base::Vector3d::Constant(INFINITY);
+}
+
+void GeometryIndex::build(const Environment& env)
+{
+  clear();
+  segments.reserve(env.planes.size());
+
+  for(unsigned int i = 0; i < env.planes.size(); i++){
+    const Plane& plane = env.planes[i];
+    Segment segment;
+    segment.start = base::Vector2d(plane.position.x(), plane.position.y());
+    segment.end = segment.start + base::Vector2d(plane.span_horizontal.x(), plane.span_horizontal.y());
+    segment.z_min = plane.position.z() + std::min(0.0, plane.span_vertical.z());
+    segment.z_max = plane.position.z() + std::max(0.0, plane.span_vertical.z());
+    segment.plane = i;
+    segments.push_back(segment);
+  }
+
+  if(segments.empty())
+    return;
+
+  nodes.reserve(2 * segments.size() / LEAF_SIZE + 1);
+  buildNode(segments, nodes, 0, segments.size());
+}
+
+void GeometryIndex::build(const Environment& env, const NodeMap& map, const std::vector<GeometryBox>& map_boxes)
+{
+  build(env);
+
+  world_min = -map.getTranslation();
+  world_max = world_min + map.getLimitations();
+  world_indexed = true;
+
+  boxes.reserve(map_boxes.size());
+
+  for(unsigned int i = 0; i < map_boxes.size(); i++){
+    Box box;
+    box.bounds = map_boxes[i];
+    box.box = i;
+    boxes.push_back(box);
+  }
+
+  if(!boxes.empty()){
+    box_nodes.reserve(2 * boxes.size() / LEAF_SIZE + 1);
+    buildNode(boxes, box_nodes, 0, boxes.size());
+  }
+
+  boxes_indexed = true;
+}
+
+template<typename Primitive>
+int GeometryIndex::buildNode(std::vector<Primitive>& primitives, std::vector<TreeNode>& tree, int first, int count)
+{
+  int index = tree.size();
+  tree.push_back(TreeNode());
+
+  base::Vector2d min = primitives[first].lower();
+  base::Vector2d max = primitives[first].upper();
+
+  for(int i = first + 1; i < first + count; i++){
+    min = min.cwiseMin(primitives[i].lower());
+    max = max.cwiseMax(primitives[i].upper());
+  }
+
+  int left = -1;
+  int right = -1;
+
+  if(count > LEAF_SIZE){
+    //Median split along the longest side
+    int axis = (max.x() - min.x()) >= (max.y() - min.y()) ? 0 : 1;
+    int half = count / 2;
+
+    std::nth_element(primitives.begin() + first, primitives.begin() + first + half,
+                     primitives.begin() + first + count, CenterLess<Primitive>(axis));
+
+    left = buildNode(primitives, tree, first, half);
+    right = buildNode(primitives, tree, first + half, count - half);
+  }
+
+  TreeNode& node = tree[index];
+  node.min = min;
+  node.max = max;
+  node.left = left;
+  node.right = right;
+  node.first = first;
+  node.count = count;
+  return index;
+}
+
+GeometryHit GeometryIndex::nearest(const base::Vector3d& point, double max_distance) const
+{
+  GeometryHit hit;
+  hit.distance = max_distance;
+
+  if(!nodes.empty())
+    nearest(0, point, hit);
+
+  return hit;
+}
+
+void GeometryIndex::nearest(int index, const base::Vector3d& point, GeometryHit& hit) const
+{
+  const TreeNode& node = nodes[index];
+  base::Vector2d point2d = point.head<2>();
+
+  //The horizontal distance is a lower bound of the distance
+  if(boxDistance(node, point2d) >= hit.distance)
+    return;
+
+  if(node.left < 0){
+    for(int i = node.first; i < node.first + node.count; i++){
+      base::Vector2d closest = closestPoint(segments[i].start, segments[i].end, point2d);
+      base::Vector3d closest3d(closest.x(), closest.y(), std::max(segments[i].z_min, std::min(segments[i].z_max, point.z())));
+      double distance = (closest3d - point).norm();
+
+      if(distance < hit.distance){
+        hit.distance = distance;
+        hit.point = closest3d;
+        hit.primitive = segments[i].plane;
+      }
+    }
+    return;
+  }
+
+  //The nearer child first, so the other one is pruned more often
+  int first = node.left;
+  int second = node.right;
+
+  if(boxDistance(nodes[second], point2d) < boxDistance(nodes[first], point2d))
+    std::swap(first, second);
+
+  nearest(first, point, hit);
+  nearest(second, point, hit);
+}
+
+GeometryHit GeometryIndex::raycast(const base::Vector3d& origin, const base::Vector2d& direction, double max_distance) const
+{
+  GeometryHit hit;
+  hit.distance = max_distance;
+
+  double length = direction.norm();
+
+  if(!nodes.empty() && length > 0.0)
+    raycast(0, origin, direction / length, hit);
+
+  return hit;
+}
+
+void GeometryIndex::raycast(int index, const base::Vector3d& origin, const base::Vector2d& direction, GeometryHit& hit) const
+{
+  const TreeNode& node = nodes[index];
+  base::Vector2d origin2d = origin.head<2>();
+  double entry, exit;
+
+  if(!rayHitsBox(node.min, node.max, origin2d, direction, hit.distance, entry, exit))
+    return;
+
+  if(node.left < 0){
+    for(int i = node.first; i < node.first + node.count; i++){
+
+      if(origin.z() < segments[i].z_min || origin.z() > segments[i].z_max)
+        continue;
+
+      base::Vector2d segment = segments[i].end - segments[i].start;
+      base::Vector2d offset = segments[i].start - origin2d;
+      double denominator = direction.x() * segment.y() - direction.y() * segment.x();
+
+      //Parallel to the ray
+      if(std::fabs(denominator) < 1e-12)
+        continue;
+
+      double t = (offset.x() * segment.y() - offset.y() * segment.x()) / denominator;
+      double s = (offset.x() * direction.y() - offset.y() * direction.x()) / denominator;
+
+      if(t >= 0.0 && t < hit.distance && s >= 0.0 && s <= 1.0){
+        hit.distance = t;
+        hit.point = base::Vector3d(origin.x() + t * direction.x(), origin.y() + t * direction.y(), origin.z());
+        hit.primitive = segments[i].plane;
+      }
+    }
+    return;
+  }
+
+  raycast(node.left, origin, direction, hit);
+  raycast(node.right, origin, direction, hit);
+}
+
+GeometryHit GeometryIndex::beam(const base::Vector3d& origin, double yaw, double vertical_half_angle, double max_distance) const
+{
+  GeometryHit hit;
+  hit.distance = max_distance;
+
+  if(!box_nodes.empty())
+    beam(0, origin, base::Vector2d(std::cos(yaw), std::sin(yaw)), std::tan(std::fabs(vertical_half_angle)), hit);
+
+  return hit;
+}
+
+void GeometryIndex::beam(int index, const base::Vector3d& origin, const base::Vector2d& direction, double slope, GeometryHit& hit) const
+{
+  const TreeNode& node = box_nodes[index];
+  base::Vector2d origin2d = origin.head<2>();
+  double entry, exit;
+
+  if(!rayHitsBox(node.min, node.max, origin2d, direction, hit.distance, entry, exit))
+    return;
+
+  if(node.left < 0){
+    for(int i = node.first; i < node.first + node.count; i++){
+      if(beamHitsBox(boxes[i].bounds, origin, direction, slope, hit))
+        hit.primitive = boxes[i].box;
+    }
+    return;
+  }
+
+  beam(node.left, origin, direction, slope, hit);
+  beam(node.right, origin, direction, slope, hit);
+}
+
+bool GeometryIndex::beamHitsBox(const GeometryBox& box, const base::Vector3d& origin, const base::Vector2d& direction,
+                                double slope, GeometryHit& hit)
+{
+  double entry, exit;
+
+  if(!rayHitsBox(box.min.head<2>(), box.max.head<2>(), origin.head<2>(), direction, hit.distance, entry, exit))
+    return false;
+
+  //The beam widens vertically, until it reaches a box above or below of it
+  double t = entry;
+
+  if(box.min.z() > origin.z())
+    t = std::max(t, slope > 0.0 ? (box.min.z() - origin.z()) / slope : INFINITY);
+  else if(box.max.z() < origin.z())
+    t = std::max(t, slope > 0.0 ? (origin.z() - box.max.z()) / slope : INFINITY);
+
+  if(t > exit || t >= hit.distance)
+    return false;
+
+  hit.distance = t;
+  hit.point = base::Vector3d(origin.x() + t * direction.x(), origin.y() + t * direction.y(),
+                             std::max(box.min.z(), std::min(box.max.z(), origin.z())));
+  return true;
+}
+
+double GeometryIndex::nearestCornerAngle(const base::Vector2d& point, double angle, double max_angle) const
+{
+  double best = max_angle;
+
+  if(!nodes.empty())
+    nearestCornerAngle(0, point, angle, best);
+
+  return best;
+}
+
+void GeometryIndex::nearestCornerAngle(int index, const base::Vector2d& point, double angle, double& best) const
+{
+  const TreeNode& node = nodes[index];
+
+  if(boxAngle(node, point, angle) >= best)
+    return;
+
+  if(node.left < 0){
+    for(int i = node.first; i < node.first + node.count; i++){
+      base::Vector2d start = segments[i].start - point;
+      base::Vector2d end = segments[i].end - point;
+
+      best = std::min(best, std::fabs(wrapAngle(atan2(start.y(), start.x()) - angle)));
+      best = std::min(best, std::fabs(wrapAngle(atan2(end.y(), end.x()) - angle)));
+    }
+    return;
+  }
+
+  nearestCornerAngle(node.left, point, angle, best);
+  nearestCornerAngle(node.right, point, angle, best);
+}
+
+double GeometryIndex::boxDistance(const TreeNode& node, const base::Vector2d& point)
+{
+  base::Vector2d outside = (node.min - point).cwiseMax(point - node.max).cwiseMax(base::Vector2d::Zero());
+  return outside.norm();
+}
+
+bool GeometryIndex::rayHitsBox(const base::Vector2d& min, const base::Vector2d& max, const base::Vector2d& origin,
+                               const base::Vector2d& direction, double max_distance, double& entry, double& exit)
+{
+  double near = 0.0;
+  double far = max_distance;
+
+  for(int axis = 0; axis < 2; axis++){
+
+    if(std::fabs(direction[axis]) < 1e-12){
+      if(origin[axis] < min[axis] || origin[axis] > max[axis])
+        return false;
+      continue;
+    }
+
+    double t1 = (min[axis] - origin[axis]) / direction[axis];
+    double t2 = (max[axis] - origin[axis]) / direction[axis];
+
+    near = std::max(near, std::min(t1, t2));
+    far = std::min(far, std::max(t1, t2));
+
+    if(near > far)
+      return false;
+  }
+
+  entry = near;
+  exit = far;
+  return true;
+}
+
+double GeometryIndex::boxAngle(const TreeNode& node, const base::Vector2d& point, double angle)
+{
+  //Every direction is possible from inside the box
+  if(point.x() >= node.min.x() && point.x() <= node.max.x() && point.y() >= node.min.y() && point.y() <= node.max.y())
+    return 0.0;
+
+  double low = M_PI;
+  double high = -M_PI;
+  double closest = M_PI;
+
+  for(int i = 0; i < 4; i++){
+    base::Vector2d corner((i & 1) ? node.max.x() : node.min.x(), (i & 2) ? node.max.y() : node.min.y());
+    base::Vector2d offset = corner - point;
+    double diff = wrapAngle(atan2(offset.y(), offset.x()) - angle);
+
+    low = std::min(low, diff);
+    high = std::max(high, diff);
+    closest = std::min(closest, std::fabs(diff));
+  }
+
+  //Seen from outside, a box covers less than half a turn. If the corners lie on both
+  //sides of the direction within this range, the direction passes through the box
+  if(low <= 0.0 && high >= 0.0 && high - low <= M_PI)
+    return 0.0;
+
+  return closest;
+}
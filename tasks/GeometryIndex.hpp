@@ -0,0 +1,196 @@
+/* ----------------------------------------------------------------------------
+ * GeometryIndex.hpp
+ * Bounding volume hierarchy over the walls and boxes of the environment
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_GEOMETRY_INDEX_HPP
+#define UW_PARTICLE_LOCALIZATION_GEOMETRY_INDEX_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <base/eigen.h>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/types/environment.hpp>
+
+namespace uw_localization {
+
+/**
+ * Result of a geometry query
+ */
+struct GeometryHit {
+  /** index of the plane or box, or -1 if nothing was found */
+  int primitive;
+  double distance;
+  base::Vector3d point;
+
+  GeometryHit() : primitive(-1), distance(INFINITY), point(base::Vector3d::Zero()) {}
+};
+
+/**
+ * An axis aligned box of the map
+ */
+struct GeometryBox {
+  base::Vector3d min;
+  base::Vector3d max;
+};
+
+/**
+ * Indexes the planes of an environment as segments in the xy-plane, from
+ * position to position + span_horizontal, which reach from position.z to
+ * position.z + span_vertical.z. The boxes of the map are indexed in a tree
+ * of their own. The trees are axis aligned bounding box trees, which are
+ * built once. Queries descend only into boxes, which can contain a better
+ * result than the current one, so their cost grows logarithmically with the
+ * number of primitives. The queries are exact, there is no discretization.
+ *
+ * The queries replace the node map queries of the layers root.wall and
+ * root.box, and NodeMap::belongsToWorld. The boxes and the world bounds are
+ * only indexed, if the index is built with the node map and its boxes.
+ */
+class GeometryIndex {
+public:
+  GeometryIndex();
+
+  /**
+   * Builds the tree over the planes of the environment
+   */
+  void build(const Environment& env);
+
+  /**
+   * Builds the trees over the planes of the environment and the boxes of
+   * the map, and takes the world bounds from the node map
+   * @param boxes: the boxes of the layer root.box, see MapLayers
+   */
+  void build(const Environment& env, const NodeMap& map, const std::vector<GeometryBox>& boxes);
+
+  void clear();
+  bool empty() const { return segments.empty(); }
+  size_t size() const { return segments.size(); }
+  size_t boxCount() const { return boxes.size(); }
+
+  /**
+   * @return: true, if the boxes of the map are indexed
+   */
+  bool hasBoxes() const { return boxes_indexed; }
+
+  /**
+   * @return: true, if the world bounds of the map are indexed
+   */
+  bool hasWorld() const { return world_indexed; }
+
+  /**
+   * Nearest point of all planes
+   * @param point: query point
+   * @param max_distance: only planes closer than this distance are searched
+   */
+  GeometryHit nearest(const base::Vector3d& point, double max_distance = INFINITY) const;
+
+  /**
+   * First intersection of a horizontal ray with the planes
+   * @param origin: start of the ray, its height has to be within the plane
+   * @param direction: direction of the ray, does not need to be normalized
+   * @param max_distance: maximum length of the ray
+   */
+  GeometryHit raycast(const base::Vector3d& origin, const base::Vector2d& direction, double max_distance = INFINITY) const;
+
+  /**
+   * First box, which is hit by a sonar beam
+   * @param origin: start of the beam
+   * @param yaw: absolute direction of the beam
+   * @param vertical_half_angle: half of the vertical opening angle of the beam
+   * @param max_distance: maximum length of the beam
+   * @return: the horizontal distance to the box and the point, where the beam enters the box
+   */
+  GeometryHit beam(const base::Vector3d& origin, double yaw, double vertical_half_angle, double max_distance = INFINITY) const;
+
+  /**
+   * @return: true, if the point is within the world bounds of the map
+   */
+  bool belongsToWorld(const base::Vector3d& point) const {
+    return point.x() >= world_min.x() && point.y() >= world_min.y() && point.z() >= world_min.z()
+      && point.x() <= world_max.x() && point.y() <= world_max.y() && point.z() <= world_max.z();
+  }
+
+  /**
+   * Smallest angle between a direction and the direction to a plane corner
+   * @param point: the observer
+   * @param angle: the direction as yaw angle
+   * @param max_angle: upper bound of the result
+   * @return: the angle difference in [0, max_angle]
+   */
+  double nearestCornerAngle(const base::Vector2d& point, double angle, double max_angle) const;
+
+  /**
+   * Intersects a sonar beam with a box. The beam widens vertically with its
+   * opening angle, so it hits boxes above or below of it at some distance
+   * @param direction: normalized horizontal direction of the beam
+   * @param slope: tangent of the vertical half opening angle
+   * @param hit: is replaced, if the box is hit before hit.distance. The primitive is not set
+   * @return: true, if the hit was replaced
+   */
+  static bool beamHitsBox(const GeometryBox& box, const base::Vector3d& origin, const base::Vector2d& direction,
+                          double slope, GeometryHit& hit);
+
+private:
+  /** writes and reads the trees of the compiled map */
+  friend class CompiledMap;
+
+  struct Segment {
+    base::Vector2d start;
+    base::Vector2d end;
+    double z_min;
+    double z_max;
+    int plane;
+
+    base::Vector2d lower() const { return start.cwiseMin(end); }
+    base::Vector2d upper() const { return start.cwiseMax(end); }
+  };
+
+  struct TreeNode {
+    base::Vector2d min;
+    base::Vector2d max;
+
+    /** children for inner nodes, a range of primitives for leafs */
+    int left;
+    int right;
+    int first;
+    int count;
+  };
+
+  struct Box {
+    GeometryBox bounds;
+    int box;
+
+    base::Vector2d lower() const { return bounds.min.head<2>(); }
+    base::Vector2d upper() const { return bounds.max.head<2>(); }
+  };
+
+  std::vector<Segment> segments;
+  std::vector<TreeNode> nodes;
+  std::vector<Box> boxes;
+  std::vector<TreeNode> box_nodes;
+
+  bool boxes_indexed;
+  bool world_indexed;
+  base::Vector3d world_min;
+  base::Vector3d world_max;
+
+  template<typename Primitive>
+  static int buildNode(std::vector<Primitive>& primitives, std::vector<TreeNode>& tree, int first, int count);
+
+  void nearest(int node, const base::Vector3d& point, GeometryHit& hit) const;
+  void raycast(int node, const base::Vector3d& origin, const base::Vector2d& direction, GeometryHit& hit) const;
+  void beam(int node, const base::Vector3d& origin, const base::Vector2d& direction, double slope, GeometryHit& hit) const;
+  void nearestCornerAngle(int node, const base::Vector2d& point, double angle, double& best) const;
+
+  static double boxDistance(const TreeNode& node, const base::Vector2d& point);
+  static bool rayHitsBox(const base::Vector2d& min, const base::Vector2d& max, const base::Vector2d& origin,
+                         const base::Vector2d& direction, double max_distance, double& entry, double& exit);
+  static double boxAngle(const TreeNode& node, const base::Vector2d& point, double angle);
+};
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "JointAdapter.hpp"
+
+using namespace uw_localization;
+
+JointAdapter::JointAdapter(size_t size)
+  : size(size), sample_size(0), sample_name_count(0), sample_name_hash(0), resolved(false)
+{
+}
+
+void JointAdapter::setJointNames(const std::vector<std::string>& names)
+{
+  joint_names = names;
+  resolved = false;
+}
+
+const base::samples::Joints& JointAdapter::adapt(const base::samples::Joints& joints)
+{
+  if(!resolved || joints.size() != sample_size || joints.names.size() != sample_name_count
+      || (joints.hasNames() && nameHash(joints.names) != sample_name_hash))
+    resolve(joints);
+
+  adapted.time = joints.time;
+
+  for(unsigned int i = 0; i < indices.size(); i++){
+
+    if(indices[i] >= 0)
+      adapted.elements[i] = joints.elements[indices[i]];
+    else
+      adapted.elements[i] = base::JointState::Raw(0.0);
+  }
+
+  return adapted;
+}
+
+void JointAdapter::resolve(const base::samples::Joints& joints)
+{
+  sample_size = joints.size();
+  sample_name_count = joints.names.size();
+  sample_name_hash = nameHash(joints.names);
+  resolved = true;
+
+  size_t count = sample_size > size ? sample_size : size;
+  indices.assign(count, -1);
+  adapted.resize(count);
+
+  for(unsigned int i = 0; i < count; i++){
+
+    if(i < sample_size)
+      indices[i] = i;
+
+    if(i < joint_names.size() && i < sample_size && joints.hasNames()){
+
+      for(unsigned int k = 0; k < joints.names.size() && k < sample_size; k++){
+
+        if(joints.names[k] == joint_names[i]){
+          indices[i] = k;
+          break;
+        }
+      }
+    }
+
+    if(indices[i] >= 0 && (size_t) indices[i] < joints.names.size())
+      adapted.names[i] = joints.names[indices[i]];
+    else
+      adapted.names[i] = std::string();
+  }
+}
+
+size_t JointAdapter::nameHash(const std::vector<std::string>& names)
+{
+  size_t hash = 2166136261u;
+
+  for(std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); it++){
+
+    for(std::string::const_iterator c = it->begin(); c != it->end(); c++){
+      hash ^= static_cast<unsigned char>(*c);
+      hash *= 16777619u;
+    }
+
+    //Separates the names, so "ab","c" and "a","bc" differ
+    hash ^= 0xff;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
@@ -0,0 +1,67 @@
+/* ----------------------------------------------------------------------------
+ * JointAdapter.hpp
+ * Maps thruster samples to the configured joint order
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_JOINT_ADAPTER_HPP
+#define UW_PARTICLE_LOCALIZATION_JOINT_ADAPTER_HPP
+
+#include <string>
+#include <vector>
+#include <base/samples/Joints.hpp>
+
+namespace uw_localization {
+
+/**
+ * Reorders the elements of thruster samples by the configured joint names.
+ * The index of every joint is resolved once for the names of a sample, and
+ * again only when the size or the names of the samples change. The names are
+ * compared by a hash, which is computed without copying them, samples without
+ * names are not hashed at all. Joints without a matching
+ * name keep their position in the sample. Missing joints are filled up with
+ * zero commands.
+ */
+class JointAdapter {
+public:
+  /**
+   * @param size: minimum number of joints of the adapted samples
+   */
+  JointAdapter(size_t size = 6);
+
+  /**
+   * @param names: joint names in the order of the motion model
+   */
+  void setJointNames(const std::vector<std::string>& names);
+
+  /**
+   * @param joints: thruster sample
+   * @return: the reordered sample. It is valid until the next call
+   */
+  const base::samples::Joints& adapt(const base::samples::Joints& joints);
+
+private:
+  size_t size;
+  std::vector<std::string> joint_names;
+
+  /** size, names and hash of the names of the sample, for which the indices were resolved */
+  size_t sample_size;
+  size_t sample_name_count;
+  size_t sample_name_hash;
+  bool resolved;
+
+  /** index of every adapted joint in the sample, or -1 for a zero command */
+  std::vector<int> indices;
+  base::samples::Joints adapted;
+
+  void resolve(const base::samples::Joints& joints);
+
+  /**
+   * FNV-1a hash over all names
+   */
+  static size_t nameHash(const std::vector<std::string>& names);
+};
+
+}
+
+#endif
@@ -0,0 +1,1000 @@
+#include "LocalizationCore.hpp"
+#include "FeatureFilter.hpp"
+#include "PropertyDefaults.hpp"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+using namespace uw_localization;
+
+VectorPropertyDefaults::VectorPropertyDefaults()
+{
+  sonar_position = base::Vector3d(-0.5, 0.0, 0.0);
+  pipeline_position = base::Vector3d(-0.7, 0.0, -2.0);
+  gps_position = base::Vector3d::Zero();
+  buoy_cam_position = base::Vector3d(0.7, 0.0, 0.0);
+  buoy_cam_rotation = base::Vector3d::Zero();
+  dvl_rotation = base::Vector3d(0.0, 0.0, 0.25 * M_PI);
+
+  param_centerOfGravity = base::Vector3d::Zero();
+  param_centerOfBuoyancy = base::Vector3d::Zero();
+
+  param_linDamp.setZero();
+  param_linDamp(0,0) = 8.203187564;
+  param_linDamp(1,1) = 24.94216;
+  param_linDampNeg = param_linDamp;
+  param_sqDamp.setZero();
+  param_sqDampNeg.setZero();
+
+  double thruster_values[] = {0.000, 0.000, -0.005, -0.005, 0.005, -0.005};
+  param_thrusterCoefficient = std::vector<double>(thruster_values, thruster_values + 6);
+
+  double tcm_values[] = { 0.0, 0.0, -1.0, -1.0, 0.0, 0.0,
+                          0.0, 0.0, 0.0, 0.0, 1.0, -1.0,
+                          1.0, -1.0, 0.0, 0.0, 0.0, 0.0,
+                          0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+                          -0.92, 0.205, 0.0, 0.0, 0.0, 0.0,
+                          0.0, 0.0, -0.17, 0.17, -0.81, 0.04};
+  param_TCM = std::vector<double>(tcm_values, tcm_values + 36);
+
+  std::string names[] = {"right", "left", "dive", "pitch", "strave", "yaw"};
+  joint_names = std::vector<std::string>(names, names + 6);
+}
+
+namespace uw_localization {
+
+void defaultFilterConfig(FilterConfig& config, Environment* env)
+{
+  VectorPropertyDefaults defaults;
+
+  config.particle_number = property_defaults::particle_number;
+  config.perception_history_number = property_defaults::perception_history_number;
+  config.hough_interspersal_ratio = property_defaults::hough_interspersal_ratio;
+  config.effective_sample_size_threshold = property_defaults::effective_sample_size_threshold;
+  config.minimum_perceptions = property_defaults::minimum_perceptions;
+  config.pure_random_motion = property_defaults::pure_random_motion;
+
+  config.init_position = base::Vector3d::Zero();
+  config.init_variance = base::Vector3d::Zero();
+
+  config.utm_relative_angle = property_defaults::utm_relative_angle;
+  config.gps_covarianz = property_defaults::gps_covarianz;
+  config.gps_interspersal_ratio = property_defaults::gps_interspersal_ratio;
+
+  config.use_markov = property_defaults::use_markov;
+  config.avg_particle_position = property_defaults::avg_particle_position;
+  config.use_best_feature_only = property_defaults::use_best_feature_only;
+
+  config.sonar_maximum_distance = property_defaults::sonar_maximum_distance;
+  config.sonar_minimum_distance = property_defaults::sonar_minimum_distance;
+  config.sonar_covariance = property_defaults::sonar_covariance;
+  config.pipeline_covariance = property_defaults::pipeline_covariance;
+  config.buoy_covariance = property_defaults::buoy_covariance;
+
+  config.sonar_vertical_angle = property_defaults::sonar_vertical_angle;
+  config.sonar_covariance_reflection_factor = property_defaults::sonar_covariance_reflection_factor;
+  config.sonar_covariance_corner_factor = property_defaults::sonar_covariance_corner_factor;
+
+  config.static_motion_covariance = Eigen::Matrix3d::Identity();
+  config.static_speed_covariance = Eigen::Matrix3d::Identity();
+
+  config.sonarToAvalon = Eigen::Translation3d(defaults.sonar_position);
+  config.pipelineToAvalon = defaults.pipeline_position;
+  config.gpsToAvalon = defaults.gps_position;
+  config.buoyCamPosition = defaults.buoy_cam_position;
+  config.buoyCamRotation = eulerToQuaternion(defaults.buoy_cam_rotation);
+  config.dvlRotation = eulerToQuaternion(defaults.dvl_rotation);
+
+  config.yaw_offset = property_defaults::orientation_offset;
+  config.useMap = true;
+  config.filterZeros = property_defaults::filter_zeros;
+
+  config.param_length = property_defaults::param_length;
+  config.param_radius = property_defaults::param_radius;
+  config.param_mass = property_defaults::param_mass;
+
+  config.param_thrusterCoefficient = defaults.param_thrusterCoefficient;
+  config.param_linearThrusterCoefficient = std::vector<double>(6, 0.0);
+  config.param_squareThrusterCoefficient = std::vector<double>(6, 0.0);
+  config.param_thrusterVoltage = property_defaults::param_thrusterVoltage;
+  config.param_TCM = defaults.param_TCM;
+
+  config.param_linDamp = defaults.param_linDamp;
+  config.param_linDampNeg = defaults.param_linDampNeg;
+  config.param_sqDamp = defaults.param_sqDamp;
+  config.param_sqDampNeg = defaults.param_sqDampNeg;
+  config.param_centerOfGravity = defaults.param_centerOfGravity;
+  config.param_centerOfBuoyancy = defaults.param_centerOfBuoyancy;
+  config.param_floating = property_defaults::param_floating;
+
+  config.advanced_motion_model = property_defaults::advanced_motion_model;
+  config.max_velocity_drift = property_defaults::max_velocity_drift;
+  config.env = env;
+  config.joint_names = defaults.joint_names;
+
+  config.feature_weight_reduction = property_defaults::feature_weight_reduction;
+  config.feature_observation_range = property_defaults::feature_observation_range;
+  config.feature_observation_minimum_range = property_defaults::feature_observation_minimum_range;
+  config.feature_grid_resolution = property_defaults::feature_grid_resolution;
+  config.feature_filter_threshold = property_defaults::feature_filter_threshold;
+  config.feature_confidence = property_defaults::feature_confidence;
+  config.feature_empty_cell_confidence = property_defaults::feature_empty_cell_confidence;
+  config.feature_confidence_threshold = property_defaults::feature_confidence_threshold;
+  config.feature_output_confidence_threshold = property_defaults::feature_output_confidence_threshold;
+  config.feature_observation_count_threshold = property_defaults::feature_observation_count_threshold;
+  config.echosounder_variance = property_defaults::echosounder_variance;
+  config.use_slam = property_defaults::use_slam;
+  config.use_mapping_only = property_defaults::use_mapping_only;
+  config.single_depth_map = property_defaults::single_depth_map;
+  config.use_initial_depthmap = false;
+}
+
+}
+
+LocalizationCoreConfig::LocalizationCoreConfig()
+  : save_depth_output_map(property_defaults::debug),
+    depth_map_journal_max_size(property_defaults::depth_map_journal_max_size),
+    depth_map_journal_segments(property_defaults::depth_map_journal_segments),
+    sonar_importance(property_defaults::sonar_importance),
+    pipeline_importance(property_defaults::pipeline_importance),
+    gps_importance(property_defaults::gps_importance),
+    minimum_depth(property_defaults::minimum_depth),
+    init_sample_rejection(property_defaults::init_sample_rejection),
+    reset_timeout(property_defaults::reset_timeout),
+    hough_timeout(property_defaults::hough_timeout),
+    hough_timeout_interspersal(property_defaults::hough_timeout_interspersal),
+    speed_samples_timeout(property_defaults::speed_samples_timeout),
+    position_covariance_threshold(property_defaults::position_covariance_threshold),
+    echosounder_batch_window(property_defaults::echosounder_batch_window),
+    echosounder_batch_distance(property_defaults::echosounder_batch_distance),
+    sonar_backlog_latency(property_defaults::sonar_backlog_latency),
+    sonar_drop_latency(property_defaults::sonar_drop_latency),
+    sonar_max_merged_beams(property_defaults::sonar_max_merged_beams),
+    velocity_smoothing(property_defaults::velocity_smoothing),
+    depth_smoothing(property_defaults::depth_smoothing),
+    shared_dead_reckoning(property_defaults::shared_dead_reckoning),
+    dynamics_cache(property_defaults::dynamics_cache),
+    dynamics_cache_velocity_tolerance(property_defaults::dynamics_cache_velocity_tolerance),
+    dynamics_cache_dt_resolution(property_defaults::dynamics_cache_dt_resolution)
+{
+}
+
+LocalizationCore::LocalizationCore()
+  : map(0), grid(0), compiled_map(0), localizer(0), ensemble(0), timing(0), sonar_debug(0),
+    state(FILTER_RUNNING), orientation_received(false), current_depth(0.0), current_ground(-8.0),
+    number_sonar_perceptions(0), number_rejected_samples(0), number_gps_perceptions(0), new_stats(false),
+    position_jump_detected(false), sum_scan(0.0), last_scan_angle(0.0)
+{
+}
+
+LocalizationCore::~LocalizationCore()
+{
+  release();
+}
+
+void LocalizationCore::release()
+{
+  //Beams, which were merged under backlog, are observed before the filter is deleted
+  if(localizer)
+    flush();
+
+  map_loader.stop();
+
+  //Final snapshot of the depth map
+  if(map_journal.isOpen()){
+    map_journal.compact(*grid, core_config.save_depth_output_map ? core_config.yaml_depth_output_map : std::string());
+    map_journal.close();
+  }
+
+  delete ensemble;
+  delete localizer;
+  delete grid;
+  delete map;
+  delete compiled_map;
+
+  ensemble = 0;
+  localizer = 0;
+  grid = 0;
+  map = 0;
+  compiled_map = 0;
+
+  laser_batch.clear();
+  obstacle_batch.clear();
+}
+
+bool LocalizationCore::configure(const FilterConfig& filter_config, const LocalizationCoreConfig& core_config)
+{
+  release();
+
+  this->core_config = core_config;
+  config = filter_config;
+  joint_adapter.setJointNames(config.joint_names);
+
+  if(core_config.yaml_map.empty()){
+    std::cout << "ERROR: No yaml-map given" << std::endl;
+    return false;
+  }
+
+  std::cout << "Setup NodeMap" << std::endl;
+  LoadedMap* loaded = MapLoader::load(mapSource(core_config.yaml_map, core_config.yaml_depth_map, core_config.compiled_map));
+  if(!loaded)
+    return false;
+
+  //The loaded map owns the previous pointers, which are 0
+  takeMap(*loaded);
+  delete loaded;
+
+  config.env = &env;
+  config.useMap = true;
+
+  if(config.init_variance.isZero())
+    config.init_variance = map->getLimitations();
+
+  //The first consumer configures the shared dead reckoning, all others have to use the same motion model
+  if(core_config.shared_dead_reckoning && !DeadReckoning::shared().configureOnce(config)){
+    std::cout << "ERROR: The shared dead reckoning is configured with different motion model parameters" << std::endl;
+    release();
+    return false;
+  }
+
+  setupEnsemble();
+
+  //The filters only index the walls themselves, the boxes, the world bounds and the layers come with the loaded map
+  if(ensemble)
+    ensemble->setEnvironment(&env, geometry_index, map_layers, compiled_map);
+
+  localizer = new ParticleLocalization(config);
+  localizer->setEnvironment(&env, geometry_index, map_layers, compiled_map);
+
+  if(core_config.shared_dead_reckoning)
+    localizer->setDeadReckoning(&DeadReckoning::shared());
+
+  localizer->initialize(config.particle_number, config.init_position, config.init_variance, 0.0, 0.0);
+
+  if(config.use_slam)
+    localizer->init_slam(map);
+
+  localizer->setSonarDebug(sonar_debug);
+  localizer->setTiming(timing);
+
+  if(config.advanced_motion_model && core_config.dynamics_cache){
+    DynamicsCacheConfig cache_config;
+    cache_config.velocity_tolerance = core_config.dynamics_cache_velocity_tolerance;
+    cache_config.dt_resolution = core_config.dynamics_cache_dt_resolution;
+    localizer->enableDynamicsCache(cache_config);
+  }
+
+  setupMapJournal();
+
+  if(ensemble)
+    ensemble->start();
+
+  state = FILTER_RUNNING;
+  orientation_received = false;
+  current_depth = 0.0;
+  current_ground = -8.0;
+  last_pose = base::samples::RigidBodyState();
+
+  last_perception = base::Time();
+  last_motion = base::Time();
+  last_speed_time = base::Time();
+  last_hough = base::Time();
+  last_hough_timeout = base::Time();
+
+  number_sonar_perceptions = 0;
+  number_rejected_samples = 0;
+  number_gps_perceptions = 0;
+  new_stats = false;
+
+  position_jump_detected = false;
+  sum_scan = 0.0;
+  last_scan_angle = 0.0;
+
+  depth_profile.configure(core_config.echosounder_batch_window, core_config.echosounder_batch_distance);
+  depth_profile.clear();
+
+  velocity_filter.setAlpha(core_config.velocity_smoothing);
+  velocity_filter.clear();
+  depth_filter.setAlpha(core_config.depth_smoothing);
+  depth_filter.clear();
+
+  return true;
+}
+
+void LocalizationCore::setTiming(TimingRecorder* timing)
+{
+  this->timing = timing;
+
+  if(localizer)
+    localizer->setTiming(timing);
+}
+
+void LocalizationCore::setSonarDebug(DebugWriter<PointInfo>* debug)
+{
+  sonar_debug = debug;
+
+  if(localizer)
+    localizer->setSonarDebug(debug);
+}
+
+void LocalizationCore::updateConfig(const FilterConfig& filter_config)
+{
+  //The environment and the initial depth map belong to the current map
+  Environment* current_env = config.env;
+  bool use_initial_depthmap = config.use_initial_depthmap;
+
+  config = filter_config;
+  config.env = current_env;
+  config.use_initial_depthmap = use_initial_depthmap;
+
+  localizer->updateConfig(config);
+
+  //The ensemble members read the grid
+  boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+  grid->initThresholds(config.feature_confidence_threshold, config.feature_observation_count_threshold);
+
+  if(map_journal.isOpen())
+    map_journal.recordThresholds(config.feature_confidence_threshold, config.feature_observation_count_threshold);
+}
+
+void LocalizationCore::setOrientation(const base::samples::RigidBodyState& rbs)
+{
+  ScopedTiming t(timing, TIMING_ORIENTATION_CALLBACK);
+  orientation_received = true;
+
+  base::samples::RigidBodyState sample = rbs;
+
+  if(depth_filter.getAlpha() < 1.0){
+    depth_filter.push(rbs.position.z());
+    sample.position.z() = depth_filter.mean();
+  }
+
+  localizer->setCurrentOrientation(sample);
+  localizer->setCurrentAngularVelocity(sample);
+  localizer->setCurrentZVelocity(sample);
+  localizer->setCurrentDepth(sample);
+
+  current_depth = sample.position.z();
+
+  if(ensemble)
+    ensemble->pushOrientation(sample);
+
+  //Without perceptions the particles can not be trusted anymore
+  if(!last_perception.isNull() && (rbs.time - last_perception).toSeconds() > core_config.reset_timeout){
+    reset(base::getYaw(rbs.orientation));
+    last_perception = rbs.time;
+  }
+}
+
+void LocalizationCore::addSpeed(const base::samples::RigidBodyState& rbs)
+{
+  ScopedTiming t(timing, TIMING_SPEED_CALLBACK);
+
+  if(!base::samples::RigidBodyState::isValidValue(rbs.velocity))
+    return;
+
+  base::samples::RigidBodyState sample = rbs;
+  sample.velocity = config.dvlRotation * rbs.velocity;
+
+  if(velocity_filter.getAlpha() < 1.0){
+    velocity_filter.push(sample.velocity);
+    sample.velocity = velocity_filter.mean();
+  }
+
+  localizer->setCurrentVelocity(sample);
+
+  if(orientation_received){
+    ScopedTiming t_dynamic(timing, TIMING_DYNAMIC);
+    localizer->update(sample, *map);
+
+    if(ensemble)
+      ensemble->pushSpeed(sample);
+  }
+  else{
+    state = FILTER_NO_ORIENTATION;
+  }
+
+  last_speed_time = rbs.time;
+  last_motion = rbs.time;
+}
+
+void LocalizationCore::addThrusters(const base::samples::Joints& joints)
+{
+  ScopedTiming t(timing, TIMING_THRUSTER_CALLBACK);
+
+  //Thrusters are only used, if there is no dvl
+  if(!last_speed_time.isNull() && joints.time.toSeconds() - last_speed_time.toSeconds() <= core_config.speed_samples_timeout)
+    return;
+
+  const base::samples::Joints& j = joint_adapter.adapt(joints);
+  last_motion = joints.time;
+
+  if(!orientation_received){
+    state = FILTER_NO_ORIENTATION;
+    return;
+  }
+
+  if(!localizer->update_dead_reckoning(j) && localizer->getDeadReckoning().getError() == DEAD_RECKONING_INVALID_VALUES)
+    state = FILTER_INVALID_VALUES;
+
+  {
+    ScopedTiming t_dynamic(timing, TIMING_DYNAMIC);
+    localizer->update(j, *map);
+  }
+
+  if(ensemble)
+    ensemble->pushThrusters(j);
+}
+
+double LocalizationCore::addLaser(const base::samples::LaserScan& scan, double latency)
+{
+  ScopedTiming t(timing, TIMING_LASER_CALLBACK);
+
+  //A scan with several ranges covers a sector
+  trackScan(scan.start_angle, scan.ranges.empty() ? 0.0 : (scan.ranges.size() - 1) * scan.angular_resolution);
+
+  if(!perceptionStateMachine(scan.time))
+    return INFINITY;
+
+  if(ensemble)
+    ensemble->pushLaser(scan, core_config.sonar_importance, !position_jump_detected || sum_scan >= M_PI);
+
+  BacklogState backlog = backlogState(latency);
+
+  if(backlog == BACKLOG_DROP){
+    localizer->countDroppedBeams(1);
+    return INFINITY;
+  }
+
+  laser_batch.push_back(scan);
+  return observeSonar(backlog, laser_batch.size());
+}
+
+double LocalizationCore::addObstacles(const sonar_detectors::ObstacleFeatures& features, double latency, bool observe)
+{
+  ScopedTiming t(timing, TIMING_OBSTACLE_CALLBACK);
+
+  filtered_obstacles = features;
+
+  FeatureFilterConfig filter_config;
+  filter_config.sonar_vertical_angle = config.sonar_vertical_angle;
+  filter_config.sonar_minimum_distance = config.sonar_minimum_distance;
+  filter_config.sonar_maximum_distance = config.sonar_maximum_distance;
+  filter_config.feature_filter_threshold = config.feature_filter_threshold;
+  filterObstacleFeatures(filtered_obstacles, filter_config, current_depth, current_ground);
+
+  trackScan(filtered_obstacles.angle, 0.0);
+
+  double Neff = INFINITY;
+
+  if(observe){
+
+    if(!perceptionStateMachine(features.time))
+      return INFINITY;
+
+    if(ensemble)
+      ensemble->pushObstacles(filtered_obstacles, core_config.sonar_importance, !position_jump_detected || sum_scan >= M_PI);
+
+    BacklogState backlog = backlogState(latency);
+
+    //The beam is too old for the current pose, so it is neither observed nor mapped
+    if(backlog == BACKLOG_DROP){
+      localizer->countDroppedBeams(1);
+      return INFINITY;
+    }
+
+    obstacle_batch.push_back(filtered_obstacles);
+    Neff = observeSonar(backlog, obstacle_batch.size());
+  }
+
+  //Without slam, the obstacles are mapped into a single grid
+  if(!config.use_slam && poseIsMappable()){
+    boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+    localizer->setObstacles(filtered_obstacles, *grid, last_pose);
+  }
+
+  return Neff;
+}
+
+void LocalizationCore::addPipeline(const base::Time& ts, const controlData::Pipeline& pipeline)
+{
+  last_perception = ts;
+
+  switch(pipeline.inspection_state) {
+    case controlData::FOUND_PIPE:
+    case controlData::FOLLOW_PIPE:
+    case controlData::END_OF_PIPE:
+    case controlData::ALIGN_AUV:
+      localizer->observe(pipeline, *map, core_config.pipeline_importance);
+      break;
+    default:
+      break;
+  }
+}
+
+void LocalizationCore::addGps(const base::samples::RigidBodyState& rbs)
+{
+  ScopedTiming t(timing, TIMING_GPS_CALLBACK);
+
+  localizer->observeAndDebug(rbs, *map, core_config.gps_importance);
+  number_gps_perceptions++;
+
+  if(number_gps_perceptions >= config.minimum_perceptions){
+    ScopedTiming t_resample(timing, TIMING_RESAMPLE);
+    localizer->resample();
+    localizer->setParticlesValid();
+    number_gps_perceptions = 0;
+  }
+}
+
+void LocalizationCore::addBuoy(const avalon::feature::Buoy& buoy)
+{
+  if(config.use_slam || !poseIsCertain() || buoy.color == avalon::feature::NO_BUOY)
+    return;
+
+  BuoyColor color = UNKNOWN;
+
+  if(buoy.color == avalon::feature::WHITE)
+    color = WHITE;
+  else if(buoy.color == avalon::feature::ORANGE)
+    color = ORANGE;
+
+  base::Vector3d buoy_position = last_pose.position + (last_pose.orientation * config.buoyCamPosition);
+  boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+
+  map_journal.recordBuoy(buoy_position.x(), buoy_position.y(), color, buoy.probability, true);
+
+  if(grid->setBuoy(buoy_position.x(), buoy_position.y(), color, buoy.probability, true)){
+    std::cout << "BOJE!" << "(" << buoy.time.toString() << "," << buoy_position.x() << "," << buoy_position.y()
+      << "," << buoy_position.z() << ",FOUND_BUOY)" << std::endl;
+  }
+}
+
+void LocalizationCore::addStructure()
+{
+  if(config.use_slam || !poseIsCertain())
+    return;
+
+  base::Vector3d structure_position = last_pose.position + (last_pose.orientation * config.buoyCamPosition);
+
+  boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+  grid->setBuoy(structure_position.x(), structure_position.y(), YELLOW, 0.9, true);
+  map_journal.recordBuoy(structure_position.x(), structure_position.y(), YELLOW, 0.9, true);
+}
+
+void LocalizationCore::addEchosounder(const base::samples::RigidBodyState& rbs)
+{
+  ScopedTiming t(timing, TIMING_ECHOSOUNDER_CALLBACK);
+
+  if(rbs.position[2] <= 0.0 || !orientation_received)
+    return;
+
+  double ground = current_depth - rbs.position[2];
+
+  depth_profile.push(rbs.time, last_pose.position, last_pose.cov_position, ground);
+  current_ground = ground;
+
+  if(depth_profile.complete())
+    observeDepthProfile();
+}
+
+void LocalizationCore::addPoseUpdate(const base::samples::RigidBodyState& rbs)
+{
+  ScopedTiming t(timing, TIMING_POSE_UPDATE_CALLBACK);
+  last_hough = rbs.time;
+
+  if(!map->belongsToWorld(rbs.position)){
+    std::cout << "Hough outside of world: " << rbs.position.transpose() << std::endl;
+    return;
+  }
+
+  //There is a jump in the position. we need at least a half scan to validate the new particles!
+  if((last_pose.position - rbs.position).norm() > 3.0){
+    std::cout << "Detected position jump: " << (last_pose.position - rbs.position).norm() << "m" << std::endl;
+    position_jump_detected = true;
+    sum_scan = 0.0;
+  }
+
+  localizer->interspersal(rbs, *map, config.hough_interspersal_ratio, false, position_jump_detected);
+
+  if(ensemble)
+    ensemble->pushPoseUpdate(rbs, config.hough_interspersal_ratio, false, position_jump_detected);
+
+  number_sonar_perceptions = 0;
+}
+
+void LocalizationCore::reset(double yaw)
+{
+  localizer->initialize(config.particle_number, config.init_position, map->getLimitations(), yaw, 0.0);
+
+  if(ensemble)
+    ensemble->pushReset(yaw);
+
+  std::cout << "Initialize" << std::endl;
+  state = FILTER_NO_SONAR;
+}
+
+void LocalizationCore::flush()
+{
+  observeSonarBatches();
+}
+
+bool LocalizationCore::requestMap(const std::string& yaml_map, const std::string& yaml_depth_map, const std::string& compiled_map)
+{
+  if(!localizer){
+    std::cout << "ERROR: Maps can only be swapped, while the filter is running" << std::endl;
+    return false;
+  }
+
+  if(yaml_map.empty()){
+    std::cout << "ERROR: No yaml-map given" << std::endl;
+    return false;
+  }
+
+  if(!map_loader.request(mapSource(yaml_map, yaml_depth_map, compiled_map))){
+    std::cout << "ERROR: Another map is still loading" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool LocalizationCore::swapMap()
+{
+  LoadedMap* loaded = map_loader.take();
+
+  if(!loaded)
+    return false;
+
+  //The members read the map without a lock
+  if(ensemble)
+    ensemble->stop();
+
+  {
+    boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+
+    //The journal belongs to the old depth map, its final state is saved before the swap
+    if(map_journal.isOpen()){
+      map_journal.compact(*grid, core_config.save_depth_output_map ? core_config.yaml_depth_output_map : std::string());
+      map_journal.close();
+      localizer->setMapJournal(0);
+    }
+
+    takeMap(*loaded);
+  }
+
+  localizer->setEnvironment(&env, geometry_index, map_layers, compiled_map);
+
+  //The depth kernel depends on the initial depth map of the new map
+  localizer->updateConfig(config);
+
+  //The slam must not use the old map, which is deleted below
+  if(config.use_slam)
+    localizer->rebind_slam(map);
+
+  if(ensemble){
+    ensemble->setMap(map, grid, &env, geometry_index, map_layers, compiled_map);
+    ensemble->resume();
+  }
+
+  core_config.yaml_map = loaded->source.yaml_map;
+  core_config.yaml_depth_map = loaded->source.yaml_depth_map;
+  core_config.compiled_map = loaded->source.compiled_map;
+
+  setupMapJournal();
+
+  std::cout << "Swapped map to " << loaded->source.yaml_map << std::endl;
+
+  //Deletes the old map and grid
+  delete loaded;
+  return true;
+}
+
+base::samples::RigidBodyState LocalizationCore::estimate()
+{
+  base::samples::RigidBodyState pose = config.avg_particle_position ? localizer->estimate_middle() : localizer->estimate();
+
+  pose.angular_velocity = localizer->dead_reckoning().angular_velocity;
+
+  //Convert velocities to world frame
+  pose.velocity = pose.orientation * pose.velocity;
+
+  //Correct position covariance by a threshold
+  double sigma_square = std::pow(core_config.position_covariance_threshold, 2);
+  for(int i = 0; i < 3; i++){
+
+    if(pose.cov_position(i,i) < sigma_square)
+      pose.cov_position(i,i) = sigma_square;
+  }
+
+  if(!pose.time.isNull())
+    last_pose = pose;
+
+  return pose;
+}
+
+bool LocalizationCore::getEnsembleEstimates(std::vector<base::samples::RigidBodyState>& poses, std::vector<Stats>& stats)
+{
+  if(!ensemble)
+    return false;
+
+  ensemble->getEstimates(poses, stats, config.avg_particle_position);
+
+  for(std::vector<base::samples::RigidBodyState>::iterator it = poses.begin(); it != poses.end(); it++){
+    it->velocity = it->orientation * it->velocity;
+  }
+
+  return true;
+}
+
+bool LocalizationCore::hasStats() const
+{
+  return localizer->hasStats();
+}
+
+Stats LocalizationCore::getStats() const
+{
+  return localizer->getStats();
+}
+
+bool LocalizationCore::takeStats(Stats& stats)
+{
+  if(!new_stats)
+    return false;
+
+  stats = localizer->getStats();
+  new_stats = false;
+  return true;
+}
+
+bool LocalizationCore::perceptionStateMachine(const base::Time& ts)
+{
+  if(!orientation_received){ //Invalid or no orientation
+    state = FILTER_NO_ORIENTATION;
+    return false;
+  }
+
+  if(current_depth >= core_config.minimum_depth){ //Invalid depth
+    state = FILTER_ABOVE_SURFACE;
+    return false;
+  }
+
+  if(last_motion.isNull() || ts.toSeconds() - last_motion.toSeconds() > core_config.reset_timeout){ //Joint timeout
+    state = FILTER_NO_JOINTS_NO_DVL;
+  }
+  else if(last_hough.isNull() || ts.toSeconds() - last_hough.toSeconds() > core_config.hough_timeout){ //Hough timeout
+    state = FILTER_NO_HOUGH;
+
+    //Intersperse random particles after every hough timeout without pose update
+    if(last_hough_timeout.isNull()){
+      last_hough_timeout = ts;
+    }
+    else if(ts.toSeconds() - last_hough_timeout.toSeconds() > core_config.hough_timeout){
+      last_hough_timeout = ts;
+      localizer->interspersal(base::samples::RigidBodyState(), *map, core_config.hough_timeout_interspersal, true, true);
+
+      if(ensemble)
+        ensemble->pushPoseUpdate(base::samples::RigidBodyState(), core_config.hough_timeout_interspersal, true, true);
+    }
+  }
+  else{ //Everything is fine :-)
+    state = FILTER_LOCALIZING;
+  }
+
+  last_perception = ts;
+
+  if(number_rejected_samples < static_cast<unsigned>(core_config.init_sample_rejection)){
+    number_rejected_samples++;
+    return false;
+  }
+
+  return true;
+}
+
+LocalizationCore::BacklogState LocalizationCore::backlogState(double latency) const
+{
+  if(core_config.sonar_drop_latency > 0.0 && latency > core_config.sonar_drop_latency)
+    return BACKLOG_DROP;
+
+  if(core_config.sonar_backlog_latency > 0.0 && latency > core_config.sonar_backlog_latency)
+    return BACKLOG_MERGE;
+
+  return BACKLOG_NONE;
+}
+
+double LocalizationCore::observeSonar(BacklogState backlog, size_t batch_size)
+{
+  //Under backlog, consecutive beams are merged and observed at once
+  if(backlog == BACKLOG_NONE || batch_size >= static_cast<size_t>(core_config.sonar_max_merged_beams))
+    return observeSonarBatches();
+
+  return INFINITY;
+}
+
+double LocalizationCore::observeSonarBatches()
+{
+  if(laser_batch.empty() && obstacle_batch.empty())
+    return INFINITY;
+
+  //Both batches are observed one after another, no pending beam is discarded.
+  //The effective sample size of the last observation covers both weightings
+  double Neff = 0.0;
+  unsigned beams = laser_batch.size() + obstacle_batch.size();
+
+  if(laser_batch.size() == 1)
+    Neff = localizer->observeAndDebug(laser_batch.front(), *map, core_config.sonar_importance);
+  else if(!laser_batch.empty())
+    Neff = localizer->observeAndDebug(laser_batch, *map, core_config.sonar_importance);
+
+  if(obstacle_batch.size() == 1)
+    Neff = localizer->observeAndDebug(obstacle_batch.front(), *map, core_config.sonar_importance);
+  else if(!obstacle_batch.empty())
+    Neff = localizer->observeAndDebug(obstacle_batch, *map, core_config.sonar_importance);
+
+  laser_batch.clear();
+  obstacle_batch.clear();
+  new_stats = localizer->hasStats();
+
+  number_sonar_perceptions += beams;
+
+  //If we had a valid observation and enough observations -> resample
+  if(number_sonar_perceptions >= static_cast<unsigned>(config.minimum_perceptions)
+      && Neff < config.effective_sample_size_threshold){
+    ScopedTiming t_resample(timing, TIMING_RESAMPLE);
+    localizer->resample();
+    validateParticles();
+    number_sonar_perceptions = 0;
+  }
+
+  return Neff;
+}
+
+void LocalizationCore::validateParticles()
+{
+  //If we had detected a position jump, we want at least a half scan to validate the particles
+  if(position_jump_detected && sum_scan < M_PI)
+    return;
+
+  position_jump_detected = false;
+  localizer->setParticlesValid();
+}
+
+void LocalizationCore::trackScan(double start_angle, double sector)
+{
+  double scan_diff = std::fabs(last_scan_angle - start_angle);
+
+  while(scan_diff > M_PI)
+    scan_diff -= 2.0 * M_PI;
+
+  last_scan_angle = start_angle + sector;
+  sum_scan += std::fabs(scan_diff) + std::fabs(sector);
+}
+
+bool LocalizationCore::poseIsMappable() const
+{
+  return !base::isNaN(last_pose.cov_position(0,0)) && !base::isInfinity(last_pose.cov_position(0,0));
+}
+
+bool LocalizationCore::poseIsCertain() const
+{
+  return last_pose.cov_position(0,0) <= core_config.position_covariance_threshold
+    && last_pose.cov_position(1,1) <= core_config.position_covariance_threshold;
+}
+
+void LocalizationCore::observeDepthProfile()
+{
+  if(config.use_markov)
+    localizer->observe_markov(depth_profile, *grid, 1.0);
+  else
+    localizer->observe(depth_profile, *grid, 1.0);
+
+  if(ensemble)
+    ensemble->pushDepth(depth_profile, config.use_markov);
+
+  if(!config.use_slam){
+
+    //One lock for all samples of the profile
+    boost::unique_lock<boost::shared_mutex> lock(grid_mutex);
+    localizer->setDepth(depth_profile, *grid, core_config.position_covariance_threshold);
+  }
+  else if(config.single_depth_map){
+    const std::vector<DepthSample>& samples = depth_profile.samples();
+
+    for(std::vector<DepthSample>::const_iterator it = samples.begin(); it != samples.end(); it++)
+      localizer->observeDepth(it->position, it->cov_position, it->depth);
+  }
+
+  depth_profile.clear();
+}
+
+void LocalizationCore::setupEnsemble()
+{
+  const std::vector<EnsembleMember>& members = core_config.ensemble;
+
+  if(members.empty())
+    return;
+
+  ensemble = new FilterEnsemble(map, grid, &grid_mutex);
+
+  for(std::vector<EnsembleMember>::const_iterator it = members.begin(); it != members.end(); it++){
+
+    FilterConfig member_config = config;
+    double ess_threshold = config.effective_sample_size_threshold;
+    int minimum_perceptions = config.minimum_perceptions;
+
+    if(it->particle_number > 0)
+      member_config.particle_number = it->particle_number;
+    if(it->minimum_perceptions > 0)
+      minimum_perceptions = it->minimum_perceptions;
+    if(it->effective_sample_size_threshold > 0.0)
+      ess_threshold = it->effective_sample_size_threshold;
+    if(it->sonar_covariance > 0.0)
+      member_config.sonar_covariance = it->sonar_covariance;
+    if(it->sonar_covariance_reflection_factor > 0.0)
+      member_config.sonar_covariance_reflection_factor = it->sonar_covariance_reflection_factor;
+    if(it->sonar_covariance_corner_factor > 0.0)
+      member_config.sonar_covariance_corner_factor = it->sonar_covariance_corner_factor;
+    if(it->pipeline_covariance > 0.0)
+      member_config.pipeline_covariance = it->pipeline_covariance;
+    if(it->max_velocity_drift > 0.0)
+      member_config.max_velocity_drift = it->max_velocity_drift;
+    if(it->static_motion_covariance.size() == 9)
+      member_config.static_motion_covariance = convertProperty<Eigen::Matrix3d>(it->static_motion_covariance);
+    if(it->static_speed_covariance.size() == 9)
+      member_config.static_speed_covariance = convertProperty<Eigen::Matrix3d>(it->static_speed_covariance);
+
+    ensemble->addMember(member_config, ess_threshold, minimum_perceptions);
+    std::cout << "Added ensemble member " << it->name << std::endl;
+  }
+}
+
+void LocalizationCore::setupMapJournal()
+{
+  if(core_config.yaml_depth_output_map.empty() || config.use_slam)
+    return;
+
+  MapJournalHeader header;
+  header.yaml_map = core_config.yaml_map;
+  header.yaml_depth_map = config.use_initial_depthmap ? core_config.yaml_depth_map : std::string();
+
+  //The filter reads the initial depths from the compiled map, they are not part of the grid
+  if(compiled_map && config.use_initial_depthmap)
+    header.yaml_depth_map = compiled_map->getHeader().yaml_depth_map;
+  header.resolution = config.feature_grid_resolution;
+  header.min_depth = -8.0;
+  header.max_depth = 0.0;
+  header.depth_resolution = 2.0;
+  header.confidence_threshold = config.feature_confidence_threshold;
+  header.count_threshold = config.feature_observation_count_threshold;
+
+  size_t max_size = core_config.depth_map_journal_max_size > 0.0 ? core_config.depth_map_journal_max_size * 1024.0 * 1024.0 : 0;
+  unsigned segments = core_config.depth_map_journal_segments > 0 ? core_config.depth_map_journal_segments : 0;
+
+  if(map_journal.open(core_config.yaml_depth_output_map + ".journal", header, max_size, segments)){
+    map_journal.setGridHoldsDepthMap(compiled_map == 0);
+    localizer->setMapJournal(&map_journal);
+  }
+}
+
+void LocalizationCore::takeMap(LoadedMap& loaded)
+{
+  std::swap(map, loaded.map);
+  std::swap(grid, loaded.grid);
+  std::swap(compiled_map, loaded.compiled);
+  env = loaded.env;
+  geometry_index = loaded.geometry_index;
+  map_layers = loaded.layers;
+  config.use_initial_depthmap = loaded.use_initial_depthmap;
+}
+
+MapSource LocalizationCore::mapSource(const std::string& yaml_map, const std::string& yaml_depth_map, const std::string& compiled_map) const
+{
+  MapSource source;
+  source.yaml_map = yaml_map;
+  source.yaml_depth_map = yaml_depth_map;
+  source.compiled_map = compiled_map;
+  source.resolution = config.feature_grid_resolution;
+  source.confidence_threshold = config.feature_confidence_threshold;
+  source.count_threshold = config.feature_observation_count_threshold;
+  return source;
+}
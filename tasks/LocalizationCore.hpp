@@ -0,0 +1,418 @@
+/* ----------------------------------------------------------------------------
+ * LocalizationCore.hpp
+ * Particle localization without the orocos task, for tools and simulations
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_LOCALIZATION_CORE_HPP
+#define UW_PARTICLE_LOCALIZATION_LOCALIZATION_CORE_HPP
+
+#include <string>
+#include <vector>
+#include <boost/thread/shared_mutex.hpp>
+#include <base/samples/rigid_body_state.h>
+#include <base/samples/Joints.hpp>
+#include <base/samples/laser_scan.h>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+#include <sonar_detectors/SonarDetectorTypes.hpp>
+#include <offshore_pipeline_detector/pipeline.h>
+#include <visual_detectors/Types.hpp>
+#include "LocalizationConfig.hpp"
+#include "ParticleLocalization.hpp"
+#include "FilterEnsemble.hpp"
+#include "MapLoader.hpp"
+#include "MapJournal.hpp"
+#include "Timing.hpp"
+#include "JointAdapter.hpp"
+#include "Fir.hpp"
+#include "DepthProfile.hpp"
+#include "Types.hpp"
+
+namespace uw_localization {
+
+/**
+ * Defaults of the task properties, which have no default in the orogen file.
+ * The task sets these properties to them, defaultFilterConfig uses them
+ */
+struct VectorPropertyDefaults {
+  VectorPropertyDefaults();
+
+  /** sensor positions in the body frame */
+  base::Vector3d sonar_position;
+  base::Vector3d pipeline_position;
+  base::Vector3d gps_position;
+  base::Vector3d buoy_cam_position;
+
+  /** sensor rotations as euler angles */
+  base::Vector3d buoy_cam_rotation;
+  base::Vector3d dvl_rotation;
+
+  base::Vector3d param_centerOfGravity;
+  base::Vector3d param_centerOfBuoyancy;
+  base::Matrix6d param_linDamp;
+  base::Matrix6d param_sqDamp;
+  base::Matrix6d param_linDampNeg;
+  base::Matrix6d param_sqDampNeg;
+
+  /** constant thruster coefficients, the linear and square coefficients are 0 */
+  std::vector<double> param_thrusterCoefficient;
+  std::vector<double> param_TCM;
+  std::vector<std::string> joint_names;
+};
+
+/**
+ * Fills the config with the default property values of the task
+ * @param config: the configuration
+ * @param env: environment of the map
+ */
+void defaultFilterConfig(FilterConfig& config, Environment* env);
+
+/**
+ * Settings of the sample handling, which are properties of the task.
+ * The defaults are the defaults of the properties
+ */
+struct LocalizationCoreConfig {
+  LocalizationCoreConfig();
+
+  std::string yaml_map;
+
+  /** initial depth map, may be empty */
+  std::string yaml_depth_map;
+
+  /** compiled map, used instead of yaml_depth_map and the geometry of yaml_map if it matches the grid */
+  std::string compiled_map;
+
+  /** all changes of the grid are journaled to <file>.journal, empty or slam disables the journal */
+  std::string yaml_depth_output_map;
+
+  /** true, if the snapshots of the journal are also saved to yaml_depth_output_map */
+  bool save_depth_output_map;
+
+  /** size in megabytes, at which the journal is rotated, and number of kept segments */
+  double depth_map_journal_max_size;
+  int depth_map_journal_segments;
+
+  double sonar_importance;
+  double pipeline_importance;
+  double gps_importance;
+
+  /** perceptions are only observed below this depth, the first init_sample_rejection are dropped */
+  double minimum_depth;
+  int init_sample_rejection;
+
+  /** the particles are reinitialized, if there was no perception for this time in seconds */
+  double reset_timeout;
+
+  /** without pose updates for this time in seconds, hough_timeout_interspersal random particles are interspersed */
+  double hough_timeout;
+  double hough_timeout_interspersal;
+
+  /** thruster samples are only used, if there was no speed sample for this time */
+  double speed_samples_timeout;
+
+  /** lower bound of the position sigma, the grid is only mapped below this sigma */
+  double position_covariance_threshold;
+
+  /** echosounder samples are observed as one profile per window in seconds or traveled distance in meter, 0 disables */
+  double echosounder_batch_window;
+  double echosounder_batch_distance;
+
+  /** sonar beams are merged above this sample latency and dropped above the drop latency, 0 disables */
+  double sonar_backlog_latency;
+  double sonar_drop_latency;
+  int sonar_max_merged_beams;
+
+  /** weight of a new dvl velocity and depth in their exponential smoothing, 1.0 disables it */
+  double velocity_smoothing;
+  double depth_smoothing;
+
+  /** use the dead reckoning, which is shared in the process */
+  bool shared_dead_reckoning;
+
+  /** linearize the advanced motion model, see DynamicsCache */
+  bool dynamics_cache;
+  double dynamics_cache_velocity_tolerance;
+  double dynamics_cache_dt_resolution;
+
+  /** additional filters, which run on the same map and samples */
+  std::vector<EnsembleMember> ensemble;
+};
+
+/**
+ * State of the perception handling, the runtime states of the task
+ */
+enum FilterState {
+  FILTER_RUNNING,
+  FILTER_LOCALIZING,
+  FILTER_NO_ORIENTATION,
+  FILTER_NO_SONAR,
+  FILTER_ABOVE_SURFACE,
+  FILTER_NO_HOUGH,
+  FILTER_NO_JOINTS_NO_DVL,
+  FILTER_INVALID_VALUES
+};
+
+/**
+ * The filter loop of the task: owns the map, the depth-obstacle-grid, the
+ * localizer and the ensemble. Decides, which perceptions are observed,
+ * merges sonar beams under backlog and resamples after enough perceptions.
+ * All methods have to be called from the same thread. The grid is read
+ * by the ensemble and can be read by other threads with the grid mutex.
+ */
+class LocalizationCore {
+public:
+  LocalizationCore();
+  ~LocalizationCore();
+
+  /**
+   * Loads the maps, initializes the particles, starts the ensemble and opens the journal
+   * @param filter_config: configuration of the filter. config.env is set by the core
+   * @param core_config: maps and sample handling
+   * @return: false, if the map could not be loaded or the shared dead reckoning has another motion model
+   */
+  bool configure(const FilterConfig& filter_config, const LocalizationCoreConfig& core_config);
+
+  /**
+   * Stops the ensemble and the map loader, saves the journal and deletes the filter and the map
+   */
+  void release();
+
+  /**
+   * Records the stage timings into the recorder. A null recorder disables timing
+   */
+  void setTiming(TimingRecorder* timing);
+
+  /**
+   * Writes the best sonar perceptions to the debug writer
+   */
+  void setSonarDebug(DebugWriter<PointInfo>* debug);
+
+  /**
+   * Changes the covariances and slam settings of a running filter, and the thresholds of the grid
+   */
+  void updateConfig(const FilterConfig& filter_config);
+
+  void setOrientation(const base::samples::RigidBodyState& rbs);
+  void addSpeed(const base::samples::RigidBodyState& rbs);
+  void addThrusters(const base::samples::Joints& joints);
+
+  /**
+   * @param latency: latency of the sample, see sonar_backlog_latency
+   * @return: the effective sample size, or INFINITY if the beam was not observed yet
+   */
+  double addLaser(const base::samples::LaserScan& scan, double latency = 0.0);
+
+  /**
+   * Filters the features, observes them and maps them into the grid, if slam is not used
+   * @param latency: latency of the sample, see sonar_backlog_latency
+   * @param observe: false, if the laser scans are observed, the features are only mapped then
+   * @return: the effective sample size, or INFINITY if the beam was not observed yet
+   */
+  double addObstacles(const sonar_detectors::ObstacleFeatures& features, double latency = 0.0, bool observe = true);
+
+  void addPipeline(const base::Time& ts, const controlData::Pipeline& pipeline);
+  void addGps(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Maps a detected buoy or structure in front of the buoy camera, if slam is not used
+   */
+  void addBuoy(const avalon::feature::Buoy& buoy);
+  void addStructure();
+
+  /**
+   * Observes the ground distance and maps the depth, if slam is not used
+   * @param rbs: ground distance in position.z
+   */
+  void addEchosounder(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Intersperses particles around an external position fix, see hough_interspersal_ratio
+   */
+  void addPoseUpdate(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Reinitializes the particles over the whole map
+   */
+  void reset(double yaw);
+
+  /**
+   * Observes all merged sonar beams, e.g. after the sample queue was drained
+   */
+  void flush();
+
+  /**
+   * Loads a map in the background, see swapMap
+   * @return: false, if no filter is configured or another map is loading
+   */
+  bool requestMap(const std::string& yaml_map, const std::string& yaml_depth_map, const std::string& compiled_map);
+
+  /**
+   * Replaces the map with a map, which was loaded in the background. The particles are kept.
+   * The slam grid keeps the extent of the first map
+   * @return: true, if the map was swapped. The map files of getCoreConfig() are the new ones
+   */
+  bool swapMap();
+
+  /**
+   * The estimate is the pose, which is used for mapping until the next estimate
+   * @return: the current pose with world frame velocities, like the pose_samples port
+   */
+  base::samples::RigidBodyState estimate();
+
+  /**
+   * @return: the last estimate with a valid time
+   */
+  const base::samples::RigidBodyState& lastPose() const { return last_pose; }
+
+  /**
+   * Copies the estimates of the ensemble members with world frame velocities
+   * @return: false, if there is no ensemble
+   */
+  bool getEnsembleEstimates(std::vector<base::samples::RigidBodyState>& poses, std::vector<Stats>& stats);
+
+  bool hasStats() const;
+  Stats getStats() const;
+
+  /**
+   * @return: true once after every sonar observation, with the stats of the filter
+   */
+  bool takeStats(Stats& stats);
+
+  FilterState getState() const { return state; }
+
+  /**
+   * @return: the features of the last addObstacles, after filtering
+   */
+  const sonar_detectors::ObstacleFeatures& getFilteredObstacles() const { return filtered_obstacles; }
+
+  NodeMap& getMap() { return *map; }
+  DepthObstacleGrid& getGrid() { return *grid; }
+  boost::shared_mutex& getGridMutex() { return grid_mutex; }
+  MapJournal& getJournal() { return map_journal; }
+  ParticleLocalization& getLocalizer() { return *localizer; }
+  const FilterConfig& getConfig() const { return config; }
+  const LocalizationCoreConfig& getCoreConfig() const { return core_config; }
+
+private:
+  FilterConfig config;
+  LocalizationCoreConfig core_config;
+  Environment env;
+  GeometryIndex geometry_index;
+  MapLayers map_layers;
+  NodeMap* map;
+  DepthObstacleGrid* grid;
+  CompiledMap* compiled_map;
+  ParticleLocalization* localizer;
+  FilterEnsemble* ensemble;
+  TimingRecorder* timing;
+  DebugWriter<PointInfo>* sonar_debug;
+  JointAdapter joint_adapter;
+  MapLoader map_loader;
+  MapJournal map_journal;
+
+  /** guards grid, which is read by the ensemble members */
+  boost::shared_mutex grid_mutex;
+
+  ExponentialFilter<base::Vector3d> velocity_filter;
+  ExponentialFilter<double> depth_filter;
+
+  FilterState state;
+  bool orientation_received;
+  double current_depth;
+  double current_ground;
+  base::samples::RigidBodyState last_pose;
+
+  base::Time last_perception;
+  base::Time last_motion;
+  base::Time last_speed_time;
+  base::Time last_hough;
+  base::Time last_hough_timeout;
+
+  unsigned number_sonar_perceptions;
+  unsigned number_rejected_samples;
+  int number_gps_perceptions;
+  bool new_stats;
+
+  /** after a position jump, the particles are only validated after half a scan */
+  bool position_jump_detected;
+  double sum_scan;
+  double last_scan_angle;
+
+  DepthProfile depth_profile;
+  sonar_detectors::ObstacleFeatures filtered_obstacles;
+
+  /** sonar beams, which are merged into one observation under backlog */
+  std::vector<base::samples::LaserScan> laser_batch;
+  std::vector<sonar_detectors::ObstacleFeatures> obstacle_batch;
+
+  enum BacklogState {
+    BACKLOG_NONE,
+    BACKLOG_MERGE,
+    BACKLOG_DROP
+  };
+
+  /**
+   * @param ts: timestamp of the perception
+   * @return: true, if the perception should be observed
+   */
+  bool perceptionStateMachine(const base::Time& ts);
+
+  /**
+   * @return: the handling of a sonar beam with this latency
+   */
+  BacklogState backlogState(double latency) const;
+
+  /**
+   * Queues a sonar beam and observes the queue, unless beams are merged
+   * @return: the effective sample size, or INFINITY if the beam was not observed yet
+   */
+  double observeSonar(BacklogState backlog, size_t batch_size);
+
+  /**
+   * Observes all batched sonar beams with one weighting of the particles and resamples if needed
+   * @return: the effective sample size, or INFINITY if there was no beam
+   */
+  double observeSonarBatches();
+
+  /**
+   * Sets all particles to valid. After a position jump only after at least half a scan
+   */
+  void validateParticles();
+
+  /**
+   * Adds the angle between two sonar beams to the scanned sector
+   */
+  void trackScan(double start_angle, double sector);
+
+  /**
+   * @return: true, if the last pose has a valid position covariance, so obstacles can be mapped with it
+   */
+  bool poseIsMappable() const;
+
+  /**
+   * @return: true, if the horizontal position sigma of the last pose is below position_covariance_threshold
+   */
+  bool poseIsCertain() const;
+
+  /**
+   * @return: the map files with the grid parameters of the config
+   */
+  MapSource mapSource(const std::string& yaml_map, const std::string& yaml_depth_map, const std::string& compiled_map) const;
+
+  void observeDepthProfile();
+  void setupEnsemble();
+  void setupMapJournal();
+
+  /**
+   * Takes the map, grid and geometry of a loaded map, the old ones go to the loaded map
+   */
+  void takeMap(LoadedMap& loaded);
+
+  LocalizationCore(const LocalizationCore&);
+  LocalizationCore& operator=(const LocalizationCore&);
+};
+
+}
+
+#endif
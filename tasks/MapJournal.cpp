@@ -0,0 +1,677 @@
+#include "MapJournal.hpp"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/crc.hpp>
+
+using namespace uw_localization;
+
+namespace {
+
+boost::uint32_t checksum(const char* data, size_t size)
+{
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+template<typename T>
+void put(std::string& buffer, const T& value)
+{
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void putString(std::string& buffer, const std::string& value)
+{
+  put(buffer, static_cast<boost::uint32_t>(value.size()));
+  buffer.append(value);
+}
+
+template<typename T>
+bool get(FILE* file, T& value)
+{
+  return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+bool getString(FILE* file, std::string& value)
+{
+  boost::uint32_t size;
+
+  if(!get(file, size) || size > 4096)
+    return false;
+
+  value.resize(size);
+  return size == 0 || fread(&value[0], 1, size, file) == size;
+}
+
+void encode(const MapJournalRecord& record, char* buffer)
+{
+  buffer[0] = record.operation;
+  buffer[1] = record.flag;
+  buffer[2] = record.color;
+  buffer[3] = 0;
+  memcpy(buffer + 4, &record.sequence, 4);
+  memcpy(buffer + 8, &record.x, 8);
+  memcpy(buffer + 16, &record.y, 8);
+  memcpy(buffer + 24, &record.value, 8);
+  memcpy(buffer + 32, &record.variance, 8);
+
+  boost::uint32_t crc = checksum(buffer, 40);
+  memcpy(buffer + 40, &crc, 4);
+}
+
+void decode(const char* buffer, MapJournalRecord& record)
+{
+  record.operation = buffer[0];
+  record.flag = buffer[1];
+  record.color = buffer[2];
+  memcpy(&record.sequence, buffer + 4, 4);
+  memcpy(&record.x, buffer + 8, 8);
+  memcpy(&record.y, buffer + 16, 8);
+  memcpy(&record.value, buffer + 24, 8);
+  memcpy(&record.variance, buffer + 32, 8);
+}
+
+}
+
+const boost::uint32_t MapJournal::MAGIC;
+const boost::uint32_t MapJournal::VERSION;
+const size_t MapJournal::RECORD_SIZE;
+
+MapJournal::MapJournal()
+  : journal(0), sequence(0), size(0), max_size(0), max_segments(1),
+    needed_segments(0), compaction_needed(false), grid_holds_depth_map(true)
+{
+}
+
+MapJournal::~MapJournal()
+{
+  close();
+}
+
+bool MapJournal::open(const std::string& file, const MapJournalHeader& header, size_t max_size, unsigned max_segments)
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(journal)
+    fclose(journal);
+
+  journal = 0;
+  sequence = 0;
+  this->file = file;
+  this->header = header;
+  this->max_size = max_size;
+  this->max_segments = max_segments;
+  needed_segments = 0;
+  compaction_needed = false;
+  buoys.clear();
+
+  //The journal of the previous session is kept as <file>.1
+  rotate(max_segments);
+  return create();
+}
+
+std::string MapJournal::segmentName(const std::string& file, unsigned segment)
+{
+  if(segment == 0)
+    return file;
+
+  std::ostringstream name;
+  name << file << "." << segment;
+  return name.str();
+}
+
+void MapJournal::rotate(unsigned kept)
+{
+  if(kept == 0){
+    remove(file.c_str());
+    return;
+  }
+
+  //rename replaces the oldest segment
+  for(unsigned i = kept; i > 0; i--)
+    rename(segmentName(file, i - 1).c_str(), segmentName(file, i).c_str());
+
+  dropSegments(kept + 1);
+}
+
+void MapJournal::dropSegments(unsigned first)
+{
+  //Segments, which were kept until a snapshot, are dropped afterwards
+  for(unsigned i = first; remove(segmentName(file, i).c_str()) == 0; i++);
+}
+
+void MapJournal::closeSegment()
+{
+  fflush(journal);
+  fsync(fileno(journal));
+  fclose(journal);
+  journal = 0;
+}
+
+bool MapJournal::create()
+{
+  journal = fopen(file.c_str(), "wb");
+
+  if(!journal){
+    std::cout << "ERROR: Could not create map journal " << file << std::endl;
+    return false;
+  }
+
+  std::string buffer;
+  put(buffer, MAGIC);
+  put(buffer, VERSION);
+  putString(buffer, header.yaml_map);
+  putString(buffer, header.yaml_depth_map);
+  put(buffer, header.resolution);
+  put(buffer, header.min_depth);
+  put(buffer, header.max_depth);
+  put(buffer, header.depth_resolution);
+  put(buffer, header.confidence_threshold);
+  put(buffer, header.count_threshold);
+  put(buffer, checksum(buffer.data(), buffer.size()));
+
+  if(fwrite(buffer.data(), 1, buffer.size(), journal) != buffer.size() || fflush(journal) != 0){
+    std::cout << "ERROR: Could not write map journal header " << file << std::endl;
+    fclose(journal);
+    journal = 0;
+    return false;
+  }
+
+  size = buffer.size();
+  needed_segments++;
+  return true;
+}
+
+void MapJournal::close()
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(journal)
+    closeSegment();
+}
+
+void MapJournal::recordDepth(double x, double y, double depth, double variance)
+{
+  MapJournalRecord record;
+  record.operation = JOURNAL_DEPTH;
+  record.flag = 0;
+  record.color = 0;
+  record.x = x;
+  record.y = y;
+  record.value = depth;
+  record.variance = variance;
+  append(record);
+}
+
+void MapJournal::recordObstacle(double x, double y, bool obstacle, double confidence)
+{
+  MapJournalRecord record;
+  record.operation = JOURNAL_OBSTACLE;
+  record.flag = obstacle;
+  record.color = 0;
+  record.x = x;
+  record.y = y;
+  record.value = confidence;
+  record.variance = 0.0;
+  append(record);
+}
+
+void MapJournal::recordBuoy(double x, double y, BuoyColor color, double confidence, bool buoy)
+{
+  MapJournalRecord record;
+  record.operation = JOURNAL_BUOY;
+  record.flag = buoy;
+  record.color = color;
+  record.x = x;
+  record.y = y;
+  record.value = confidence;
+  record.variance = 0.0;
+  append(record);
+}
+
+void MapJournal::recordThresholds(double confidence_threshold, int count_threshold)
+{
+  {
+    //The thresholds are set with every update of the configuration
+    boost::mutex::scoped_lock lock(mutex);
+
+    if(confidence_threshold == header.confidence_threshold && count_threshold == header.count_threshold)
+      return;
+  }
+
+  MapJournalRecord record;
+  record.operation = JOURNAL_THRESHOLDS;
+  record.flag = 0;
+  record.color = 0;
+  record.x = 0.0;
+  record.y = 0.0;
+  record.value = confidence_threshold;
+  record.variance = count_threshold;
+  append(record);
+}
+
+bool MapJournal::write(MapJournalRecord& record)
+{
+  char buffer[RECORD_SIZE];
+  encode(record, buffer);
+
+  if(fwrite(buffer, RECORD_SIZE, 1, journal) != 1){
+    std::cout << "ERROR: Could not append to map journal, journal is closed" << std::endl;
+    fclose(journal);
+    journal = 0;
+    return false;
+  }
+
+  return true;
+}
+
+void MapJournal::append(MapJournalRecord& record)
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(!journal)
+    return;
+
+  record.sequence = sequence++;
+
+  if(!write(record))
+    return;
+
+  //Snapshots and new segments start with the current state
+  if(record.operation == JOURNAL_BUOY)
+    buoys.push_back(record);
+
+  if(record.operation == JOURNAL_THRESHOLDS){
+    header.confidence_threshold = record.value;
+    header.count_threshold = static_cast<boost::int32_t>(record.variance);
+  }
+
+  size += RECORD_SIZE;
+
+  if(max_size > 0 && size >= max_size){
+
+    //The segments since the newest snapshot are still needed for a replay
+    unsigned kept = max_segments > needed_segments ? max_segments : needed_segments;
+
+    if(kept > max_segments && !compaction_needed){
+      std::cout << "WARNING: Map journal keeps " << kept << " segments, until the next snapshot" << std::endl;
+      compaction_needed = true;
+    }
+
+    closeSegment();
+    rotate(kept);
+    create();
+  }
+}
+
+void MapJournal::flush()
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(journal)
+    fflush(journal);
+}
+
+bool MapJournal::compact(DepthObstacleGrid& grid, const std::string& yaml_file)
+{
+  bool written = true;
+
+  {
+    boost::mutex::scoped_lock lock(mutex);
+
+    if(journal)
+      written = writeSnapshot(grid);
+  }
+
+  if(yaml_file.empty())
+    return written;
+
+  std::string temp_file = yaml_file + ".tmp";
+  grid.saveYML(temp_file);
+
+  int fd = ::open(temp_file.c_str(), O_RDONLY);
+  if(fd < 0){
+    std::cout << "ERROR: Could not write map snapshot " << temp_file << std::endl;
+    return false;
+  }
+  fsync(fd);
+  ::close(fd);
+
+  if(rename(temp_file.c_str(), yaml_file.c_str()) != 0){
+    std::cout << "ERROR: Could not rename map snapshot to " << yaml_file << std::endl;
+    return false;
+  }
+
+  return written;
+}
+
+bool MapJournal::writeSnapshot(DepthObstacleGrid& grid)
+{
+  SimpleGrid cells;
+  grid.getSimpleGrid(cells, 0.0, 0);
+
+  std::vector<MapJournalRecord> records;
+  MapJournalRecord record;
+  record.sequence = sequence;
+  record.color = 0;
+
+  unsigned int width = static_cast<unsigned int>(std::ceil(cells.span.x() / cells.resolution));
+  unsigned int height = static_cast<unsigned int>(std::ceil(cells.span.y() / cells.resolution));
+
+  for(unsigned int y = 0; y < height; y++){
+    for(unsigned int x = 0; x < width; x++){
+      SimpleGridElement cell;
+      record.x = cells.position.x() + (x + 0.5) * cells.resolution;
+      record.y = cells.position.y() + (y + 0.5) * cells.resolution;
+
+      if(!cells.getCell(record.x, record.y, cell))
+        continue;
+
+      if(!std::isnan(cell.depth)){
+        record.operation = JOURNAL_DEPTH;
+        record.flag = 0;
+        record.value = cell.depth;
+        record.variance = cell.depth_variance;
+        records.push_back(record);
+      }
+
+      if(cell.obstacle_confidence > 0.0){
+        record.operation = JOURNAL_OBSTACLE;
+        record.flag = cell.obstacle;
+        record.value = cell.obstacle_confidence;
+        record.variance = 0.0;
+        records.push_back(record);
+      }
+    }
+  }
+
+  for(std::vector<MapJournalRecord>::iterator it = buoys.begin(); it != buoys.end(); it++){
+    records.push_back(*it);
+    records.back().sequence = sequence;
+  }
+
+  //The older segments are kept, until the snapshot is complete
+  closeSegment();
+  rotate(max_segments > needed_segments ? max_segments : needed_segments);
+
+  //The initial depth map is part of the snapshot, if the grid holds it
+  if(grid_holds_depth_map)
+    header.yaml_depth_map.clear();
+
+  if(!create())
+    return false;
+
+  MapJournalRecord marker;
+  marker.operation = JOURNAL_SNAPSHOT;
+  marker.flag = 0;
+  marker.color = 0;
+  marker.sequence = sequence;
+  marker.x = 0.0;
+  marker.y = 0.0;
+  marker.value = records.size();
+  marker.variance = 0.0;
+
+  if(!write(marker))
+    return false;
+
+  for(std::vector<MapJournalRecord>::iterator it = records.begin(); it != records.end(); it++){
+    if(!write(*it))
+      return false;
+  }
+
+  marker.operation = JOURNAL_SNAPSHOT_END;
+
+  if(!write(marker) || fflush(journal) != 0){
+    std::cout << "ERROR: Could not write map journal snapshot " << file << std::endl;
+    return false;
+  }
+
+  //The segment is rotated by the size of its records, the snapshot is not counted
+  fsync(fileno(journal));
+  needed_segments = 1;
+  compaction_needed = false;
+  dropSegments(max_segments + 1);
+  return true;
+}
+
+bool MapJournal::needsCompaction()
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return compaction_needed;
+}
+
+MapJournalReader::MapJournalReader()
+  : journal(0), corrupted(false)
+{
+}
+
+MapJournalReader::~MapJournalReader()
+{
+  if(journal)
+    fclose(journal);
+}
+
+bool MapJournalReader::open(const std::string& file)
+{
+  if(journal)
+    fclose(journal);
+
+  corrupted = false;
+  journal = fopen(file.c_str(), "rb");
+
+  if(!journal){
+    std::cout << "ERROR: Could not open map journal " << file << std::endl;
+    return false;
+  }
+
+  boost::uint32_t magic, version, crc;
+
+  if(!get(journal, magic) || magic != MapJournal::MAGIC || !get(journal, version) || version != MapJournal::VERSION
+      || !getString(journal, header.yaml_map) || !getString(journal, header.yaml_depth_map)
+      || !get(journal, header.resolution) || !get(journal, header.min_depth) || !get(journal, header.max_depth)
+      || !get(journal, header.depth_resolution) || !get(journal, header.confidence_threshold)
+      || !get(journal, header.count_threshold) || !get(journal, crc)){
+    std::cout << "ERROR: " << file << " is not a map journal" << std::endl;
+    fclose(journal);
+    journal = 0;
+    return false;
+  }
+
+  std::string buffer;
+  put(buffer, magic);
+  put(buffer, version);
+  putString(buffer, header.yaml_map);
+  putString(buffer, header.yaml_depth_map);
+  put(buffer, header.resolution);
+  put(buffer, header.min_depth);
+  put(buffer, header.max_depth);
+  put(buffer, header.depth_resolution);
+  put(buffer, header.confidence_threshold);
+  put(buffer, header.count_threshold);
+
+  if(checksum(buffer.data(), buffer.size()) != crc){
+    std::cout << "ERROR: Corrupted header in map journal " << file << std::endl;
+    fclose(journal);
+    journal = 0;
+    return false;
+  }
+
+  return true;
+}
+
+bool MapJournalReader::next(MapJournalRecord& record)
+{
+  if(!journal || corrupted)
+    return false;
+
+  char buffer[MapJournal::RECORD_SIZE];
+  size_t size = fread(buffer, 1, MapJournal::RECORD_SIZE, journal);
+
+  if(size == 0)
+    return false;
+
+  boost::uint32_t crc;
+  memcpy(&crc, buffer + 40, 4);
+
+  if(size != MapJournal::RECORD_SIZE || checksum(buffer, 40) != crc){
+    corrupted = true;
+    return false;
+  }
+
+  decode(buffer, record);
+  return true;
+}
+
+DepthObstacleGrid* MapJournalReader::createGrid(const MapJournalHeader& header, NodeMap* map)
+{
+  DepthObstacleGrid* grid = new DepthObstacleGrid( base::Vector2d(-map->getTranslation().x(), -map->getTranslation().y() ),
+                              base::Vector2d(map->getLimitations().x(), map->getLimitations().y() ), header.resolution);
+  grid->initGrid();
+  grid->initDepthObstacleConfig(header.min_depth, header.max_depth, header.depth_resolution);
+  grid->initThresholds(header.confidence_threshold, header.count_threshold);
+  grid->initializeStatics(map);
+
+  if(!header.yaml_depth_map.empty())
+    grid->initializeDepth(header.yaml_depth_map, 0.0001);
+
+  return grid;
+}
+
+void MapJournalReader::apply(const MapJournalRecord& record, DepthObstacleGrid& grid)
+{
+  switch(record.operation){
+    case JOURNAL_DEPTH:
+      grid.setDepth(record.x, record.y, record.value, record.variance);
+      break;
+    case JOURNAL_OBSTACLE:
+      grid.setObstacle(record.x, record.y, record.flag, record.value);
+      break;
+    case JOURNAL_BUOY:
+      grid.setBuoy(record.x, record.y, static_cast<BuoyColor>(record.color), record.value, record.flag);
+      break;
+    case JOURNAL_THRESHOLDS:
+      grid.initThresholds(record.value, static_cast<int>(record.variance));
+      break;
+    default:
+      break;
+  }
+}
+
+MapJournalReplay::MapJournalReplay()
+  : start(0), has_snapshot(false), snapshot_sequence(0), replayed(0), warnings(false)
+{
+}
+
+bool MapJournalReplay::readSnapshot(MapJournalReader& reader, std::vector<MapJournalRecord>& cells, boost::uint32_t& sequence)
+{
+  MapJournalRecord record;
+  cells.clear();
+
+  if(!reader.next(record) || record.operation != JOURNAL_SNAPSHOT)
+    return false;
+
+  size_t count = record.value;
+  sequence = record.sequence;
+
+  while(reader.next(record)){
+    if(record.operation == JOURNAL_SNAPSHOT_END)
+      return cells.size() == count;
+
+    cells.push_back(record);
+  }
+
+  //A snapshot torn by a crash is ignored
+  return false;
+}
+
+bool MapJournalReplay::open(const std::vector<std::string>& segments)
+{
+  this->segments = segments;
+  start = 0;
+  has_snapshot = false;
+  snapshot_sequence = 0;
+  replayed = 0;
+  warnings = false;
+
+  if(segments.empty())
+    return false;
+
+  std::vector<MapJournalRecord> cells;
+
+  for(size_t i = segments.size(); i > 0 && !has_snapshot; i--){
+    MapJournalReader reader;
+
+    if(reader.open(segments[i - 1]) && readSnapshot(reader, cells, snapshot_sequence)){
+      start = i - 1;
+      has_snapshot = true;
+    }
+  }
+
+  MapJournalReader reader;
+
+  if(!reader.open(segments[start]))
+    return false;
+
+  header = reader.getHeader();
+  return true;
+}
+
+DepthObstacleGrid* MapJournalReplay::replay(NodeMap* map)
+{
+  MapJournalReader reader;
+
+  if(segments.empty() || !reader.open(segments[start]))
+    return 0;
+
+  DepthObstacleGrid* grid = reader.createGrid(map);
+  boost::uint32_t expected_sequence = 0;
+  replayed = 0;
+
+  if(has_snapshot){
+    std::vector<MapJournalRecord> cells;
+    readSnapshot(reader, cells, expected_sequence);
+
+    for(std::vector<MapJournalRecord>::iterator it = cells.begin(); it != cells.end(); it++)
+      MapJournalReader::apply(*it, *grid);
+  }
+
+  MapJournalRecord record;
+
+  for(size_t i = start; i < segments.size(); i++){
+
+    if(i > start && !reader.open(segments[i]))
+      break;
+
+    bool first = true;
+    while(reader.next(record)){
+
+      //Snapshots of later segments were not complete, the records before them are replayed instead
+      if(record.operation == JOURNAL_SNAPSHOT){
+        while(reader.next(record) && record.operation != JOURNAL_SNAPSHOT_END);
+        continue;
+      }
+
+      //A gap means, that segments were dropped by the rotation or belong to different runs
+      if(first && record.sequence != expected_sequence){
+        std::cout << "WARNING: " << segments[i] << " starts at record " << record.sequence << ", expected " << expected_sequence << std::endl;
+        warnings = true;
+      }
+
+      MapJournalReader::apply(record, *grid);
+      expected_sequence = record.sequence + 1;
+      first = false;
+      replayed++;
+    }
+
+    if(reader.isCorrupted()){
+      std::cout << "WARNING: " << segments[i] << " ends with a corrupted record" << std::endl;
+      warnings = true;
+    }
+  }
+
+  return grid;
+}
@@ -0,0 +1,286 @@
+/* ----------------------------------------------------------------------------
+ * MapJournal.hpp
+ * Append-only binary journal of depth-obstacle-grid changes
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_MAP_JOURNAL_HPP
+#define UW_PARTICLE_LOCALIZATION_MAP_JOURNAL_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+
+namespace uw_localization {
+
+/**
+ * Everything needed to rebuild the initial grid, before the journal is replayed
+ */
+struct MapJournalHeader {
+  std::string yaml_map;
+  std::string yaml_depth_map;
+  double resolution;
+  double min_depth;
+  double max_depth;
+  double depth_resolution;
+  double confidence_threshold;
+  boost::int32_t count_threshold;
+};
+
+enum MapJournalOperation {
+  JOURNAL_DEPTH = 1,
+  JOURNAL_OBSTACLE,
+  JOURNAL_BUOY,
+  /** value: confidence threshold, variance: observation count threshold */
+  JOURNAL_THRESHOLDS,
+  /** begins a snapshot of the grid, value: number of cell records of the snapshot */
+  JOURNAL_SNAPSHOT,
+  /** ends a snapshot, value: number of cell records of the snapshot */
+  JOURNAL_SNAPSHOT_END
+};
+
+/**
+ * One grid operation. On disk, every record has a fixed size and a crc32,
+ * so a record torn by a crash is detected and ignored.
+ */
+struct MapJournalRecord {
+  boost::uint8_t operation;
+  boost::uint8_t flag;
+  boost::uint8_t color;
+  boost::uint32_t sequence;
+  double x;
+  double y;
+  double value;
+  double variance;
+};
+
+/**
+ * Writes all changes of a DepthObstacleGrid to an append-only journal.
+ * The journal can be replayed with the MapJournalReplay, to get the grid.
+ * All methods may be called from different threads.
+ *
+ * The journal is rotated, when it is opened and when it reaches its maximum
+ * size: <file> becomes <file>.1, <file>.1 becomes <file>.2 and so on. A
+ * rotated segment keeps the header and the record sequence continues, so
+ * the segments of a session can be replayed one after another.
+ *
+ * compact() starts a new segment with a snapshot of the grid. The snapshot
+ * carries the sequence of the next record, so a replay loads the newest
+ * snapshot and applies the records of the later segments. Only segments
+ * older than the newest snapshot are dropped by the rotation, segments of the
+ * previous session are always dropped first. If more than max_segments are
+ * needed, they are kept and needsCompaction() is set.
+ *
+ * A snapshot stores the depth and the obstacle confidence of every cell,
+ * applied to a grid with the static obstacles of the node map. The
+ * observation counts of the obstacles are not available from the grid, a
+ * restored obstacle counts as one observation. Buoys are kept as their
+ * original records. The initial depth map is part of the snapshot, unless
+ * the grid does not hold it, see setGridHoldsDepthMap().
+ */
+class MapJournal {
+public:
+  static const boost::uint32_t MAGIC = 0x4a4d5755; // "UWMJ"
+  static const boost::uint32_t VERSION = 2;
+  static const size_t RECORD_SIZE = 44;
+
+  MapJournal();
+  ~MapJournal();
+
+  /**
+   * Creates a new journal. An existing journal is rotated, not overwritten
+   * @param file: file of the journal
+   * @param header: configuration of the initial grid
+   * @param max_size: size in bytes, at which the journal is rotated. 0 disables the rotation
+   * @param max_segments: number of kept rotated segments
+   * @return: true, if the journal could be created
+   */
+  bool open(const std::string& file, const MapJournalHeader& header, size_t max_size = 0, unsigned max_segments = 1);
+  void close();
+  bool isOpen() const { return journal != 0; }
+
+  void recordDepth(double x, double y, double depth, double variance);
+  void recordObstacle(double x, double y, bool obstacle, double confidence);
+  void recordBuoy(double x, double y, BuoyColor color, double confidence, bool buoy);
+
+  /**
+   * Records a change of DepthObstacleGrid::initThresholds, unchanged thresholds are not recorded
+   */
+  void recordThresholds(double confidence_threshold, int count_threshold);
+
+  /**
+   * If the initial depths are not part of the grid, e.g. because the filter
+   * reads them from a compiled map, the snapshots keep the yaml_depth_map of
+   * the header, so a replay still starts with the initial depths
+   */
+  void setGridHoldsDepthMap(bool holds) { grid_holds_depth_map = holds; }
+
+  /**
+   * Flushes buffered records to the operating system
+   */
+  void flush();
+
+  /**
+   * Starts a new segment with a snapshot of the grid, afterwards the older
+   * segments are no longer needed for a replay. Optionally the grid is saved
+   * as yaml, the file is first written to a temporary file and renamed
+   * afterwards, so the output is never truncated.
+   * The grid must not be changed while compacting.
+   * @param grid: the grid, whose changes were recorded
+   * @param yaml_file: output file, empty if no yaml should be saved
+   * @return: true, if the snapshots were written
+   */
+  bool compact(DepthObstacleGrid& grid, const std::string& yaml_file);
+
+  /**
+   * @return: true, if the rotation kept more than max_segments, because no
+   *   snapshot was written since. It is reset by compact()
+   */
+  bool needsCompaction();
+
+  boost::uint32_t records() const { return sequence; }
+
+  /**
+   * @return: name of a rotated segment, segment 0 is the journal itself
+   */
+  static std::string segmentName(const std::string& file, unsigned segment);
+
+private:
+  FILE* journal;
+  boost::uint32_t sequence;
+  boost::mutex mutex;
+
+  std::string file;
+  MapJournalHeader header;
+  size_t size;
+  size_t max_size;
+  unsigned max_segments;
+
+  /** segments of this session since the newest snapshot, including the open one */
+  unsigned needed_segments;
+  bool compaction_needed;
+  bool grid_holds_depth_map;
+  std::vector<MapJournalRecord> buoys;
+
+  void append(MapJournalRecord& record);
+  bool write(MapJournalRecord& record);
+  bool writeSnapshot(DepthObstacleGrid& grid);
+  void closeSegment();
+  void rotate(unsigned kept);
+  void dropSegments(unsigned first);
+  bool create();
+};
+
+/**
+ * Reads a journal, written by the MapJournal
+ */
+class MapJournalReader {
+public:
+  MapJournalReader();
+  ~MapJournalReader();
+
+  /**
+   * Opens the journal and reads the header
+   * @return: false, if the file could not be read or is not a journal
+   */
+  bool open(const std::string& file);
+
+  const MapJournalHeader& getHeader() const { return header; }
+
+  /**
+   * Reads the next record
+   * @return: false at the end of the journal or at the first corrupted record
+   */
+  bool next(MapJournalRecord& record);
+
+  /**
+   * @return: true, if reading stopped at a corrupted or incomplete record
+   */
+  bool isCorrupted() const { return corrupted; }
+
+  /**
+   * Creates the initial grid described by the header
+   * @param map: node map, loaded from the header's yaml_map
+   */
+  DepthObstacleGrid* createGrid(NodeMap* map) const { return createGrid(header, map); }
+
+  /**
+   * Creates the initial grid described by a header
+   * @param map: node map, loaded from the header's yaml_map
+   */
+  static DepthObstacleGrid* createGrid(const MapJournalHeader& header, NodeMap* map);
+
+  /**
+   * Applies a record to the grid, snapshot markers are ignored
+   */
+  static void apply(const MapJournalRecord& record, DepthObstacleGrid& grid);
+
+private:
+  FILE* journal;
+  MapJournalHeader header;
+  bool corrupted;
+};
+
+/**
+ * Rebuilds the grid from the segments of a session. The replay starts at
+ * the newest segment with a complete snapshot, or at the first segment if
+ * there is none.
+ */
+class MapJournalReplay {
+public:
+  MapJournalReplay();
+
+  /**
+   * Finds the segment, where the replay starts, and reads its header
+   * @param segments: the segments of one session, oldest first
+   * @return: false, if the start segment could not be read
+   */
+  bool open(const std::vector<std::string>& segments);
+
+  /**
+   * @return: header of the start segment, it describes the initial grid
+   */
+  const MapJournalHeader& getHeader() const { return header; }
+
+  /**
+   * Creates the initial grid, loads the snapshot and applies the later records
+   * @param map: node map, loaded from the header's yaml_map
+   * @return: the grid, or 0 if open() failed
+   */
+  DepthObstacleGrid* replay(NodeMap* map);
+
+  bool hasSnapshot() const { return has_snapshot; }
+
+  /**
+   * @return: sequence of the first record after the snapshot
+   */
+  boost::uint32_t snapshotSequence() const { return snapshot_sequence; }
+
+  /**
+   * @return: number of replayed records, without the records of the snapshot
+   */
+  unsigned records() const { return replayed; }
+
+  /**
+   * @return: true, if a gap in the sequence or a corrupted record was found
+   */
+  bool hasWarnings() const { return warnings; }
+
+private:
+  std::vector<std::string> segments;
+  size_t start;
+  MapJournalHeader header;
+  bool has_snapshot;
+  boost::uint32_t snapshot_sequence;
+  unsigned replayed;
+  bool warnings;
+
+  static bool readSnapshot(MapJournalReader& reader, std::vector<MapJournalRecord>& cells, boost::uint32_t& sequence);
+};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "MapLayers.hpp"
+#include <iostream>
+#include <yaml-cpp/yaml.h>
+
+using namespace uw_localization;
+
+namespace {
+
+base::Vector3d readVector(const YAML::Node& node)
+{
+  return base::Vector3d(node[0].as<double>(), node[1].as<double>(), node[2].as<double>());
+}
+
+LayerStrip pointStrip(const base::Vector3d& point)
+{
+  LayerStrip strip;
+  strip.start = point.head<2>();
+  strip.end = strip.start;
+  strip.z_min = point.z();
+  strip.z_max = point.z();
+  return strip;
+}
+
+/**
+ * Reads the nodes of a layer like NodeMap::fromYaml: walls and lines from
+ * line_from to line_to with an optional height, boxes by their center
+ * (position) and size (span), buoys by their mean and points by their position
+ * @return: false, if a node is of an unknown kind
+ */
+/**
+ * The caption of a layer is its path in the yaml file, e.g. root.wall
+ * @return: the node of the layer, or an undefined node if the path does not exist
+ */
+YAML::Node findLayer(const YAML::Node& node, const std::string& caption, size_t begin)
+{
+  if(!node || !node.IsMap())
+    return YAML::Node();
+
+  size_t end = caption.find('.', begin);
+
+  if(end == std::string::npos)
+    return node[caption.substr(begin)];
+
+  return findLayer(node[caption.substr(begin, end - begin)], caption, end + 1);
+}
+
+bool readLayer(const YAML::Node& layer, std::vector<LayerStrip>& strips, std::vector<GeometryBox>& boxes)
+{
+  if(!layer || !layer.IsSequence())
+    return true;
+
+  for(YAML::const_iterator it = layer.begin(); it != layer.end(); ++it){
+    const YAML::Node& node = *it;
+
+    if(node["line_from"] && node["line_to"]){
+      base::Vector3d from = readVector(node["line_from"]);
+      base::Vector3d to = readVector(node["line_to"]);
+      double height = node["height"] ? node["height"].as<double>() : 0.0;
+
+      LayerStrip strip;
+      strip.start = from.head<2>();
+      strip.end = to.head<2>();
+      strip.z_min = from.z() + std::min(0.0, height);
+      strip.z_max = from.z() + std::max(0.0, height);
+      strips.push_back(strip);
+    }
+    else if(node["position"] && node["span"]){
+      base::Vector3d center = readVector(node["position"]);
+      base::Vector3d span = readVector(node["span"]).cwiseAbs();
+
+      GeometryBox box;
+      box.min = center - span / 2.0;
+      box.max = center + span / 2.0;
+      boxes.push_back(box);
+    }
+    else if(node["mean"]){
+      strips.push_back(pointStrip(readVector(node["mean"])));
+    }
+    else if(node["position"]){
+      strips.push_back(pointStrip(readVector(node["position"])));
+    }
+    else{
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}
+
+bool MapLayers::resolve(const std::string& yaml_map)
+{
+  unresolve();
+
+  MapLayer* layers[] = {&wall, &box, &pipeline, &end_of_pipe, &buoy};
+
+  try{
+    const YAML::Node map = YAML::LoadFile(yaml_map);
+
+    for(unsigned int i = 0; i < sizeof(layers) / sizeof(layers[0]); i++){
+
+      const std::string& caption = layers[i]->caption();
+      std::vector<LayerStrip> strips;
+      std::vector<GeometryBox> boxes;
+
+      if(readLayer(findLayer(map, caption, 0), strips, boxes))
+        layers[i]->resolve(strips, boxes);
+      else
+        std::cout << "WARNING: The layer " << caption << " of " << yaml_map << " has unknown nodes, it is queried by the node map" << std::endl;
+    }
+  }
+  catch(const YAML::Exception& e){
+    std::cout << "ERROR: Could not read the layers of " << yaml_map << ": " << e.what() << std::endl;
+    unresolve();
+    return false;
+  }
+
+  return true;
+}
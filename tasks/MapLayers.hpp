@@ -0,0 +1,196 @@
+/* ----------------------------------------------------------------------------
+ * MapLayers.hpp
+ * Typed handles of the node map layers
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_MAP_LAYERS_HPP
+#define UW_PARTICLE_LOCALIZATION_MAP_LAYERS_HPP
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <boost/tuple/tuple.hpp>
+#include <base/eigen.h>
+#include <uw_localization/maps/node_map.hpp>
+#include "GeometryIndex.hpp"
+
+namespace uw_localization {
+
+/**
+ * Nearest node of a layer, its distance and the nearest point
+ */
+typedef boost::tuple<Node*, double, Eigen::Vector3d> LayerDistance;
+
+/**
+ * A node of a layer, which is not a box: a vertical strip from start to end,
+ * which reaches from z_min to z_max. Lines have no height, points no length
+ */
+struct LayerStrip {
+  base::Vector2d start;
+  base::Vector2d end;
+  double z_min;
+  double z_max;
+
+  /**
+   * @return: the point of the strip, which is nearest to the given point
+   */
+  base::Vector3d nearestPoint(const base::Vector3d& point) const {
+    base::Vector2d segment = end - start;
+    double length = segment.squaredNorm();
+    double t = length > 0.0 ? std::max(0.0, std::min(1.0, (point.head<2>() - start).dot(segment) / length)) : 0.0;
+    base::Vector2d closest = start + t * segment;
+    return base::Vector3d(closest.x(), closest.y(), std::max(z_min, std::min(z_max, point.z())));
+  }
+};
+
+/**
+ * A layer of the node map, which is queried with a point.
+ * The layer is resolved once per map: its nodes are read from the yaml file
+ * of the map, and the queries run over this list. The node map only resolves
+ * a layer by its caption and does not hand out its nodes, so a layer, which
+ * could not be resolved, is still queried by its caption.
+ */
+class MapLayer {
+public:
+  explicit MapLayer(const char* caption) : layer_caption(caption), resolved(false) {}
+
+  /**
+   * Uses the given nodes for all queries
+   */
+  void resolve(const std::vector<LayerStrip>& strips, const std::vector<GeometryBox>& boxes) {
+    layer_strips = strips;
+    layer_boxes = boxes;
+    resolved = true;
+  }
+
+  /**
+   * Queries the node map by caption again, e.g. if the nodes of the map are unknown
+   */
+  void unresolve() {
+    layer_strips.clear();
+    layer_boxes.clear();
+    resolved = false;
+  }
+
+  /**
+   * @param point: the point, e.g. the end of a sonar beam
+   * @param origin: the position of the particle
+   * @return: no node, the distance from the origin to the node point nearest to
+   * the given point and this node point. An infinite distance, if the layer is empty
+   */
+  LayerDistance nearest(const NodeMap& map, const Eigen::Vector3d& point, const Eigen::Vector3d& origin) const {
+    if(!resolved)
+      return map.getNearestDistance(layer_caption, point, origin);
+
+    double best = INFINITY;
+    base::Vector3d nearest_point = point;
+
+    for(std::vector<LayerStrip>::const_iterator it = layer_strips.begin(); it != layer_strips.end(); ++it){
+      base::Vector3d candidate = it->nearestPoint(point);
+      double distance = (candidate - point).squaredNorm();
+
+      if(distance < best){
+        best = distance;
+        nearest_point = candidate;
+      }
+    }
+
+    for(std::vector<GeometryBox>::const_iterator it = layer_boxes.begin(); it != layer_boxes.end(); ++it){
+      base::Vector3d candidate = point.cwiseMax(it->min).cwiseMin(it->max);
+      double distance = (candidate - point).squaredNorm();
+
+      if(distance < best){
+        best = distance;
+        nearest_point = candidate;
+      }
+    }
+
+    if(best == INFINITY)
+      return LayerDistance(0, INFINITY, point);
+
+    return LayerDistance(0, (nearest_point - origin).norm(), nearest_point);
+  }
+
+  bool isResolved() const { return resolved; }
+  const std::vector<LayerStrip>& strips() const { return layer_strips; }
+  const std::vector<GeometryBox>& boxes() const { return layer_boxes; }
+  const std::string& caption() const { return layer_caption; }
+
+protected:
+  std::string layer_caption;
+  std::vector<LayerStrip> layer_strips;
+  std::vector<GeometryBox> layer_boxes;
+  bool resolved;
+};
+
+/**
+ * The box layer is queried with a sonar beam instead of a point
+ */
+class BoxLayer : public MapLayer {
+public:
+  explicit BoxLayer(const char* caption) : MapLayer(caption) {}
+
+  /**
+   * @param vertical_half_angle: half of the vertical opening angle of the beam
+   * @param yaw: absolute direction of the beam
+   * @param origin: the position of the particle
+   * @return: no node, the distance from the origin to the first box on the beam
+   * and the point, where the beam enters it. An infinite distance, if the beam misses all boxes
+   */
+  LayerDistance beam(const NodeMap& map, double vertical_half_angle, double yaw, const Eigen::Vector3d& origin) const {
+    if(!resolved)
+      return map.getNearestDistance(layer_caption, Eigen::Vector3d(0.0, vertical_half_angle, yaw), origin);
+
+    base::Vector2d direction(std::cos(yaw), std::sin(yaw));
+    double slope = std::tan(std::fabs(vertical_half_angle));
+    GeometryHit hit;
+
+    for(std::vector<GeometryBox>::const_iterator it = layer_boxes.begin(); it != layer_boxes.end(); ++it){
+      if(GeometryIndex::beamHitsBox(*it, origin, direction, slope, hit)){
+        hit.primitive = it - layer_boxes.begin();
+      }
+    }
+
+    if(hit.primitive < 0)
+      return LayerDistance(0, INFINITY, origin);
+
+    return LayerDistance(0, (hit.point - origin).norm(), hit.point);
+  }
+};
+
+/**
+ * All layers, which are used by the perceptions
+ */
+struct MapLayers {
+  MapLayer wall;
+  BoxLayer box;
+  MapLayer pipeline;
+  MapLayer end_of_pipe;
+  MapLayer buoy;
+
+  MapLayers()
+    : wall("root.wall"), box("root.box"), pipeline("root.pipeline"),
+      end_of_pipe("root.end_of_pipe"), buoy("root.buoy") {}
+
+  /**
+   * Reads the nodes of all layers from the yaml file of a map. A missing
+   * layer is resolved without nodes. A layer with nodes of an unknown
+   * kind stays unresolved
+   * @return: false, if the file could not be parsed. All layers stay unresolved then
+   */
+  bool resolve(const std::string& yaml_map);
+
+  void unresolve() {
+    wall.unresolve();
+    box.unresolve();
+    pipeline.unresolve();
+    end_of_pipe.unresolve();
+    buoy.unresolve();
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "MapLoader.hpp"
+#include <iostream>
+#include <boost/bind.hpp>
+
+using namespace uw_localization;
+
+LoadedMap::LoadedMap()
+  : map(0), grid(0), compiled(0), use_initial_depthmap(false)
+{
+}
+
+LoadedMap::~LoadedMap()
+{
+  delete map;
+  delete grid;
+  delete compiled;
+}
+
+MapLoader::MapLoader()
+  : loading(false), loaded(0)
+{
+}
+
+MapLoader::~MapLoader()
+{
+  stop();
+}
+
+LoadedMap* MapLoader::load(const MapSource& source)
+{
+  LoadedMap* result = new LoadedMap();
+  result->source = source;
+  result->map = new NodeMap();
+
+  if(!result->map->fromYaml(source.yaml_map)){
+    std::cerr << "ERROR: No map could be load " << source.yaml_map.c_str() << std::endl;
+    delete result;
+    return 0;
+  }
+
+  NodeMap* map = result->map;
+
+  if(!source.compiled_map.empty()){
+    CompiledMap* compiled_map = new CompiledMap();
+
+    if(!compiled_map->open(source.compiled_map)){
+      delete compiled_map;
+    }else if(!compiled_map->matches(*map, source.resolution)){
+      std::cout << "Compiled map " << source.compiled_map << " does not match the map or the grid resolution" << std::endl;
+      delete compiled_map;
+    }else if(!compiled_map->readGeometry(result->env, result->layers, result->geometry_index)){
+      delete compiled_map;
+    }else{
+      std::cout << "Mapped " << compiled_map->getHeader().depth_cells << " depth cells from " << source.compiled_map << std::endl;
+      result->compiled = compiled_map;
+      result->use_initial_depthmap = compiled_map->getHeader().depth_cells > 0;
+    }
+  }
+
+  if(!result->compiled){
+    result->env = map->getEnvironment();
+    result->layers.resolve(source.yaml_map);
+    result->geometry_index.build(result->env, *map, result->layers.box.boxes());
+  }
+
+  result->grid = new DepthObstacleGrid( base::Vector2d(-map->getTranslation().x(), -map->getTranslation().y() ),
+                          base::Vector2d(map->getLimitations().x(), map->getLimitations().y() ), source.resolution);
+  result->grid->initGrid();
+  result->grid->initDepthObstacleConfig(-8.0, 0.0, 2.0);
+  result->grid->initThresholds(source.confidence_threshold, source.count_threshold);
+  result->grid->initializeStatics(map);
+
+  if(!result->compiled && !source.yaml_depth_map.empty())
+    result->use_initial_depthmap = result->grid->initializeDepth(source.yaml_depth_map, 0.0001);
+
+  return result;
+}
+
+bool MapLoader::request(const MapSource& source)
+{
+  boost::mutex::scoped_lock lock(mutex);
+
+  if(loading)
+    return false;
+
+  //The last loading thread has finished, but may not be joined yet
+  if(thread.joinable())
+    thread.join();
+
+  delete loaded;
+  loaded = 0;
+  loading = true;
+  thread = boost::thread(boost::bind(&MapLoader::run, this, source));
+  return true;
+}
+
+bool MapLoader::busy()
+{
+  boost::mutex::scoped_lock lock(mutex);
+  return loading;
+}
+
+LoadedMap* MapLoader::take()
+{
+  boost::mutex::scoped_lock lock(mutex);
+  LoadedMap* result = loaded;
+  loaded = 0;
+  return result;
+}
+
+void MapLoader::stop()
+{
+  if(thread.joinable())
+    thread.join();
+
+  boost::mutex::scoped_lock lock(mutex);
+  delete loaded;
+  loaded = 0;
+}
+
+void MapLoader::run(MapSource source)
+{
+  LoadedMap* result = load(source);
+
+  boost::mutex::scoped_lock lock(mutex);
+  loaded = result;
+  loading = false;
+}
@@ -0,0 +1,114 @@
+/* ----------------------------------------------------------------------------
+ * MapLoader.hpp
+ * Loads maps and their lookup structures on a background thread
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_MAP_LOADER_HPP
+#define UW_PARTICLE_LOCALIZATION_MAP_LOADER_HPP
+
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+#include <uw_localization/types/environment.hpp>
+#include "GeometryIndex.hpp"
+#include "MapLayers.hpp"
+#include "CompiledMap.hpp"
+
+namespace uw_localization {
+
+/**
+ * Files and grid parameters of a map
+ */
+struct MapSource {
+  std::string yaml_map;
+  std::string yaml_depth_map;
+
+  /** compiled map, which is preferred to yaml_depth_map and to the geometry of yaml_map if it matches */
+  std::string compiled_map;
+
+  double resolution;
+  double confidence_threshold;
+  int count_threshold;
+
+  MapSource() : resolution(0.5), confidence_threshold(0.0), count_threshold(0) {}
+};
+
+/**
+ * A map with everything, which is precomputed for the filter.
+ * Owns the node map, the grid and the compiled map, they are deleted with the loaded map.
+ * Swapping them with the pointers in use hands the old map to the loaded map.
+ */
+struct LoadedMap {
+  MapSource source;
+  NodeMap* map;
+  DepthObstacleGrid* grid;
+  Environment env;
+  GeometryIndex geometry_index;
+  MapLayers layers;
+
+  /** the opened compiled map, if it matches, or 0. The initial depths are read from it, the grid does not hold them */
+  CompiledMap* compiled;
+
+  /** true, if depths were loaded from the compiled or yaml depth map */
+  bool use_initial_depthmap;
+
+  LoadedMap();
+  ~LoadedMap();
+
+private:
+  LoadedMap(const LoadedMap&);
+  LoadedMap& operator=(const LoadedMap&);
+};
+
+/**
+ * Loads one map at a time on a worker thread. The filter thread polls for
+ * the result with take(), so it can swap the map between two filter steps.
+ */
+class MapLoader {
+public:
+  MapLoader();
+  ~MapLoader();
+
+  /**
+   * Loads a map on the calling thread
+   * @return: the map, or 0 if the node map could not be loaded
+   */
+  static LoadedMap* load(const MapSource& source);
+
+  /**
+   * Starts loading a map in the background. A loaded map, which was not
+   * taken yet, is replaced
+   * @return: false, if another map is still loading
+   */
+  bool request(const MapSource& source);
+
+  /**
+   * @return: true, if a map is loading
+   */
+  bool busy();
+
+  /**
+   * @return: the loaded map, or 0 if none is ready. The caller owns the map
+   */
+  LoadedMap* take();
+
+  /**
+   * Waits for a running load and discards its result
+   */
+  void stop();
+
+private:
+  boost::thread thread;
+  boost::mutex mutex;
+  bool loading;
+  LoadedMap* loaded;
+
+  void run(MapSource source);
+};
+
+}
+
+#endif
@@ -66,16 +66,25 @@ bool MotionModel::startHook()
     initMotionConfig();
     
     advanced_model = _advanced_motion_model;
-    uw_localization::UwVehicleParameter uw_param = uw_localization::ParticleLocalization::VehicleParameter(config);
     
-    if(advanced_model){
-      underwaterVehicle::Parameters params = uw_localization::ParticleLocalization::initializeDynamicModel(uw_param, config);
-      dynamic_model = new underwaterVehicle::DynamicModel(0.1, 5, 0.0, NULL, 12, 6);
-      dynamic_model->init_param(params);      
+    dead_reckoning = _shared_dead_reckoning.get() ? &uw_localization::DeadReckoning::shared() : &own_dead_reckoning;
+    
+    //The first consumer sets the parameters of the shared dead reckoning, all others have to use the same
+    if(!_shared_dead_reckoning.get()){
+      dead_reckoning->configure(config);
+      dead_reckoning->reset(base::Vector3d::Zero());
+    }
+    else if(!dead_reckoning->configureOnce(config)){
+      std::cout << "ERROR: The shared dead reckoning is configured with different motion model parameters" << std::endl;
+      return false;
+    }
+    
+    if(advanced_model && _dynamics_cache.get()){
+      uw_localization::DynamicsCacheConfig cache_config;
+      cache_config.velocity_tolerance = _dynamics_cache_velocity_tolerance.get();
+      cache_config.dt_resolution = _dynamics_cache_dt_resolution.get();
+      dead_reckoning->enableDynamicsCache(cache_config);
     }
-    else{
-      motion_model.init(uw_param);
-    }    
     
     motion_pose.position = base::Vector3d::Zero();
     motion_pose.velocity = base::Vector3d::Zero();
@@ -97,86 +106,23 @@ void MotionModel::thruster_samplesCallback(const base::Time& ts, const base::sam
 
       if(last_orientation.hasValidOrientation()){
   
-        base::samples::Joints j = joint;
+        const base::samples::Joints& j = joint_adapter.adapt(joint);
         
-        //If we have no 6 thruster, fill up the joints with zeros
-        if(j.size() < 6){
+      if(!last_orientation.time.isNull()){
           
-          unsigned int size = j.size();
-          j.elements.resize(6);
-          j.names.resize(6);
-          
-          for(; size < 6; size++){
+          //Integrates the sample, unless another consumer of a shared dead reckoning did it already
+          if(dead_reckoning->update(j, last_orientation.orientation)){
+            base::samples::RigidBodyState pose = dead_reckoning->getPose();
+            double dt = (j.time - lastThrusterTime).toSeconds();
             
-            j.elements[size].raw = 0.0;
+            motion_pose.position = pose.position;
+            motion_pose.velocity = pose.velocity;
+            motion_pose.cov_velocity = _velocity_covariance.value().asDiagonal();
             
+            if(!lastThrusterTime.isNull() && dt >= 0.0 && dt < 5.0)
+              motion_pose.cov_position = motion_pose.cov_position + motion_pose.cov_velocity * dt;
           }
-          
-        }       
-        
-        if(joint.hasNames()){
-        
-          for(unsigned int i = 0; i < joint.size() && i < config.joint_names.size(); i++){
-            
-              try{
-                j.elements[i] = joint[config.joint_names[i]]; 
-              }
-              catch(...){
-              }   
-          }  
-        }
-        
-      if(!last_orientation.time.isNull() && !lastThrusterTime.isNull() ) {
-          base::Vector6d Xt;
-          base::Vector3d u_t1;
-          double dt = (j.time - lastThrusterTime).toSeconds();
-          
-          if(dt < 5.0 && dt >= 0.0){
-            
-            if(advanced_model){
-                        
-              //std::cout << "Velocity: " << motion_pose.velocity[0] << " " << motion_pose.velocity[1] << std::endl;
-              dynamic_model->setPosition(motion_pose.position);
-              dynamic_model->setLinearVelocity(motion_pose.velocity);
-              dynamic_model->setAngularVelocity(base::Vector3d::Zero());
-              dynamic_model->setOrientation(last_orientation.orientation);
-              dynamic_model->setSamplingtime(dt);
-              
-              dynamic_model->setPWMLevels(j);        
-              
-              u_t1 = dynamic_model->getLinearVelocity();  
-  ;
-            }else{
-              
-              Xt.block<3,1>(0,0) = motion_pose.velocity;
-              Xt.block<3,1>(3,0) = base::Vector3d(0.0, 0.0, 0.0);
-              
-              base::Vector6d V = motion_model.transition(Xt, dt, j);
-              u_t1 = V.block<3,1>(0,0);      
-            }
-
-            base::Vector3d v_avg = (motion_pose.velocity + u_t1) / 2.0;            
-
-            if(base::samples::RigidBodyState::isValidValue(u_t1) && last_orientation.hasValidOrientation() ){
-              
-              motion_pose.position = motion_pose.position + last_orientation.orientation * (v_avg * dt);
-              motion_pose.velocity = u_t1;
-              motion_pose.cov_velocity = _velocity_covariance.value().asDiagonal();
-              motion_pose.cov_position = motion_pose.cov_position + motion_pose.cov_velocity * dt;              
-            
-            }else{
-              std::cout << "Error in motion_model. Velocity or orientation is unset." << std::endl;
-              if(!last_orientation.hasValidOrientation())
-                std::cout << "Invalid orientation" << std::endl;
-            }
-
-          }else{
-            std::cout << "Timestampdifference between thruster-samples to big" << std::endl;
-            std::cout << lastThrusterTime.toString() << std::endl;
-            std::cout << j.time.toString() << std::endl;
-          }
-          
-      }     
+      }
         
         lastThrusterTime = joint.time;      
         motion_pose.orientation = last_orientation.orientation;
@@ -284,6 +230,7 @@ bool MotionModel::initMotionConfig()
     }
     
     config.joint_names = names; 
+    joint_adapter.setJointNames(names);
     
     return true;
 }
@@ -4,10 +4,10 @@
 #define UW_PARTICLE_LOCALIZATION_MOTIONMODEL_TASK_HPP
 
 #include "uw_particle_localization/MotionModelBase.hpp"
-#include <uwv_dynamic_model/uwv_dynamic_model.h>
-#include <uw_localization/model/uw_motion_model.hpp>
 #include <base/Eigen.hpp>
 #include "LocalizationConfig.hpp"
+#include "DeadReckoning.hpp"
+#include "JointAdapter.hpp"
 
 namespace uw_particle_localization {
 
@@ -36,9 +36,9 @@ namespace uw_particle_localization {
       
       
     private:
-	uw_localization::UwMotionModel motion_model;
-	underwaterVehicle::DynamicModel* dynamic_model;
-	underwaterVehicle::Parameters dynamic_model_params;
+	uw_localization::DeadReckoning own_dead_reckoning;
+	uw_localization::DeadReckoning* dead_reckoning;
+	uw_localization::JointAdapter joint_adapter;
 	
 	base::Time lastThrusterTime;
 	base::samples::RigidBodyState motion_pose;
@@ -38,7 +38,7 @@ bool OrientationCorrection::startHook()
     if (! OrientationCorrectionBase::startHook())
         return false;
     
-    offset_buffer = new boost::circular_buffer<double>(_buffer_size.get());
+    offset_buffer = new uw_localization::CircularMedian(_buffer_size.get());
     
     lastOrientation.time = base::Time::fromSeconds(0);
     lastIMU.time = base::Time::fromSeconds(0);
@@ -83,11 +83,11 @@ void OrientationCorrection::updateHook()
     sonar_wall_hough::PositionQuality offset;    
     while(_orientation_offset.read(offset) == RTT::NewData){
       
-      offset_buffer->push_back(offset.orientation_drift);
+      offset_buffer->push(offset.orientation_drift);
       
       if(offset_buffer->size() >= _min_buffer_size.get()){
 	
-	double sonar_offset = calcMedian(offset_buffer);
+	double sonar_offset = offset_buffer->median();
         actOffsetVal = -sonar_offset;
 	actOffset = actNorthOffset * Eigen::AngleAxis<double>(-sonar_offset, Eigen::Vector3d::UnitZ());
       
@@ -120,61 +120,8 @@ bool OrientationCorrection::reset(double angle){
   return true;
 }
 
-double OrientationCorrection::calcMedian(boost::circular_buffer<double> *buffer){
+void OrientationCorrection::middleOffsets(uw_localization::CircularMedian *buffer){
   
-  if(!buffer->empty()){
-   
-    std::list<double> sorted_list;
-    
-    //Sort the buffered offsets
-    for(boost::circular_buffer<double>::iterator it = buffer->begin(); it != buffer->end(); it++){
-      
-      if(sorted_list.empty()){
-	sorted_list.push_back(*it);
-      }else{
-	
-	std::list<double>::iterator jt = sorted_list.begin();
-		
-	while( jt != sorted_list.end() && *jt < *it)
-	  jt++;
-	
-	if(jt != sorted_list.end()){
-	  sorted_list.insert(jt, *it);
-	}
-	else{
-	  sorted_list.push_back(*it);
-	}
-	
-      }     
-    
-    }
-    
-    //Return the middle element of the list
-    std::list<double>::iterator jt = sorted_list.begin();
-    
-    //since there is no random access to lists, iterate to the middle element
-    for(unsigned int i = 0; i < sorted_list.size()/2; i++){
-      jt++;
-      
-    }
-        
-    return *jt;    
-  }
-  
-  return 0.0;  
-}
-
-void OrientationCorrection::middleOffsets(boost::circular_buffer<double> *buffer){
-  
-  if(!buffer->empty()){
-    
-    for(boost::circular_buffer<double>::iterator it = buffer->begin(); it != buffer->end(); it++){
-      
-      *it -= actOffsetVal;
-      
-    }   
-    
-  } 
+  buffer->shift(-actOffsetVal);
   
 }
-
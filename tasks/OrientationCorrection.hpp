@@ -4,8 +4,8 @@
 #define UW_PARTICLE_LOCALIZATION_ORIENTATIONCORRECTION_TASK_HPP
 
 #include "uw_particle_localization/OrientationCorrectionBase.hpp"
-#include <boost/circular_buffer.hpp>
 #include <math.h>
+#include "CircularMedian.hpp"
 
 namespace uw_particle_localization {
 
@@ -95,14 +95,13 @@ namespace uw_particle_localization {
 	
           base::samples::RigidBodyState lastOrientation;
           base::samples::RigidBodyState lastIMU;
-          boost::circular_buffer<double> *offset_buffer;
+          uw_localization::CircularMedian *offset_buffer;
           
           Eigen::AngleAxis<double> actOffset;
           double actOffsetVal;
           Eigen::AngleAxis<double> actNorthOffset;
           
-          double calcMedian(boost::circular_buffer<double> *buffer);
-          void middleOffsets(boost::circular_buffer<double> *buffer);
+          void middleOffsets(uw_localization::CircularMedian *buffer);
           
           int offset_recieved;
           base::Time lastResetRecieved;	
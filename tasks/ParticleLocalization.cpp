@@ -7,29 +7,35 @@ using namespace machine_learning;
 
 namespace uw_localization {
 
+//Declared by uw_localization, but not used: every filter reads its own vehicle_pose
 base::samples::RigidBodyState* PoseSlamParticle::pose = 0;
 
 ParticleLocalization::ParticleLocalization(const FilterConfig& config) 
     : ParticleFilter<PoseSlamParticle>(), filter_config(config),
     StaticSpeedNoise(Random::multi_gaussian(Eigen::Vector3d(0.0, 0.0, 0.0), config.static_speed_covariance)),
     StaticMotionNoise(Random::multi_gaussian(Eigen::Vector3d(0.0, 0.0, 0.0), config.static_motion_covariance)),
-    perception_history_sum(0.0),
-    sonar_debug(0)
+    perception_history(config.perception_history_number),
+    sonar_debug(0),
+    timing(0),
+    map_journal(0)
 {
     first_perception_received = false;
-    PoseSlamParticle::pose = &vehicle_pose;
     utm_origin = base::Vector3d::Zero();
     utm_origin[0] = -1;
-    dynamic_model = 0;
+    dead_reckoner = &own_dead_reckoner;
+    shared_dead_reckoner = false;
+    compiled_map = 0;
     max_features_per_cell = 0;
+    rated_beams = 0;
+    merged_beams = 0;
+    dropped_beams = 0;
+    sonar_preprocessor.configure(config);
+    selectKernels();
+    indexEnvironment();
 }
 
 ParticleLocalization::~ParticleLocalization()
 { 
-  if(filter_config.advanced_motion_model){
-    delete dynamic_model;
-    dynamic_model = 0;
-  }
 }
 
 
@@ -88,6 +94,16 @@ void ParticleLocalization::init_slam(NodeMap *map){
   
 }
 
+void ParticleLocalization::rebind_slam(NodeMap *map){
+  
+  for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); it++){
+    it->depth_cells.clear();
+    it->obstacle_cells.clear();
+  }
+  
+  init_slam(map);
+}
+
 
 void ParticleLocalization::initialize(int numbers, const Eigen::Vector3d& pos, const Eigen::Vector3d& var, double yaw, double yaw_cov)
 {  
@@ -118,7 +134,6 @@ void ParticleLocalization::initialize(int numbers, const Eigen::Vector3d& pos, c
     
     particles.clear();
     perception_history.clear();
-    perception_history_sum = 0.0;
 
     for(int i = 0; i < numbers; i++) {
         PoseSlamParticle pp;
@@ -139,15 +154,19 @@ void ParticleLocalization::initialize(int numbers, const Eigen::Vector3d& pos, c
 
     generation++;
 
-    motion_pose.position = pos;
-    motion_pose.velocity << 0.0,0.0,0.0;
-    motion_pose.angular_velocity << 0.0,0.0,0.0;
-    motion_pose.time = base::Time::now();
+    //The particles are predicted with an own model, which is not shared and needs no lock
+    predictor.configure(filter_config);
+    selectKernels();
     
-    full_motion_pose.position = pos;
-    full_motion_pose.velocity << 0.0, 0.0, 0.0;
-    full_motion_pose.angular_velocity << 0.0, 0.0, 0.0;
-    full_motion_pose.time = base::Time::now();
+    //An own dead reckoning starts at the new position. A shared one is configured by its
+    //first consumer, it starts at its init_position. Its pose belongs to all consumers, so it is not reset
+    if(!shared_dead_reckoner){
+      dead_reckoner->configure(filter_config);
+      dead_reckoner->reset(pos);
+    }
+    else{
+      dead_reckoner->configureOnce(filter_config);
+    }
     
     vehicle_pose.position = pos;
     vehicle_pose.velocity << 0.0, 0.0, 0.0;
@@ -155,17 +174,6 @@ void ParticleLocalization::initialize(int numbers, const Eigen::Vector3d& pos, c
     vehicle_pose.time = base::Time::now();
     
     best_sonar_measurement.confidence = 0.0;
-    lastActuatorTime = base::Time();
-    
-    if(filter_config.advanced_motion_model){
-      
-      underwaterVehicle::Parameters params = initializeDynamicModel(VehicleParameter(filter_config), filter_config);
-      dynamic_model = new underwaterVehicle::DynamicModel(0.1, 5, 0.0, NULL, 12, 6);
-      dynamic_model->init_param(params);
-      dynamic_model_params = params;
-    }else{      
-      motion_model.init(VehicleParameter(filter_config));
-    }
 }
 
 underwaterVehicle::Parameters ParticleLocalization::initializeDynamicModel(UwVehicleParameter p, FilterConfig filter_config){
@@ -267,16 +275,128 @@ underwaterVehicle::Parameters ParticleLocalization::initializeDynamicModel(UwVeh
 void ParticleLocalization::updateConfig(const FilterConfig& config){
   filter_config = config;
   dp_slam.update_config(config);
+  sonar_preprocessor.configure(config);
+  selectKernels();
+  
+  //The config is updated periodically, the environment rarely changes
+  if(config.env != indexed_env)
+    indexEnvironment();
+}
+
+void ParticleLocalization::selectKernels(){
+  
+  //The predictor decides about the dynamic model, it is configured by initialize
+  if(filter_config.pure_random_motion)
+    selectMotionKernels< MotionPolicy<true, false, false> >();
+  else if(predictor.usesDynamicsCache())
+    selectMotionKernels< MotionPolicy<false, true, true> >();
+  else if(predictor.dynamicModel())
+    selectMotionKernels< MotionPolicy<false, true, false> >();
+  else
+    selectMotionKernels< MotionPolicy<false, false, false> >();
+  
+  if(filter_config.use_markov)
+    laser_observer = &ParticleLocalization::observeBeams< ObservationPolicy<true>, &ParticleLocalization::laserLogPerception >;
+  else
+    laser_observer = &ParticleLocalization::observeBeams< ObservationPolicy<false>, &ParticleLocalization::laserLogPerception >;
+  
+  //With slam and without mapping only, the particles are rated by their maps
+  if(filter_config.use_slam && !filter_config.use_mapping_only)
+    selectSonarKernels< SonarPolicy<true, false, false> >();
+  else if(filter_config.use_slam && filter_config.use_best_feature_only)
+    selectSonarKernels< SonarPolicy<true, true, true> >();
+  else if(filter_config.use_slam)
+    selectSonarKernels< SonarPolicy<true, true, false> >();
+  else if(filter_config.use_best_feature_only)
+    selectSonarKernels< SonarPolicy<false, false, true> >();
+  else
+    selectSonarKernels< SonarPolicy<false, false, false> >();
+  
+  if(filter_config.use_slam && !filter_config.single_depth_map){
+    depth_kernel = &ParticleLocalization::depthPerception< DepthPolicy<true, false> >;
+    depth_profile_kernel = &ParticleLocalization::depthProfilePerception< DepthPolicy<true, false> >;
+  }else if(!filter_config.use_slam && filter_config.use_initial_depthmap){
+    depth_kernel = &ParticleLocalization::depthPerception< DepthPolicy<false, true> >;
+    depth_profile_kernel = &ParticleLocalization::depthProfilePerception< DepthPolicy<false, true> >;
+  }else{
+    depth_kernel = &ParticleLocalization::depthPerception< DepthPolicy<false, false> >;
+    depth_profile_kernel = &ParticleLocalization::depthProfilePerception< DepthPolicy<false, false> >;
+  }
+  
+  if(filter_config.useMap)
+    gps_kernel = &ParticleLocalization::gpsPerception< GpsPolicy<true> >;
+  else
+    gps_kernel = &ParticleLocalization::gpsPerception< GpsPolicy<false> >;
+}
+
+template<class Motion>
+void ParticleLocalization::selectMotionKernels(){
+  speed_kernel = &ParticleLocalization::speedDynamic<Motion>;
+  thruster_kernel = &ParticleLocalization::thrusterDynamic<Motion>;
+  speed_update = &ParticleLocalization::speedUpdate<Motion>;
+  thruster_update = &ParticleLocalization::thrusterUpdate<Motion>;
+}
+
+template<class Sonar>
+void ParticleLocalization::selectSonarKernels(){
+  sonar_kernel = &ParticleLocalization::sonarPerception<Sonar>;
+  sonar_log_kernel = &ParticleLocalization::sonarBeamsLogPerception<Sonar>;
+  
+  if(filter_config.use_markov)
+    sonar_observer = &ParticleLocalization::observeBeams< ObservationPolicy<true>, &ParticleLocalization::sonarBeamsLogPerception<Sonar> >;
+  else
+    sonar_observer = &ParticleLocalization::observeBeams< ObservationPolicy<false>, &ParticleLocalization::sonarBeamsLogPerception<Sonar> >;
+}
+
+void ParticleLocalization::indexEnvironment(){
+  if(filter_config.env)
+    geometry_index.build(*filter_config.env);
+  else
+    geometry_index.clear();
+
+  indexed_env = filter_config.env;
+  
+  //The nodes of the map are unknown, so the layers are queried by the node map and the depths are read from the grid
+  layers.unresolve();
+  compiled_map = 0;
+}
+
+void ParticleLocalization::setEnvironment(Environment* env, const GeometryIndex& index, const MapLayers& layers, const CompiledMap* compiled_map){
+  filter_config.env = env;
+  geometry_index = index;
+  indexed_env = env;
+  this->layers = layers;
+  this->compiled_map = compiled_map;
 }
 
 void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::RigidBodyState& U, const NodeMap& map)
+{
+    (this->*speed_kernel)(X, U, map);
+}
+
+void ParticleLocalization::update(const base::samples::RigidBodyState& U, const NodeMap& map)
+{
+    (this->*speed_update)(U, map);
+}
+
+template<class Motion>
+void ParticleLocalization::speedUpdate(const base::samples::RigidBodyState& U, const NodeMap& map)
+{
+    for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it)
+      speedDynamic<Motion>(*it, U, map);
+    
+    timestamp = U.time;
+}
+
+template<class Motion>
+void ParticleLocalization::speedDynamic(PoseSlamParticle& X, const base::samples::RigidBodyState& U, const NodeMap& map)
 {
     base::Vector3d v_noisy;
     base::Vector3d u_velocity;
 
     used_dvl = true;
     
-    if(filter_config.pure_random_motion)
+    if(Motion::pure_random)
         u_velocity = base::Vector3d(0.0, 0.0, 0.0);
     else
         u_velocity = U.velocity;
@@ -289,7 +409,7 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Rig
       
       base::Vector3d pos = X.p_position + vehicle_pose.orientation * (v_avg * dt);
       
-      if(map.belongsToWorld(pos)){      
+      if(belongsToWorld(pos, map)){      
         X.p_position = pos;
       }
       else{
@@ -305,7 +425,26 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Rig
 
 void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Joints& Ut, const NodeMap& map)
 {
-    Vector6d Xt;
+    (this->*thruster_kernel)(X, Ut, map);
+}
+
+void ParticleLocalization::update(const base::samples::Joints& Ut, const NodeMap& map)
+{
+    (this->*thruster_update)(Ut, map);
+}
+
+template<class Motion>
+void ParticleLocalization::thrusterUpdate(const base::samples::Joints& Ut, const NodeMap& map)
+{
+    for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it)
+      thrusterDynamic<Motion>(*it, Ut, map);
+    
+    timestamp = Ut.time;
+}
+
+template<class Motion>
+void ParticleLocalization::thrusterDynamic(PoseSlamParticle& X, const base::samples::Joints& Ut, const NodeMap& map)
+{
     base::Time sample_time = Ut.time;
     
     used_dvl = false;
@@ -321,27 +460,10 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Joi
 	  base::Vector3d v_noisy;
 	  base::Vector3d u_velocity;
 
-	    if(filter_config.pure_random_motion) {
+	    if(Motion::pure_random) {
 		u_velocity = base::Vector3d(0.0, 0.0, 0.0);
-	    }else if(filter_config.advanced_motion_model){	  	  
-
-              //UPdate motion model
-	      dynamic_model->setPosition(X.p_position);
-	      dynamic_model->setLinearVelocity(X.p_velocity);
-              dynamic_model->setAngularVelocity(base::Vector3d::Zero());
-              dynamic_model->setOrientation(vehicle_pose.orientation);
-	      dynamic_model->setSamplingtime(dt);
-	      dynamic_model->setPWMLevels(Ut);	
-	      
-	      u_velocity = dynamic_model->getLinearVelocity();
-	      
-	    }else{  
-	      Xt << X.p_velocity.x(), X.p_velocity.y(), X.p_velocity.z(), 
-		  X.p_position.x(), X.p_position.y(), X.p_position.z();
-
-		Vector6d V = motion_model.transition(Xt, dt, Ut);
-
-		u_velocity = V.block<3, 1>(0, 0);	   
+	    }else{
+	      u_velocity = predictor.predict<Motion>(X.p_velocity, vehicle_pose.orientation, Ut, dt);
 	    }   
 	  
 	  //Motion noise. Noise depends on the delta-time. For a long time intervall, there is more noise
@@ -355,7 +477,7 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Joi
             base::Vector3d pos = X.p_position + vehicle_pose.orientation * (v_avg * dt);
           
             //Only exept new position, if new position is part of world
-            if(map.belongsToWorld(pos)){
+            if(belongsToWorld(pos, map)){
               X.p_position = pos;
             }
             else{
@@ -365,13 +487,14 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Joi
 	    X.p_velocity = v_noisy;
           
           //Cut off velocity ddift
+          base::Vector3d motion_velocity = dead_reckoner->getVelocity();
           for(int i = 0; i < 3; i++){
             
-            if(X.p_velocity[i] < motion_pose.velocity[i] - filter_config.max_velocity_drift)
-              X.p_velocity[i] = motion_pose.velocity[i] - filter_config.max_velocity_drift;
+            if(X.p_velocity[i] < motion_velocity[i] - filter_config.max_velocity_drift)
+              X.p_velocity[i] = motion_velocity[i] - filter_config.max_velocity_drift;
             
-            if(X.p_velocity[i] > motion_pose.velocity[i] + filter_config.max_velocity_drift)
-              X.p_velocity[i] = motion_pose.velocity[i] + filter_config.max_velocity_drift;
+            if(X.p_velocity[i] > motion_velocity[i] + filter_config.max_velocity_drift)
+              X.p_velocity[i] = motion_velocity[i] + filter_config.max_velocity_drift;
             
           }        
           
@@ -385,83 +508,22 @@ void ParticleLocalization::dynamic(PoseSlamParticle& X, const base::samples::Joi
 }
  
 
-void ParticleLocalization::update_dead_reckoning(const base::samples::Joints& Ut)
+bool ParticleLocalization::update_dead_reckoning(const base::samples::Joints& Ut)
 {   
-    base::Time sample_time = Ut.time;
-    if(sample_time.isNull())
-      sample_time = base::Time::now(); 
-    
-    if( !lastActuatorTime.isNull() ) {
-        Vector6d Xt;
-	base::Vector3d u_t1;
-	double dt = (Ut.time - lastActuatorTime).toSeconds();
-	
-	if(dt < 5.0 && dt >= 0.0){
-	  
-	  if(filter_config.advanced_motion_model){
-		      
-	    //std::cout << "Velocity: " << motion_pose.velocity[0] << " " << motion_pose.velocity[1] << std::endl;
-	    dynamic_model->setPosition(motion_pose.position);
-	    dynamic_model->setLinearVelocity(motion_pose.velocity);
-	    dynamic_model->setAngularVelocity(base::Vector3d::Zero());
-	    dynamic_model->setOrientation(vehicle_pose.orientation);
-	    dynamic_model->setSamplingtime(dt);
-	    
-	    dynamic_model->setPWMLevels(Ut);	   
-	    
-	    u_t1 = dynamic_model->getLinearVelocity();	
-	    
-	    //Full dead reckoning
-	    dynamic_model->setPosition(full_motion_pose.position);
-	    dynamic_model->setLinearVelocity(full_motion_pose.velocity);
-	    dynamic_model->setAngularVelocity(full_motion_pose.angular_velocity);
-	    dynamic_model->setOrientation(full_motion_pose.orientation);
-	    
-	    dynamic_model->setPWMLevels(Ut);
-	    
-	    full_motion_pose.position = dynamic_model->getPosition();
-	    full_motion_pose.velocity = dynamic_model->getLinearVelocity();
-	    full_motion_pose.angular_velocity = dynamic_model->getAngularVelocity();
-	    full_motion_pose.orientation = dynamic_model->getOrientation_in_Quat();
-	    full_motion_pose.time = Ut.time;
-	    
-	    
-	    //std::cout << "new Velocity: " << u_t1[0] << " " << u_t1[1] << std::endl ;
-	  }else{
-	    
-	    Xt.block<3,1>(0,0) = motion_pose.velocity;
-	    Xt.block<3,1>(3,0) = base::Vector3d(0.0, 0.0, 0.0);
-	    
-	    Vector6d V = motion_model.transition(Xt, dt, Ut);
-	    u_t1 = V.block<3,1>(0,0);	   
-	  }
-
-	  base::Vector3d v_avg = (motion_pose.velocity + u_t1) / 2.0;
-	  
-	  if(base::samples::RigidBodyState::isValidValue(u_t1) && vehicle_pose.hasValidOrientation() && vehicle_pose.hasValidVelocity()){
-	    
-	    motion_pose.position = motion_pose.position + vehicle_pose.orientation * (v_avg * dt);
-	    motion_pose.velocity = u_t1;	 
-	  
-	  }else{
-	    std::cout << "Error in motion_model. Velocity or orientation is unset." << std::endl;
-	    if(!vehicle_pose.hasValidOrientation())
-	      std::cout << "Invalid orientation" << std::endl;
-	  }
-	}else{
-          std::cout << "Timestampdifference between thruster-samples to big or negative" << std::endl;
-          std::cout << "Last: " << lastActuatorTime << " actual: " << Ut.time << std::endl; 
-	}
-	
-    } 
+    if(!vehicle_pose.hasValidOrientation()){
+      std::cout << "Error in motion_model. Invalid orientation" << std::endl;
+      return false;
+    }
     
-    lastActuatorTime = sample_time;
-    motion_pose.time = base::Time::now();
+    //Integrates the sample, unless another consumer of a shared dead reckoning did it already
+    bool valid = dead_reckoner->update(Ut, vehicle_pose.orientation);
+    dead_reckoner->setZVelocity(vehicle_pose.velocity.z());
     
-    motion_pose.velocity.z() = vehicle_pose.velocity.z();
-    vehicle_pose.velocity.x() = motion_pose.velocity.x();
-    vehicle_pose.velocity.y() = motion_pose.velocity.y();
+    base::Vector3d velocity = dead_reckoner->getVelocity();
+    vehicle_pose.velocity.x() = velocity.x();
+    vehicle_pose.velocity.y() = velocity.y();
     
+    return valid;
 }
 
 
@@ -490,14 +552,15 @@ double ParticleLocalization::observeAndDebug(const base::samples::LaserScan& z,
     
     double effective_sample_size;
     
-    if(filter_config.use_markov)
-      effective_sample_size = observe_markov(z, m, importance);
-    else      
-      effective_sample_size = observe(z, m, importance);
+    {
+      ScopedTiming t(timing, TIMING_PERCEPTION);
+      effective_sample_size = (this->*laser_observer)(sonar_preprocessor.prepare(z), m, importance);
+    }
     
     best_sonar_measurement.time = z.time;
 
-    sonar_debug->write(best_sonar_measurement);
+    if(sonar_debug)
+      sonar_debug->write(best_sonar_measurement);
 
     if(best_sonar_measurement.status == OKAY)
         addHistory(best_sonar_measurement);
@@ -521,14 +584,16 @@ double ParticleLocalization::observeAndDebug(const sonar_detectors::ObstacleFeat
     
     double effective_sample_size;
     
-    if(filter_config.use_markov)
-      effective_sample_size = observe_markov(z, m, importance);
-    else      
-      effective_sample_size = observe(z, m, importance);
+    {
+      ScopedTiming t(timing, TIMING_PERCEPTION);
+      std::vector<SonarFeatures> beams(1, sonar_preprocessor.prepare(z));
+      effective_sample_size = (this->*sonar_observer)(beams, m, importance);
+    }
     
     best_sonar_measurement.time = z.time;
 
-    sonar_debug->write(best_sonar_measurement);
+    if(sonar_debug)
+      sonar_debug->write(best_sonar_measurement);
 
     if(best_sonar_measurement.status == OKAY)
         addHistory(best_sonar_measurement);
@@ -546,6 +611,74 @@ double ParticleLocalization::observeAndDebug(const sonar_detectors::ObstacleFeat
 
 
 
+double ParticleLocalization::observeAndDebug(const std::vector<base::samples::LaserScan>& z, NodeMap& m, double importance)
+{
+    zeroConfidenceCount = 0;
+    measurement_incomplete = false;
+    merged_beams += z.size();
+    
+    double effective_sample_size;
+    
+    {
+      ScopedTiming t(timing, TIMING_PERCEPTION);
+      effective_sample_size = (this->*laser_observer)(sonar_preprocessor.prepare(z), m, importance);
+    }
+    
+    if(!z.empty())
+      best_sonar_measurement.time = z.back().time;
+
+    if(sonar_debug)
+      sonar_debug->write(best_sonar_measurement);
+
+    if(best_sonar_measurement.status == OKAY)
+        addHistory(best_sonar_measurement);
+
+    best_sonar_measurement.confidence = -1.0;
+    
+    if(zeroConfidenceCount > 0 && filter_config.filterZeros)
+      filterZeros();
+
+    if(measurement_incomplete)
+      return INFINITY; //If we have no complete meassurement, we do not want to resample!!!
+    
+    return effective_sample_size;
+}
+
+
+double ParticleLocalization::observeAndDebug(const std::vector<sonar_detectors::ObstacleFeatures>& z, NodeMap& m, double importance)
+{
+    zeroConfidenceCount = 0;
+    measurement_incomplete = false;
+    merged_beams += z.size();
+    
+    double effective_sample_size;
+    
+    {
+      ScopedTiming t(timing, TIMING_PERCEPTION);
+      effective_sample_size = (this->*sonar_observer)(sonar_preprocessor.prepare(z), m, importance);
+    }
+    
+    if(!z.empty())
+      best_sonar_measurement.time = z.back().time;
+
+    if(sonar_debug)
+      sonar_debug->write(best_sonar_measurement);
+
+    if(best_sonar_measurement.status == OKAY)
+        addHistory(best_sonar_measurement);
+
+    best_sonar_measurement.confidence = -1.0;
+    
+    if(zeroConfidenceCount > 0 && filter_config.filterZeros)
+      filterZeros();
+
+    if(measurement_incomplete)
+      return INFINITY; //If we have no complete meassurement, we do not want to resample!!!
+    
+    return effective_sample_size;
+}
+
+
 double ParticleLocalization::observeAndDebug(const base::samples::RigidBodyState& z, NodeMap& m, double importance)
 {	
     if(utm_origin[0]==-1){
@@ -590,43 +723,124 @@ double ParticleLocalization::observeAndDebug(const base::samples::RigidBodyState
 
 
 
+template<class Observation, double (ParticleLocalization::*LogPerception)(PoseSlamParticle&, const std::vector<SonarFeatures>&, NodeMap&)>
+double ParticleLocalization::observeBeams(const std::vector<SonarFeatures>& beams, NodeMap& M, double importance)
+{
+    std::vector<double> log_weights;
+    log_weights.reserve(particles.size());
+    double best = -INFINITY;
+    
+    for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it){
+      unsigned int rated = rated_beams;
+      double log_weight = importance * (this->*LogPerception)(*it, beams, M);
+      
+      //Markov weights only depend on the measurement, unless it could not rate the particle
+      if(!Observation::markov || rated == rated_beams)
+        log_weight += std::log(it->main_confidence);
+      
+      if(log_weight > best)
+        best = log_weight;
+      
+      log_weights.push_back(log_weight);
+    }
+    
+    return setLogWeights(log_weights, best);
+}
+
+
+double ParticleLocalization::setLogWeights(const std::vector<double>& log_weights, double best)
+{
+    //No particle is possible, filterZeros handles the zero weights
+    if(!(best > -INFINITY)){
+      
+      for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it)
+        it->main_confidence = 0.0;
+      
+      effective_sample_size = 0.0;
+      return effective_sample_size;
+    }
+    
+    //Relative to the best particle, so the exponent does not underflow for every particle
+    double sum = 0.0;
+    std::vector<double>::const_iterator log_it = log_weights.begin();
+    
+    for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it, ++log_it){
+      it->main_confidence = std::isnan(*log_it) ? 0.0 : std::exp(*log_it - best);
+      sum += it->main_confidence;
+    }
+    
+    double square_sum = 0.0;
+    
+    for(std::list<PoseSlamParticle>::iterator it = particles.begin(); it != particles.end(); ++it){
+      it->main_confidence /= sum;
+      square_sum += it->main_confidence * it->main_confidence;
+    }
+    
+    //Relative to the number of particles, like the effective_sample_size_threshold
+    effective_sample_size = 1.0 / (square_sum * particles.size());
+    return effective_sample_size;
+}
+
+
 double ParticleLocalization::perception(PoseSlamParticle& X, const base::samples::LaserScan& Z, NodeMap& M)
 {
-    uw_localization::PointInfo info;
-    info.time = X.timestamp;
+    //Every range of the scan is a beam, the beams are prepared once for all particles
+    return std::exp(laserLogPerception(X, sonar_preprocessor.prepare(Z), M));
+}
 
-    double angle = Z.start_angle;
-    double yaw = base::getYaw(vehicle_pose.orientation);
-    double z_distance = Z.ranges[0] / 1000.0;
 
+double ParticleLocalization::laserLogPerception(PoseSlamParticle& X, const std::vector<SonarFeatures>& beams, NodeMap& M)
+{
     // check if this particle is still part of the world
-    if(!M.belongsToWorld(X.p_position)) {
-        debug(z_distance, X.p_position, 0.0, NOT_IN_WORLD);
+    if(!belongsToWorld(X.p_position, M)) {
+        debug(0.0, X.p_position, 0.0, NOT_IN_WORLD);
         zeroConfidenceCount++;
+        rated_beams++;
+        return -INFINITY;
+    }
+
+    if(beams.empty()){
+        debug(0.0, X.p_position, X.main_confidence, OUT_OF_RANGE);
         return 0.0;
     }
 
+    double yaw = base::getYaw(vehicle_pose.orientation);
+    Eigen::AngleAxis<double> abs_yaw(yaw, Eigen::Vector3d::UnitZ());
+
+    //The sum of the log propabilities, the product of a whole scan would underflow
+    double log_probability = 0.0;
+
+    for(std::vector<SonarFeatures>::const_iterator it = beams.begin(); it != beams.end(); it++){
+      unsigned int rated = rated_beams;
+      double probability = beamPerception(X, it->angle, it->features.front(), yaw, abs_yaw, M);
+      
+      if(rated != rated_beams)
+        log_probability += std::log(probability);
+    }
+
+    return log_probability;
+}
+
+
+double ParticleLocalization::beamPerception(PoseSlamParticle& X, double angle, const SonarFeature& Z, double yaw,
+                                            const Eigen::AngleAxis<double>& abs_yaw, NodeMap& M)
+{
+    double z_distance = Z.distance;
+
     // check if current laser scan is in a valid range
-    if(Z.ranges[0] == base::samples::TOO_FAR 
-            || z_distance > filter_config.sonar_maximum_distance 
-            || z_distance < filter_config.sonar_minimum_distance)
+    if(!Z.has(FEATURE_MEASURED | FEATURE_IN_SONAR_RANGE))
     {
         double p = 1.0 / (filter_config.sonar_maximum_distance - filter_config.sonar_minimum_distance);
         debug(z_distance, X.p_position, p, OUT_OF_RANGE);
+        rated_beams++;
         return p;
     }
    
     // check current measurement with map
-    Eigen::AngleAxis<double> sonar_yaw(angle, Eigen::Vector3d::UnitZ()); 
-    Eigen::AngleAxis<double> abs_yaw(yaw, Eigen::Vector3d::UnitZ());
-    Eigen::Affine3d SonarToAvalon(filter_config.sonarToAvalon);
-
-    Eigen::Vector3d RelativeZ = sonar_yaw * SonarToAvalon * base::Vector3d(z_distance, 0.0, 0.0);
-    Eigen::Vector3d AbsZ = (abs_yaw * RelativeZ) + X.p_position;
+    Eigen::Vector3d AbsZ = (abs_yaw * Z.relative) + X.p_position;
 
-    boost::tuple<Node*, double, Eigen::Vector3d> distance = M.getNearestDistance("root.wall", AbsZ, X.p_position);
-    boost::tuple<Node*, double, Eigen::Vector3d> distance_box = M.getNearestDistance("root.box",
-				  Eigen::Vector3d(0.0, filter_config.sonar_vertical_angle/2.0, yaw + angle), X.p_position);
+    LayerDistance distance = wallDistance(AbsZ, X.p_position, M);
+    LayerDistance distance_box = boxDistance(yaw + angle, X.p_position, M);
 
 
     double dst = distance.get<1>();
@@ -672,16 +886,30 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const base::samples
     //std::cout << distance.get<1>() << std::endl;    
     
     first_perception_received = true;
+    rated_beams++;
 
     return probability;
 }
 
 double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detectors::ObstacleFeatures& Z, NodeMap& M){
+  
+  //The beam is prepared by the first particle and reused by the others
+  return perception(X, sonar_preprocessor.prepare(Z), M);
+}
+
+double ParticleLocalization::perception(PoseSlamParticle& X, const SonarFeatures& Z, NodeMap& M){
+  
+  return (this->*sonar_kernel)(X, Z, M);
+}
+
+template<class Sonar>
+double ParticleLocalization::sonarPerception(PoseSlamParticle& X, const SonarFeatures& Z, NodeMap& M){
  
     //Check if particle is part of the map
-    if(!M.belongsToWorld(X.p_position)) {
+    if(!belongsToWorld(X.p_position, M)) {
         debug(0.0, X.p_position, 0.0, NOT_IN_WORLD);
         zeroConfidenceCount++;
+        rated_beams++;
         return 0.0;
     }  
   
@@ -693,14 +921,20 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detecto
      return p;
   }
   
-  if(filter_config.use_slam){
-    double val = dp_slam.observe(X, Z, base::getYaw(vehicle_pose.orientation), vehicle_pose.position.z());
+  if(Sonar::slam){
+    double val;
+    
+    {
+      ScopedTiming t(timing, TIMING_SLAM_OBSERVE);
+      val = dp_slam.observe(X, Z, base::getYaw(vehicle_pose.orientation), vehicle_pose.position.z());
+    }
         
-    if(!filter_config.use_mapping_only){
+    if(!Sonar::mapping_only){
     
       if(val == 0.0)
         return X.main_confidence;
       
+      rated_beams++;
       return val;
     }
   }
@@ -708,10 +942,8 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detecto
   
     double angle = Z.angle;
     double yaw = base::getYaw(vehicle_pose.orientation);
-    // Sonar transformations
-    Eigen::AngleAxis<double> sonar_yaw(angle, Eigen::Vector3d::UnitZ()); 
+    // The features are already in the vehicle frame
     Eigen::AngleAxis<double> abs_yaw(yaw, Eigen::Vector3d::UnitZ());    
-    Eigen::Affine3d SonarToAvalon(filter_config.sonarToAvalon);  
   
   
   bool valid_range = false;
@@ -723,32 +955,22 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detecto
   std::list<base::Vector3d> z_points;
   
   //Calculate perception for every feature
-  for(std::vector<sonar_detectors::ObstacleFeature>::const_iterator it = Z.features.begin(); it != Z.features.end(); it++){
+  for(std::vector<SonarFeature>::const_iterator it = Z.features.begin(); it != Z.features.end(); it++){
     
-    //If the confidence is zero, ignore feature
-    if(it->confidence <= 0.0)
+    //If the confidence is zero or the feature is out of range, ignore feature
+    if(!it->has(FEATURE_MEASURED | FEATURE_IN_SONAR_RANGE))
       continue;
     
-    double z_distance = it->range / 1000.0;
-    
-    // check if current laser scan is in a valid range
-    if(z_distance == base::samples::TOO_FAR 
-            || z_distance > filter_config.sonar_maximum_distance 
-            || z_distance < filter_config.sonar_minimum_distance)
-    {
-        continue;
-    }    
+    double z_distance = it->distance;
     
     //At least, on feature is in valid range
     valid_range = true;
     
-    Eigen::Vector3d RelativeZ = sonar_yaw * SonarToAvalon * base::Vector3d(z_distance, 0.0, 0.0);
-    Eigen::Vector3d AbsZ = (abs_yaw * RelativeZ) + X.p_position;
+    Eigen::Vector3d AbsZ = (abs_yaw * it->relative) + X.p_position;
     
     //Calculate perception model
-    boost::tuple<Node*, double, Eigen::Vector3d> distance = M.getNearestDistance("root.wall", AbsZ, X.p_position);
-    boost::tuple<Node*, double, Eigen::Vector3d> distance_box = M.getNearestDistance("root.box",
-                                  Eigen::Vector3d(0.0, filter_config.sonar_vertical_angle/2.0, yaw + angle), X.p_position);
+    LayerDistance distance = wallDistance(AbsZ, X.p_position, M);
+    LayerDistance distance_box = boxDistance(yaw + angle, X.p_position, M);
     
     double dist_diff = std::fabs(z_distance - distance.get<1>());
     double dist_diff_box = std::fabs(z_distance - distance_box.get<1>());
@@ -816,7 +1038,7 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detecto
   //Rate the best feature
   double probability;
   
-  if(filter_config.use_best_feature_only){ //Rate only the best feature
+  if(Sonar::best_feature_only){ //Rate only the best feature
     probability = gaussian1d(0.0, filter_config.sonar_covariance, best_diff);
   }  
   else{ //Rate all features, multiply probabilities
@@ -831,12 +1053,49 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const sonar_detecto
   debug(best_z, best_distance.get<1>() ,angle + yaw  ,best_distance.get<2>(), best_zPoint, X.p_position, probability, best_state);
   
   first_perception_received = true;
+  rated_beams++;
   
  return probability; 
 }
 
 
 
+double ParticleLocalization::perception(PoseSlamParticle& X, const std::vector<base::samples::LaserScan>& Z, NodeMap& M)
+{
+    return std::exp(laserLogPerception(X, sonar_preprocessor.prepare(Z), M));
+}
+
+
+double ParticleLocalization::perception(PoseSlamParticle& X, const std::vector<sonar_detectors::ObstacleFeatures>& Z, NodeMap& M)
+{
+    return std::exp(sonarLogPerception(X, sonar_preprocessor.prepare(Z), M));
+}
+
+
+double ParticleLocalization::sonarLogPerception(PoseSlamParticle& X, const std::vector<SonarFeatures>& beams, NodeMap& M)
+{
+    return (this->*sonar_log_kernel)(X, beams, M);
+}
+
+
+template<class Sonar>
+double ParticleLocalization::sonarBeamsLogPerception(PoseSlamParticle& X, const std::vector<SonarFeatures>& beams, NodeMap& M)
+{
+    double log_probability = 0.0;
+    
+    //The sum of the log propabilities, so a merged batch weights like its beams one by one
+    for(std::vector<SonarFeatures>::const_iterator it = beams.begin(); it != beams.end(); it++){
+      unsigned int rated = rated_beams;
+      double probability = sonarPerception<Sonar>(X, *it, M);
+      
+      if(rated != rated_beams)
+        log_probability += std::log(probability);
+    }
+    
+    return log_probability;
+}
+
+
 double ParticleLocalization::perception(PoseSlamParticle& X, const controlData::Pipeline& Z, NodeMap& M) 
 {
     double yaw = base::getYaw(vehicle_pose.orientation);
@@ -844,12 +1103,12 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const controlData::
 
     Eigen::Vector3d AbsZ = (abs_yaw * filter_config.pipelineToAvalon) + X.p_position;
 
-    boost::tuple<Node*, double, Eigen::Vector3d> distance;
+    LayerDistance distance;
     if(Z.inspection_state == controlData::END_OF_PIPE){
-        distance = M.getNearestDistance("root.end_of_pipe", AbsZ, X.p_position);
+        distance = layers.end_of_pipe.nearest(M, AbsZ, X.p_position);
 	
     }else if(Z.inspection_state == controlData::FOUND_PIPE || Z.inspection_state == controlData::FOLLOW_PIPE || Z.inspection_state){
-        distance = M.getNearestDistance("root.pipeline", AbsZ, X.p_position);
+        distance = layers.pipeline.nearest(M, AbsZ, X.p_position);
     }
 
     double probability = gaussian1d(0.0, filter_config.pipeline_covariance, distance.get<1>());
@@ -861,6 +1120,12 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const controlData::
 
 
 double ParticleLocalization::perception(PoseSlamParticle& X, const base::Vector3d& Z, NodeMap& M)
+{
+    return (this->*gps_kernel)(X, Z, M);
+}
+
+template<class Gps>
+double ParticleLocalization::gpsPerception(PoseSlamParticle& X, const base::Vector3d& Z, NodeMap& M)
 {
     Eigen::Matrix<double,2,1> pos;
     pos << X.p_position[0] , X.p_position[1];
@@ -870,7 +1135,7 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const base::Vector3
     gps << Z[0], Z[1];    
     
     //check if this particle is part of the world
-    if(filter_config.useMap && !M.belongsToWorld(X.p_position)) {
+    if(Gps::use_map && !belongsToWorld(X.p_position, M)) {
         debug(Z, 0.0, NOT_IN_WORLD); 
         return 0.0;
     }
@@ -893,7 +1158,7 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const avalon::featu
   Eigen::Vector3d buoyToCam = vehicle_pose.orientation * (filter_config.buoyCamRotation * Z.world_coord);
   Eigen::Vector3d buoyInWorld = cameraInWorld + buoyToCam;
   
-  double distance = M.getNearestDistance("root.buoy", buoyInWorld, X.p_position).get<1>();
+  double distance = layers.buoy.nearest(M, buoyInWorld, X.p_position).get<1>();
   
   double probability = gaussian1d(0.0, filter_config.buoy_covariance, distance);
   
@@ -905,12 +1170,18 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const avalon::featu
 
 double ParticleLocalization::perception(PoseSlamParticle& X, const double& Z, DepthObstacleGrid& M){
 
-  if(filter_config.use_slam && (!filter_config.single_depth_map) )
+  return (this->*depth_kernel)(X, Z, M);
+}
+
+template<class Depth>
+double ParticleLocalization::depthPerception(PoseSlamParticle& X, const double& Z, DepthObstacleGrid& M){
+
+  if(Depth::slam_depth_map)
     dp_slam.observe(X, Z);
   
-  if(!filter_config.use_slam && filter_config.use_initial_depthmap){
+  if(Depth::initial_depth_map){
     
-    double depth = M.getDepth(X.p_position.x(), X.p_position.y());
+    double depth = initialDepth(X.p_position.x(), X.p_position.y(), M);
     
     if(!isnan(depth)){
       
@@ -922,21 +1193,65 @@ double ParticleLocalization::perception(PoseSlamParticle& X, const double& Z, De
   return X.main_confidence;
   
 }  
+
+double ParticleLocalization::perception(PoseSlamParticle& X, const DepthProfile& Z, DepthObstacleGrid& M){
+
+  return (this->*depth_profile_kernel)(X, Z, M);
+}
+
+template<class Depth>
+double ParticleLocalization::depthProfilePerception(PoseSlamParticle& X, const DepthProfile& Z, DepthObstacleGrid& M){
+
+  if(Z.empty())
+    return X.main_confidence;
+  
+  const std::vector<DepthSample>& samples = Z.samples();
+  const base::Vector3d& reference = Z.back().position;
+  
+  if(Depth::slam_depth_map){
+    
+    //Every sample is mapped at its own position relative to the particle
+    base::Vector3d particle_position = X.p_position;
+    
+    for(std::vector<DepthSample>::const_iterator it = samples.begin(); it != samples.end(); it++){
+      X.p_position = particle_position + (it->position - reference);
+      dp_slam.observe(X, it->depth);
+    }
+    
+    X.p_position = particle_position;
+  }
+  
+  if(!Depth::initial_depth_map)
+    return X.main_confidence;
+  
+  double squared_error = 0.0;
+  int known_depths = 0;
+  
+  for(std::vector<DepthSample>::const_iterator it = samples.begin(); it != samples.end(); it++){
+    base::Vector3d position = X.p_position + (it->position - reference);
+    double depth = initialDepth(position.x(), position.y(), M);
+    
+    if(!isnan(depth)){
+      squared_error += (depth - it->depth) * (depth - it->depth);
+      known_depths++;
+    }
+  }
+  
+  if(known_depths == 0)
+    return X.main_confidence;
+  
+  //Geometric mean of the sample likelihoods, the product of a whole profile would underflow
+  return gaussian1d(0.0, filter_config.echosounder_variance, std::sqrt(squared_error / known_depths));
+}
   
 void ParticleLocalization::addHistory(const uw_localization::PointInfo& info)
 {
-    if(perception_history.size() >= filter_config.perception_history_number) {
-        perception_history_sum -= perception_history.front();
-        perception_history.pop_front();
-    }
-
-    perception_history.push_back(info.confidence);
-    perception_history_sum += perception_history.back();
+    perception_history.push(info.confidence);
 }
 
 bool ParticleLocalization::hasStats() const
 {
-    return (perception_history.size() == filter_config.perception_history_number) && !timestamp.isNull();
+    return perception_history.full() && !timestamp.isNull();
 }
 
 
@@ -944,11 +1259,13 @@ uw_localization::Stats ParticleLocalization::getStats() const
 {
     uw_localization::Stats stats;
     stats.timestamp = timestamp;
-    stats.uncertainty_degree = perception_history_sum / filter_config.perception_history_number;
+    stats.uncertainty_degree = perception_history.mean();
     stats.effective_sample_size = effective_sample_size;
     stats.particle_generation = generation;
     stats.used_dvl = used_dvl;
     stats.max_features_per_cell = max_features_per_cell;
+    stats.merged_beams = merged_beams;
+    stats.dropped_beams = dropped_beams;
     
     if(particles.size() > 0){
       stats.obstacle_features_per_particle = particles.front().obstacle_cells.size();
@@ -960,6 +1277,7 @@ uw_localization::Stats ParticleLocalization::getStats() const
 
 void ParticleLocalization::interspersal(const base::samples::RigidBodyState& p, const NodeMap& m, double ratio, bool random_uniform, bool invalidate_particles)
 {
+    ScopedTiming t(timing, TIMING_INTERSPERSAL);
     reduceParticles(1.0 - ratio);
 
     PoseSlamParticle best = particles.front();
@@ -1092,8 +1410,7 @@ void ParticleLocalization::setCurrentOrientation(const base::samples::RigidBodyS
       vehicle_pose.orientation = Eigen::AngleAxis<double>(filter_config.yaw_offset, Eigen::Vector3d::UnitZ()) * orientation.orientation;
       vehicle_pose.cov_orientation = orientation.cov_orientation;
 
-      motion_pose.orientation = vehicle_pose.orientation;
-      motion_pose.cov_orientation = vehicle_pose.cov_orientation;
+      dead_reckoner->setOrientation(vehicle_pose.orientation, vehicle_pose.cov_orientation);
     }
     
 }
@@ -1104,7 +1421,7 @@ void ParticleLocalization::setCurrentVelocity(const base::samples::RigidBodyStat
   if(base::samples::RigidBodyState::isValidValue(speed.velocity)){
   
     vehicle_pose.velocity = speed.velocity;
-    motion_pose.velocity = speed.velocity;
+    dead_reckoner->setVelocity(speed.velocity);
   }
   
 }
@@ -1114,7 +1431,7 @@ void ParticleLocalization::setCurrentAngularVelocity(const base::samples::RigidB
   if(base::samples::RigidBodyState::isValidValue(speed.angular_velocity)){
   
     vehicle_pose.angular_velocity = speed.angular_velocity;
-    motion_pose.angular_velocity = speed.angular_velocity;
+    dead_reckoner->setAngularVelocity(speed.angular_velocity);
   }
 }
 
@@ -1122,7 +1439,7 @@ void ParticleLocalization::setCurrentZVelocity(const base::samples::RigidBodySta
   
   if(!std::isnan(speed.velocity.z() )){
     vehicle_pose.velocity.z() = speed.velocity.z();
-    motion_pose.velocity.z() = speed.velocity.z();
+    dead_reckoner->setZVelocity(speed.velocity.z());
   }
   
 }
@@ -1131,36 +1448,62 @@ void ParticleLocalization::setCurrentDepth(const base::samples::RigidBodyState&
   
   if(!std::isnan(depth.position.z() )){
     vehicle_pose.position.z() = depth.position.z();
-    motion_pose.position.z() = depth.position.z();
+    dead_reckoner->setDepth(depth.position.z());
   }
   
 }
 
 void ParticleLocalization::setThrusterVoltage(double voltage){
-  if(filter_config.advanced_motion_model)
-    dynamic_model->setThrusterVoltage(voltage);
-  else
-    motion_model.setThrusterVoltage(voltage); 
+  predictor.setThrusterVoltage(voltage);
+  dead_reckoner->setThrusterVoltage(voltage);
+}
+
+
+LayerDistance ParticleLocalization::wallDistance(const base::Vector3d& point, const base::Vector3d& origin, const NodeMap& m) const{
+  
+  if(!filter_config.env || filter_config.env != indexed_env || geometry_index.size() != indexed_env->planes.size())
+    return layers.wall.nearest(m, point, origin);
+  
+  GeometryHit hit = geometry_index.nearest(point);
+  
+  if(hit.primitive < 0)
+    return LayerDistance(0, INFINITY, point);
+  
+  return LayerDistance(0, (hit.point - origin).norm(), hit.point);
 }
 
+LayerDistance ParticleLocalization::boxDistance(double yaw, const base::Vector3d& origin, const NodeMap& m) const{
+  
+  if(!geometry_index.hasBoxes())
+    return layers.box.beam(m, filter_config.sonar_vertical_angle/2.0, yaw, origin);
+  
+  GeometryHit hit = geometry_index.beam(origin, yaw, filter_config.sonar_vertical_angle/2.0);
+  
+  if(hit.primitive < 0)
+    return LayerDistance(0, INFINITY, origin);
+  
+  return LayerDistance(0, (hit.point - origin).norm(), hit.point);
+}
 
 double ParticleLocalization::angleDiffToCorner(double sonar_orientation, base::Vector3d position, Environment* env){
-  //Environment env = m.getEnvironment();
+  base::Vector2d point(position.x(), position.y());
+
+  //The environment of the filter is indexed, so only corners near the beam direction are checked
+  if(env == indexed_env && geometry_index.size() == env->planes.size())
+    return geometry_index.nearestCornerAngle(point, sonar_orientation, M_PI/2.0);
+
   double minAngleDiff = M_PI/2.0;
   
   for (std::vector<Plane>::iterator it = env->planes.begin() ; it != env->planes.end(); it++){
-      double angle = atan2(it->position[1] - position[1], it->position[0] - position[0]);
-      double angleDiff = fabs(sonar_orientation - angle) < M_PI ? fabs(sonar_orientation - angle) : (2.0*M_PI)-fabs(sonar_orientation - angle); 
-      
-      if(angleDiff < minAngleDiff)
-	minAngleDiff = angleDiff;
+      base::Vector3d corners[2] = {it->position, it->position + it->span_horizontal};
       
-      angle = atan2((it->position + it->span_horizontal)[1] - position[0],
-		    (it->position + it->span_horizontal)[0] - position[0]);
-      angleDiff = fabs(sonar_orientation - angle) < M_PI ? fabs(sonar_orientation - angle) : (2.0*M_PI)-fabs(sonar_orientation - angle);
-      
-      if(angleDiff < minAngleDiff)
-	minAngleDiff = angleDiff;    
+      for(int i = 0; i < 2; i++){
+        double angle = atan2(corners[i][1] - position[1], corners[i][0] - position[0]);
+        double angleDiff = fabs(atan2(sin(sonar_orientation - angle), cos(sonar_orientation - angle)));
+        
+        if(angleDiff < minAngleDiff)
+          minAngleDiff = angleDiff;
+      }
   }  
   
   return minAngleDiff;
@@ -1226,6 +1569,8 @@ void ParticleLocalization::setObstacles(const sonar_detectors::ObstacleFeatures&
     
     //std::cout << "obstacle: " << AbsZ.transpose() << std::endl;
     m.setObstacle(AbsZ.x(), AbsZ.y(), true, filter_config.feature_confidence);
+    if(map_journal)
+      map_journal->recordObstacle(AbsZ.x(), AbsZ.y(), true, filter_config.feature_confidence);
     
     base::Vector2d z_temp = m.getGridCoord(AbsZ.x(), AbsZ.y()); //Grid cell of the observation
     
@@ -1248,6 +1593,8 @@ void ParticleLocalization::setObstacles(const sonar_detectors::ObstacleFeatures&
   for(std::vector<Eigen::Vector2d>::iterator it_grid = grid_cells.begin(); it_grid != grid_cells.end(); it_grid++){
     //std::cout << "Remove obstacle: " << it_grid->transpose() << std::endl;
     m.setObstacle(it_grid->x(), it_grid->y(), false, filter_config.feature_empty_cell_confidence); 
+    if(map_journal)
+      map_journal->recordObstacle(it_grid->x(), it_grid->y(), false, filter_config.feature_empty_cell_confidence);
     
   }  
   
@@ -1257,7 +1604,26 @@ void ParticleLocalization::setObstacles(const sonar_detectors::ObstacleFeatures&
 void ParticleLocalization::setDepth(const double &depth, DepthObstacleGrid& m, const base::samples::RigidBodyState& rbs){
   
   m.setDepth(rbs.position.x(), rbs.position.y(), depth, filter_config.echosounder_variance + rbs.cov_position(0,0) );
+  if(map_journal)
+    map_journal->recordDepth(rbs.position.x(), rbs.position.y(), depth, filter_config.echosounder_variance + rbs.cov_position(0,0));
+  
+}
+
+void ParticleLocalization::setDepth(const DepthProfile& profile, DepthObstacleGrid& m, double position_covariance_threshold){
   
+  const std::vector<DepthSample>& samples = profile.samples();
+  
+  for(std::vector<DepthSample>::const_iterator it = samples.begin(); it != samples.end(); it++){
+    
+    if(it->cov_position(0,0) > position_covariance_threshold || it->cov_position(1,1) > position_covariance_threshold)
+      continue;
+    
+    double variance = filter_config.echosounder_variance + it->cov_position(0,0);
+    m.setDepth(it->position.x(), it->position.y(), it->depth, variance);
+    
+    if(map_journal)
+      map_journal->recordDepth(it->position.x(), it->position.y(), it->depth, variance);
+  }
 }
 
 
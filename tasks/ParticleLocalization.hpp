@@ -28,6 +28,16 @@
 #include "LocalizationConfig.hpp"
 #include "Types.hpp"
 #include "DPSlam.hpp"
+#include "MapJournal.hpp"
+#include "DeadReckoning.hpp"
+#include "GeometryIndex.hpp"
+#include "DepthProfile.hpp"
+#include "MapLayers.hpp"
+#include "CompiledMap.hpp"
+#include "SonarPreprocessor.hpp"
+#include "FilterPolicies.hpp"
+#include "Timing.hpp"
+#include "Fir.hpp"
 
 
 namespace uw_localization {
@@ -37,10 +47,13 @@ class ParticleLocalization : public ParticleFilter<PoseSlamParticle>,
   public Dynamic<PoseSlamParticle, base::samples::RigidBodyState, NodeMap>,
   public Perception<PoseSlamParticle, base::samples::LaserScan, NodeMap>,
   public Perception<PoseSlamParticle, sonar_detectors::ObstacleFeatures, NodeMap>,
+  public Perception<PoseSlamParticle, std::vector<base::samples::LaserScan>, NodeMap>,
+  public Perception<PoseSlamParticle, std::vector<sonar_detectors::ObstacleFeatures>, NodeMap>,
   public Perception<PoseSlamParticle, controlData::Pipeline, NodeMap>,
   public Perception<PoseSlamParticle, std::pair<double,double>, NodeMap>,
   public Perception<PoseSlamParticle, avalon::feature::Buoy, NodeMap>,
-  public Perception<PoseSlamParticle, double, DepthObstacleGrid>
+  public Perception<PoseSlamParticle, double, DepthObstacleGrid>,
+  public Perception<PoseSlamParticle, DepthProfile, DepthObstacleGrid>
 {
 public:
   ParticleLocalization(const FilterConfig& config);
@@ -49,14 +62,21 @@ public:
   static UwVehicleParameter VehicleParameter(FilterConfig filter_config);
 
   void init_slam(NodeMap *map);
+  
+  /**
+   * Binds the slam to a new map, the old map is not used afterwards.
+   * The features of the particles belong to the grid of the old map, so they are dropped
+   */
+  void rebind_slam(NodeMap *map);
   virtual void initialize(int numbers, const Eigen::Vector3d& pos, const Eigen::Vector3d& cov, double yaw, double yaw_cov);
   static underwaterVehicle::Parameters initializeDynamicModel(UwVehicleParameter p, FilterConfig filter_config);
   
   void updateConfig(const FilterConfig& config);
 
   virtual base::Position position(const PoseSlamParticle& X) const { return X.p_position; }
-  virtual base::Vector3d velocity(const PoseSlamParticle& X) const { return X.pose->velocity; }
-  virtual base::samples::RigidBodyState orientation(const PoseSlamParticle& X) const { return *(X.pose); }
+  //The vehicle pose belongs to this filter, so ensemble members do not read each other's pose
+  virtual base::Vector3d velocity(const PoseSlamParticle& X) const { return vehicle_pose.velocity; }
+  virtual base::samples::RigidBodyState orientation(const PoseSlamParticle& X) const { return vehicle_pose; }
   virtual bool isValid(const PoseSlamParticle& X) const {return X.valid; }
   virtual void setValid(PoseSlamParticle &X, bool flag){ X.valid = flag; }
 
@@ -66,11 +86,32 @@ public:
   virtual void dynamic(PoseSlamParticle& x, const base::samples::RigidBodyState& u, const NodeMap& m);
   virtual void dynamic(PoseSlamParticle& x, const base::samples::Joints& u, const NodeMap& m);
 
+  /**
+   * Moves all particles by a velocity or a thruster sample. The loop over the particles
+   * is specialized for the motion policy of the configuration, it hides the update of the
+   * ParticleFilter, which calls dynamic for every particle
+   */
+  void update(const base::samples::RigidBodyState& u, const NodeMap& m);
+  void update(const base::samples::Joints& u, const NodeMap& m);
+
   virtual const base::Time& getTimestamp(const base::samples::RigidBodyState& u);
   virtual const base::Time& getTimestamp(const base::samples::Joints& u);
   base::Time getCurrentTimestamp();
 
+  /**
+   * Calculates the propability of a particle using every range of a laser scan
+   * The beam angles are start_angle + i * angular_resolution, the propability
+   * is the product of the single beam propabilities. It underflows for long scans,
+   * observeAndDebug weights the particles with laserLogPerception instead
+   */
   virtual double perception(PoseSlamParticle& x, const base::samples::LaserScan& z, NodeMap& m);
+
+  /**
+   * Calculates the log propability of a particle using the prepared beams of laser scans.
+   * It is the sum of the log propabilities of the beams, which could be rated
+   */
+  double laserLogPerception(PoseSlamParticle& x, const std::vector<SonarFeatures>& beams, NodeMap& m);
+  
   virtual double perception(PoseSlamParticle& x, const controlData::Pipeline& z, NodeMap& m);
   virtual double perception(PoseSlamParticle& x, const avalon::feature::Buoy& z, NodeMap& m);  
   
@@ -82,6 +123,23 @@ public:
    * @return: propability of the particle
    */
   virtual double perception(PoseSlamParticle& x, const sonar_detectors::ObstacleFeatures& z, NodeMap& m);  
+  
+  /**
+   * Calculates the propability of a particle using several merged sonar beams
+   * The propability is the product of the single beam propabilities
+   * @param X: a Particle
+   * @param Z: consecutive sonar beams
+   * @param M: the nodemap
+   * @return: propability of the particle
+   */
+  virtual double perception(PoseSlamParticle& x, const std::vector<base::samples::LaserScan>& z, NodeMap& m);
+  virtual double perception(PoseSlamParticle& x, const std::vector<sonar_detectors::ObstacleFeatures>& z, NodeMap& m);
+  
+  /**
+   * Calculates the log propability of a particle using prepared sonar beams.
+   * It is the sum of the log propabilities of the beams, which could be rated
+   */
+  double sonarLogPerception(PoseSlamParticle& x, const std::vector<SonarFeatures>& beams, NodeMap& m);
     
  /**
  * Calculates the propability of a particle using a received gps-position
@@ -101,6 +159,16 @@ public:
    */  
   virtual double perception(PoseSlamParticle& x, const double& z, DepthObstacleGrid& m);
   
+  /**
+   * Calculates the position propability using several depth samples
+   * The propability is the geometric mean of the sample propabilities, each sample
+   * is compared and mapped at the particle position shifted by the vehicle motion since the sample
+   * @param x: a position particle
+   * @param z: depth samples in the order of arrival
+   * @param M: the gridmap
+   */
+  virtual double perception(PoseSlamParticle& x, const DepthProfile& z, DepthObstacleGrid& m);
+  
   /**
    * Delete a amount of particles and insert randomly new articles
    * @param pos: state of the vehicle, with position and position_covariance
@@ -116,6 +184,21 @@ public:
   
   double observeAndDebug(const sonar_detectors::ObstacleFeatures& z, NodeMap& m, double importance = 1.0);
   
+  /**
+   * Observes laser scans or consecutive sonar beams. The log propabilities
+   * of the beams are summed per particle, the weights are normalized relative to the best
+   * particle, so they do not underflow. The importance is the exponent of the propability
+   * @param z: beams in the order of arrival
+   * @return: the effectiv sample size, relative to the number of particles
+   */
+  double observeAndDebug(const std::vector<base::samples::LaserScan>& z, NodeMap& m, double importance = 1.0);
+  double observeAndDebug(const std::vector<sonar_detectors::ObstacleFeatures>& z, NodeMap& m, double importance = 1.0);
+  
+  /**
+   * Counts sonar beams, which were dropped by the task because of a backlog
+   */
+  void countDroppedBeams(unsigned int count) { dropped_beams += count; }
+  
   /**
    * Receives a perception as a gps-position and updates the current particle-set
    * @param z: Perception as an utm-coordinate
@@ -141,16 +224,80 @@ public:
   void setCurrentZVelocity(const base::samples::RigidBodyState& speed);
   void setCurrentDepth(const base::samples::RigidBodyState& depth);
 
-  void update_dead_reckoning(const base::samples::Joints& u);
-  const base::samples::RigidBodyState& dead_reckoning() const { return motion_pose; }
-  const base::samples::RigidBodyState& full_dead_reckoning() const { return full_motion_pose;}
+  /**
+   * Integrates a thruster sample into the dead reckoning
+   * @return: false, if the sample could not be integrated, see DeadReckoning::getError()
+   */
+  bool update_dead_reckoning(const base::samples::Joints& u);
+  base::samples::RigidBodyState dead_reckoning() const { return dead_reckoner->getPose(); }
+  base::samples::RigidBodyState full_dead_reckoning() const { return dead_reckoner->getFullPose(); }
 
   void setSonarDebug(DebugWriter<uw_localization::PointInfo>* debug) {
       sonar_debug = debug;
   }
   
+  /**
+   * Sets the recorder for the perception, interspersal and slam timings
+   * @param timing: recorder, or 0 to disable timing
+   */
+  void setTiming(TimingRecorder* timing) {
+      this->timing = timing;
+  }
+  
+  /**
+   * Sets the journal for all changes of the depth obstacle grid
+   * @param journal: journal, or 0 to disable journaling
+   */
+  void setMapJournal(MapJournal* journal) {
+      map_journal = journal;
+  }
+  
+  /**
+   * Uses linearized transitions of the dynamic model instead of integrating it
+   * for every particle. Only used with the advanced motion model
+   */
+  void enableDynamicsCache(const DynamicsCacheConfig& config) {
+      predictor.enableDynamicsCache(config);
+      dead_reckoner->enableDynamicsCache(config);
+      selectKernels();
+  }
+  
+  /**
+   * The dynamics cache of the particle predictions
+   */
+  const DynamicsCache& getDynamicsCache() const { return predictor.getDynamicsCache(); }
+  
+  /**
+   * Uses a dead reckoning, which is shared with other consumers of the
+   * thruster samples. Has to be set before initialize. The first
+   * consumer configures it, initialize does not reset its pose.
+   * @param reckoner: the shared dead reckoning, or 0 for an own instance
+   */
+  void setDeadReckoning(DeadReckoning* reckoner) {
+      shared_dead_reckoner = reckoner != 0;
+      dead_reckoner = reckoner ? reckoner : &own_dead_reckoner;
+  }
+  
+  const DeadReckoning& getDeadReckoning() const { return *dead_reckoner; }
+  
   void setThrusterVoltage(double voltage);
   
+  /**
+   * Index over the planes of the environment of the filter configuration,
+   * and the boxes and world bounds of its map
+   */
+  const GeometryIndex& getGeometryIndex() const { return geometry_index; }
+  
+  /**
+   * Replaces the environment of a new map, the particles are kept
+   * @param env: the environment, which has to outlive the filter
+   * @param index: index, which was built for env
+   * @param layers: the layers of the new map, resolved with its yaml file
+   * @param compiled_map: the compiled map, from which the initial depths are read, or 0
+   *   if the initial depths are part of the grid. It has to outlive the filter
+   */
+  void setEnvironment(Environment* env, const GeometryIndex& index, const MapLayers& layers, const CompiledMap* compiled_map);
+  
   /**
    * Calculates the angle-difference between the sonar_beam and the nearest corner of the pool
    * @sonar_orientation: the orientation angle of the sonar (yaw)
@@ -168,6 +315,12 @@ public:
   void setObstacles(const sonar_detectors::ObstacleFeatures& z, DepthObstacleGrid& m, const base::samples::RigidBodyState& rbs);
   void setDepth(const double &depth, DepthObstacleGrid& m, const base::samples::RigidBodyState& rbs);
   
+  /**
+   * Sets the depths of a profile in the grid
+   * @param position_covariance_threshold: samples with a larger position covariance are skipped
+   */
+  void setDepth(const DepthProfile& profile, DepthObstacleGrid& m, double position_covariance_threshold);
+  
   void observeDepth(const Eigen::Vector3d &pose, const Eigen::Matrix3d pos_covar, double depth);
   
   /**
@@ -178,14 +331,137 @@ public:
   void getSimpleGrid(uw_localization::SimpleGrid &grid);
 
 private:
+  /**
+   * Builds the geometry index for the environment of the filter configuration
+   */
+  void indexEnvironment();
+
+  /**
+   * NodeMap::belongsToWorld, answered by the geometry index if it has the world bounds
+   */
+  bool belongsToWorld(const base::Vector3d& position, const NodeMap& m) const {
+    return geometry_index.hasWorld() ? geometry_index.belongsToWorld(position) : m.belongsToWorld(position);
+  }
+
+  /**
+   * Initial depth at a position, read from the compiled map or from the grid
+   * @return: the depth, or NaN if it is unknown
+   */
+  double initialDepth(double x, double y, DepthObstacleGrid& m) const {
+    return compiled_map ? compiled_map->depthAt(x, y) : m.getDepth(x, y);
+  }
+
+  /**
+   * Nearest wall point of a measured point, answered by the geometry index if it indexes the environment
+   * @param point: the measured point
+   * @param origin: the position of the particle
+   * @return: no node, the distance from the origin to the wall point and the wall point
+   */
+  LayerDistance wallDistance(const base::Vector3d& point, const base::Vector3d& origin, const NodeMap& m) const;
+
+  /**
+   * First box on a sonar beam, answered by the geometry index if it has the boxes
+   * @param yaw: absolute direction of the beam
+   * @param origin: the position of the particle
+   * @return: no node, the distance from the origin to the box and the point on the box
+   */
+  LayerDistance boxDistance(double yaw, const base::Vector3d& origin, const NodeMap& m) const;
+
+  /**
+   * Calculates the propability of a particle using a prepared sonar beam
+   */
+  double perception(PoseSlamParticle& x, const SonarFeatures& z, NodeMap& m);
+
+  /**
+   * Weights all particles with the prepared beams
+   * @param Observation: ObservationPolicy of the configuration
+   * @param LogPerception: log propability of a particle for the beams
+   * @return: the effectiv sample size, relative to the number of particles
+   */
+  template<class Observation, double (ParticleLocalization::*LogPerception)(PoseSlamParticle&, const std::vector<SonarFeatures>&, NodeMap&)>
+  double observeBeams(const std::vector<SonarFeatures>& beams, NodeMap& m, double importance);
+
+  /**
+   * Sets the normalized weights of the particles
+   * @param log_weights: log weight of every particle, in the order of the particles
+   * @param best: the largest log weight
+   * @return: the effectiv sample size, relative to the number of particles
+   */
+  double setLogWeights(const std::vector<double>& log_weights, double best);
+
+  /**
+   * Propability of a single laser beam
+   * @param angle: angle of the beam relative to the vehicle
+   * @param z: the measured range of the beam
+   * @param yaw: yaw of the vehicle
+   */
+  double beamPerception(PoseSlamParticle& x, double angle, const SonarFeature& z, double yaw,
+                        const Eigen::AngleAxis<double>& abs_yaw, NodeMap& m);
+
+  /**
+   * Kernels of the filter steps, which are specialized for the flags of the
+   * filter configuration. The flags are policy parameters, so the kernels do
+   * not test them per particle or per feature. dynamic and perception call
+   * the kernels, which were selected by selectKernels for the configuration.
+   */
+  template<class Motion>
+  void speedDynamic(PoseSlamParticle& x, const base::samples::RigidBodyState& u, const NodeMap& m);
+  template<class Motion>
+  void thrusterDynamic(PoseSlamParticle& x, const base::samples::Joints& u, const NodeMap& m);
+  template<class Motion>
+  void speedUpdate(const base::samples::RigidBodyState& u, const NodeMap& m);
+  template<class Motion>
+  void thrusterUpdate(const base::samples::Joints& u, const NodeMap& m);
+  template<class Sonar>
+  double sonarPerception(PoseSlamParticle& x, const SonarFeatures& z, NodeMap& m);
+  template<class Sonar>
+  double sonarBeamsLogPerception(PoseSlamParticle& x, const std::vector<SonarFeatures>& beams, NodeMap& m);
+  template<class Depth>
+  double depthPerception(PoseSlamParticle& x, const double& z, DepthObstacleGrid& m);
+  template<class Depth>
+  double depthProfilePerception(PoseSlamParticle& x, const DepthProfile& z, DepthObstacleGrid& m);
+  template<class Gps>
+  double gpsPerception(PoseSlamParticle& x, const base::Vector3d& z, NodeMap& m);
+
+  /**
+   * Selects the kernels for the current filter configuration. The loops over the
+   * particles are selected once, so they do not dispatch per particle
+   */
+  void selectKernels();
+  template<class Motion>
+  void selectMotionKernels();
+  template<class Sonar>
+  void selectSonarKernels();
+
+  typedef void (ParticleLocalization::*SpeedKernel)(PoseSlamParticle&, const base::samples::RigidBodyState&, const NodeMap&);
+  typedef void (ParticleLocalization::*ThrusterKernel)(PoseSlamParticle&, const base::samples::Joints&, const NodeMap&);
+  typedef double (ParticleLocalization::*SonarKernel)(PoseSlamParticle&, const SonarFeatures&, NodeMap&);
+  typedef double (ParticleLocalization::*DepthKernel)(PoseSlamParticle&, const double&, DepthObstacleGrid&);
+  typedef double (ParticleLocalization::*DepthProfileKernel)(PoseSlamParticle&, const DepthProfile&, DepthObstacleGrid&);
+  typedef double (ParticleLocalization::*GpsKernel)(PoseSlamParticle&, const base::Vector3d&, NodeMap&);
+  typedef double (ParticleLocalization::*SonarLogKernel)(PoseSlamParticle&, const std::vector<SonarFeatures>&, NodeMap&);
+  typedef void (ParticleLocalization::*SpeedUpdate)(const base::samples::RigidBodyState&, const NodeMap&);
+  typedef void (ParticleLocalization::*ThrusterUpdate)(const base::samples::Joints&, const NodeMap&);
+  typedef double (ParticleLocalization::*BeamsObserver)(const std::vector<SonarFeatures>&, NodeMap&, double);
+
+  SpeedKernel speed_kernel;
+  ThrusterKernel thruster_kernel;
+  SonarKernel sonar_kernel;
+  DepthKernel depth_kernel;
+  DepthProfileKernel depth_profile_kernel;
+  GpsKernel gps_kernel;
+  SonarLogKernel sonar_log_kernel;
+  SpeedUpdate speed_update;
+  ThrusterUpdate thruster_update;
+  BeamsObserver laser_observer;
+  BeamsObserver sonar_observer;
+
   FilterConfig filter_config;
-  UwMotionModel motion_model;
-  underwaterVehicle::DynamicModel* dynamic_model;
-  underwaterVehicle::Parameters dynamic_model_params;
+  DeadReckoning own_dead_reckoner;
+  DeadReckoning* dead_reckoner;
+  bool shared_dead_reckoner;
+  VelocityPredictor predictor;
   base::samples::RigidBodyState vehicle_pose;
-  base::samples::RigidBodyState motion_pose;
-  base::samples::RigidBodyState full_motion_pose;
-  base::Time lastActuatorTime;
   DPSlam dp_slam;
 
   machine_learning::MultiNormalRandom<3> StaticSpeedNoise;
@@ -193,10 +469,18 @@ private:
 
   uw_localization::PointInfo best_sonar_measurement;
 
-  std::list<double> perception_history;
-  double perception_history_sum;
+  MovingVariance<double> perception_history;
+  GeometryIndex geometry_index;
+  const Environment* indexed_env;
+  MapLayers layers;
+  const CompiledMap* compiled_map;
+  SonarPreprocessor sonar_preprocessor;
   bool used_dvl;
   unsigned int max_features_per_cell;
+  //Counts the beams, which rated a particle, unrated beams do not change its weight
+  unsigned int rated_beams;
+  unsigned int merged_beams;
+  unsigned int dropped_beams;
   
   //the origin of the coordinate system as utm-coordinate
   base::Vector3d utm_origin;
@@ -209,6 +493,8 @@ private:
 
   /** observers */
   DebugWriter<uw_localization::PointInfo>* sonar_debug;
+  TimingRecorder* timing;
+  MapJournal* map_journal;
 };
 
 
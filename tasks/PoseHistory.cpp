@@ -0,0 +1,150 @@
+#include "PoseHistory.hpp"
+#include <cmath>
+
+using namespace uw_localization;
+
+PoseHistory::PoseHistory(size_t capacity)
+  : position(capacity), depth(capacity), orientation(capacity), velocity(capacity)
+{
+}
+
+void PoseHistory::setCapacity(size_t capacity)
+{
+  position.setCapacity(capacity);
+  depth.setCapacity(capacity);
+  orientation.setCapacity(capacity);
+  velocity.setCapacity(capacity);
+}
+
+void PoseHistory::clear()
+{
+  position.clear();
+  depth.clear();
+  orientation.clear();
+  velocity.clear();
+}
+
+bool PoseHistory::addPosition(const base::samples::RigidBodyState& rbs)
+{
+  if(!base::samples::RigidBodyState::isValidValue(rbs.position))
+    return false;
+
+  VectorSample sample;
+  sample.value = rbs.position;
+  sample.rate = rbs.velocity;
+  return position.push(rbs.time, sample);
+}
+
+bool PoseHistory::addDepth(const base::samples::RigidBodyState& rbs)
+{
+  if(std::isnan(rbs.position.z()) || std::isnan(rbs.velocity.z()))
+    return false;
+
+  VectorSample sample;
+  sample.value = base::Vector3d(0.0, 0.0, rbs.position.z());
+  sample.rate = base::Vector3d(0.0, 0.0, rbs.velocity.z());
+  return depth.push(rbs.time, sample);
+}
+
+bool PoseHistory::addOrientation(const base::samples::RigidBodyState& rbs)
+{
+  if(!base::samples::RigidBodyState::isValidValue(rbs.orientation) ||
+      !base::samples::RigidBodyState::isValidValue(rbs.angular_velocity))
+    return false;
+
+  OrientationSample sample;
+  sample.orientation = rbs.orientation;
+  sample.angular_velocity = rbs.angular_velocity;
+  return orientation.push(rbs.time, sample);
+}
+
+bool PoseHistory::addVelocity(const base::samples::RigidBodyState& rbs)
+{
+  if(!base::samples::RigidBodyState::isValidValue(rbs.velocity))
+    return false;
+
+  return velocity.push(rbs.time, rbs.velocity);
+}
+
+base::Time PoseHistory::latestCompleteTime(double stream_timeout) const
+{
+  base::Time newest;
+
+  if(!position.empty() && position.newest() > newest)
+    newest = position.newest();
+  if(!depth.empty() && depth.newest() > newest)
+    newest = depth.newest();
+  if(!orientation.empty() && orientation.newest() > newest)
+    newest = orientation.newest();
+
+  if(newest.isNull())
+    return newest;
+
+  //The body velocity is optional, so it is not waited for
+  base::Time stale = newest - base::Time::fromSeconds(stream_timeout);
+  base::Time complete = newest;
+
+  if(!position.empty() && position.newest() >= stale && position.newest() < complete)
+    complete = position.newest();
+  if(!depth.empty() && depth.newest() >= stale && depth.newest() < complete)
+    complete = depth.newest();
+  if(!orientation.empty() && orientation.newest() >= stale && orientation.newest() < complete)
+    complete = orientation.newest();
+
+  return complete;
+}
+
+bool PoseHistory::getPose(const base::Time& time, base::samples::RigidBodyState& pose, double velocity_timeout) const
+{
+  if(position.empty() && depth.empty() && orientation.empty())
+    return false;
+
+  pose.time = time;
+
+  OrientationSample o;
+  bool has_orientation = orientation.get(time, o);
+  if(has_orientation){
+    pose.orientation = o.orientation;
+    pose.angular_velocity = o.angular_velocity;
+  }
+
+  VectorSample p;
+  if(position.get(time, p)){
+    pose.position.x() = p.value.x();
+    pose.position.y() = p.value.y();
+    pose.velocity.x() = p.rate.x();
+    pose.velocity.y() = p.rate.y();
+  }
+
+  //Prefer the body velocity, if it is not outdated. It needs an orientation for the world frame
+  base::Vector3d body_velocity;
+  if(has_orientation && !velocity.empty() && (time - velocity.newest()).toSeconds() <= velocity_timeout
+      && velocity.get(time, body_velocity)){
+    base::Vector3d world_velocity = o.orientation * body_velocity;
+    pose.velocity.x() = world_velocity.x();
+    pose.velocity.y() = world_velocity.y();
+  }
+
+  VectorSample d;
+  if(depth.get(time, d)){
+    pose.position.z() = d.value.z();
+    pose.velocity.z() = d.rate.z();
+  }
+
+  return true;
+}
+
+base::samples::RigidBodyState uw_localization::extrapolatePose(const base::samples::RigidBodyState& pose, double horizon)
+{
+  base::samples::RigidBodyState result = pose;
+  result.time = pose.time + base::Time::fromSeconds(horizon);
+  result.position = pose.position + pose.velocity * horizon;
+
+  double angle = pose.angular_velocity.norm() * horizon;
+  if(angle > 0.0){
+    result.orientation = pose.orientation * base::Quaterniond(Eigen::AngleAxisd(angle, pose.angular_velocity.normalized()));
+    result.orientation.normalize();
+  }
+
+  return result;
+}
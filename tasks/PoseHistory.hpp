@@ -0,0 +1,194 @@
+/* ----------------------------------------------------------------------------
+ * PoseHistory.hpp
+ * Time-indexed ring buffers of pose streams with interpolation
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_POSE_HISTORY_HPP
+#define UW_PARTICLE_LOCALIZATION_POSE_HISTORY_HPP
+
+#include <boost/circular_buffer.hpp>
+#include <base/eigen.h>
+#include <base/time.h>
+#include <base/samples/rigid_body_state.h>
+
+namespace uw_localization {
+
+/**
+ * A vector and its derivative, e.g. position and velocity
+ */
+struct VectorSample {
+  base::Vector3d value;
+  base::Vector3d rate;
+};
+
+struct OrientationSample {
+  base::Quaterniond orientation;
+  base::Vector3d angular_velocity;
+};
+
+inline base::Vector3d interpolate(const base::Vector3d& a, const base::Vector3d& b, double ratio)
+{
+  return a + ratio * (b - a);
+}
+
+inline VectorSample interpolate(const VectorSample& a, const VectorSample& b, double ratio)
+{
+  VectorSample result;
+  result.value = interpolate(a.value, b.value, ratio);
+  result.rate = interpolate(a.rate, b.rate, ratio);
+  return result;
+}
+
+inline OrientationSample interpolate(const OrientationSample& a, const OrientationSample& b, double ratio)
+{
+  OrientationSample result;
+  result.orientation = a.orientation.slerp(ratio, b.orientation);
+  result.angular_velocity = interpolate(a.angular_velocity, b.angular_velocity, ratio);
+  return result;
+}
+
+/**
+ * Ring buffer of timestamped samples of one stream.
+ * Samples have to be added in time order, older samples are rejected.
+ */
+template<typename T>
+class SampleHistory {
+public:
+  SampleHistory(size_t capacity = 100) : samples(capacity) {}
+
+  void setCapacity(size_t capacity) { samples.set_capacity(capacity); }
+  void clear() { samples.clear(); }
+  bool empty() const { return samples.empty(); }
+
+  const base::Time& newest() const { return samples.back().first; }
+  const base::Time& oldest() const { return samples.front().first; }
+
+  /**
+   * @return: false, if the sample is older than the newest sample
+   */
+  bool push(const base::Time& time, const T& value)
+  {
+    if(!samples.empty() && time < samples.back().first)
+      return false;
+
+    samples.push_back(std::make_pair(time, value));
+    return true;
+  }
+
+  /**
+   * Interpolates between the two samples around the time.
+   * Outside of the history, the oldest or newest sample is held.
+   * @param time: time of the value
+   * @param value: the interpolated value
+   * @return: false, if the history is empty
+   */
+  bool get(const base::Time& time, T& value) const
+  {
+    if(samples.empty())
+      return false;
+
+    if(time <= samples.front().first){
+      value = samples.front().second;
+      return true;
+    }
+
+    if(time >= samples.back().first){
+      value = samples.back().second;
+      return true;
+    }
+
+    //Binary search for the first sample after the time
+    size_t lower = 0;
+    size_t upper = samples.size() - 1;
+
+    while(upper - lower > 1){
+      size_t middle = (lower + upper) / 2;
+
+      if(samples[middle].first <= time)
+        lower = middle;
+      else
+        upper = middle;
+    }
+
+    const std::pair<base::Time, T>& a = samples[lower];
+    const std::pair<base::Time, T>& b = samples[upper];
+    double dt = (b.first - a.first).toSeconds();
+    double ratio = dt > 0.0 ? (time - a.first).toSeconds() / dt : 1.0;
+
+    value = interpolate(a.second, b.second, ratio);
+    return true;
+  }
+
+private:
+  boost::circular_buffer< std::pair<base::Time, T> > samples;
+};
+
+/**
+ * Extrapolates a pose with constant world frame velocity and constant
+ * body frame angular velocity
+ * @param pose: pose with world frame velocities
+ * @param horizon: time in seconds
+ */
+base::samples::RigidBodyState extrapolatePose(const base::samples::RigidBodyState& pose, double horizon);
+
+/**
+ * History of the input streams of the FastFusion.
+ * A pose can be queried at any time inside the history.
+ */
+class PoseHistory {
+public:
+  PoseHistory(size_t capacity = 100);
+
+  void setCapacity(size_t capacity);
+  void clear();
+
+  /**
+   * Adds x- and y-position and the xy-velocity in world frame
+   * @return: false, if the sample is invalid or too old
+   */
+  bool addPosition(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Adds the depth and the depth velocity
+   */
+  bool addDepth(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Adds the orientation and the angular velocity
+   */
+  bool addOrientation(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * Adds the linear velocity in body frame
+   */
+  bool addVelocity(const base::samples::RigidBodyState& rbs);
+
+  /**
+   * The newest time, at which all streams with samples have data.
+   * Streams, whose newest sample is more than stream_timeout older than the
+   * newest sample of all streams, are not waited for.
+   * @return: null time, if there are no samples
+   */
+  base::Time latestCompleteTime(double stream_timeout) const;
+
+  /**
+   * Interpolates the pose at the given time
+   * @param time: time of the pose
+   * @param pose: the pose, with world frame velocities
+   * @param velocity_timeout: if there is no body velocity sample in this
+   *   time, the velocity of the position stream is used
+   * @return: false, if there are no samples
+   */
+  bool getPose(const base::Time& time, base::samples::RigidBodyState& pose, double velocity_timeout) const;
+
+private:
+  SampleHistory<VectorSample> position;
+  SampleHistory<VectorSample> depth;
+  SampleHistory<OrientationSample> orientation;
+  SampleHistory<base::Vector3d> velocity;
+};
+
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include "SonarPreprocessor.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+/**
+ * Compares the fields of two beams, which are used by the preparation
+ */
+bool sameFeatures(const sonar_detectors::ObstacleFeatures& a, const sonar_detectors::ObstacleFeatures& b)
+{
+  if(a.time != b.time || a.angle != b.angle || a.features.size() != b.features.size())
+    return false;
+
+  for(size_t i = 0; i < a.features.size(); i++){
+    if(a.features[i].range != b.features[i].range || a.features[i].confidence != b.features[i].confidence)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * Compares the fields of two laser scans, which are used by the preparation
+ */
+bool sameScan(const base::samples::LaserScan& a, const base::samples::LaserScan& b)
+{
+  return a.time == b.time && a.start_angle == b.start_angle
+    && a.angular_resolution == b.angular_resolution && a.ranges == b.ranges;
+}
+
+}
+
+SonarPreprocessor::SonarPreprocessor()
+  : minimum_distance(0.0), maximum_distance(INFINITY),
+    observation_minimum_range(0.0), observation_range(INFINITY),
+    sonar_to_vehicle(Eigen::Translation3d::Identity()),
+    prepared_sample(PREPARED_NONE), preparation_count(0)
+{
+}
+
+void SonarPreprocessor::configure(const FilterConfig& config)
+{
+  minimum_distance = config.sonar_minimum_distance;
+  maximum_distance = config.sonar_maximum_distance;
+  observation_minimum_range = config.feature_observation_minimum_range;
+  observation_range = config.feature_observation_range;
+  sonar_to_vehicle = config.sonarToAvalon;
+  invalidate();
+}
+
+void SonarPreprocessor::invalidate()
+{
+  prepared_sample = PREPARED_NONE;
+}
+
+bool SonarPreprocessor::isPrepared(const sonar_detectors::ObstacleFeatures& sample) const
+{
+  return prepared_sample == PREPARED_FEATURES && sameFeatures(sample, source_features);
+}
+
+bool SonarPreprocessor::isPrepared(const std::vector<sonar_detectors::ObstacleFeatures>& samples) const
+{
+  if(prepared_sample != PREPARED_FEATURES_BATCH || samples.size() != source_features_batch.size())
+    return false;
+
+  for(size_t i = 0; i < samples.size(); i++){
+    if(!sameFeatures(samples[i], source_features_batch[i]))
+      return false;
+  }
+
+  return true;
+}
+
+bool SonarPreprocessor::isPrepared(const base::samples::LaserScan& scan) const
+{
+  return prepared_sample == PREPARED_SCAN && sameScan(scan, source_scan);
+}
+
+bool SonarPreprocessor::isPrepared(const std::vector<base::samples::LaserScan>& scans) const
+{
+  if(prepared_sample != PREPARED_SCAN_BATCH || scans.size() != source_scan_batch.size())
+    return false;
+
+  for(size_t i = 0; i < scans.size(); i++){
+    if(!sameScan(scans[i], source_scan_batch[i]))
+      return false;
+  }
+
+  return true;
+}
+
+const SonarFeatures& SonarPreprocessor::prepare(const sonar_detectors::ObstacleFeatures& sample)
+{
+  if(!isPrepared(sample)){
+    prepare(sample, prepared);
+    source_features = sample;
+    prepared_sample = PREPARED_FEATURES;
+    preparation_count++;
+  }
+
+  return prepared;
+}
+
+const std::vector<SonarFeatures>& SonarPreprocessor::prepare(const std::vector<sonar_detectors::ObstacleFeatures>& samples)
+{
+  if(!isPrepared(samples)){
+    prepared_batch.resize(samples.size());
+
+    for(size_t i = 0; i < samples.size(); i++)
+      prepare(samples[i], prepared_batch[i]);
+
+    source_features_batch = samples;
+    prepared_sample = PREPARED_FEATURES_BATCH;
+    preparation_count++;
+  }
+
+  return prepared_batch;
+}
+
+const std::vector<SonarFeatures>& SonarPreprocessor::prepare(const base::samples::LaserScan& scan)
+{
+  if(!isPrepared(scan)){
+    prepared_batch.clear();
+    prepare(scan, prepared_batch);
+    source_scan = scan;
+    prepared_sample = PREPARED_SCAN;
+    preparation_count++;
+  }
+
+  return prepared_batch;
+}
+
+const std::vector<SonarFeatures>& SonarPreprocessor::prepare(const std::vector<base::samples::LaserScan>& scans)
+{
+  if(!isPrepared(scans)){
+    prepared_batch.clear();
+
+    for(size_t i = 0; i < scans.size(); i++)
+      prepare(scans[i], prepared_batch);
+
+    source_scan_batch = scans;
+    prepared_sample = PREPARED_SCAN_BATCH;
+    preparation_count++;
+  }
+
+  return prepared_batch;
+}
+
+void SonarPreprocessor::prepare(const sonar_detectors::ObstacleFeatures& sample, SonarFeatures& result) const
+{
+  result.time = sample.time;
+  result.angle = sample.angle;
+  result.features.resize(sample.features.size());
+
+  for(size_t i = 0; i < sample.features.size(); i++){
+    const sonar_detectors::ObstacleFeature& feature = sample.features[i];
+    SonarFeature& prepared_feature = result.features[i];
+
+    prepareFeature(feature.range / 1000.0, feature.confidence, sample.angle, prepared_feature);
+
+    if(feature.confidence > 0.0 && prepared_feature.distance != base::samples::TOO_FAR)
+      prepared_feature.flags |= FEATURE_MEASURED;
+  }
+}
+
+void SonarPreprocessor::prepare(const base::samples::LaserScan& scan, std::vector<SonarFeatures>& result) const
+{
+  size_t first = result.size();
+  result.resize(first + scan.ranges.size());
+
+  for(size_t i = 0; i < scan.ranges.size(); i++){
+    SonarFeatures& beam = result[first + i];
+    beam.time = scan.time;
+    beam.angle = scan.start_angle + i * scan.angular_resolution;
+    beam.features.resize(1);
+
+    prepareFeature(scan.ranges[i] / 1000.0, 1.0, beam.angle, beam.features[0]);
+
+    if(scan.ranges[i] != base::samples::TOO_FAR)
+      beam.features[0].flags |= FEATURE_MEASURED;
+  }
+}
+
+void SonarPreprocessor::prepareFeature(double distance, double confidence, double angle, SonarFeature& result) const
+{
+  Eigen::AngleAxis<double> sonar_yaw(angle, Eigen::Vector3d::UnitZ());
+
+  result.distance = distance;
+  result.confidence = confidence;
+  result.relative = sonar_yaw * sonar_to_vehicle * base::Vector3d(distance, 0.0, 0.0);
+  result.flags = 0;
+
+  if(distance >= minimum_distance && distance <= maximum_distance)
+    result.flags |= FEATURE_IN_SONAR_RANGE;
+
+  if(distance >= observation_minimum_range && distance <= observation_range)
+    result.flags |= FEATURE_IN_OBSERVATION_RANGE;
+}
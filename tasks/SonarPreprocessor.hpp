@@ -0,0 +1,150 @@
+/* ----------------------------------------------------------------------------
+ * SonarPreprocessor.hpp
+ * Particle independent preparation of sonar obstacle features
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_SONAR_PREPROCESSOR_HPP
+#define UW_PARTICLE_LOCALIZATION_SONAR_PREPROCESSOR_HPP
+
+#include <vector>
+#include <base/eigen.h>
+#include <base/time.h>
+#include <base/samples/laser_scan.h>
+#include <sonar_detectors/SonarDetectorTypes.hpp>
+#include "LocalizationConfig.hpp"
+
+namespace uw_localization {
+
+/**
+ * Validity flags of a prepared feature
+ */
+enum SonarFeatureFlags {
+  /** the feature has a positive confidence and is not marked as too far */
+  FEATURE_MEASURED = 0x1,
+  /** the feature is between sonar_minimum_distance and sonar_maximum_distance */
+  FEATURE_IN_SONAR_RANGE = 0x2,
+  /** the feature is between feature_observation_minimum_range and feature_observation_range */
+  FEATURE_IN_OBSERVATION_RANGE = 0x4
+};
+
+struct SonarFeature {
+  /** distance in meter */
+  double distance;
+  double confidence;
+
+  /** feature in the vehicle frame, it only has to be rotated by the vehicle yaw */
+  base::Vector3d relative;
+
+  /** combination of SonarFeatureFlags */
+  unsigned char flags;
+
+  bool has(unsigned char mask) const { return (flags & mask) == mask; }
+};
+
+/**
+ * The kind of sample, whose beams are kept by the SonarPreprocessor
+ */
+enum PreparedSample {
+  PREPARED_NONE,
+  PREPARED_FEATURES,
+  PREPARED_FEATURES_BATCH,
+  PREPARED_SCAN,
+  PREPARED_SCAN_BATCH
+};
+
+/**
+ * A sonar beam, whose features were prepared for the perception of the particles
+ */
+struct SonarFeatures {
+  base::Time time;
+  double angle;
+  std::vector<SonarFeature> features;
+};
+
+/**
+ * Converts the features of a sonar beam to meter, transforms them into the
+ * vehicle frame and checks their ranges. This does not depend on a particle,
+ * so it is done once per beam: the last beam is kept, while every particle
+ * observes it. The kept beam is found by the content of the sample, a copy of
+ * the sample is kept for the comparison.
+ * Every range of a laser scan is a beam of its own with a single feature,
+ * at start_angle + i * angular_resolution.
+ */
+class SonarPreprocessor {
+public:
+  SonarPreprocessor();
+
+  void configure(const FilterConfig& config);
+
+  /**
+   * @param sample: the features of one beam
+   * @return: the prepared beam, it is valid until the next call
+   */
+  const SonarFeatures& prepare(const sonar_detectors::ObstacleFeatures& sample);
+
+  /**
+   * @param samples: a batch of beams
+   * @return: the prepared beams, they are valid until the next call
+   */
+  const std::vector<SonarFeatures>& prepare(const std::vector<sonar_detectors::ObstacleFeatures>& samples);
+
+  /**
+   * @param scan: a laser scan with one or more ranges
+   * @return: one prepared beam per range, they are valid until the next call
+   */
+  const std::vector<SonarFeatures>& prepare(const base::samples::LaserScan& scan);
+
+  /**
+   * @param scans: a batch of laser scans
+   * @return: the prepared beams of all scans, they are valid until the next call
+   */
+  const std::vector<SonarFeatures>& prepare(const std::vector<base::samples::LaserScan>& scans);
+
+  /**
+   * Drops the kept beams, the next call of prepare prepares them again
+   */
+  void invalidate();
+
+  /**
+   * Prepares a beam without keeping it
+   */
+  void prepare(const sonar_detectors::ObstacleFeatures& sample, SonarFeatures& result) const;
+
+  /**
+   * Prepares the beams of a laser scan without keeping them
+   * @param result: the beams are appended
+   */
+  void prepare(const base::samples::LaserScan& scan, std::vector<SonarFeatures>& result) const;
+
+  /**
+   * @return: number of samples, which were prepared and not taken from the kept beams
+   */
+  unsigned int preparations() const { return preparation_count; }
+
+private:
+  double minimum_distance;
+  double maximum_distance;
+  double observation_minimum_range;
+  double observation_range;
+  Eigen::Translation3d sonar_to_vehicle;
+
+  PreparedSample prepared_sample;
+  sonar_detectors::ObstacleFeatures source_features;
+  std::vector<sonar_detectors::ObstacleFeatures> source_features_batch;
+  base::samples::LaserScan source_scan;
+  std::vector<base::samples::LaserScan> source_scan_batch;
+  SonarFeatures prepared;
+  std::vector<SonarFeatures> prepared_batch;
+  unsigned int preparation_count;
+
+  bool isPrepared(const sonar_detectors::ObstacleFeatures& sample) const;
+  bool isPrepared(const std::vector<sonar_detectors::ObstacleFeatures>& samples) const;
+  bool isPrepared(const base::samples::LaserScan& scan) const;
+  bool isPrepared(const std::vector<base::samples::LaserScan>& scans) const;
+  void prepareFeature(double distance, double confidence, double angle, SonarFeature& result) const;
+};
+
+}
+
+#endif
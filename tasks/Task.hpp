@@ -9,20 +9,14 @@
 #include <vector>
 #include <list>
 #include "LocalizationConfig.hpp"
-#include <uw_localization/maps/grid_map.hpp>
-#include <uw_localization/maps/depth_obstacle_grid.hpp>
-#include <uw_localization/types/map.hpp>
+#include "LocalizationCore.hpp"
+#include "Timing.hpp"
+#include "DebugExporter.hpp"
 
 namespace aggregator {
     class StreamAligner;
 }
 
-namespace uw_localization {
-    class ParticleLocalization;
-    class NodeMap;
-    class DepthObstacleGrid;
-}
-
 namespace uw_particle_localization {
 
     class Task : public TaskBase,
@@ -30,37 +24,31 @@ namespace uw_particle_localization {
     {
 	friend class TaskBase;
     protected:
-          base::Time last_perception;
-          base::Time last_motion;
-          base::Time start_time;
-          base::Time last_hough;
-          base::Time last_hough_timeout;
-          base::Time last_speed_time;
-          base::Time last_echosounder;
-          base::samples::RigidBodyState lastRBS;
-          base::samples::RigidBodyState lastOrientation;
           base::Time last_map_update;
 
-          double current_depth;
-          double current_ground;
-          bool orientation_sample_recieved;
-
-          unsigned number_sonar_perceptions;
-          unsigned number_rejected_samples;
-          int number_gps_perceptions;
-          bool position_jump_detected;
-          double sum_scan;
-          double last_scan_angle;
           bool found_buoy_white;
           bool found_buoy_orange;
-           
+
+          /**
+           * The filter loop, the task only converts properties and ports
+           */
+          uw_localization::LocalizationCore core;
+
           /**
            * Changes the state of the task
            * If the new state is equal to the old state, no action is performed
            */
           void changeState(States new_state);
-          
-          void step(const base::samples::RigidBodyState& sample);
+
+          /**
+           * Changes the state to the perception state of the core
+           */
+          void updateState();
+
+          /**
+           * Writes the stats of the last sonar observation
+           */
+          void writeStats();
 
           virtual void laser_samplesCallback(const base::Time& ts, const base::samples::LaserScan& scan);
           virtual void orientation_samplesCallback(const base::Time& ts, const base::samples::RigidBodyState& rbs);
@@ -74,42 +62,48 @@ namespace uw_particle_localization {
           virtual void obstacle_samplesCallback(const base::Time&, const sonar_detectors::ObstacleFeatures& features);
           virtual void structure_samplesCallback(const base::Time& ts, const bool& structure);
 
-          uw_localization::ParticleLocalization* localizer;
-          uw_localization::NodeMap* map;
-          uw_localization::DepthObstacleGrid* grid_map;
-          uw_localization::Environment env;
-          uw_localization::FilterConfig config;
-          
-          void write(const uw_localization::PointInfo& sample);
-          bool initMotionConfig();
-          
+          uw_localization::TimingRecorder timing;
+          base::Time last_timing_stats;
+
           /**
-           * Statemachine for perception states
-           * @param ts: Timestamp of the perception
-           * @return: True, if the perception should be observed
+           * @return: the timing recorder, or 0 if timing is disabled
            */
-          bool perception_state_machine(const base::Time& ts);
-          
+          uw_localization::TimingRecorder* timingRecorder();
+
+          uw_localization::DebugExporter debug_exporter;
+
           /**
-           * Sets all particles to valid
-           * If there was a position jump, we only set the particles to valid, when we have at least a half scan
-           * @param angle: angle of the last scan
+           * True, if the environment has to be written with the next debug snapshot
            */
-          void validate_particles();
-          
+          bool environment_changed;
+
+          base::Time last_map_compaction;
+
+          void write(const uw_localization::PointInfo& sample);
+          bool initMotionConfig(uw_localization::FilterConfig& config);
+
           /**
-           * Filter out duplicate features. If a feature is found multiple times, the feature with the highest confidence is choosen
-           * We assume, that duplicate features are succeed to each other, to reduce computation time
-           * @param sample: Features to be filtered
+           * Sets the vector and matrix properties, which have no default in the orogen file
            */
-          void filter_sample(sonar_detectors::ObstacleFeatures& sample);
-          
+          void setPropertyDefaults();
+
+          /**
+           * @return: the sample handling and map settings of the properties
+           */
+          uw_localization::LocalizationCoreConfig coreConfig();
+
           /**
            * Update the config-struct for changed properties
-           * Change only the covariances, slam-properties 
+           * Change only the covariances, slam-properties
            */
           void updateConfig();
 
+          /**
+           * Writes a debug snapshot to the output ports. Runs on the debug worker thread
+           * @param snapshot: snapshot, which was collected in the updateHook
+           */
+          void exportDebugSnapshot(uw_localization::DebugSnapshot& snapshot);
+
     public:
         Task(std::string const& name = "uw_particle_localization::Task");
 
@@ -129,9 +123,14 @@ namespace uw_particle_localization {
 
         void stopHook();
 
+        /**
+         * Loads a map in the background, it is used from the next update on
+         * @return: false, if the task is not running or another map is loading
+         */
+        virtual bool loadMap(std::string const& yaml_map, std::string const& yaml_depth_map, std::string const& compiled_map);
+
         // void cleanupHook();
     };
 }
 
 #endif
-
@@ -0,0 +1,131 @@
+/* ----------------------------------------------------------------------------
+ * TiledGrid.hpp
+ * Sparse grid of fixed-size tiles
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_TILED_GRID_HPP
+#define UW_PARTICLE_LOCALIZATION_TILED_GRID_HPP
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace uw_localization {
+
+/**
+ * Coordinates of a tile, ordered by x and then by y
+ */
+struct TileKey {
+  int x;
+  int y;
+
+  TileKey(int x = 0, int y = 0) : x(x), y(y) {}
+
+  bool operator<(const TileKey& other) const {
+    return x < other.x || (x == other.x && y < other.y);
+  }
+
+  bool operator==(const TileKey& other) const {
+    return x == other.x && y == other.y;
+  }
+};
+
+/**
+ * Grid of cells, which are stored in square tiles. A tile is allocated on
+ * the first write into it, so the memory grows with the covered area and not
+ * with the extent of the grid. Reading a cell of an unallocated tile returns
+ * the empty value.
+ *
+ * The map compiler collects the tiles of a compiled map here. The depth
+ * obstacle grid of the filter is not tiled, it is part of uw_localization.
+ */
+template<typename T>
+class TiledGrid {
+public:
+  /**
+   * @param empty: value of cells, which were never written
+   * @param tile_size: number of cells of a tile side
+   */
+  TiledGrid(const T& empty, unsigned int tile_size = 64)
+    : empty(empty), tile_size(tile_size > 0 ? tile_size : 1) {}
+
+  unsigned int tileSize() const { return tile_size; }
+  size_t tileCount() const { return tiles.size(); }
+
+  /**
+   * @return: the value of the cell, or the empty value if it was never written
+   */
+  T get(int x, int y) const
+  {
+    typename std::map<TileKey, std::vector<T> >::const_iterator it = tiles.find(tileKey(x, y));
+
+    if(it == tiles.end())
+      return empty;
+
+    return it->second[cellIndex(x, y)];
+  }
+
+  /**
+   * @return: the cell. Its tile is allocated, if it does not exist
+   */
+  T& at(int x, int y)
+  {
+    std::vector<T>& cells = tiles[tileKey(x, y)];
+
+    if(cells.empty())
+      cells.assign(tile_size * tile_size, empty);
+
+    return cells[cellIndex(x, y)];
+  }
+
+  void set(int x, int y, const T& value) { at(x, y) = value; }
+
+  /**
+   * @return: the coordinates of all allocated tiles, in the order of TileKey
+   */
+  std::vector<TileKey> tileKeys() const
+  {
+    std::vector<TileKey> keys;
+    keys.reserve(tiles.size());
+
+    for(typename std::map<TileKey, std::vector<T> >::const_iterator it = tiles.begin(); it != tiles.end(); it++)
+      keys.push_back(it->first);
+
+    return keys;
+  }
+
+  /**
+   * @return: the cells of a tile in row major order, or 0 if it is not allocated
+   */
+  const T* tileCells(const TileKey& key) const
+  {
+    typename std::map<TileKey, std::vector<T> >::const_iterator it = tiles.find(key);
+    return it != tiles.end() ? &it->second[0] : 0;
+  }
+
+private:
+  T empty;
+  unsigned int tile_size;
+  std::map<TileKey, std::vector<T> > tiles;
+
+  static int floorDiv(int value, int divisor)
+  {
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+  }
+
+  TileKey tileKey(int x, int y) const
+  {
+    return TileKey(floorDiv(x, tile_size), floorDiv(y, tile_size));
+  }
+
+  size_t cellIndex(int x, int y) const
+  {
+    int size = tile_size;
+    return (y - floorDiv(y, size) * size) * tile_size + (x - floorDiv(x, size) * size);
+  }
+};
+
+}
+
+#endif
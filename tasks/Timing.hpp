@@ -0,0 +1,246 @@
+/* ----------------------------------------------------------------------------
+ * Timing.hpp
+ * Low-overhead latency instrumentation for the filter callbacks
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_TIMING_HPP
+#define UW_PARTICLE_LOCALIZATION_TIMING_HPP
+
+#include <time.h>
+#include <cmath>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include "Types.hpp"
+
+namespace uw_localization {
+
+/**
+ * Stages, which are recorded by the TimingRecorder
+ */
+enum TimingStage {
+  TIMING_LASER_CALLBACK = 0,
+  TIMING_OBSTACLE_CALLBACK,
+  TIMING_SPEED_CALLBACK,
+  TIMING_THRUSTER_CALLBACK,
+  TIMING_ORIENTATION_CALLBACK,
+  TIMING_ECHOSOUNDER_CALLBACK,
+  TIMING_POSE_UPDATE_CALLBACK,
+  TIMING_GPS_CALLBACK,
+  TIMING_DYNAMIC,
+  TIMING_PERCEPTION,
+  TIMING_RESAMPLE,
+  TIMING_INTERSPERSAL,
+  TIMING_SLAM_OBSERVE,
+  TIMING_DEBUG_EXPORT,
+  TIMING_STAGE_COUNT
+};
+
+inline const char* timingStageName(TimingStage stage)
+{
+  static const char* names[TIMING_STAGE_COUNT] = {
+    "laser_samples", "obstacle_samples", "speed_samples", "thruster_samples",
+    "orientation_samples", "echosounder_samples", "pose_update", "gps_pose_samples",
+    "dynamic", "perception", "resample", "interspersal", "slam_observe", "debug_export" };
+
+  return names[stage];
+}
+
+/**
+ * Bucket layout of the latency histograms.
+ * Every power of two is split into 8 linear buckets, so the relative error of a
+ * percentile is below 12.5 percent.
+ */
+struct LatencyBuckets {
+  static const unsigned SUB_BUCKET_BITS = 3;
+  static const unsigned SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const unsigned BUCKETS = 64 * SUB_BUCKETS;
+
+  static unsigned bucketIndex(boost::uint64_t us)
+  {
+    if(us < SUB_BUCKETS)
+      return static_cast<unsigned>(us);
+
+    unsigned msb = 63 - __builtin_clzll(us);
+    unsigned group = msb - SUB_BUCKET_BITS + 1;
+    unsigned sub = static_cast<unsigned>(us >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+    return group * SUB_BUCKETS + sub;
+  }
+
+  static double bucketLowerBound(unsigned index)
+  {
+    unsigned group = index / SUB_BUCKETS;
+    unsigned sub = index % SUB_BUCKETS;
+
+    if(group == 0)
+      return sub;
+
+    return std::ldexp(static_cast<double>(SUB_BUCKETS + sub), group - 1);
+  }
+};
+
+/**
+ * Counts of a latency histogram, which were taken at one point in time
+ */
+class LatencySnapshot : public LatencyBuckets {
+public:
+  LatencySnapshot() : total(0), maximum(0)
+  {
+    for(unsigned i = 0; i < BUCKETS; i++)
+      counts[i] = 0;
+  }
+
+  boost::uint64_t count() const { return total; }
+
+  /** @return maximum duration in seconds */
+  double max() const { return maximum / 1.0e6; }
+
+  /**
+   * @param p: percentile between 0.0 and 1.0
+   * @return duration in seconds, the middle of the matching bucket
+   */
+  double percentile(double p) const
+  {
+    if(total == 0)
+      return 0.0;
+
+    boost::uint64_t rank = static_cast<boost::uint64_t>(p * total);
+    if(rank >= total)
+      rank = total - 1;
+
+    boost::uint64_t sum = 0;
+    for(unsigned i = 0; i < BUCKETS; i++){
+      sum += counts[i];
+
+      if(sum > rank){
+        double lower = bucketLowerBound(i);
+        double width = bucketLowerBound(i + 1) - lower;
+        double value = (lower + 0.5 * width) / 1.0e6;
+        return value < max() ? value : max();
+      }
+    }
+
+    return max();
+  }
+
+private:
+  friend class LatencyHistogram;
+
+  boost::uint32_t counts[BUCKETS];
+  boost::uint64_t total;
+  boost::uint64_t maximum;
+};
+
+/**
+ * Log-linear histogram of durations in microseconds.
+ * Recording is lock-free and may be done from several threads.
+ */
+class LatencyHistogram : public LatencyBuckets {
+public:
+  LatencyHistogram()
+  {
+    for(unsigned i = 0; i < BUCKETS; i++)
+      counts[i].store(0, boost::memory_order_relaxed);
+
+    maximum.store(0, boost::memory_order_relaxed);
+  }
+
+  void record(boost::uint64_t us)
+  {
+    counts[bucketIndex(us)].fetch_add(1, boost::memory_order_relaxed);
+
+    boost::uint64_t current = maximum.load(boost::memory_order_relaxed);
+    while(us > current && !maximum.compare_exchange_weak(current, us, boost::memory_order_relaxed)){
+    }
+  }
+
+  /**
+   * Moves the counts into the snapshot and starts a new histogram.
+   * Every bucket is exchanged on its own, so a duration, which is recorded
+   * meanwhile, is either in this snapshot or in the next one
+   */
+  void take(LatencySnapshot& snapshot)
+  {
+    snapshot.total = 0;
+
+    for(unsigned i = 0; i < BUCKETS; i++){
+      snapshot.counts[i] = counts[i].exchange(0, boost::memory_order_relaxed);
+      snapshot.total += snapshot.counts[i];
+    }
+
+    snapshot.maximum = maximum.exchange(0, boost::memory_order_relaxed);
+  }
+
+private:
+  boost::atomic<boost::uint32_t> counts[BUCKETS];
+  boost::atomic<boost::uint64_t> maximum;
+};
+
+/**
+ * One histogram for every TimingStage
+ */
+class TimingRecorder {
+public:
+  void record(TimingStage stage, boost::uint64_t us) { histograms[stage].record(us); }
+
+  /**
+   * Writes the percentiles of all recorded stages and resets the histograms
+   */
+  void getStats(TimingStats& stats)
+  {
+    stats.stages.clear();
+
+    for(unsigned i = 0; i < TIMING_STAGE_COUNT; i++){
+      LatencySnapshot h;
+      histograms[i].take(h);
+
+      if(h.count() == 0)
+        continue;
+
+      StageTiming timing;
+      timing.stage = timingStageName(static_cast<TimingStage>(i));
+      timing.count = h.count();
+      timing.p50 = h.percentile(0.5);
+      timing.p90 = h.percentile(0.9);
+      timing.p99 = h.percentile(0.99);
+      timing.max = h.max();
+      stats.stages.push_back(timing);
+    }
+  }
+
+  static boost::uint64_t nowMicroseconds()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+
+private:
+  LatencyHistogram histograms[TIMING_STAGE_COUNT];
+};
+
+/**
+ * Records the lifetime of the object into a stage of the recorder.
+ * A null recorder disables the measurement
+ */
+class ScopedTiming {
+public:
+  ScopedTiming(TimingRecorder* recorder, TimingStage stage)
+    : recorder(recorder), stage(stage), start(recorder ? TimingRecorder::nowMicroseconds() : 0) {}
+
+  ~ScopedTiming()
+  {
+    if(recorder)
+      recorder->record(stage, TimingRecorder::nowMicroseconds() - start);
+  }
+
+private:
+  TimingRecorder* recorder;
+  TimingStage stage;
+  boost::uint64_t start;
+};
+
+}
+
+#endif
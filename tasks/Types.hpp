@@ -10,6 +10,9 @@
 
 #include <base/eigen.h>
 #include <base/time.h>
+#include <base/samples/rigid_body_state.h>
+#include <string>
+#include <vector>
 
 namespace uw_localization {
 
@@ -37,8 +40,84 @@ struct Stats {
     
     /**True, if the last used dynamic step was the dvl. false, if the motion model was used */
     bool used_dvl;
+    
+    /** Number of sonar beams, which were merged into batched observations because of a backlog */
+    unsigned int merged_beams;
+    
+    /** Number of sonar beams, which were dropped because of a backlog */
+    unsigned int dropped_beams;
+};
+
+/**
+ * Latency percentiles of one filter stage, in seconds
+ */
+struct StageTiming {
+    std::string stage;
+    
+    /** number of recorded calls in the last period */
+    unsigned int count;
+    
+    double p50;
+    
+    double p90;
+    
+    double p99;
+    
+    double max;
+};
+
+struct TimingStats {
+    base::Time time;
+    
+    std::vector<StageTiming> stages;
+};
+
+/**
+ * Filter parameters of one member of the parallel filter ensemble.
+ * Values of zero (or empty vectors) inherit the corresponding task property.
+ */
+struct EnsembleMember {
+    /** name of this configuration, for identification in logs */
+    std::string name;
+    
+    int particle_number;
+    
+    int minimum_perceptions;
+    
+    double effective_sample_size_threshold;
+    
+    double sonar_covariance;
+    
+    double sonar_covariance_reflection_factor;
+    
+    double sonar_covariance_corner_factor;
+    
+    double pipeline_covariance;
+    
+    double max_velocity_drift;
+    
+    /** row-wise 3x3 matrix */
+    std::vector<double> static_motion_covariance;
+    
+    /** row-wise 3x3 matrix */
+    std::vector<double> static_speed_covariance;
 };
 
+/**
+ * Pose of the FastFusion, extrapolated to the time of the prediction
+ */
+struct PredictedPose {
+    base::samples::RigidBodyState pose;
+    
+    /** time of the last fused pose, which was extrapolated */
+    base::Time source_time;
+    
+    /** extrapolated time in seconds, limited by max_prediction_horizon */
+    double horizon;
+    
+    /** true, if the horizon was limited */
+    bool clamped;
+};
 
 }
 
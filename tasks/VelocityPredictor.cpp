@@ -0,0 +1,87 @@
+#include "VelocityPredictor.hpp"
+#include "ParticleLocalization.hpp"
+
+using namespace uw_localization;
+
+VelocityPredictor::VelocityPredictor()
+  : configured(false), dynamic_model(0), use_dynamics_cache(false), integration_count(0)
+{
+}
+
+VelocityPredictor::~VelocityPredictor()
+{
+  delete dynamic_model;
+  dynamic_model = 0;
+}
+
+void VelocityPredictor::configure(const FilterConfig& config)
+{
+  delete dynamic_model;
+  dynamic_model = 0;
+
+  if(config.advanced_motion_model){
+    underwaterVehicle::Parameters params = ParticleLocalization::initializeDynamicModel(ParticleLocalization::VehicleParameter(config), config);
+    dynamic_model = new underwaterVehicle::DynamicModel(0.1, 5, 0.0, NULL, 12, 6);
+    dynamic_model->init_param(params);
+  }else{
+    motion_model.init(ParticleLocalization::VehicleParameter(config));
+  }
+
+  dynamics_cache.clear();
+  configured = true;
+}
+
+void VelocityPredictor::enableDynamicsCache(const DynamicsCacheConfig& config)
+{
+  dynamics_cache.configure(config);
+  use_dynamics_cache = true;
+}
+
+void VelocityPredictor::setThrusterVoltage(double voltage)
+{
+  if(dynamic_model){
+    dynamic_model->setThrusterVoltage(voltage);
+    dynamics_cache.clear();
+  }
+  else
+    motion_model.setThrusterVoltage(voltage);
+}
+
+base::Vector3d VelocityPredictor::predict(const base::Vector3d& velocity, const base::Quaterniond& orientation,
+                                          const base::samples::Joints& joints, double dt)
+{
+  if(usesDynamicsCache())
+    return dynamics_cache.predict(*dynamic_model, velocity, orientation, joints, dt);
+
+  if(dynamic_model)
+    return integrateDynamicModel(velocity, orientation, joints, dt);
+
+  return integrateMotionModel(velocity, joints, dt);
+}
+
+base::Vector3d VelocityPredictor::integrateDynamicModel(const base::Vector3d& velocity, const base::Quaterniond& orientation,
+                                                        const base::samples::Joints& joints, double dt)
+{
+  integration_count++;
+
+  dynamic_model->setPosition(base::Vector3d::Zero());
+  dynamic_model->setLinearVelocity(velocity);
+  dynamic_model->setAngularVelocity(base::Vector3d::Zero());
+  dynamic_model->setOrientation(orientation);
+  dynamic_model->setSamplingtime(dt);
+  dynamic_model->setPWMLevels(joints);
+
+  return dynamic_model->getLinearVelocity();
+}
+
+base::Vector3d VelocityPredictor::integrateMotionModel(const base::Vector3d& velocity, const base::samples::Joints& joints, double dt)
+{
+  integration_count++;
+
+  Vector6d Xt;
+  Xt.block<3,1>(0,0) = velocity;
+  Xt.block<3,1>(3,0) = base::Vector3d(0.0, 0.0, 0.0);
+
+  Vector6d V = motion_model.transition(Xt, dt, joints);
+  return V.block<3,1>(0,0);
+}
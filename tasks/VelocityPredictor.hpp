@@ -0,0 +1,101 @@
+/* ----------------------------------------------------------------------------
+ * VelocityPredictor.hpp
+ * Velocity predictions of the motion model for the particles of one filter
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_VELOCITY_PREDICTOR_HPP
+#define UW_PARTICLE_LOCALIZATION_VELOCITY_PREDICTOR_HPP
+
+#include <base/eigen.h>
+#include <base/samples/Joints.hpp>
+#include <uw_localization/model/uw_motion_model.hpp>
+#include <uwv_dynamic_model/uwv_dynamic_model.h>
+#include "LocalizationConfig.hpp"
+#include "DynamicsCache.hpp"
+
+namespace uw_localization {
+
+/**
+ * Predicts the velocity with the simple or the advanced motion model.
+ * Every filter owns its predictor, so the particles are predicted without
+ * locking. The predictor is not thread safe and must not be shared.
+ */
+class VelocityPredictor {
+public:
+  VelocityPredictor();
+  ~VelocityPredictor();
+
+  /**
+   * Creates the motion model, the linearizations of the dynamics cache are dropped
+   */
+  void configure(const FilterConfig& config);
+  bool isConfigured() const { return configured; }
+
+  /**
+   * Uses linearized transitions of the dynamic model. Only used with the advanced motion model
+   */
+  void enableDynamicsCache(const DynamicsCacheConfig& config);
+  const DynamicsCache& getDynamicsCache() const { return dynamics_cache; }
+
+  void setThrusterVoltage(double voltage);
+
+  /**
+   * Predicts the linear velocity after dt
+   * @param velocity: linear velocity in body frame
+   * @param orientation: orientation of the vehicle
+   * @param joints: thruster commands
+   * @param dt: sampling time in seconds
+   * @return: linear velocity in body frame
+   */
+  base::Vector3d predict(const base::Vector3d& velocity, const base::Quaterniond& orientation,
+                         const base::samples::Joints& joints, double dt);
+
+  /**
+   * Predicts the linear velocity after dt, the model is selected by the policy
+   * @param Motion: MotionPolicy, which has to match the configuration, see usesDynamicsCache
+   */
+  template<class Motion>
+  base::Vector3d predict(const base::Vector3d& velocity, const base::Quaterniond& orientation,
+                         const base::samples::Joints& joints, double dt)
+  {
+    if(Motion::advanced && Motion::cached)
+      return dynamics_cache.predict(*dynamic_model, velocity, orientation, joints, dt);
+
+    if(Motion::advanced)
+      return integrateDynamicModel(velocity, orientation, joints, dt);
+
+    return integrateMotionModel(velocity, joints, dt);
+  }
+
+  /**
+   * True, if the advanced motion model uses the dynamics cache
+   */
+  bool usesDynamicsCache() const { return dynamic_model && use_dynamics_cache; }
+
+  /**
+   * The dynamic model of the advanced motion model, otherwise 0
+   */
+  underwaterVehicle::DynamicModel* dynamicModel() { return dynamic_model; }
+
+  unsigned int integrations() const { return integration_count; }
+
+private:
+  bool configured;
+  UwMotionModel motion_model;
+  underwaterVehicle::DynamicModel* dynamic_model;
+  DynamicsCache dynamics_cache;
+  bool use_dynamics_cache;
+  unsigned int integration_count;
+
+  base::Vector3d integrateDynamicModel(const base::Vector3d& velocity, const base::Quaterniond& orientation,
+                                       const base::samples::Joints& joints, double dt);
+  base::Vector3d integrateMotionModel(const base::Vector3d& velocity, const base::samples::Joints& joints, double dt);
+
+  VelocityPredictor(const VelocityPredictor&);
+  VelocityPredictor& operator=(const VelocityPredictor&);
+};
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "../tasks/CircularMedian.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+/**
+ * Upper median of the angles relative to the first angle, by sorting
+ */
+double sortedMedian(const std::deque<double>& angles)
+{
+  std::vector<double> offsets;
+
+  for(std::deque<double>::const_iterator it = angles.begin(); it != angles.end(); it++)
+    offsets.push_back(wrapAngle(*it - angles.front()));
+
+  std::sort(offsets.begin(), offsets.end());
+  return wrapAngle(angles.front() + offsets[offsets.size() / 2]);
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(circular_median)
+
+BOOST_AUTO_TEST_CASE(matches_sorted_median_across_wraparound)
+{
+  boost::mt19937 rng(42);
+  boost::variate_generator<boost::mt19937&, boost::uniform_real<> > angle(rng, boost::uniform_real<>(-M_PI, M_PI));
+  boost::variate_generator<boost::mt19937&, boost::uniform_real<> > noise(rng, boost::uniform_real<>(-0.5, 0.5));
+  boost::variate_generator<boost::mt19937&, boost::uniform_int<> > window_size(rng, boost::uniform_int<>(1, 16));
+
+  for(int trial = 0; trial < 200; trial++){
+    size_t size = window_size();
+    CircularMedian median(size);
+    std::deque<double> window;
+
+    //The center drifts slowly over the wraparound, so a window spreads less than pi
+    double center = angle();
+
+    for(int i = 0; i < 50; i++){
+      center = wrapAngle(center + 0.05);
+      double sample = wrapAngle(center + noise());
+
+      median.push(sample);
+      window.push_back(sample);
+      if(window.size() > size)
+        window.pop_front();
+
+      BOOST_REQUIRE_EQUAL(median.size(), window.size());
+      BOOST_REQUIRE_SMALL(wrapAngle(median.median() - sortedMedian(window)), 1e-9);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(zero_window_keeps_the_last_angle)
+{
+  CircularMedian median(0);
+
+  median.push(1.0);
+  median.push(-3.0);
+
+  BOOST_CHECK_EQUAL(median.size(), 1u);
+  BOOST_CHECK_CLOSE(median.median(), -3.0, 1e-9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
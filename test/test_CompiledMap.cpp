@@ -0,0 +1,125 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdio>
+#include "../tasks/CompiledMap.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+const std::string DEPTH_MAP = "test_compiled_map_depth.yml";
+const std::string COMPILED_MAP = "test_compiled_map.uwcm";
+
+std::string yamlMap()
+{
+  return std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+}
+
+DepthObstacleGrid* createGrid(NodeMap& map)
+{
+  DepthObstacleGrid* grid = new DepthObstacleGrid( base::Vector2d(-map.getTranslation().x(), -map.getTranslation().y() ),
+                          base::Vector2d(map.getLimitations().x(), map.getLimitations().y() ), 0.5);
+  grid->initGrid();
+  grid->initDepthObstacleConfig(-8.0, 0.0, 2.0);
+  return grid;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(compiled_map)
+
+BOOST_AUTO_TEST_CASE(compiled_map_matches_the_yaml_maps)
+{
+  NodeMap map;
+  BOOST_REQUIRE(map.fromYaml(yamlMap()));
+
+  //A surveyed stripe, the rest of the grid has no depth
+  DepthObstacleGrid* grid = createGrid(map);
+  for(int i = 0; i < 20; i++)
+    grid->setDepth(-4.5 + 0.5 * i, 1.25, -3.0 - 0.1 * i, 0.2);
+  grid->saveYML(DEPTH_MAP);
+  delete grid;
+
+  BOOST_REQUIRE(CompiledMap::compile(yamlMap(), DEPTH_MAP, 0.5, COMPILED_MAP));
+
+  CompiledMap compiled;
+  BOOST_REQUIRE(compiled.open(COMPILED_MAP));
+  BOOST_CHECK(compiled.matches(map, 0.5));
+  BOOST_CHECK(!compiled.matches(map, 0.25));
+
+  //The depths are read from the mapping like the grid reads them from yaml
+  grid = createGrid(map);
+  BOOST_REQUIRE(grid->initializeDepth(DEPTH_MAP, 0.0001));
+  unsigned int depth_cells = 0;
+
+  for(double y = -9.75; y < 10.0; y += 0.5){
+    for(double x = -11.5; x < 11.75; x += 0.5){
+      double depth = grid->getDepth(x, y);
+      float compiled_depth = compiled.depthAt(x, y);
+      BOOST_CHECK_EQUAL(std::isnan(depth), std::isnan(compiled_depth));
+
+      if(!std::isnan(depth)){
+        BOOST_CHECK_CLOSE(compiled_depth, depth, 1e-4);
+        depth_cells++;
+      }
+    }
+  }
+
+  delete grid;
+  BOOST_CHECK_EQUAL(depth_cells, 20u);
+  BOOST_CHECK_EQUAL(compiled.getHeader().depth_cells, 20u);
+  BOOST_CHECK(std::isnan(compiled.depthAt(1000.0, 0.0)));
+
+  //The geometry is read without the yaml map
+  Environment env;
+  MapLayers layers;
+  GeometryIndex index;
+  BOOST_REQUIRE(compiled.readGeometry(env, layers, index));
+
+  Environment expected_env = map.getEnvironment();
+  BOOST_CHECK_EQUAL(env.planes.size(), expected_env.planes.size());
+  BOOST_CHECK_EQUAL(env.landmarks.size(), expected_env.landmarks.size());
+  BOOST_CHECK(layers.wall.isResolved());
+  BOOST_CHECK_EQUAL(layers.box.boxes().size(), 3u);
+  BOOST_CHECK(index.hasBoxes());
+  BOOST_CHECK(index.hasWorld());
+
+  MapLayers expected_layers;
+  BOOST_REQUIRE(expected_layers.resolve(yamlMap()));
+  GeometryIndex expected_index;
+  expected_index.build(expected_env, map, expected_layers.box.boxes());
+
+  for(int i = 0; i < 50; i++){
+    base::Vector3d point(-11.0 + 0.45 * i, 8.0 - 0.35 * i, -2.0);
+    BOOST_CHECK_CLOSE(index.nearest(point).distance, expected_index.nearest(point).distance, 1e-9);
+    BOOST_CHECK_EQUAL(index.beam(point, 0.13 * i, 0.2).primitive, expected_index.beam(point, 0.13 * i, 0.2).primitive);
+    BOOST_CHECK_EQUAL(index.belongsToWorld(point), expected_index.belongsToWorld(point));
+  }
+
+  compiled.close();
+  std::remove(DEPTH_MAP.c_str());
+  std::remove(COMPILED_MAP.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(corrupted_maps_are_rejected)
+{
+  CompiledMap compiled;
+  BOOST_CHECK(!compiled.open("test_compiled_map_missing.uwcm"));
+
+  FILE* file = fopen(COMPILED_MAP.c_str(), "wb");
+  BOOST_REQUIRE(file);
+  fputs("UWCM but no compiled map", file);
+  fclose(file);
+
+  BOOST_CHECK(!compiled.open(COMPILED_MAP));
+  BOOST_CHECK(!compiled.isOpen());
+  BOOST_CHECK(std::isnan(compiled.depth(0, 0)));
+
+  Environment env;
+  MapLayers layers;
+  GeometryIndex index;
+  BOOST_CHECK(!compiled.readGeometry(env, layers, index));
+  std::remove(COMPILED_MAP.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+#include <boost/test/unit_test.hpp>
+#include "../tasks/DeadReckoning.hpp"
+#include "../tasks/LocalizationCore.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+base::samples::Joints thrusters(const FilterConfig& config, double t)
+{
+  base::samples::Joints joints;
+  joints.time = base::Time::fromSeconds(t);
+  joints.names = config.joint_names;
+  joints.elements.resize(joints.names.size());
+
+  for(unsigned i = 0; i < joints.elements.size(); i++)
+    joints.elements[i].raw = 0.5;
+
+  return joints;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(dead_reckoning)
+
+BOOST_AUTO_TEST_CASE(older_thruster_sample_is_ignored)
+{
+  Environment env;
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+
+  DeadReckoning dead_reckoning;
+  dead_reckoning.configure(config);
+
+  base::Quaterniond orientation = base::Quaterniond::Identity();
+  BOOST_CHECK(dead_reckoning.update(thrusters(config, 1.0), orientation));
+  BOOST_CHECK(dead_reckoning.update(thrusters(config, 2.0), orientation));
+
+  base::samples::RigidBodyState pose = dead_reckoning.getPose();
+
+  //A delayed sample neither moves the pose nor the time of the last sample
+  BOOST_CHECK(dead_reckoning.update(thrusters(config, 1.5), orientation));
+  BOOST_CHECK(dead_reckoning.getPose().position == pose.position);
+  BOOST_CHECK(dead_reckoning.getPose().time == pose.time);
+  BOOST_CHECK_EQUAL(dead_reckoning.getError(), DEAD_RECKONING_OK);
+
+  //The next sample is integrated from the newest sample
+  BOOST_CHECK(dead_reckoning.update(thrusters(config, 2.1), orientation));
+  BOOST_CHECK(dead_reckoning.getPose().time == base::Time::fromSeconds(2.1));
+
+  BOOST_CHECK(!dead_reckoning.update(thrusters(config, 10.0), orientation));
+  BOOST_CHECK_EQUAL(dead_reckoning.getError(), DEAD_RECKONING_TIME_GAP);
+}
+
+BOOST_AUTO_TEST_CASE(configure_once_rejects_other_motion_model)
+{
+  Environment env;
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+
+  DeadReckoning dead_reckoning;
+  BOOST_CHECK(dead_reckoning.configureOnce(config));
+  BOOST_CHECK(dead_reckoning.configureOnce(config));
+
+  //The voltage is set at runtime, it does not conflict
+  FilterConfig other_voltage = config;
+  other_voltage.param_thrusterVoltage = 20.0;
+  BOOST_CHECK(dead_reckoning.configureOnce(other_voltage));
+
+  FilterConfig other_mass = config;
+  other_mass.param_mass = 80.0;
+  BOOST_CHECK(!dead_reckoning.configureOnce(other_mass));
+}
+
+BOOST_AUTO_TEST_CASE(configure_once_starts_at_the_init_position)
+{
+  Environment env;
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+  config.init_position = base::Vector3d(3.0, -2.0, -1.5);
+
+  DeadReckoning dead_reckoning;
+  BOOST_CHECK(dead_reckoning.configureOnce(config));
+  BOOST_CHECK(dead_reckoning.getPose().position == config.init_position);
+
+  //Later consumers do not move the pose of the first one
+  FilterConfig other_position = config;
+  other_position.init_position = base::Vector3d::Zero();
+  BOOST_CHECK(dead_reckoning.configureOnce(other_position));
+  BOOST_CHECK(dead_reckoning.getPose().position == config.init_position);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include "../tasks/DepthProfile.hpp"
+#include "../tasks/ParticleLocalization.hpp"
+#include "../tasks/LocalizationCore.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+const base::Matrix3d NO_COVARIANCE = base::Matrix3d::Zero();
+
+/**
+ * A valley along y, the deepest point is at x = 10
+ */
+double valley(double x)
+{
+  return -5.0 - 0.5 * std::fabs(x - 10.0);
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(depth_profile)
+
+BOOST_AUTO_TEST_CASE(profile_completes_by_window_distance_or_size)
+{
+  //Without window and distance, every sample is a profile
+  DepthProfile single;
+  BOOST_CHECK(!single.complete());
+  single.push(base::Time::fromSeconds(1.0), base::Vector3d::Zero(), NO_COVARIANCE, -5.0);
+  BOOST_CHECK(single.complete());
+
+  DepthProfile window(2.0, 0.0, 50);
+  window.push(base::Time::fromSeconds(1.0), base::Vector3d::Zero(), NO_COVARIANCE, -5.0);
+  window.push(base::Time::fromSeconds(2.5), base::Vector3d::Zero(), NO_COVARIANCE, -5.0);
+  BOOST_CHECK(!window.complete());
+  window.push(base::Time::fromSeconds(3.0), base::Vector3d::Zero(), NO_COVARIANCE, -5.0);
+  BOOST_CHECK(window.complete());
+
+  //Only the horizontal motion is traveled distance
+  DepthProfile distance(0.0, 2.0, 50);
+  distance.push(base::Time::fromSeconds(1.0), base::Vector3d(0.0, 0.0, 0.0), NO_COVARIANCE, -5.0);
+  distance.push(base::Time::fromSeconds(2.0), base::Vector3d(0.0, 0.0, -3.0), NO_COVARIANCE, -5.0);
+  BOOST_CHECK(!distance.complete());
+  distance.push(base::Time::fromSeconds(3.0), base::Vector3d(1.2, 1.6, -3.0), NO_COVARIANCE, -5.0);
+  BOOST_CHECK(distance.complete());
+
+  DepthProfile size(100.0, 0.0, 3);
+  for(int i = 0; i < 3; i++){
+    BOOST_CHECK(!size.complete());
+    size.push(base::Time::fromSeconds(i), base::Vector3d::Zero(), NO_COVARIANCE, -5.0);
+  }
+  BOOST_CHECK(size.complete());
+
+  size.clear();
+  BOOST_CHECK(size.empty());
+  BOOST_CHECK(!size.complete());
+}
+
+BOOST_AUTO_TEST_CASE(profile_is_compared_along_the_motion_of_the_vehicle)
+{
+  Environment env;
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+  config.use_slam = false;
+  config.use_initial_depthmap = true;
+  config.echosounder_variance = 0.5;
+
+  DepthObstacleGrid grid(base::Vector2d(0.0, 0.0), base::Vector2d(40.0, 40.0), 0.5);
+  grid.initGrid();
+  for(double x = 0.25; x < 20.0; x += 0.5){
+    for(double y = 0.25; y < 20.0; y += 0.5)
+      grid.setDepth(x, y, valley(x), 0.01);
+  }
+
+  ParticleLocalization localizer(config);
+
+  //The vehicle climbed the valley side from x = 10 to x = 14
+  DepthProfile profile(0.0, 0.0, 50);
+  for(int i = 0; i < 9; i++){
+    double x = 10.0 + i * 0.5;
+    profile.push(base::Time::fromSeconds(i), base::Vector3d(x, 10.0, -2.0), NO_COVARIANCE, valley(x));
+  }
+
+  PoseSlamParticle matching;
+  matching.p_position = base::Vector3d(14.0, 10.0, -2.0);
+  matching.main_confidence = 1.0;
+  matching.valid = true;
+
+  //On the other valley side, the last depth fits as well, but the profile goes downhill there
+  PoseSlamParticle mirrored = matching;
+  mirrored.p_position = base::Vector3d(6.0, 10.0, -2.0);
+
+  DepthProfile last;
+  last.push(profile.back().time, profile.back().position, NO_COVARIANCE, profile.back().depth);
+
+  BOOST_CHECK_CLOSE(localizer.perception(matching, last, grid), localizer.perception(mirrored, last, grid), 1e-6);
+  BOOST_CHECK_GT(localizer.perception(matching, profile, grid), localizer.perception(mirrored, profile, grid));
+
+  //A profile of one sample weights like the single depth
+  BOOST_CHECK_CLOSE(localizer.perception(mirrored, last, grid), localizer.perception(mirrored, last.back().depth, grid), 1e-9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
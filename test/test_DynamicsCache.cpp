@@ -0,0 +1,73 @@
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include "../tasks/VelocityPredictor.hpp"
+#include "../tasks/LocalizationCore.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+base::samples::Joints thrusters(const FilterConfig& config, double t, double raw)
+{
+  base::samples::Joints joints;
+  joints.time = base::Time::fromSeconds(t);
+  joints.names = config.joint_names;
+  joints.elements.resize(joints.names.size());
+
+  for(unsigned i = 0; i < joints.elements.size(); i++)
+    joints.elements[i].raw = (i % 2 ? raw : -0.5 * raw);
+
+  return joints;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(dynamics_cache)
+
+BOOST_AUTO_TEST_CASE(cached_prediction_follows_the_integration_of_a_ramped_input)
+{
+  Environment env;
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+  config.advanced_motion_model = true;
+
+  VelocityPredictor integrated;
+  integrated.configure(config);
+
+  VelocityPredictor cached;
+  cached.configure(config);
+  cached.enableDynamicsCache(DynamicsCacheConfig());
+
+  //Particle velocities spread over +-0.3 m/s
+  std::vector<base::Vector3d> velocities;
+  for(int i = 0; i < 50; i++)
+    velocities.push_back(base::Vector3d(0.3 + ((i * 37) % 60) / 100.0 - 0.3, ((i * 53) % 60) / 100.0 - 0.3, ((i * 71) % 20) / 100.0 - 0.1));
+
+  double max_error = 0.0;
+  unsigned int predictions = 0;
+
+  //The thruster commands ramp up, while the vehicle pitches slowly
+  for(int step = 0; step < 400; step++){
+    base::samples::Joints joints = thrusters(config, step * 0.1, step * 0.002);
+    base::Quaterniond orientation(Eigen::AngleAxisd(step * 0.00025, base::Vector3d::UnitY()));
+
+    for(unsigned i = 0; i < velocities.size(); i++){
+      base::Vector3d expected = integrated.predict(velocities[i], orientation, joints, 0.1);
+      base::Vector3d predicted = cached.predict(velocities[i], orientation, joints, 0.1);
+
+      max_error = std::max(max_error, (predicted - expected).norm());
+      predictions++;
+    }
+  }
+
+  const DynamicsCache& cache = cached.getDynamicsCache();
+
+  BOOST_CHECK_SMALL(max_error, 0.01);
+  BOOST_CHECK_EQUAL(cache.hits() + cache.linearizations() + cache.integrations(), predictions);
+  BOOST_CHECK_GT(static_cast<double>(cache.hits()) / predictions, 0.75);
+
+  //The linearizations and the direct integrations cost less than integrating every particle
+  BOOST_CHECK_LT(cache.integrations() + cache.linearizations() * 14, integrated.integrations());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdlib>
+#include "../tasks/Fir.hpp"
+
+using namespace uw_localization;
+
+BOOST_AUTO_TEST_SUITE(fir)
+
+BOOST_AUTO_TEST_CASE(fir_filter_matches_the_list_fir)
+{
+  std::vector<double> weights;
+  weights.push_back(0.1);
+  weights.push_back(0.2);
+  weights.push_back(0.3);
+  weights.push_back(0.4);
+
+  FirFilter<double> filter(weights);
+  std::list<double> window;
+
+  for(int i = 0; i < 20; i++){
+    double sample = std::sin(i * 0.7) + i * 0.1;
+    filter.push(sample);
+
+    window.push_back(sample);
+    if(window.size() > weights.size())
+      window.pop_front();
+
+    //Before the window is full, the last weights are applied
+    std::vector<double> used(weights.end() - window.size(), weights.end());
+    BOOST_CHECK_CLOSE(filter.value(), Fir(used, window), 1e-9);
+  }
+
+  BOOST_CHECK(filter.full());
+  filter.clear();
+  BOOST_CHECK_EQUAL(filter.size(), 0u);
+  BOOST_CHECK_EQUAL(filter.value(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(fir_filter_of_vectors)
+{
+  FirFilter<Eigen::Vector3d> filter(MovingAverage(2));
+  filter.push(Eigen::Vector3d(1.0, 2.0, 3.0));
+  filter.push(Eigen::Vector3d(3.0, 2.0, 1.0));
+  filter.push(Eigen::Vector3d(5.0, 0.0, 1.0));
+
+  BOOST_CHECK_SMALL((filter.value() - Eigen::Vector3d(4.0, 1.0, 1.0)).norm(), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(moving_variance_matches_the_window)
+{
+  MovingVariance<double> variance(5);
+  std::list<double> window;
+  std::srand(7);
+
+  //Long enough for several recomputations of the running sums
+  for(int i = 0; i < 1000; i++){
+    double sample = 1000.0 + std::rand() / static_cast<double>(RAND_MAX);
+    variance.push(sample);
+
+    window.push_back(sample);
+    if(window.size() > 5)
+      window.pop_front();
+
+    double mean = 0.0;
+    for(std::list<double>::const_iterator it = window.begin(); it != window.end(); it++)
+      mean += *it;
+    mean /= window.size();
+
+    double expected = 0.0;
+    for(std::list<double>::const_iterator it = window.begin(); it != window.end(); it++)
+      expected += (*it - mean) * (*it - mean);
+    expected /= window.size();
+
+    BOOST_CHECK_CLOSE(variance.mean(), mean, 1e-9);
+    BOOST_CHECK_SMALL(variance.variance() - expected, 1e-6);
+  }
+
+  BOOST_CHECK(variance.full());
+  BOOST_CHECK_EQUAL(variance.size(), 5u);
+}
+
+BOOST_AUTO_TEST_CASE(moving_variance_of_vectors_is_element_wise)
+{
+  MovingVariance<Eigen::Vector2d> variance(2);
+  variance.push(Eigen::Vector2d(1.0, 5.0));
+  variance.push(Eigen::Vector2d(3.0, 5.0));
+
+  BOOST_CHECK_SMALL((variance.mean() - Eigen::Vector2d(2.0, 5.0)).norm(), 1e-9);
+  BOOST_CHECK_SMALL((variance.variance() - Eigen::Vector2d(1.0, 0.0)).norm(), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(exponential_filter_converges_to_a_constant)
+{
+  ExponentialFilter<double> filter(0.5);
+  BOOST_CHECK(filter.empty());
+
+  //The first sample initializes the mean
+  filter.push(4.0);
+  BOOST_CHECK_EQUAL(filter.mean(), 4.0);
+  BOOST_CHECK_EQUAL(filter.variance(), 0.0);
+
+  filter.push(2.0);
+  BOOST_CHECK_CLOSE(filter.mean(), 3.0, 1e-9);
+  BOOST_CHECK_CLOSE(filter.variance(), 1.0, 1e-9);
+
+  for(int i = 0; i < 100; i++)
+    filter.push(1.0);
+
+  BOOST_CHECK_CLOSE(filter.mean(), 1.0, 1e-9);
+  BOOST_CHECK_SMALL(filter.variance(), 1e-9);
+
+  //An alpha of one follows the samples
+  filter.setAlpha(1.0);
+  filter.push(7.0);
+  BOOST_CHECK_EQUAL(filter.mean(), 7.0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdlib>
+#include "../tasks/GeometryIndex.hpp"
+#include "../tasks/MapLayers.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+double uniform(double min, double max)
+{
+  return min + (max - min) * (std::rand() / (double) RAND_MAX);
+}
+
+/**
+ * Quay walls as a polyline around the origin, like the microbench
+ */
+Environment quayWalls(unsigned count)
+{
+  Environment env;
+
+  for(unsigned i = 0; i < count; i++){
+    double a = 2.0 * M_PI * i / count;
+    double b = 2.0 * M_PI * (i + 1) / count;
+    Plane plane;
+    plane.position = base::Vector3d(30.0 * std::cos(a), 20.0 * std::sin(a), 0.0);
+    plane.span_horizontal = base::Vector3d(30.0 * std::cos(b), 20.0 * std::sin(b), 0.0) - plane.position;
+    plane.span_vertical = base::Vector3d(0.0, 0.0, -5.0);
+    env.planes.push_back(plane);
+  }
+
+  return env;
+}
+
+base::Vector3d closestWallPoint(const Plane& plane, const base::Vector3d& point)
+{
+  base::Vector2d start(plane.position.x(), plane.position.y());
+  base::Vector2d segment(plane.span_horizontal.x(), plane.span_horizontal.y());
+  double t = std::max(0.0, std::min(1.0, (point.head<2>() - start).dot(segment) / segment.squaredNorm()));
+  base::Vector2d closest = start + t * segment;
+
+  double z_min = plane.position.z() + std::min(0.0, plane.span_vertical.z());
+  double z_max = plane.position.z() + std::max(0.0, plane.span_vertical.z());
+  return base::Vector3d(closest.x(), closest.y(), std::max(z_min, std::min(z_max, point.z())));
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(geometry_index)
+
+BOOST_AUTO_TEST_CASE(nearest_wall_matches_all_planes)
+{
+  Environment env = quayWalls(200);
+  GeometryIndex index;
+  index.build(env);
+  std::srand(42);
+
+  for(int i = 0; i < 500; i++){
+    base::Vector3d point(uniform(-40.0, 40.0), uniform(-30.0, 30.0), uniform(-8.0, 2.0));
+
+    double best = INFINITY;
+    for(unsigned j = 0; j < env.planes.size(); j++)
+      best = std::min(best, (closestWallPoint(env.planes[j], point) - point).norm());
+
+    GeometryHit hit = index.nearest(point);
+    BOOST_REQUIRE(hit.primitive >= 0);
+    BOOST_CHECK_CLOSE(hit.distance, best, 1e-6);
+    BOOST_CHECK_CLOSE((closestWallPoint(env.planes[hit.primitive], point) - point).norm(), best, 1e-6);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(raycast_matches_all_planes)
+{
+  Environment env = quayWalls(200);
+  GeometryIndex index;
+  index.build(env);
+  std::srand(7);
+
+  for(int i = 0; i < 500; i++){
+    base::Vector3d origin(uniform(-20.0, 20.0), uniform(-12.0, 12.0), -2.0);
+    double yaw = uniform(-M_PI, M_PI);
+    base::Vector2d direction(std::cos(yaw), std::sin(yaw));
+
+    double best = INFINITY;
+    for(unsigned j = 0; j < env.planes.size(); j++){
+      base::Vector2d start(env.planes[j].position.x(), env.planes[j].position.y());
+      base::Vector2d segment(env.planes[j].span_horizontal.x(), env.planes[j].span_horizontal.y());
+      base::Vector2d offset = start - origin.head<2>();
+      double denominator = direction.x() * segment.y() - direction.y() * segment.x();
+      double t = (offset.x() * segment.y() - offset.y() * segment.x()) / denominator;
+      double s = (offset.x() * direction.y() - offset.y() * direction.x()) / denominator;
+
+      if(t >= 0.0 && s >= 0.0 && s <= 1.0)
+        best = std::min(best, t);
+    }
+
+    GeometryHit hit = index.raycast(origin, direction * 3.0);
+    BOOST_CHECK_CLOSE(hit.distance, best, 1e-6);
+  }
+
+  //The ray passes below the walls
+  GeometryHit below = index.raycast(base::Vector3d(0.0, 0.0, -6.0), base::Vector2d(1.0, 0.0));
+  BOOST_CHECK(below.primitive < 0);
+}
+
+BOOST_AUTO_TEST_CASE(index_matches_the_node_map)
+{
+  std::string yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+  NodeMap map;
+  BOOST_REQUIRE(map.fromYaml(yaml_map));
+  Environment env = map.getEnvironment();
+
+  MapLayers resolved;
+  BOOST_REQUIRE(resolved.resolve(yaml_map));
+
+  GeometryIndex index;
+  index.build(env, map, resolved.box.boxes());
+  BOOST_CHECK(index.hasBoxes());
+  BOOST_CHECK(index.hasWorld());
+  BOOST_CHECK_EQUAL(index.boxCount(), 3u);
+
+  //Unresolved layers ask the node map
+  MapLayers layers;
+  double vertical_half_angle = 0.3;
+  std::srand(3);
+
+  for(int i = 0; i < 300; i++){
+    base::Vector3d origin(uniform(-11.0, 11.0), uniform(-9.0, 9.0), uniform(-4.0, -1.0));
+    double yaw = uniform(-M_PI, M_PI);
+    base::Vector3d point = origin + base::Vector3d(uniform(1.0, 15.0) * std::cos(yaw), uniform(1.0, 15.0) * std::sin(yaw), 0.0);
+
+    //Like the perception, the distance from the particle to the wall point nearest to the measured point
+    LayerDistance wall = layers.wall.nearest(map, point, origin);
+    GeometryHit wall_hit = index.nearest(point);
+    BOOST_CHECK_CLOSE((wall_hit.point - origin).norm(), wall.get<1>(), 1e-4);
+
+    LayerDistance box = layers.box.beam(map, vertical_half_angle, yaw, origin);
+    GeometryHit box_hit = index.beam(origin, yaw, vertical_half_angle);
+    BOOST_CHECK_EQUAL(box_hit.primitive >= 0, box.get<1>() != INFINITY);
+
+    if(box_hit.primitive >= 0 && box.get<1>() != INFINITY)
+      BOOST_CHECK_CLOSE((box_hit.point - origin).norm(), box.get<1>(), 1e-4);
+  }
+
+  for(int i = 0; i < 300; i++){
+    base::Vector3d point(uniform(-15.0, 15.0), uniform(-13.0, 13.0), uniform(-13.0, 3.0));
+    BOOST_CHECK_EQUAL(index.belongsToWorld(point), map.belongsToWorld(point));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(beam_hits_boxes_from_the_side)
+{
+  MapLayers layers;
+  BOOST_REQUIRE(layers.resolve(std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml"));
+
+  GeometryIndex index;
+  Environment env;
+  NodeMap map;
+  index.build(env, map, layers.box.boxes());
+
+  //A beam along the first box, which misses it, and one that hits it from the side
+  BOOST_CHECK(index.beam(base::Vector3d(-8.0, 0.0, -2.0), 0.0, 0.1).primitive < 0);
+  GeometryHit hit = index.beam(base::Vector3d(-8.0, 3.0, -2.0), 0.0, 0.1);
+  BOOST_CHECK_EQUAL(hit.primitive, 0);
+  BOOST_CHECK_CLOSE(hit.distance, 3.0, 1e-9);
+
+  //A box below the beam is hit, where the widening beam reaches its top
+  GeometryBox low;
+  low.min = base::Vector3d(5.0, -1.0, -10.0);
+  low.max = base::Vector3d(20.0, 1.0, -6.0);
+  hit = GeometryHit();
+  BOOST_REQUIRE(GeometryIndex::beamHitsBox(low, base::Vector3d(0.0, 0.0, -2.0), base::Vector2d(1.0, 0.0), 0.5, hit));
+  BOOST_CHECK_CLOSE(hit.distance, 8.0, 1e-9);
+  BOOST_CHECK_CLOSE(hit.point.z(), -6.0, 1e-9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
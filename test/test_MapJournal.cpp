@@ -0,0 +1,204 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <unistd.h>
+#include "../tasks/MapJournal.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+const std::string JOURNAL = "test_map_journal.journal";
+
+bool exists(const std::string& file)
+{
+  FILE* f = fopen(file.c_str(), "rb");
+
+  if(f)
+    fclose(f);
+
+  return f != 0;
+}
+
+/**
+ * @return: the segments of the journal, oldest first
+ */
+std::vector<std::string> segments()
+{
+  std::vector<std::string> result;
+
+  for(unsigned i = 1; exists(MapJournal::segmentName(JOURNAL, i)); i++)
+    result.insert(result.begin(), MapJournal::segmentName(JOURNAL, i));
+
+  if(exists(JOURNAL))
+    result.push_back(JOURNAL);
+
+  return result;
+}
+
+void removeSegments()
+{
+  for(unsigned i = 0; remove(MapJournal::segmentName(JOURNAL, i).c_str()) == 0 || i == 0; i++);
+}
+
+MapJournalHeader testHeader()
+{
+  MapJournalHeader header;
+  header.yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+  header.resolution = 0.5;
+  header.min_depth = -8.0;
+  header.max_depth = 0.0;
+  header.depth_resolution = 2.0;
+  header.confidence_threshold = 0.5;
+  header.count_threshold = 2;
+  return header;
+}
+
+void checkCell(DepthObstacleGrid& expected, DepthObstacleGrid& replayed, double x, double y)
+{
+  SimpleGrid expected_grid, replayed_grid;
+  expected.getSimpleGrid(expected_grid, 0.0, 0);
+  replayed.getSimpleGrid(replayed_grid, 0.0, 0);
+
+  SimpleGridElement expected_cell, replayed_cell;
+  BOOST_REQUIRE(expected_grid.getCell(x, y, expected_cell));
+  BOOST_REQUIRE(replayed_grid.getCell(x, y, replayed_cell));
+
+  BOOST_CHECK_EQUAL(std::isnan(expected_cell.depth), std::isnan(replayed_cell.depth));
+  if(!std::isnan(expected_cell.depth)){
+    BOOST_CHECK_CLOSE(expected_cell.depth, replayed_cell.depth, 1e-6);
+    BOOST_CHECK_CLOSE(expected_cell.depth_variance, replayed_cell.depth_variance, 1e-6);
+  }
+
+  BOOST_CHECK_EQUAL(expected_cell.obstacle, replayed_cell.obstacle);
+  BOOST_CHECK_CLOSE(expected_cell.obstacle_confidence, replayed_cell.obstacle_confidence, 1e-6);
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(map_journal)
+
+BOOST_AUTO_TEST_CASE(replay_starts_at_the_newest_snapshot)
+{
+  removeSegments();
+
+  MapJournalHeader header = testHeader();
+  NodeMap map;
+  BOOST_REQUIRE(map.fromYaml(header.yaml_map));
+  DepthObstacleGrid* grid = MapJournalReader::createGrid(header, &map);
+
+  //Every segment holds ten records
+  MapJournal journal;
+  BOOST_REQUIRE(journal.open(JOURNAL, header, 10 * MapJournal::RECORD_SIZE, 1));
+
+  for(int i = 0; i < 30; i++){
+    double x = 0.5 * (i % 10);
+    double y = -5.0 + 0.5 * (i / 10);
+    grid->setDepth(x, y, -3.0 - 0.1 * i, 0.2);
+    journal.recordDepth(x, y, -3.0 - 0.1 * i, 0.2);
+  }
+
+  for(int i = 0; i < 12; i++){
+    grid->setObstacle(2.0 + 0.5 * i, -3.0, i % 3 != 0, 0.8);
+    journal.recordObstacle(2.0 + 0.5 * i, -3.0, i % 3 != 0, 0.8);
+  }
+
+  grid->setBuoy(6.0, 2.0, YELLOW, 0.9, true);
+  journal.recordBuoy(6.0, 2.0, YELLOW, 0.9, true);
+
+  //No snapshot exists, so all segments are kept beyond the maximum
+  BOOST_CHECK(journal.needsCompaction());
+  BOOST_CHECK_GT(segments().size(), 2u);
+
+  BOOST_REQUIRE(journal.compact(*grid, ""));
+  BOOST_CHECK(!journal.needsCompaction());
+  BOOST_CHECK_EQUAL(segments().size(), 2u);
+
+  boost::uint32_t snapshot_sequence = journal.records();
+
+  //Changes after the snapshot are rotated again
+  grid->initThresholds(0.7, 3);
+  journal.recordThresholds(0.7, 3);
+  journal.recordThresholds(0.7, 3);
+
+  for(int i = 0; i < 25; i++){
+    double x = 0.5 * (i % 5);
+    double y = -5.0 + 0.5 * (i / 5);
+    grid->setDepth(x, y, -4.0, 0.3);
+    journal.recordDepth(x, y, -4.0, 0.3);
+  }
+
+  grid->setObstacle(4.0, -3.0, true, 0.6);
+  journal.recordObstacle(4.0, -3.0, true, 0.6);
+  journal.close();
+
+  MapJournalReplay replay;
+  BOOST_REQUIRE(replay.open(segments()));
+  BOOST_CHECK(replay.hasSnapshot());
+  BOOST_CHECK_EQUAL(replay.snapshotSequence(), snapshot_sequence);
+  BOOST_CHECK(replay.getHeader().yaml_depth_map.empty());
+
+  DepthObstacleGrid* replayed = replay.replay(&map);
+  BOOST_REQUIRE(replayed);
+
+  //The unchanged thresholds are not recorded twice
+  BOOST_CHECK_EQUAL(replay.records(), 27u);
+  BOOST_CHECK(!replay.hasWarnings());
+
+  for(int i = 0; i < 30; i++)
+    checkCell(*grid, *replayed, 0.5 * (i % 10), -5.0 + 0.5 * (i / 10));
+
+  for(int i = 0; i < 12; i++)
+    checkCell(*grid, *replayed, 2.0 + 0.5 * i, -3.0);
+
+  delete replayed;
+  delete grid;
+  removeSegments();
+}
+
+BOOST_AUTO_TEST_CASE(torn_snapshot_replays_the_older_segments)
+{
+  removeSegments();
+
+  MapJournalHeader header = testHeader();
+  NodeMap map;
+  BOOST_REQUIRE(map.fromYaml(header.yaml_map));
+  DepthObstacleGrid* grid = MapJournalReader::createGrid(header, &map);
+
+  MapJournal journal;
+  BOOST_REQUIRE(journal.open(JOURNAL, header, 0, 2));
+
+  for(int i = 0; i < 5; i++){
+    grid->setDepth(0.5 * i, 0.0, -3.0, 0.2);
+    journal.recordDepth(0.5 * i, 0.0, -3.0, 0.2);
+  }
+
+  BOOST_REQUIRE(journal.compact(*grid, ""));
+  journal.close();
+
+  //The end of the snapshot is lost, like after a crash while compacting
+  FILE* file = fopen(JOURNAL.c_str(), "rb");
+  BOOST_REQUIRE(file);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  BOOST_REQUIRE(truncate(JOURNAL.c_str(), size - MapJournal::RECORD_SIZE) == 0);
+
+  MapJournalReplay replay;
+  BOOST_REQUIRE(replay.open(segments()));
+  BOOST_CHECK(!replay.hasSnapshot());
+
+  DepthObstacleGrid* replayed = replay.replay(&map);
+  BOOST_REQUIRE(replayed);
+  BOOST_CHECK_EQUAL(replay.records(), 5u);
+
+  for(int i = 0; i < 5; i++)
+    checkCell(*grid, *replayed, 0.5 * i, 0.0);
+
+  delete replayed;
+  delete grid;
+  removeSegments();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include "../tasks/MapLayers.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+double uniform(double min, double max)
+{
+  return min + (max - min) * (std::rand() / (double) RAND_MAX);
+}
+
+std::string mapFile(const std::string& name)
+{
+  return std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/" + name;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(map_layers)
+
+BOOST_AUTO_TEST_CASE(layers_are_read_from_the_map)
+{
+  MapLayers layers;
+  BOOST_REQUIRE(layers.resolve(mapFile("testhalle.yml")));
+
+  BOOST_CHECK(layers.wall.isResolved());
+  BOOST_REQUIRE_EQUAL(layers.wall.strips().size(), 4u);
+  BOOST_CHECK(layers.wall.boxes().empty());
+  BOOST_CHECK_CLOSE(layers.wall.strips()[0].start.y(), -9.5, 1e-9);
+  BOOST_CHECK_CLOSE(layers.wall.strips()[0].end.y(), 9.5, 1e-9);
+  BOOST_CHECK_CLOSE(layers.wall.strips()[0].z_min, -20.0, 1e-9);
+  BOOST_CHECK_EQUAL(layers.wall.strips()[0].z_max, 0.0);
+
+  //The position is the center of the box
+  BOOST_REQUIRE_EQUAL(layers.box.boxes().size(), 3u);
+  BOOST_CHECK_CLOSE(layers.box.boxes()[0].min.x(), -5.0, 1e-9);
+  BOOST_CHECK_CLOSE(layers.box.boxes()[0].max.y(), 5.0, 1e-9);
+  BOOST_CHECK_CLOSE(layers.box.boxes()[0].min.z(), -20.0, 1e-9);
+
+  //Layers, which are missing in the map, are resolved without nodes
+  BOOST_CHECK(layers.buoy.isResolved());
+  BOOST_CHECK(layers.buoy.strips().empty());
+  BOOST_CHECK(layers.pipeline.isResolved());
+
+  NodeMap map;
+  BOOST_CHECK_EQUAL(layers.buoy.nearest(map, base::Vector3d(1.0, 2.0, -3.0), base::Vector3d::Zero()).get<1>(), INFINITY);
+
+  BOOST_REQUIRE(layers.resolve(mapFile("studiobad.yml")));
+  BOOST_CHECK(layers.box.isResolved());
+  BOOST_CHECK(layers.box.boxes().empty());
+  BOOST_CHECK_EQUAL(layers.box.beam(map, 0.1, 0.0, base::Vector3d::Zero()).get<1>(), INFINITY);
+}
+
+BOOST_AUTO_TEST_CASE(resolved_layers_match_the_node_map)
+{
+  NodeMap map;
+  BOOST_REQUIRE(map.fromYaml(mapFile("testhalle.yml")));
+
+  MapLayers resolved;
+  BOOST_REQUIRE(resolved.resolve(mapFile("testhalle.yml")));
+  MapLayers layers;
+  std::srand(11);
+
+  for(int i = 0; i < 300; i++){
+    base::Vector3d origin(uniform(-11.0, 11.0), uniform(-9.0, 9.0), uniform(-4.0, -1.0));
+    double yaw = uniform(-M_PI, M_PI);
+    base::Vector3d point = origin + base::Vector3d(uniform(1.0, 15.0) * std::cos(yaw), uniform(1.0, 15.0) * std::sin(yaw), 0.0);
+
+    BOOST_CHECK_CLOSE(resolved.wall.nearest(map, point, origin).get<1>(), layers.wall.nearest(map, point, origin).get<1>(), 1e-4);
+
+    double box = layers.box.beam(map, 0.3, yaw, origin).get<1>();
+    double resolved_box = resolved.box.beam(map, 0.3, yaw, origin).get<1>();
+    BOOST_CHECK_EQUAL(resolved_box != INFINITY, box != INFINITY);
+
+    if(resolved_box != INFINITY && box != INFINITY)
+      BOOST_CHECK_CLOSE(resolved_box, box, 1e-4);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(unknown_nodes_leave_the_layer_unresolved)
+{
+  const std::string file = "test_map_layers.yml";
+  {
+    std::ofstream out(file.c_str());
+    out << "root:\n"
+        << "  wall:\n"
+        << "    - line_from: [0.0, 0.0, 0.0]\n"
+        << "      line_to:   [4.0, 0.0, 0.0]\n"
+        << "      height:    -2.0\n"
+        << "  pipeline:\n"
+        << "    - curve: [1.0, 2.0]\n"
+        << "  buoy:\n"
+        << "    - mean: [1.0, 3.0, -1.0]\n";
+  }
+
+  MapLayers layers;
+  BOOST_REQUIRE(layers.resolve(file));
+  BOOST_CHECK(layers.wall.isResolved());
+  BOOST_CHECK(!layers.pipeline.isResolved());
+  BOOST_CHECK(layers.buoy.isResolved());
+
+  //The distance is measured from the origin to the nearest point of the layer
+  NodeMap map;
+  LayerDistance wall = layers.wall.nearest(map, base::Vector3d(2.0, 1.0, -5.0), base::Vector3d(2.0, 3.0, -2.0));
+  BOOST_CHECK_CLOSE(wall.get<2>().z(), -2.0, 1e-9);
+  BOOST_CHECK_CLOSE(wall.get<1>(), 3.0, 1e-9);
+
+  LayerDistance buoy = layers.buoy.nearest(map, base::Vector3d(0.0, 0.0, 0.0), base::Vector3d(1.0, 0.0, -1.0));
+  BOOST_CHECK_CLOSE(buoy.get<1>(), 3.0, 1e-9);
+
+  //A file, which can not be read, leaves all layers unresolved
+  std::remove(file.c_str());
+  BOOST_CHECK(!layers.resolve(file));
+  BOOST_CHECK(!layers.wall.isResolved());
+  BOOST_CHECK(!layers.buoy.isResolved());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,254 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <algorithm>
+#include "../tasks/ParticleLocalization.hpp"
+#include "../tasks/LocalizationCore.hpp"
+#include "../tasks/MapLoader.hpp"
+#include "../tasks/MapLayers.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+/**
+ * Gives the test access to the particles of the filter
+ */
+class TestLocalization : public ParticleLocalization {
+public:
+  TestLocalization(const FilterConfig& config) : ParticleLocalization(config) {}
+
+  std::list<PoseSlamParticle>& particleList() { return particles; }
+};
+
+std::vector<double> weights(const std::list<PoseSlamParticle>& particles)
+{
+  std::vector<double> result;
+
+  for(std::list<PoseSlamParticle>::const_iterator it = particles.begin(); it != particles.end(); ++it)
+    result.push_back(it->main_confidence);
+
+  return result;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(particle_localization)
+
+BOOST_AUTO_TEST_CASE(angle_diff_to_corner_checks_both_corners)
+{
+  Environment env;
+  Plane plane;
+  plane.position = base::Vector3d(4.0, -1.0, 0.0);
+  plane.span_horizontal = base::Vector3d(0.0, 6.0, 0.0);
+  plane.span_vertical = base::Vector3d(0.0, 0.0, -2.0);
+  env.planes.push_back(plane);
+
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+  ParticleLocalization localizer(config);
+
+  base::Vector3d position(2.0, 0.0, 0.0);
+
+  //Beam straight at the second corner (4, 5)
+  double diff = localizer.angleDiffToCorner(std::atan2(5.0, 2.0), position, &env);
+  BOOST_CHECK_SMALL(diff, 1e-9);
+
+  //Beam at the first corner (4, -1), with the yaw wound up by two turns
+  diff = localizer.angleDiffToCorner(std::atan2(-1.0, 2.0) + 4.0 * M_PI, position, &env);
+  BOOST_CHECK_SMALL(diff, 1e-9);
+
+  //Beam away from both corners
+  diff = localizer.angleDiffToCorner(M_PI, position, &env);
+  BOOST_CHECK_CLOSE(diff, M_PI / 2.0, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(slam_uses_the_new_map_after_a_swap)
+{
+  MapSource source;
+  source.yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+  LoadedMap* old_map = MapLoader::load(source);
+  source.yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/nurc.yml";
+  LoadedMap* new_map = MapLoader::load(source);
+  BOOST_REQUIRE(old_map && new_map);
+
+  FilterConfig config;
+  defaultFilterConfig(config, &old_map->env);
+  config.use_slam = true;
+  config.use_initial_depthmap = false;
+
+  //The particles are inside the new map, but outside of the old one
+  ParticleLocalization localizer(config);
+  localizer.initialize(20, base::Vector3d(-30.0, 25.0, -2.0), base::Vector3d(1.0, 1.0, 0.0), 0.0, 0.0);
+  localizer.init_slam(old_map->map);
+
+  config.env = &new_map->env;
+  localizer.setEnvironment(&new_map->env, new_map->geometry_index, new_map->layers, new_map->compiled);
+  localizer.updateConfig(config);
+  localizer.rebind_slam(new_map->map);
+  delete old_map;
+
+  base::samples::RigidBodyState orientation;
+  orientation.time = base::Time::now();
+  orientation.position = base::Vector3d(0.0, 0.0, -2.0);
+  orientation.orientation = base::Quaterniond::Identity();
+  localizer.setCurrentOrientation(orientation);
+
+  sonar_detectors::ObstacleFeatures beam;
+  beam.time = orientation.time;
+  beam.angle = M_PI;
+  sonar_detectors::ObstacleFeature feature;
+  feature.range = 5000;
+  feature.confidence = 1.0;
+  beam.features.push_back(feature);
+
+  localizer.observe(beam, *new_map->map, 1.0);
+  localizer.observe(3.0, *new_map->grid, 1.0);
+
+  BOOST_CHECK_GT(localizer.getStats().depth_features_per_particle, 0u);
+
+  delete new_map;
+}
+
+BOOST_AUTO_TEST_CASE(full_laser_scan_weight_does_not_underflow)
+{
+  MapSource source;
+  source.yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+  LoadedMap* map = MapLoader::load(source);
+  BOOST_REQUIRE(map);
+
+  FilterConfig config;
+  defaultFilterConfig(config, &map->env);
+  config.sonar_maximum_distance = 50.0;
+
+  ParticleLocalization localizer(config);
+  localizer.setEnvironment(&map->env, map->geometry_index, map->layers, map->compiled);
+
+  base::samples::RigidBodyState pose;
+  pose.time = base::Time::now();
+  pose.position = base::Vector3d(0.0, -4.0, -2.0);
+  pose.orientation = base::Quaterniond::Identity();
+  localizer.setCurrentOrientation(pose);
+
+  //A full turn with half a degree resolution, simulated like generate_scenario does
+  base::samples::LaserScan scan;
+  scan.time = pose.time;
+  scan.start_angle = -M_PI;
+  scan.angular_resolution = M_PI / 360.0;
+
+  MapLayers layers;
+  for(int i = 0; i < 720; i++){
+    double angle = scan.start_angle + i * scan.angular_resolution;
+    Eigen::AngleAxis<double> beam_yaw(angle, Eigen::Vector3d::UnitZ());
+    base::Vector3d end = pose.position + beam_yaw * (config.sonarToAvalon * base::Vector3d(config.sonar_maximum_distance, 0.0, 0.0));
+
+    double wall = layers.wall.nearest(*map->map, end, pose.position).get<1>();
+    double box = layers.box.beam(*map->map, config.sonar_vertical_angle / 2.0, angle, pose.position).get<1>();
+    scan.ranges.push_back(static_cast<uint32_t>(std::min(wall, box) * 1000.0));
+  }
+
+  PoseSlamParticle matching;
+  matching.p_position = pose.position;
+  matching.main_confidence = 1.0;
+  matching.valid = true;
+
+  PoseSlamParticle shifted = matching;
+  shifted.p_position += base::Vector3d(3.0, 2.0, 0.0);
+
+  SonarPreprocessor preprocessor;
+  preprocessor.configure(config);
+  const std::vector<SonarFeatures>& beams = preprocessor.prepare(scan);
+
+  double matching_weight = localizer.laserLogPerception(matching, beams, *map->map);
+  double shifted_weight = localizer.laserLogPerception(shifted, beams, *map->map);
+
+  BOOST_CHECK(matching_weight > -INFINITY);
+  BOOST_CHECK(shifted_weight > -INFINITY);
+  BOOST_CHECK_GT(matching_weight, shifted_weight);
+
+  //The weights are normalized relative to the best particle, they do not underflow together
+  localizer.initialize(50, pose.position, base::Vector3d(2.0, 2.0, 0.0), 0.0, 0.0);
+  localizer.setCurrentOrientation(pose);
+  double effective_sample_size = localizer.observeAndDebug(scan, *map->map, 1.0);
+
+  double sum = 0.0;
+  double best = 0.0;
+  const std::list<PoseSlamParticle>& particles = localizer.getParticles();
+  for(std::list<PoseSlamParticle>::const_iterator it = particles.begin(); it != particles.end(); ++it){
+    BOOST_CHECK(!std::isnan(it->main_confidence));
+    sum += it->main_confidence;
+    best = std::max(best, it->main_confidence);
+  }
+
+  BOOST_CHECK_CLOSE(sum, 1.0, 1e-6);
+  BOOST_CHECK_GT(best, 0.0);
+  BOOST_CHECK_GT(effective_sample_size, 0.0);
+
+  delete map;
+}
+
+BOOST_AUTO_TEST_CASE(merged_sonar_batch_weights_like_single_beams)
+{
+  MapSource source;
+  source.yaml_map = std::string(UW_PARTICLE_LOCALIZATION_MAPS) + "/testhalle.yml";
+  LoadedMap* map = MapLoader::load(source);
+  BOOST_REQUIRE(map);
+
+  FilterConfig config;
+  defaultFilterConfig(config, &map->env);
+  config.use_slam = false;
+  config.use_markov = false;
+  config.filterZeros = false;
+
+  TestLocalization localizer(config);
+  localizer.setEnvironment(&map->env, map->geometry_index, map->layers, map->compiled);
+
+  base::samples::RigidBodyState pose;
+  pose.time = base::Time::now();
+  pose.position = base::Vector3d(0.0, -4.0, -2.0);
+  pose.orientation = base::Quaterniond::Identity();
+  localizer.setCurrentOrientation(pose);
+
+  //Particles around the vehicle with different prior weights
+  std::list<PoseSlamParticle> particles;
+  for(int i = 0; i < 20; i++){
+    PoseSlamParticle particle;
+    particle.p_position = pose.position + base::Vector3d((i % 5) * 0.4 - 0.8, (i / 5) * 0.4 - 0.6, 0.0);
+    particle.p_velocity = base::Vector3d::Zero();
+    particle.main_confidence = (1.0 + i % 3) / 40.0;
+    particle.valid = true;
+    particles.push_back(particle);
+  }
+
+  //A sweep of beams, every beam sees one feature
+  std::vector<sonar_detectors::ObstacleFeatures> batch;
+  for(int i = 0; i < 12; i++){
+    sonar_detectors::ObstacleFeatures beam;
+    beam.time = pose.time + base::Time::fromMicroseconds(i * 50000);
+    beam.angle = -M_PI + i * (M_PI / 6.0);
+
+    sonar_detectors::ObstacleFeature feature;
+    feature.range = 3000 + 250 * i;
+    feature.confidence = 1.0;
+    beam.features.push_back(feature);
+    batch.push_back(beam);
+  }
+
+  localizer.particleList() = particles;
+  for(std::vector<sonar_detectors::ObstacleFeatures>::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    localizer.observeAndDebug(*it, *map->map, 1.0);
+  std::vector<double> single = weights(localizer.particleList());
+
+  localizer.particleList() = particles;
+  localizer.observeAndDebug(batch, *map->map, 1.0);
+  std::vector<double> merged = weights(localizer.particleList());
+
+  BOOST_REQUIRE_EQUAL(single.size(), merged.size());
+  for(unsigned i = 0; i < single.size(); i++){
+    BOOST_CHECK(!std::isnan(merged[i]));
+    BOOST_CHECK_CLOSE(single[i] + 1e-12, merged[i] + 1e-12, 1e-6);
+  }
+
+  delete map;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
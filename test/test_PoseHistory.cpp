@@ -0,0 +1,123 @@
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include "../tasks/PoseHistory.hpp"
+
+using namespace uw_localization;
+
+namespace {
+
+base::samples::RigidBodyState sample(double t)
+{
+  base::samples::RigidBodyState rbs;
+  rbs.time = base::Time::fromSeconds(t);
+  rbs.position = base::Vector3d::Zero();
+  rbs.velocity = base::Vector3d::Zero();
+  rbs.orientation = base::Quaterniond::Identity();
+  rbs.angular_velocity = base::Vector3d::Zero();
+  return rbs;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(pose_history)
+
+BOOST_AUTO_TEST_CASE(sample_history_interpolates_and_holds_the_ends)
+{
+  SampleHistory<base::Vector3d> history(10);
+  BOOST_CHECK(history.push(base::Time::fromSeconds(1.0), base::Vector3d(0.0, 0.0, 0.0)));
+  BOOST_CHECK(history.push(base::Time::fromSeconds(2.0), base::Vector3d(2.0, 0.0, 0.0)));
+  BOOST_CHECK(history.push(base::Time::fromSeconds(4.0), base::Vector3d(2.0, 4.0, 0.0)));
+
+  //Older samples are rejected
+  BOOST_CHECK(!history.push(base::Time::fromSeconds(3.0), base::Vector3d::Zero()));
+
+  base::Vector3d value;
+  BOOST_REQUIRE(history.get(base::Time::fromSeconds(1.5), value));
+  BOOST_CHECK_SMALL((value - base::Vector3d(1.0, 0.0, 0.0)).norm(), 1e-9);
+
+  BOOST_REQUIRE(history.get(base::Time::fromSeconds(3.5), value));
+  BOOST_CHECK_SMALL((value - base::Vector3d(2.0, 3.0, 0.0)).norm(), 1e-9);
+
+  BOOST_REQUIRE(history.get(base::Time::fromSeconds(0.0), value));
+  BOOST_CHECK_SMALL(value.norm(), 1e-9);
+
+  BOOST_REQUIRE(history.get(base::Time::fromSeconds(10.0), value));
+  BOOST_CHECK_SMALL((value - base::Vector3d(2.0, 4.0, 0.0)).norm(), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(sample_history_drops_the_oldest_sample)
+{
+  SampleHistory<base::Vector3d> history(2);
+  history.push(base::Time::fromSeconds(1.0), base::Vector3d(1.0, 0.0, 0.0));
+  history.push(base::Time::fromSeconds(2.0), base::Vector3d(2.0, 0.0, 0.0));
+  history.push(base::Time::fromSeconds(3.0), base::Vector3d(3.0, 0.0, 0.0));
+
+  BOOST_CHECK(history.oldest() == base::Time::fromSeconds(2.0));
+
+  base::Vector3d value;
+  BOOST_REQUIRE(history.get(base::Time::fromSeconds(1.0), value));
+  BOOST_CHECK_SMALL((value - base::Vector3d(2.0, 0.0, 0.0)).norm(), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(orientation_is_interpolated_by_slerp)
+{
+  OrientationSample a;
+  a.orientation = base::Quaterniond(Eigen::AngleAxisd(0.0, base::Vector3d::UnitZ()));
+  a.angular_velocity = base::Vector3d(0.0, 0.0, 0.2);
+
+  OrientationSample b;
+  b.orientation = base::Quaterniond(Eigen::AngleAxisd(M_PI / 2.0, base::Vector3d::UnitZ()));
+  b.angular_velocity = base::Vector3d(0.0, 0.0, 0.4);
+
+  //A quarter of the way rotates by a quarter of the angle, with a unit quaternion
+  OrientationSample result = interpolate(a, b, 0.25);
+  base::Quaterniond expected(Eigen::AngleAxisd(M_PI / 8.0, base::Vector3d::UnitZ()));
+
+  BOOST_CHECK_SMALL(result.orientation.angularDistance(expected), 1e-9);
+  BOOST_CHECK_CLOSE(result.orientation.norm(), 1.0, 1e-9);
+  BOOST_CHECK_CLOSE(result.angular_velocity.z(), 0.25, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(pose_combines_the_streams_at_the_query_time)
+{
+  PoseHistory history(10);
+
+  base::samples::RigidBodyState position = sample(1.0);
+  position.position = base::Vector3d(1.0, 2.0, 0.0);
+  position.velocity = base::Vector3d(1.0, 0.0, 0.0);
+  BOOST_CHECK(history.addPosition(position));
+  position = sample(2.0);
+  position.position = base::Vector3d(2.0, 2.0, 0.0);
+  position.velocity = base::Vector3d(1.0, 0.0, 0.0);
+  BOOST_CHECK(history.addPosition(position));
+
+  base::samples::RigidBodyState depth = sample(1.0);
+  depth.position.z() = -1.0;
+  BOOST_CHECK(history.addDepth(depth));
+  depth = sample(2.0);
+  depth.position.z() = -2.0;
+  BOOST_CHECK(history.addDepth(depth));
+
+  base::samples::RigidBodyState orientation = sample(1.0);
+  BOOST_CHECK(history.addOrientation(orientation));
+  orientation = sample(2.0);
+  orientation.orientation = base::Quaterniond(Eigen::AngleAxisd(M_PI / 2.0, base::Vector3d::UnitZ()));
+  BOOST_CHECK(history.addOrientation(orientation));
+
+  BOOST_CHECK(history.latestCompleteTime(0.5) == base::Time::fromSeconds(2.0));
+
+  base::samples::RigidBodyState pose;
+  BOOST_REQUIRE(history.getPose(base::Time::fromSeconds(1.5), pose, 0.5));
+  BOOST_CHECK_SMALL((pose.position - base::Vector3d(1.5, 2.0, -1.5)).norm(), 1e-9);
+  BOOST_CHECK_SMALL(pose.orientation.angularDistance(base::Quaterniond(Eigen::AngleAxisd(M_PI / 4.0, base::Vector3d::UnitZ()))), 1e-9);
+
+  //The body velocity is rotated into the world frame
+  base::samples::RigidBodyState velocity = sample(1.5);
+  velocity.velocity = base::Vector3d(1.0, 0.0, 0.0);
+  BOOST_CHECK(history.addVelocity(velocity));
+  BOOST_REQUIRE(history.getPose(base::Time::fromSeconds(1.5), pose, 0.5));
+  BOOST_CHECK_SMALL(pose.velocity.x() - std::sqrt(0.5), 1e-9);
+  BOOST_CHECK_SMALL(pose.velocity.y() - std::sqrt(0.5), 1e-9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+#include <boost/test/unit_test.hpp>
+#include "../tasks/SonarPreprocessor.hpp"
+
+using namespace uw_localization;
+
+BOOST_AUTO_TEST_SUITE(sonar_preprocessor)
+
+namespace {
+
+void configure(SonarPreprocessor& preprocessor)
+{
+  FilterConfig config;
+  config.sonar_minimum_distance = 0.5;
+  config.sonar_maximum_distance = 50.0;
+  config.feature_observation_minimum_range = 0.5;
+  config.feature_observation_range = 20.0;
+  config.sonarToAvalon = Eigen::Translation3d(0.5, 0.0, 0.0);
+  preprocessor.configure(config);
+}
+
+sonar_detectors::ObstacleFeatures makeBeam(double angle, uint32_t range)
+{
+  sonar_detectors::ObstacleFeatures beam;
+  beam.time = base::Time::fromSeconds(10.0);
+  beam.angle = angle;
+
+  sonar_detectors::ObstacleFeature feature;
+  feature.range = range;
+  feature.confidence = 1.0;
+  beam.features.push_back(feature);
+  return beam;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(equal_beams_at_other_addresses_are_kept)
+{
+  SonarPreprocessor preprocessor;
+  configure(preprocessor);
+
+  sonar_detectors::ObstacleFeatures beam = makeBeam(0.3, 5000);
+  sonar_detectors::ObstacleFeatures copy = beam;
+
+  preprocessor.prepare(beam);
+  const SonarFeatures& prepared = preprocessor.prepare(copy);
+
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 1u);
+  BOOST_CHECK_CLOSE(prepared.features[0].distance, 5.0, 1e-9);
+
+  std::vector<sonar_detectors::ObstacleFeatures> batch(3, beam);
+  std::vector<sonar_detectors::ObstacleFeatures> batch_copy = batch;
+
+  preprocessor.prepare(batch);
+  preprocessor.prepare(batch_copy);
+
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(changed_beams_at_the_same_address_are_prepared_again)
+{
+  SonarPreprocessor preprocessor;
+  configure(preprocessor);
+
+  //Same address, time and number of features, only the content differs
+  sonar_detectors::ObstacleFeatures beam = makeBeam(0.3, 5000);
+  preprocessor.prepare(beam);
+
+  beam.features[0].range = 7000;
+  BOOST_CHECK_CLOSE(preprocessor.prepare(beam).features[0].distance, 7.0, 1e-9);
+
+  beam.angle = -0.3;
+  const SonarFeatures& turned = preprocessor.prepare(beam);
+  BOOST_CHECK_CLOSE(turned.angle, -0.3, 1e-9);
+  BOOST_CHECK(turned.features[0].relative.y() < 0.0);
+
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 3u);
+
+  base::samples::LaserScan scan;
+  scan.time = beam.time;
+  scan.start_angle = 0.0;
+  scan.angular_resolution = 0.1;
+  scan.ranges.push_back(3000);
+  scan.ranges.push_back(4000);
+
+  preprocessor.prepare(scan);
+  scan.ranges[1] = 30000;
+  const std::vector<SonarFeatures>& beams = preprocessor.prepare(scan);
+
+  BOOST_REQUIRE_EQUAL(beams.size(), 2u);
+  BOOST_CHECK_CLOSE(beams[1].features[0].distance, 30.0, 1e-9);
+  BOOST_CHECK(beams[1].features[0].has(FEATURE_IN_SONAR_RANGE));
+  BOOST_CHECK(!beams[1].features[0].has(FEATURE_IN_OBSERVATION_RANGE));
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 5u);
+}
+
+BOOST_AUTO_TEST_CASE(kept_beams_of_another_kind_are_not_reused)
+{
+  SonarPreprocessor preprocessor;
+  configure(preprocessor);
+
+  sonar_detectors::ObstacleFeatures beam = makeBeam(0.3, 5000);
+  std::vector<sonar_detectors::ObstacleFeatures> batch(1, beam);
+
+  preprocessor.prepare(beam);
+  preprocessor.prepare(batch);
+  preprocessor.prepare(beam);
+
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 3u);
+
+  preprocessor.invalidate();
+  preprocessor.prepare(beam);
+  BOOST_CHECK_EQUAL(preprocessor.preparations(), 4u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
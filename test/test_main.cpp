@@ -0,0 +1,2 @@
+#define BOOST_TEST_MODULE uw_particle_localization
+#include <boost/test/unit_test.hpp>
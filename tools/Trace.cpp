@@ -0,0 +1,341 @@
+#include "Trace.hpp"
+#include <cstring>
+#include <iostream>
+
+using namespace uw_localization;
+
+const boost::uint32_t TraceWriter::MAGIC;
+const boost::uint32_t TraceWriter::VERSION;
+
+namespace {
+
+template<typename T>
+void put(std::string& buffer, const T& value)
+{
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void putVector(std::string& buffer, const base::Vector3d& v)
+{
+  put(buffer, v.x());
+  put(buffer, v.y());
+  put(buffer, v.z());
+}
+
+/**
+ * Reads values from a record payload, fails on truncated payloads
+ */
+class PayloadReader {
+public:
+  PayloadReader(const std::string& buffer) : buffer(buffer), pos(0), valid(true) {}
+
+  template<typename T>
+  T get()
+  {
+    T value = T();
+
+    if(pos + sizeof(T) > buffer.size()){
+      valid = false;
+      return value;
+    }
+
+    memcpy(&value, buffer.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  base::Vector3d getVector()
+  {
+    base::Vector3d v;
+    v.x() = get<double>();
+    v.y() = get<double>();
+    v.z() = get<double>();
+    return v;
+  }
+
+  std::string getString()
+  {
+    boost::uint32_t size = get<boost::uint32_t>();
+
+    if(!valid || pos + size > buffer.size()){
+      valid = false;
+      return std::string();
+    }
+
+    std::string value = buffer.substr(pos, size);
+    pos += size;
+    return value;
+  }
+
+  bool isValid() const { return valid; }
+
+private:
+  const std::string& buffer;
+  size_t pos;
+  bool valid;
+};
+
+}
+
+TraceWriter::TraceWriter()
+  : file(0), count(0)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+  close();
+}
+
+bool TraceWriter::open(const std::string& filename)
+{
+  close();
+
+  file = fopen(filename.c_str(), "wb");
+  count = 0;
+
+  if(!file){
+    std::cout << "ERROR: Could not create trace " << filename << std::endl;
+    return false;
+  }
+
+  fwrite(&MAGIC, sizeof(MAGIC), 1, file);
+  fwrite(&VERSION, sizeof(VERSION), 1, file);
+  return true;
+}
+
+void TraceWriter::close()
+{
+  if(file){
+    fclose(file);
+    file = 0;
+  }
+}
+
+void TraceWriter::writeRecord(TraceSampleType type, const base::Time& time)
+{
+  if(!file)
+    return;
+
+  boost::uint8_t t = type;
+  boost::uint32_t size = buffer.size();
+  boost::int64_t us = time.toMicroseconds();
+
+  fwrite(&t, sizeof(t), 1, file);
+  fwrite(&size, sizeof(size), 1, file);
+  fwrite(&us, sizeof(us), 1, file);
+  fwrite(buffer.data(), 1, buffer.size(), file);
+  count++;
+}
+
+void TraceWriter::writeRigidBodyState(TraceSampleType type, const base::samples::RigidBodyState& rbs)
+{
+  buffer.clear();
+  putVector(buffer, rbs.position);
+  putVector(buffer, rbs.velocity);
+  putVector(buffer, rbs.angular_velocity);
+  put(buffer, rbs.orientation.w());
+  put(buffer, rbs.orientation.x());
+  put(buffer, rbs.orientation.y());
+  put(buffer, rbs.orientation.z());
+  putVector(buffer, rbs.cov_position.diagonal());
+  writeRecord(type, rbs.time);
+}
+
+void TraceWriter::writeThrusters(const base::samples::Joints& joints)
+{
+  buffer.clear();
+  put(buffer, static_cast<boost::uint32_t>(joints.elements.size()));
+
+  for(unsigned i = 0; i < joints.elements.size(); i++){
+    std::string name = i < joints.names.size() ? joints.names[i] : std::string();
+    put(buffer, static_cast<boost::uint32_t>(name.size()));
+    buffer.append(name);
+    put(buffer, joints.elements[i].position);
+    put(buffer, joints.elements[i].speed);
+    put(buffer, joints.elements[i].effort);
+    put(buffer, joints.elements[i].raw);
+  }
+
+  writeRecord(TRACE_THRUSTERS, joints.time);
+}
+
+void TraceWriter::writeObstacles(const sonar_detectors::ObstacleFeatures& features)
+{
+  buffer.clear();
+  put(buffer, features.angle);
+  put(buffer, static_cast<boost::uint32_t>(features.features.size()));
+
+  for(std::vector<sonar_detectors::ObstacleFeature>::const_iterator it = features.features.begin(); it != features.features.end(); it++){
+    put(buffer, static_cast<boost::uint32_t>(it->range));
+    put(buffer, it->confidence);
+  }
+
+  writeRecord(TRACE_OBSTACLES, features.time);
+}
+
+void TraceWriter::writeLaser(const base::samples::LaserScan& scan)
+{
+  buffer.clear();
+  put(buffer, scan.start_angle);
+  put(buffer, scan.angular_resolution);
+  put(buffer, static_cast<boost::uint32_t>(scan.minRange));
+  put(buffer, static_cast<boost::uint32_t>(scan.maxRange));
+  put(buffer, static_cast<boost::uint32_t>(scan.ranges.size()));
+
+  for(unsigned i = 0; i < scan.ranges.size(); i++)
+    put(buffer, static_cast<boost::uint32_t>(scan.ranges[i]));
+
+  writeRecord(TRACE_LASER, scan.time);
+}
+
+TraceReader::TraceReader()
+  : file(0), data_start(0)
+{
+}
+
+TraceReader::~TraceReader()
+{
+  if(file)
+    fclose(file);
+}
+
+bool TraceReader::open(const std::string& filename)
+{
+  if(file)
+    fclose(file);
+
+  file = fopen(filename.c_str(), "rb");
+
+  if(!file){
+    std::cout << "ERROR: Could not open trace " << filename << std::endl;
+    return false;
+  }
+
+  boost::uint32_t magic = 0, version = 0;
+
+  if(fread(&magic, sizeof(magic), 1, file) != 1 || magic != TraceWriter::MAGIC
+      || fread(&version, sizeof(version), 1, file) != 1 || version != TraceWriter::VERSION){
+    std::cout << "ERROR: " << filename << " is not a trace" << std::endl;
+    fclose(file);
+    file = 0;
+    return false;
+  }
+
+  data_start = ftell(file);
+  return true;
+}
+
+void TraceReader::rewind()
+{
+  if(file)
+    fseek(file, data_start, SEEK_SET);
+}
+
+bool TraceReader::next(TraceSample& sample)
+{
+  while(file){
+    boost::uint8_t type;
+    boost::uint32_t size;
+    boost::int64_t us;
+
+    if(fread(&type, sizeof(type), 1, file) != 1 || fread(&size, sizeof(size), 1, file) != 1
+        || fread(&us, sizeof(us), 1, file) != 1)
+      return false;
+
+    buffer.resize(size);
+    if(size > 0 && fread(&buffer[0], 1, size, file) != size)
+      return false;
+
+    sample.type = static_cast<TraceSampleType>(type);
+    sample.time = base::Time::fromMicroseconds(us);
+
+    PayloadReader reader(buffer);
+
+    switch(sample.type){
+      case TRACE_ORIENTATION:
+      case TRACE_SPEED:
+      case TRACE_ECHOSOUNDER:
+      case TRACE_GROUND_TRUTH:
+      {
+        base::samples::RigidBodyState& rbs = sample.rbs;
+        rbs.time = sample.time;
+        rbs.position = reader.getVector();
+        rbs.velocity = reader.getVector();
+        rbs.angular_velocity = reader.getVector();
+        double w = reader.get<double>();
+        double x = reader.get<double>();
+        double y = reader.get<double>();
+        double z = reader.get<double>();
+        rbs.orientation = Eigen::Quaterniond(w, x, y, z);
+        rbs.cov_position = reader.getVector().asDiagonal();
+        break;
+      }
+      case TRACE_THRUSTERS:
+      {
+        base::samples::Joints& joints = sample.joints;
+        joints.time = sample.time;
+        boost::uint32_t n = reader.get<boost::uint32_t>();
+
+        if(!reader.isValid() || n > 64)
+          return false;
+
+        joints.names.resize(n);
+        joints.elements.resize(n);
+
+        for(unsigned i = 0; i < n; i++){
+          joints.names[i] = reader.getString();
+          joints.elements[i].position = reader.get<double>();
+          joints.elements[i].speed = reader.get<double>();
+          joints.elements[i].effort = reader.get<double>();
+          joints.elements[i].raw = reader.get<double>();
+        }
+        break;
+      }
+      case TRACE_OBSTACLES:
+      {
+        sonar_detectors::ObstacleFeatures& features = sample.obstacles;
+        features.time = sample.time;
+        features.angle = reader.get<double>();
+        boost::uint32_t n = reader.get<boost::uint32_t>();
+
+        if(!reader.isValid() || n * 12 > size)
+          return false;
+
+        features.features.resize(n);
+
+        for(unsigned i = 0; i < n; i++){
+          features.features[i].range = reader.get<boost::uint32_t>();
+          features.features[i].confidence = reader.get<double>();
+        }
+        break;
+      }
+      case TRACE_LASER:
+      {
+        base::samples::LaserScan& scan = sample.laser;
+        scan.time = sample.time;
+        scan.start_angle = reader.get<double>();
+        scan.angular_resolution = reader.get<double>();
+        scan.minRange = reader.get<boost::uint32_t>();
+        scan.maxRange = reader.get<boost::uint32_t>();
+        boost::uint32_t n = reader.get<boost::uint32_t>();
+
+        if(!reader.isValid() || n * 4 > size)
+          return false;
+
+        scan.ranges.resize(n);
+
+        for(unsigned i = 0; i < n; i++)
+          scan.ranges[i] = reader.get<boost::uint32_t>();
+        break;
+      }
+      default:
+        //Unknown sample type of a newer trace
+        continue;
+    }
+
+    return reader.isValid();
+  }
+
+  return false;
+}
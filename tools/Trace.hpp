@@ -0,0 +1,111 @@
+/* ----------------------------------------------------------------------------
+ * Trace.hpp
+ * Compact binary trace of filter input samples for offline replay
+ * ----------------------------------------------------------------------------
+*/
+
+#ifndef UW_PARTICLE_LOCALIZATION_TRACE_HPP
+#define UW_PARTICLE_LOCALIZATION_TRACE_HPP
+
+#include <cstdio>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <base/samples/rigid_body_state.h>
+#include <base/samples/Joints.hpp>
+#include <base/samples/laser_scan.h>
+#include <sonar_detectors/SonarDetectorTypes.hpp>
+
+namespace uw_localization {
+
+/**
+ * Sample types in a trace. The values are part of the file format
+ */
+enum TraceSampleType {
+  TRACE_ORIENTATION = 1,
+  TRACE_SPEED = 2,
+  TRACE_THRUSTERS = 3,
+  TRACE_OBSTACLES = 4,
+  TRACE_LASER = 5,
+  TRACE_ECHOSOUNDER = 6,
+  TRACE_GROUND_TRUTH = 7
+};
+
+/**
+ * One sample of a trace. Only the member matching the type is valid.
+ * Orientation, speed, echosounder and ground truth samples are rigid body states,
+ * with the same meaning as on the task ports
+ */
+struct TraceSample {
+  TraceSampleType type;
+  base::Time time;
+  base::samples::RigidBodyState rbs;
+  base::samples::Joints joints;
+  sonar_detectors::ObstacleFeatures obstacles;
+  base::samples::LaserScan laser;
+};
+
+/**
+ * Writes a trace. The file starts with a magic number and a version, followed by
+ * records of the form: uint8 type, uint32 payload size, int64 time in microseconds, payload.
+ * All values are stored in host byte order
+ */
+class TraceWriter {
+public:
+  static const boost::uint32_t MAGIC = 0x52545755; // "UWTR"
+  static const boost::uint32_t VERSION = 1;
+
+  TraceWriter();
+  ~TraceWriter();
+
+  bool open(const std::string& file);
+  void close();
+
+  void writeRigidBodyState(TraceSampleType type, const base::samples::RigidBodyState& rbs);
+  void writeThrusters(const base::samples::Joints& joints);
+  void writeObstacles(const sonar_detectors::ObstacleFeatures& features);
+  void writeLaser(const base::samples::LaserScan& scan);
+
+  /** @return: number of written samples */
+  boost::uint64_t samples() const { return count; }
+
+private:
+  FILE* file;
+  boost::uint64_t count;
+  std::string buffer;
+
+  void writeRecord(TraceSampleType type, const base::Time& time);
+};
+
+/**
+ * Reads a trace, written by the TraceWriter
+ */
+class TraceReader {
+public:
+  TraceReader();
+  ~TraceReader();
+
+  /**
+   * @return: false, if the file could not be opened or is not a trace
+   */
+  bool open(const std::string& file);
+
+  /**
+   * Reads the next sample. Samples of unknown types are skipped
+   * @return: false at the end of the trace or at a truncated record
+   */
+  bool next(TraceSample& sample);
+
+  /**
+   * Starts again with the first sample
+   */
+  void rewind();
+
+private:
+  FILE* file;
+  long data_start;
+  std::string buffer;
+};
+
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* ----------------------------------------------------------------------------
+ * compile_map.cpp
+ * Compiles the yaml maps into the binary format of the CompiledMap
+ * ----------------------------------------------------------------------------
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include "../tasks/CompiledMap.hpp"
+
+using namespace uw_localization;
+
+int main(int argc, char** argv)
+{
+  if(argc != 5){
+    std::cout << "usage: " << argv[0] << " <yaml_map> <yaml_depth_map> <grid_resolution> <output>" << std::endl;
+    std::cout << "  grid_resolution has to match the feature_grid_resolution of the task" << std::endl;
+    return 1;
+  }
+
+  double resolution = atof(argv[3]);
+
+  if(resolution <= 0.0){
+    std::cerr << "ERROR: Invalid grid resolution " << argv[3] << std::endl;
+    return 1;
+  }
+
+  if(!CompiledMap::compile(argv[1], argv[2], resolution, argv[4]))
+    return 1;
+
+  //Check, that the written map can be loaded
+  CompiledMap map;
+  return map.open(argv[4]) ? 0 : 1;
+}
@@ -0,0 +1,372 @@
+/* ----------------------------------------------------------------------------
+ * generate_scenario.cpp
+ * Generates a synthetic sensor trace from a yaml map and a trajectory
+ * ----------------------------------------------------------------------------
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <uw_localization/maps/node_map.hpp>
+#include "../tasks/LocalizationCore.hpp"
+#include "../tasks/MapLayers.hpp"
+#include "Trace.hpp"
+
+using namespace uw_localization;
+
+struct Waypoint {
+  double time;
+  base::Vector3d position;
+  double yaw;
+};
+
+struct ScenarioOptions {
+  std::string yaml_map;
+  std::string trajectory;
+  std::string output;
+  bool laser;
+  double beam_rate;
+  double beam_step;
+  double range_noise;
+  double multipath;
+  double dropout;
+  double velocity_noise;
+  double ground_depth;
+  int repeat;
+  unsigned seed;
+};
+
+class Scenario {
+public:
+  Scenario(const ScenarioOptions& options, NodeMap& map, const FilterConfig& config)
+    : options(options), map(map), config(config), generator(options.seed),
+      normal(generator, boost::normal_distribution<double>(0.0, 1.0)),
+      uniform(generator, boost::uniform_real<double>(0.0, 1.0)) {}
+
+  bool loadTrajectory();
+  bool generate(TraceWriter& trace);
+
+private:
+  const ScenarioOptions& options;
+  NodeMap& map;
+  MapLayers layers;
+  const FilterConfig& config;
+  std::vector<Waypoint> waypoints;
+
+  boost::mt19937 generator;
+  boost::variate_generator<boost::mt19937&, boost::normal_distribution<double> > normal;
+  boost::variate_generator<boost::mt19937&, boost::uniform_real<double> > uniform;
+
+  base::samples::RigidBodyState poseAt(double time);
+
+  /**
+   * Distance from the sonar to the nearest wall or box in the direction of the beam
+   */
+  double castBeam(const base::samples::RigidBodyState& pose, double angle);
+
+  void writeBeam(TraceWriter& trace, const base::samples::RigidBodyState& pose, double angle);
+};
+
+bool Scenario::loadTrajectory()
+{
+  std::ifstream file(options.trajectory.c_str());
+
+  if(!file){
+    std::cout << "ERROR: Could not open trajectory " << options.trajectory << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while(std::getline(file, line)){
+    if(line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream stream(line);
+    Waypoint w;
+
+    if(stream >> w.time >> w.position.x() >> w.position.y() >> w.position.z() >> w.yaw)
+      waypoints.push_back(w);
+  }
+
+  if(waypoints.size() < 2){
+    std::cout << "ERROR: The trajectory needs at least two waypoints" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+base::samples::RigidBodyState Scenario::poseAt(double time)
+{
+  unsigned i = 0;
+  while(i + 2 < waypoints.size() && waypoints[i + 1].time < time)
+    i++;
+
+  const Waypoint& a = waypoints[i];
+  const Waypoint& b = waypoints[i + 1];
+  double dt = b.time - a.time;
+  double s = dt > 0.0 ? std::min(1.0, std::max(0.0, (time - a.time) / dt)) : 1.0;
+
+  double yaw_diff = b.yaw - a.yaw;
+  while(yaw_diff > M_PI)
+    yaw_diff -= 2.0 * M_PI;
+  while(yaw_diff < -M_PI)
+    yaw_diff += 2.0 * M_PI;
+
+  base::samples::RigidBodyState pose;
+  pose.position = a.position + s * (b.position - a.position);
+  pose.orientation = Eigen::AngleAxisd(a.yaw + s * yaw_diff, Eigen::Vector3d::UnitZ());
+  pose.velocity = dt > 0.0 && s < 1.0 ? base::Vector3d((b.position - a.position) / dt) : base::Vector3d::Zero();
+  pose.angular_velocity = base::Vector3d(0.0, 0.0, dt > 0.0 && s < 1.0 ? yaw_diff / dt : 0.0);
+  pose.cov_position = base::Matrix3d::Identity() * 0.01;
+  return pose;
+}
+
+double Scenario::castBeam(const base::samples::RigidBodyState& pose, double angle)
+{
+  double yaw = base::getYaw(pose.orientation);
+
+  //Same frame as ParticleLocalization::beamPerception: the range is measured from the
+  //vehicle origin, the end of the beam is shifted by the sonar offset like a prepared feature
+  Eigen::AngleAxis<double> beam_yaw(yaw + angle, Eigen::Vector3d::UnitZ());
+  base::Vector3d end = pose.position
+    + beam_yaw * (config.sonarToAvalon * base::Vector3d(config.sonar_maximum_distance, 0.0, 0.0));
+
+  double wall = layers.wall.nearest(map, end, pose.position).get<1>();
+  double box = layers.box.beam(map, config.sonar_vertical_angle / 2.0, yaw + angle, pose.position).get<1>();
+
+  return std::min(wall, box);
+}
+
+void Scenario::writeBeam(TraceWriter& trace, const base::samples::RigidBodyState& pose, double angle)
+{
+  double range = castBeam(pose, angle);
+  bool valid = range < config.sonar_maximum_distance && uniform() >= options.dropout;
+
+  if(valid)
+    range = std::max(0.0, range + normal() * options.range_noise);
+
+  //A multipath echo arrives later than the direct echo
+  bool multipath = valid && uniform() < options.multipath;
+  double multipath_range = range * (1.3 + 0.7 * uniform());
+
+  if(options.laser){
+    base::samples::LaserScan scan;
+    scan.time = pose.time;
+    scan.start_angle = angle;
+    scan.angular_resolution = options.beam_step;
+    scan.minRange = config.sonar_minimum_distance * 1000;
+    scan.maxRange = config.sonar_maximum_distance * 1000;
+
+    if(!valid)
+      scan.ranges.push_back(base::samples::TOO_FAR);
+    else
+      scan.ranges.push_back((multipath ? multipath_range : range) * 1000.0);
+
+    trace.writeLaser(scan);
+  }
+  else{
+    sonar_detectors::ObstacleFeatures features;
+    features.time = pose.time;
+    features.angle = angle;
+
+    if(valid){
+      sonar_detectors::ObstacleFeature feature;
+      feature.range = range * 1000.0;
+      feature.confidence = 0.8 + 0.2 * uniform();
+      features.features.push_back(feature);
+
+      if(multipath){
+        feature.range = multipath_range * 1000.0;
+        feature.confidence = 0.3 + 0.4 * uniform();
+        features.features.push_back(feature);
+      }
+    }
+
+    trace.writeObstacles(features);
+  }
+}
+
+bool Scenario::generate(TraceWriter& trace)
+{
+  const double rate = 100.0;
+  double duration = waypoints.back().time - waypoints.front().time;
+  double beam_interval = 1.0 / options.beam_rate;
+  double next_beam = 0.0;
+  double sonar_angle = -M_PI;
+  base::Time start = base::Time::fromSeconds(1.0);
+
+  for(int run = 0; run < options.repeat; run++){
+    for(unsigned step = 0; step * (1.0 / rate) <= duration; step++){
+      double t = step * (1.0 / rate);
+      double stamp = run * duration + t;
+
+      base::samples::RigidBodyState pose = poseAt(waypoints.front().time + t);
+      pose.time = start + base::Time::fromSeconds(stamp);
+
+      //Orientation with 20 Hz, depth is the z-position
+      if(step % 5 == 0){
+        base::samples::RigidBodyState orientation = pose;
+        orientation.velocity = base::Vector3d(0.0, 0.0, pose.velocity.z());
+        trace.writeRigidBodyState(TRACE_ORIENTATION, orientation);
+      }
+
+      //DVL, thrusters and ground truth with 10 Hz
+      if(step % 10 == 0){
+        base::samples::RigidBodyState speed = pose;
+        speed.velocity = pose.orientation.inverse() * pose.velocity;
+        for(int i = 0; i < 3; i++)
+          speed.velocity[i] += normal() * options.velocity_noise;
+        trace.writeRigidBodyState(TRACE_SPEED, speed);
+
+        //Crude thruster commands, which would produce the body velocity
+        base::samples::Joints joints;
+        joints.time = pose.time;
+        joints.names = config.joint_names;
+        joints.elements.resize(joints.names.size());
+        base::Vector3d body = pose.orientation.inverse() * pose.velocity;
+
+        for(unsigned i = 0; i < joints.names.size(); i++){
+          double raw = 0.0;
+          if(joints.names[i] == "right" || joints.names[i] == "left")
+            raw = body.x();
+          else if(joints.names[i] == "strave")
+            raw = body.y();
+          else if(joints.names[i] == "dive")
+            raw = body.z();
+          else if(joints.names[i] == "yaw")
+            raw = pose.angular_velocity.z();
+          joints.elements[i].raw = std::max(-1.0, std::min(1.0, raw));
+        }
+        trace.writeThrusters(joints);
+
+        trace.writeRigidBodyState(TRACE_GROUND_TRUTH, pose);
+      }
+
+      //Echosounder with 5 Hz, distance to the ground
+      if(step % 20 == 0 && uniform() >= options.dropout){
+        base::samples::RigidBodyState echo = pose;
+        echo.position = base::Vector3d(0.0, 0.0, pose.position.z() - options.ground_depth + normal() * options.range_noise);
+        trace.writeRigidBodyState(TRACE_ECHOSOUNDER, echo);
+      }
+
+      while(next_beam <= stamp){
+        base::samples::RigidBodyState beam_pose = pose;
+        beam_pose.time = start + base::Time::fromSeconds(next_beam);
+        writeBeam(trace, beam_pose, sonar_angle);
+
+        sonar_angle += options.beam_step;
+        if(sonar_angle > M_PI)
+          sonar_angle -= 2.0 * M_PI;
+
+        next_beam += beam_interval;
+      }
+    }
+  }
+
+  return true;
+}
+
+void usage(const char* name)
+{
+  std::cout << "usage: " << name << " <yaml_map> <trajectory> <output_trace> [options]" << std::endl;
+  std::cout << "  trajectory: text file with lines 'time x y z yaw', linear interpolated" << std::endl;
+  std::cout << "  --laser                 write laser scans instead of obstacle features" << std::endl;
+  std::cout << "  --beam-rate <hz>        sonar beams per second (default 30)" << std::endl;
+  std::cout << "  --beam-step <rad>       sonar head step per beam (default 0.0314)" << std::endl;
+  std::cout << "  --range-noise <m>       std deviation of sonar and echosounder ranges (default 0.1)" << std::endl;
+  std::cout << "  --multipath <p>         probability of a multipath echo (default 0.05)" << std::endl;
+  std::cout << "  --dropout <p>           probability of a missing echo (default 0.05)" << std::endl;
+  std::cout << "  --velocity-noise <m/s>  std deviation of the dvl velocity (default 0.02)" << std::endl;
+  std::cout << "  --ground-depth <m>      z-coordinate of the ground (default -8)" << std::endl;
+  std::cout << "  --repeat <n>            drive the trajectory n times (default 1)" << std::endl;
+  std::cout << "  --seed <n>              random seed (default 42)" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, ScenarioOptions& options)
+{
+  if(argc < 4)
+    return false;
+
+  options.yaml_map = argv[1];
+  options.trajectory = argv[2];
+  options.output = argv[3];
+  options.laser = false;
+  options.beam_rate = 30.0;
+  options.beam_step = 0.0314;
+  options.range_noise = 0.1;
+  options.multipath = 0.05;
+  options.dropout = 0.05;
+  options.velocity_noise = 0.02;
+  options.ground_depth = -8.0;
+  options.repeat = 1;
+  options.seed = 42;
+
+  for(int i = 4; i < argc; i++){
+    bool has_value = i + 1 < argc;
+
+    if(!strcmp(argv[i], "--laser"))
+      options.laser = true;
+    else if(!strcmp(argv[i], "--beam-rate") && has_value)
+      options.beam_rate = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--beam-step") && has_value)
+      options.beam_step = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--range-noise") && has_value)
+      options.range_noise = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--multipath") && has_value)
+      options.multipath = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--dropout") && has_value)
+      options.dropout = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--velocity-noise") && has_value)
+      options.velocity_noise = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--ground-depth") && has_value)
+      options.ground_depth = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--repeat") && has_value)
+      options.repeat = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--seed") && has_value)
+      options.seed = atoi(argv[++i]);
+    else
+      return false;
+  }
+
+  return options.beam_rate > 0.0 && options.repeat > 0;
+}
+
+int main(int argc, char** argv)
+{
+  ScenarioOptions options;
+
+  if(!parseOptions(argc, argv, options)){
+    usage(argv[0]);
+    return 1;
+  }
+
+  NodeMap map;
+  if(!map.fromYaml(options.yaml_map)){
+    std::cerr << "ERROR: No map could be load " << options.yaml_map << std::endl;
+    return 1;
+  }
+  Environment env = map.getEnvironment();
+
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+
+  Scenario scenario(options, map, config);
+  if(!scenario.loadTrajectory())
+    return 1;
+
+  TraceWriter trace;
+  if(!trace.open(options.output))
+    return 1;
+
+  scenario.generate(trace);
+  std::cout << "Wrote " << trace.samples() << " samples to " << options.output << std::endl;
+
+  return 0;
+}
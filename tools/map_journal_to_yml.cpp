@@ -0,0 +1,62 @@
+/* ----------------------------------------------------------------------------
+ * map_journal_to_yml.cpp
+ * Replays a map journal and writes the resulting depth obstacle grid as yaml
+ * ----------------------------------------------------------------------------
+*/
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+#include "../tasks/MapJournal.hpp"
+
+using namespace uw_localization;
+
+int main(int argc, char** argv)
+{
+  std::string yaml_map;
+  std::vector<std::string> args;
+
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+      yaml_map = argv[++i];
+    else
+      args.push_back(argv[i]);
+  }
+
+  if(args.size() < 2){
+    std::cout << "usage: " << argv[0] << " [--map yaml_map] <output.yml> <journal> [<journal> ...]" << std::endl;
+    std::cout << "  the journals are replayed in the given order. Pass the rotated segments of one run" << std::endl;
+    std::cout << "  oldest first, e.g. <file>.journal.2 <file>.journal.1 <file>.journal" << std::endl;
+    std::cout << "  the replay starts at the newest segment with a complete snapshot" << std::endl;
+    std::cout << "  yaml_map overrides the node map, which is stored in the journal" << std::endl;
+    return 1;
+  }
+
+  MapJournalReplay replay;
+
+  if(!replay.open(std::vector<std::string>(args.begin() + 1, args.end())))
+    return 1;
+
+  if(yaml_map.empty())
+    yaml_map = replay.getHeader().yaml_map;
+
+  NodeMap map;
+  if(!map.fromYaml(yaml_map)){
+    std::cerr << "ERROR: No map could be load " << yaml_map << std::endl;
+    return 1;
+  }
+
+  DepthObstacleGrid* grid = replay.replay(&map);
+
+  if(replay.hasSnapshot())
+    std::cout << "Loaded the snapshot at record " << replay.snapshotSequence() << std::endl;
+
+  std::cout << "Replayed " << replay.records() << " records" << std::endl;
+
+  grid->saveYML(args[0]);
+  delete grid;
+
+  return 0;
+}
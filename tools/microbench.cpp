@@ -0,0 +1,649 @@
+/* ----------------------------------------------------------------------------
+ * microbench.cpp
+ * Microbenchmarks for the hot paths of the particle filter
+ * ----------------------------------------------------------------------------
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <uw_localization/maps/node_map.hpp>
+#include <uw_localization/maps/depth_obstacle_grid.hpp>
+#include "../tasks/ParticleLocalization.hpp"
+#include "../tasks/DPSlam.hpp"
+#include "../tasks/VelocityPredictor.hpp"
+#include "../tasks/FeatureFilter.hpp"
+#include "../tasks/CircularMedian.hpp"
+#include "../tasks/Fir.hpp"
+#include "../tasks/GeometryIndex.hpp"
+#include "../tasks/SonarPreprocessor.hpp"
+#include "../tasks/LocalizationCore.hpp"
+#include "../tasks/Timing.hpp"
+
+using namespace uw_localization;
+
+struct BenchOptions {
+  std::string yaml_map;
+  std::vector<unsigned> particles;
+  std::vector<unsigned> features;
+  std::string filter;
+  double min_time;
+  bool json;
+};
+
+struct BenchResult {
+  std::string kernel;
+  unsigned particles;
+  unsigned features;
+  boost::uint64_t iterations;
+  double ns_per_call;
+};
+
+class Bench {
+public:
+  Bench(const BenchOptions& options, NodeMap& map);
+  ~Bench();
+
+  void runAll();
+  void print(std::ostream& stream) const;
+
+private:
+  const BenchOptions& options;
+  NodeMap& map;
+  Environment env;
+  FilterConfig config;
+  DepthObstacleGrid* grid;
+  std::vector<BenchResult> results;
+
+  void measure(const std::string& kernel, unsigned particles, unsigned features, const boost::function<void ()>& f);
+  ParticleLocalization* createLocalizer(unsigned particles, bool slam);
+
+  sonar_detectors::ObstacleFeatures obstacleSample(unsigned features) const;
+  base::samples::LaserScan laserSample(unsigned ranges = 1) const;
+  base::samples::RigidBodyState speedSample(double t) const;
+  base::samples::Joints thrusterSample(double t) const;
+
+  void benchLocalizer(unsigned particles);
+  void benchSlam(unsigned particles);
+  void benchDynamics(unsigned particles);
+  void benchFilters();
+};
+
+namespace {
+
+std::vector<unsigned> parseList(const char* value)
+{
+  std::vector<unsigned> list;
+  std::stringstream stream(value);
+  std::string item;
+
+  while(std::getline(stream, item, ','))
+    list.push_back(atoi(item.c_str()));
+
+  return list;
+}
+
+/**
+ * Keeps the compiler from removing a benchmarked call
+ */
+volatile double sink;
+
+void observeLaser(ParticleLocalization* localizer, const base::samples::LaserScan* scan, NodeMap* map)
+{
+  sink = localizer->observe(*scan, *map, 1.0);
+}
+
+void observeObstacles(ParticleLocalization* localizer, const sonar_detectors::ObstacleFeatures* features, NodeMap* map)
+{
+  sink = localizer->observe(*features, *map, 1.0);
+}
+
+void observePipeline(ParticleLocalization* localizer, const controlData::Pipeline* pipeline, NodeMap* map)
+{
+  sink = localizer->observe(*pipeline, *map, 1.0);
+}
+
+void observeBuoy(ParticleLocalization* localizer, const avalon::feature::Buoy* buoy, NodeMap* map)
+{
+  sink = localizer->observe(*buoy, *map, 1.0);
+}
+
+void observeDepth(ParticleLocalization* localizer, double depth, DepthObstacleGrid* grid)
+{
+  sink = localizer->observe(depth, *grid, 1.0);
+}
+
+void observeDepthProfile(ParticleLocalization* localizer, const DepthProfile* profile, DepthObstacleGrid* grid)
+{
+  sink = localizer->observe(*profile, *grid, 1.0);
+}
+
+void updateSpeed(ParticleLocalization* localizer, base::samples::RigidBodyState* speed, NodeMap* map)
+{
+  speed->time = speed->time + base::Time::fromMicroseconds(100000);
+  localizer->update(*speed, *map);
+}
+
+void updateThrusters(ParticleLocalization* localizer, base::samples::Joints* joints, NodeMap* map)
+{
+  joints->time = joints->time + base::Time::fromMicroseconds(100000);
+  localizer->update(*joints, *map);
+}
+
+void predictVelocities(VelocityPredictor* predictor, const std::vector<base::Vector3d>* velocities, base::samples::Joints* joints)
+{
+  joints->time = joints->time + base::Time::fromMicroseconds(100000);
+
+  for(std::vector<base::Vector3d>::const_iterator it = velocities->begin(); it != velocities->end(); it++)
+    sink = predictor->predict(*it, Eigen::Quaterniond::Identity(), *joints, 0.1).x();
+}
+
+void resample(ParticleLocalization* localizer)
+{
+  localizer->resample();
+}
+
+void interspersal(ParticleLocalization* localizer, const base::samples::RigidBodyState* pose, NodeMap* map)
+{
+  localizer->interspersal(*pose, *map, 0.1, false, false);
+}
+
+void slamObserve(DPSlam* slam, std::vector<PoseSlamParticle>* particles, const SonarFeatures* features)
+{
+  for(std::vector<PoseSlamParticle>::iterator it = particles->begin(); it != particles->end(); it++)
+    sink = slam->observe(*it, *features, 0.0, -2.0);
+}
+
+void rateParticle(DPSlam* slam, const std::list<double>* distances, const std::list< std::pair<double, double> >* cells)
+{
+  //rateParticle takes non-const lists
+  std::list<double> d = *distances;
+  std::list< std::pair<double, double> > c = *cells;
+  sink = slam->rateParticle(d, c);
+}
+
+void filterFeatures(const sonar_detectors::ObstacleFeatures* sample, const FeatureFilterConfig* config)
+{
+  sonar_detectors::ObstacleFeatures features = *sample;
+  filterObstacleFeatures(features, *config, -2.0, -8.0);
+  sink = features.features.size();
+}
+
+void prepareFeatures(const SonarPreprocessor* preprocessor, const sonar_detectors::ObstacleFeatures* sample, SonarFeatures* prepared)
+{
+  preprocessor->prepare(*sample, *prepared);
+  sink = prepared->features.size();
+}
+
+void median(const boost::circular_buffer<double>* buffer)
+{
+  sink = Median(*buffer);
+}
+
+void circularMedian(CircularMedian* median, double* angle)
+{
+  *angle = wrapAngle(*angle + 0.37);
+  median->push(*angle);
+  sink = median->median();
+}
+
+void fir(const std::vector<double>* weights, const std::list<double>* samples)
+{
+  sink = Fir(*weights, *samples);
+}
+
+void firFilter(FirFilter<double>* filter, double* sample)
+{
+  *sample += 0.37;
+  filter->push(std::sin(*sample));
+  sink = filter->value();
+}
+
+void movingVariance(MovingVariance<double>* filter, double* sample)
+{
+  *sample += 0.37;
+  filter->push(std::sin(*sample));
+  sink = filter->variance();
+}
+
+void cornerAngle(const GeometryIndex* index, double* angle)
+{
+  *angle = wrapAngle(*angle + 0.37);
+  sink = index->nearestCornerAngle(base::Vector2d(1.0, -2.0), *angle, M_PI/2.0);
+}
+
+void raycast(const GeometryIndex* index, double* angle)
+{
+  *angle = wrapAngle(*angle + 0.37);
+  sink = index->raycast(base::Vector3d(1.0, -2.0, -2.0), base::Vector2d(std::cos(*angle), std::sin(*angle))).distance;
+}
+
+void nearestWall(const GeometryIndex* index, double* angle)
+{
+  *angle = wrapAngle(*angle + 0.37);
+  sink = index->nearest(base::Vector3d(25.0 * std::cos(*angle), 15.0 * std::sin(*angle), -2.0)).distance;
+}
+
+}
+
+Bench::Bench(const BenchOptions& options, NodeMap& map)
+  : options(options), map(map), env(map.getEnvironment())
+{
+  defaultFilterConfig(config, &env);
+  config.init_variance = map.getLimitations();
+
+  grid = new DepthObstacleGrid( base::Vector2d(-map.getTranslation().x(), -map.getTranslation().y() ),
+                          base::Vector2d(map.getLimitations().x(), map.getLimitations().y() ), config.feature_grid_resolution);
+  grid->initGrid();
+  grid->initDepthObstacleConfig(-8.0, 0.0, 2.0);
+  grid->initThresholds(config.feature_confidence_threshold, config.feature_observation_count_threshold);
+  grid->initializeStatics(&map);
+}
+
+Bench::~Bench()
+{
+  delete grid;
+}
+
+void Bench::measure(const std::string& kernel, unsigned particles, unsigned features, const boost::function<void ()>& f)
+{
+  if(!options.filter.empty() && kernel.find(options.filter) == std::string::npos)
+    return;
+
+  //Warm up
+  f();
+
+  boost::uint64_t iterations = 0;
+  boost::uint64_t start = TimingRecorder::nowMicroseconds();
+  boost::uint64_t elapsed = 0;
+
+  while(iterations < 3 || elapsed < options.min_time * 1.0e6){
+    f();
+    iterations++;
+    elapsed = TimingRecorder::nowMicroseconds() - start;
+  }
+
+  BenchResult result;
+  result.kernel = kernel;
+  result.particles = particles;
+  result.features = features;
+  result.iterations = iterations;
+  result.ns_per_call = elapsed * 1000.0 / iterations;
+  results.push_back(result);
+
+  std::cerr << kernel << " particles=" << particles << " features=" << features
+    << ": " << result.ns_per_call << " ns" << std::endl;
+}
+
+ParticleLocalization* Bench::createLocalizer(unsigned particles, bool slam)
+{
+  FilterConfig c = config;
+  c.particle_number = particles;
+  c.use_slam = slam;
+  c.use_mapping_only = false;
+
+  ParticleLocalization* localizer = new ParticleLocalization(c);
+  localizer->initialize(particles, c.init_position, c.init_variance, 0.0, 0.0);
+
+  if(slam)
+    localizer->init_slam(&map);
+
+  //Orientation and depth are needed by most perceptions
+  base::samples::RigidBodyState orientation;
+  orientation.time = base::Time::fromSeconds(1.0);
+  orientation.position = base::Vector3d(0.0, 0.0, -2.0);
+  orientation.velocity = base::Vector3d::Zero();
+  orientation.angular_velocity = base::Vector3d::Zero();
+  orientation.orientation = Eigen::Quaterniond::Identity();
+  localizer->setCurrentOrientation(orientation);
+  localizer->setCurrentAngularVelocity(orientation);
+  localizer->setCurrentZVelocity(orientation);
+  localizer->setCurrentDepth(orientation);
+
+  return localizer;
+}
+
+sonar_detectors::ObstacleFeatures Bench::obstacleSample(unsigned features) const
+{
+  sonar_detectors::ObstacleFeatures sample;
+  sample.time = base::Time::fromSeconds(1.0);
+  sample.angle = 0.3;
+
+  for(unsigned i = 0; i < features; i++){
+    sonar_detectors::ObstacleFeature feature;
+    feature.range = 2000 + (i * 13000) / std::max(1u, features);
+    feature.confidence = 0.5 + 0.5 * ((i * 7) % 10) / 10.0;
+    sample.features.push_back(feature);
+  }
+
+  return sample;
+}
+
+base::samples::LaserScan Bench::laserSample(unsigned ranges) const
+{
+  base::samples::LaserScan scan;
+  scan.time = base::Time::fromSeconds(1.0);
+  scan.start_angle = 0.3;
+  scan.angular_resolution = 0.03;
+  scan.minRange = 1000;
+  scan.maxRange = 20000;
+  for(unsigned i = 0; i < ranges; i++)
+    scan.ranges.push_back(7500 + (i * 37) % 500);
+  return scan;
+}
+
+base::samples::RigidBodyState Bench::speedSample(double t) const
+{
+  base::samples::RigidBodyState speed;
+  speed.time = base::Time::fromSeconds(t);
+  speed.position = base::Vector3d::Zero();
+  speed.velocity = base::Vector3d(0.3, 0.05, 0.0);
+  speed.angular_velocity = base::Vector3d::Zero();
+  speed.orientation = Eigen::Quaterniond::Identity();
+  speed.cov_velocity = base::Matrix3d::Identity() * 0.01;
+  return speed;
+}
+
+base::samples::Joints Bench::thrusterSample(double t) const
+{
+  base::samples::Joints joints;
+  joints.time = base::Time::fromSeconds(t);
+  joints.names = config.joint_names;
+  joints.elements.resize(joints.names.size());
+
+  for(unsigned i = 0; i < joints.elements.size(); i++)
+    joints.elements[i].raw = 0.2;
+
+  return joints;
+}
+
+void Bench::benchLocalizer(unsigned particles)
+{
+  ParticleLocalization* localizer = createLocalizer(particles, false);
+
+  base::samples::LaserScan scan = laserSample();
+  measure("perception/laser", particles, 1, boost::bind(&observeLaser, localizer, &scan, &map));
+
+  for(std::vector<unsigned>::const_iterator it = options.features.begin(); it != options.features.end(); it++){
+    base::samples::LaserScan sector = laserSample(*it);
+    measure("perception/laser_sector", particles, *it, boost::bind(&observeLaser, localizer, &sector, &map));
+  }
+
+  for(std::vector<unsigned>::const_iterator it = options.features.begin(); it != options.features.end(); it++){
+    sonar_detectors::ObstacleFeatures features = obstacleSample(*it);
+    measure("perception/obstacles", particles, *it, boost::bind(&observeObstacles, localizer, &features, &map));
+  }
+
+  controlData::Pipeline pipeline;
+  pipeline.time = base::Time::fromSeconds(1.0);
+  pipeline.inspection_state = controlData::FOLLOW_PIPE;
+  measure("perception/pipeline", particles, 1, boost::bind(&observePipeline, localizer, &pipeline, &map));
+
+  avalon::feature::Buoy buoy;
+  buoy.time = base::Time::fromSeconds(1.0);
+  buoy.color = avalon::feature::ORANGE;
+  buoy.probability = 0.9;
+  buoy.world_coord = base::Vector3d(2.0, 0.0, 0.0);
+  measure("perception/buoy", particles, 1, boost::bind(&observeBuoy, localizer, &buoy, &map));
+
+  measure("perception/depth", particles, 1, boost::bind(&observeDepth, localizer, 6.0, grid));
+
+  for(std::vector<unsigned>::const_iterator it = options.features.begin(); it != options.features.end(); it++){
+    DepthProfile profile;
+
+    for(unsigned i = 0; i < *it; i++)
+      profile.push(base::Time::fromSeconds(1.0 + i * 0.2), base::Vector3d(i * 0.1, 0.0, -2.0), base::Matrix3d::Identity(), 6.0);
+
+    measure("perception/depth_profile", particles, *it, boost::bind(&observeDepthProfile, localizer, &profile, grid));
+  }
+
+  base::samples::RigidBodyState speed = speedSample(1.0);
+  measure("dynamic/speed", particles, 0, boost::bind(&updateSpeed, localizer, &speed, &map));
+
+  base::samples::Joints joints = thrusterSample(1.0);
+  measure("dynamic/thrusters", particles, 0, boost::bind(&updateThrusters, localizer, &joints, &map));
+
+  measure("resample", particles, 0, boost::bind(&resample, localizer));
+
+  base::samples::RigidBodyState pose = speedSample(1.0);
+  pose.cov_position = base::Matrix3d::Identity();
+  measure("interspersal", particles, 0, boost::bind(&interspersal, localizer, &pose, &map));
+
+  delete localizer;
+}
+
+void Bench::benchSlam(unsigned particles)
+{
+  DPSlam slam;
+  slam.init( base::Vector2d(-map.getTranslation().x(), -map.getTranslation().y() ),
+             base::Vector2d(map.getLimitations().x(), map.getLimitations().y() ),
+             config.feature_grid_resolution, config);
+  slam.initalize_statics(&map);
+
+  SonarPreprocessor preprocessor;
+  preprocessor.configure(config);
+
+  std::vector<PoseSlamParticle> slam_particles(particles);
+  for(unsigned i = 0; i < particles; i++){
+    slam_particles[i].p_position = base::Vector3d((i % 20) * 0.5 - 5.0, (i / 20 % 20) * 0.5 - 5.0, -2.0);
+    slam_particles[i].p_velocity = base::Vector3d::Zero();
+    slam_particles[i].main_confidence = 1.0 / particles;
+    slam_particles[i].valid = true;
+  }
+
+  for(std::vector<unsigned>::const_iterator it = options.features.begin(); it != options.features.end(); it++){
+    SonarFeatures features;
+    preprocessor.prepare(obstacleSample(*it), features);
+    measure("dpslam/observe", particles, *it, boost::bind(&slamObserve, &slam, &slam_particles, &features));
+  }
+}
+
+void Bench::benchDynamics(unsigned particles)
+{
+  FilterConfig c = config;
+  c.advanced_motion_model = true;
+
+  //Particle velocities after some motion steps, spread over +-0.5 m/s
+  std::vector<base::Vector3d> velocities(particles);
+  for(unsigned i = 0; i < particles; i++)
+    velocities[i] = base::Vector3d(0.3 + ((i * 37) % 100) / 100.0 - 0.5, ((i * 53) % 100) / 100.0 - 0.5, ((i * 71) % 20) / 100.0 - 0.1);
+
+  base::samples::Joints joints = thrusterSample(1.0);
+
+  VelocityPredictor integrated;
+  integrated.configure(c);
+  measure("dynamic/predict_spread", particles, 0, boost::bind(&predictVelocities, &integrated, &velocities, &joints));
+
+  VelocityPredictor cached;
+  cached.configure(c);
+  cached.enableDynamicsCache(DynamicsCacheConfig());
+  measure("dynamic/predict_spread_cached", particles, 0, boost::bind(&predictVelocities, &cached, &velocities, &joints));
+
+  const DynamicsCache& cache = cached.getDynamicsCache();
+  if(cache.hits() + cache.linearizations() > 0)
+    std::cerr << "dynamics cache particles=" << particles << " hits=" << cache.hits()
+      << " linearizations=" << cache.linearizations() << " integrations=" << cache.integrations() << std::endl;
+}
+
+void Bench::benchFilters()
+{
+  for(std::vector<unsigned>::const_iterator it = options.features.begin(); it != options.features.end(); it++){
+    DPSlam slam;
+    std::list<double> distances;
+    std::list< std::pair<double, double> > cells;
+
+    for(unsigned i = 0; i < *it; i++){
+      distances.push_back(2.0 + i * 0.5);
+      cells.push_back(std::make_pair(2.1 + i * 0.5, 0.8));
+    }
+
+    measure("dpslam/rateParticle", 0, *it, boost::bind(&rateParticle, &slam, &distances, &cells));
+
+    FeatureFilterConfig filter_config;
+    filter_config.sonar_vertical_angle = config.sonar_vertical_angle;
+    filter_config.sonar_minimum_distance = config.sonar_minimum_distance;
+    filter_config.sonar_maximum_distance = config.sonar_maximum_distance;
+    filter_config.feature_filter_threshold = 0.6;
+
+    sonar_detectors::ObstacleFeatures features = obstacleSample(*it);
+    measure("filter_sample", 0, *it, boost::bind(&filterFeatures, &features, &filter_config));
+
+    SonarPreprocessor preprocessor;
+    preprocessor.configure(config);
+    SonarFeatures prepared;
+    measure("sonar_prepare", 0, *it, boost::bind(&prepareFeatures, &preprocessor, &features, &prepared));
+
+    //Quay walls as a polyline around the origin, one plane per feature
+    Environment env;
+    for(unsigned i = 0; i < *it; i++){
+      double a = 2.0 * M_PI * i / *it;
+      double b = 2.0 * M_PI * (i + 1) / *it;
+      Plane plane;
+      plane.position = base::Vector3d(30.0 * std::cos(a), 20.0 * std::sin(a), 0.0);
+      plane.span_horizontal = base::Vector3d(30.0 * std::cos(b), 20.0 * std::sin(b), 0.0) - plane.position;
+      plane.span_vertical = base::Vector3d(0.0, 0.0, -5.0);
+      env.planes.push_back(plane);
+    }
+
+    GeometryIndex index;
+    index.build(env);
+    double angle = 0.0;
+    measure("geometry/corner_angle", 0, *it, boost::bind(&cornerAngle, &index, &angle));
+    measure("geometry/raycast", 0, *it, boost::bind(&raycast, &index, &angle));
+    measure("geometry/nearest", 0, *it, boost::bind(&nearestWall, &index, &angle));
+  }
+
+  unsigned windows[] = {8, 64, 512};
+
+  for(unsigned i = 0; i < 3; i++){
+    boost::circular_buffer<double> buffer(windows[i]);
+    std::vector<double> weights = MovingAverage(windows[i]);
+    std::list<double> samples;
+
+    for(unsigned j = 0; j < windows[i]; j++){
+      buffer.push_back(std::sin(j * 0.37));
+      samples.push_back(std::sin(j * 0.37));
+    }
+
+    measure("calcMedian", 0, windows[i], boost::bind(&median, &buffer));
+
+    CircularMedian circular_median(windows[i]);
+    double angle = 0.0;
+    measure("circular_median", 0, windows[i], boost::bind(&circularMedian, &circular_median, &angle));
+    measure("fir", 0, windows[i], boost::bind(&fir, &weights, &samples));
+
+    FirFilter<double> fir_filter(weights);
+    MovingVariance<double> moving_variance(windows[i]);
+    double sample = 0.0;
+
+    for(unsigned j = 0; j < windows[i]; j++){
+      fir_filter.push(std::sin(j * 0.37));
+      moving_variance.push(std::sin(j * 0.37));
+    }
+
+    measure("fir_filter", 0, windows[i], boost::bind(&firFilter, &fir_filter, &sample));
+    measure("moving_variance", 0, windows[i], boost::bind(&movingVariance, &moving_variance, &sample));
+  }
+}
+
+void Bench::runAll()
+{
+  for(std::vector<unsigned>::const_iterator it = options.particles.begin(); it != options.particles.end(); it++){
+    benchLocalizer(*it);
+    benchSlam(*it);
+    benchDynamics(*it);
+  }
+
+  benchFilters();
+}
+
+void Bench::print(std::ostream& stream) const
+{
+  if(options.json){
+    stream << "[" << std::endl;
+
+    for(unsigned i = 0; i < results.size(); i++){
+      const BenchResult& r = results[i];
+      stream << "  {\"kernel\": \"" << r.kernel << "\", \"particles\": " << r.particles
+        << ", \"features\": " << r.features << ", \"iterations\": " << r.iterations
+        << ", \"ns_per_call\": " << r.ns_per_call << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    stream << "]" << std::endl;
+  }
+  else{
+    stream << "kernel,particles,features,iterations,ns_per_call" << std::endl;
+
+    for(std::vector<BenchResult>::const_iterator it = results.begin(); it != results.end(); it++){
+      stream << it->kernel << "," << it->particles << "," << it->features << ","
+        << it->iterations << "," << it->ns_per_call << std::endl;
+    }
+  }
+}
+
+void usage(const char* name)
+{
+  std::cout << "usage: " << name << " <yaml_map> [options]" << std::endl;
+  std::cout << "  --particles <list>   comma separated particle counts (default 100,1000,10000)" << std::endl;
+  std::cout << "  --features <list>    comma separated feature counts (default 1,8,32)" << std::endl;
+  std::cout << "  --filter <name>      only run kernels containing name" << std::endl;
+  std::cout << "  --min-time <s>       minimum time per kernel (default 0.2)" << std::endl;
+  std::cout << "  --json               write json instead of csv" << std::endl;
+  std::cout << "Results are written to stdout, progress to stderr" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options)
+{
+  if(argc < 2)
+    return false;
+
+  options.yaml_map = argv[1];
+  options.particles = parseList("100,1000,10000");
+  options.features = parseList("1,8,32");
+  options.min_time = 0.2;
+  options.json = false;
+
+  for(int i = 2; i < argc; i++){
+    bool has_value = i + 1 < argc;
+
+    if(!strcmp(argv[i], "--particles") && has_value)
+      options.particles = parseList(argv[++i]);
+    else if(!strcmp(argv[i], "--features") && has_value)
+      options.features = parseList(argv[++i]);
+    else if(!strcmp(argv[i], "--filter") && has_value)
+      options.filter = argv[++i];
+    else if(!strcmp(argv[i], "--min-time") && has_value)
+      options.min_time = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--json"))
+      options.json = true;
+    else
+      return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  BenchOptions options;
+
+  if(!parseOptions(argc, argv, options)){
+    usage(argv[0]);
+    return 1;
+  }
+
+  NodeMap map;
+  if(!map.fromYaml(options.yaml_map)){
+    std::cerr << "ERROR: No map could be load " << options.yaml_map << std::endl;
+    return 1;
+  }
+
+  Bench bench(options, map);
+  bench.runAll();
+  bench.print(std::cout);
+
+  return 0;
+}
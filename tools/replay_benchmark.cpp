@@ -0,0 +1,259 @@
+/* ----------------------------------------------------------------------------
+ * replay_benchmark.cpp
+ * Replays a trace through the LocalizationCore as fast as possible and reports
+ * throughput, stage timings, peak memory and the pose error
+ * ----------------------------------------------------------------------------
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <sys/resource.h>
+#include <uw_localization/maps/node_map.hpp>
+#include "../tasks/LocalizationCore.hpp"
+#include "../tasks/Timing.hpp"
+#include "Trace.hpp"
+
+using namespace uw_localization;
+
+struct ReplayOptions {
+  std::string trace;
+  std::string yaml_map;
+  std::string yaml_depth_map;
+  std::string compiled_map;
+  int particle_number;
+  double effective_sample_size_threshold;
+  int minimum_perceptions;
+  bool use_slam;
+  bool use_markov;
+  double echosounder_window;
+  int repeat;
+};
+
+/**
+ * Pose error in the xy-plane, like scripts/evaluation.rb
+ */
+struct PoseError {
+  unsigned count;
+  double sum;
+  double square_sum;
+  double min;
+  double max;
+
+  PoseError() : count(0), sum(0.0), square_sum(0.0), min(INFINITY), max(0.0) {}
+
+  void add(const base::samples::RigidBodyState& real, const base::samples::RigidBodyState& estimate)
+  {
+    double error = (real.position.head<2>() - estimate.position.head<2>()).norm();
+    count++;
+    sum += error;
+    square_sum += error * error;
+    min = std::min(min, error);
+    max = std::max(max, error);
+  }
+};
+
+/**
+ * @return: number of valid ranges, every range of a scan is observed as a beam
+ */
+unsigned validRanges(const base::samples::LaserScan& scan)
+{
+  unsigned count = 0;
+
+  for(std::vector<uint32_t>::const_iterator it = scan.ranges.begin(); it != scan.ranges.end(); it++){
+    if(scan.isRangeValid(*it))
+      count++;
+  }
+
+  return count;
+}
+
+void usage(const char* name)
+{
+  std::cout << "usage: " << name << " <trace> <yaml_map> [options]" << std::endl;
+  std::cout << "  --depth-map <file>       initial depth map" << std::endl;
+  std::cout << "  --compiled-map <file>    compiled depth map, see uw_particle_localization_map_compiler" << std::endl;
+  std::cout << "  --particles <n>          number of particles (default 40)" << std::endl;
+  std::cout << "  --ess <value>            effective sample size threshold (default 0.8)" << std::endl;
+  std::cout << "  --min-perceptions <n>    minimum perceptions before resampling (default 3)" << std::endl;
+  std::cout << "  --slam                   use slam" << std::endl;
+  std::cout << "  --no-markov              do not use markov observations" << std::endl;
+  std::cout << "  --echosounder-window <s> observe echosounder samples as profiles of this duration (default 0)" << std::endl;
+  std::cout << "  --repeat <n>             replay the trace n times, each from a fresh filter (default 1)" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, ReplayOptions& options)
+{
+  if(argc < 3)
+    return false;
+
+  options.trace = argv[1];
+  options.yaml_map = argv[2];
+  options.particle_number = 40;
+  options.effective_sample_size_threshold = 0.8;
+  options.minimum_perceptions = 3;
+  options.use_slam = false;
+  options.use_markov = true;
+  options.echosounder_window = 0.0;
+  options.repeat = 1;
+
+  for(int i = 3; i < argc; i++){
+    bool has_value = i + 1 < argc;
+
+    if(!strcmp(argv[i], "--depth-map") && has_value)
+      options.yaml_depth_map = argv[++i];
+    else if(!strcmp(argv[i], "--compiled-map") && has_value)
+      options.compiled_map = argv[++i];
+    else if(!strcmp(argv[i], "--particles") && has_value)
+      options.particle_number = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--ess") && has_value)
+      options.effective_sample_size_threshold = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--min-perceptions") && has_value)
+      options.minimum_perceptions = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--slam"))
+      options.use_slam = true;
+    else if(!strcmp(argv[i], "--no-markov"))
+      options.use_markov = false;
+    else if(!strcmp(argv[i], "--echosounder-window") && has_value)
+      options.echosounder_window = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--repeat") && has_value)
+      options.repeat = atoi(argv[++i]);
+    else
+      return false;
+  }
+
+  return options.particle_number > 0 && options.repeat > 0;
+}
+
+int main(int argc, char** argv)
+{
+  ReplayOptions options;
+
+  if(!parseOptions(argc, argv, options)){
+    usage(argv[0]);
+    return 1;
+  }
+
+  TraceReader trace;
+  if(!trace.open(options.trace))
+    return 1;
+
+  //The defaults need the environment of the map, the core loads its own copy
+  NodeMap map;
+  if(!map.fromYaml(options.yaml_map)){
+    std::cerr << "ERROR: No map could be load " << options.yaml_map << std::endl;
+    return 1;
+  }
+  Environment env = map.getEnvironment();
+
+  FilterConfig config;
+  defaultFilterConfig(config, &env);
+  config.particle_number = options.particle_number;
+  config.effective_sample_size_threshold = options.effective_sample_size_threshold;
+  config.minimum_perceptions = options.minimum_perceptions;
+  config.use_slam = options.use_slam;
+  config.use_markov = options.use_markov;
+
+  //Traces store the velocity in the body frame
+  config.dvlRotation = Eigen::Quaterniond::Identity();
+
+  LocalizationCoreConfig core_config;
+  core_config.yaml_map = options.yaml_map;
+  core_config.yaml_depth_map = options.yaml_depth_map;
+  core_config.compiled_map = options.compiled_map;
+  core_config.echosounder_batch_window = options.echosounder_window;
+
+  TimingRecorder timing;
+  LocalizationCore core;
+  core.setTiming(&timing);
+
+  TraceSample sample;
+  PoseError error;
+  boost::uint64_t samples = 0;
+  boost::uint64_t beams = 0;
+  boost::uint64_t replay_time = 0;
+
+  for(int run = 0; run < options.repeat; run++){
+
+    //Every run starts with a fresh map, grid and particle set, like the first one
+    if(!core.configure(config, core_config))
+      return 1;
+
+    trace.rewind();
+    boost::uint64_t start = TimingRecorder::nowMicroseconds();
+
+    while(trace.next(sample)){
+      samples++;
+
+      switch(sample.type){
+        case TRACE_ORIENTATION:
+          core.setOrientation(sample.rbs);
+          break;
+        case TRACE_SPEED:
+          core.addSpeed(sample.rbs);
+          break;
+        case TRACE_THRUSTERS:
+          core.addThrusters(sample.joints);
+          break;
+        case TRACE_OBSTACLES:
+          if(core.addObstacles(sample.obstacles) != INFINITY)
+            beams++;
+          break;
+        case TRACE_LASER:
+          if(core.addLaser(sample.laser) != INFINITY)
+            beams += validRanges(sample.laser);
+          break;
+        case TRACE_ECHOSOUNDER:
+          core.addEchosounder(sample.rbs);
+          break;
+        case TRACE_GROUND_TRUTH:
+          break;
+      }
+
+      //Like an update of the task, the estimate is the mapping pose until the next sample
+      core.flush();
+      base::samples::RigidBodyState pose = core.estimate();
+
+      if(sample.type == TRACE_GROUND_TRUTH)
+        error.add(sample.rbs, pose);
+    }
+
+    replay_time += TimingRecorder::nowMicroseconds() - start;
+  }
+
+  double seconds = replay_time / 1.0e6;
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  TimingStats stats;
+  timing.getStats(stats);
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "particles:      " << core.getConfig().particle_number << std::endl;
+  std::cout << "samples:        " << samples << std::endl;
+  std::cout << "beams:          " << beams << std::endl;
+  std::cout << "time:           " << seconds << " s" << std::endl;
+  std::cout << "beams/s:        " << (seconds > 0.0 ? beams / seconds : 0.0) << std::endl;
+  std::cout << "peak rss:       " << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+  if(error.count > 0){
+    std::cout << "pose error avg: " << error.sum / error.count << " m" << std::endl;
+    std::cout << "pose error rms: " << std::sqrt(error.square_sum / error.count) << " m" << std::endl;
+    std::cout << "pose error min: " << error.min << " m" << std::endl;
+    std::cout << "pose error max: " << error.max << " m" << std::endl;
+  }
+
+  std::cout << std::endl << std::left << std::setw(22) << "stage" << std::right
+    << std::setw(10) << "count" << std::setw(12) << "p50 [us]" << std::setw(12) << "p90 [us]"
+    << std::setw(12) << "p99 [us]" << std::setw(12) << "max [us]" << std::endl;
+
+  for(std::vector<StageTiming>::const_iterator it = stats.stages.begin(); it != stats.stages.end(); it++){
+    std::cout << std::left << std::setw(22) << it->stage << std::right << std::setprecision(1)
+      << std::setw(10) << it->count << std::setw(12) << it->p50 * 1.0e6 << std::setw(12) << it->p90 * 1.0e6
+      << std::setw(12) << it->p99 * 1.0e6 << std::setw(12) << it->max * 1.0e6 << std::endl;
+  }
+
+  return 0;
+}